@@ -343,6 +343,62 @@ unlock_spawning (lock_spawn_t *lock, const char *name)
     }
 }
 
+/* Wait up to SECS seconds for the just started agent (if
+   FOR_DIRMNGR is false) or dirmngr to accept connections on SOCKNAME
+   and connect CTX to it.  The daemons create their listening socket
+   before they detach, thus a successful connect tells us that the
+   daemon is ready.  We poll with an exponentially increasing delay
+   so that we usually connect a few milliseconds after the daemon has
+   come up instead of sleeping for a full second.  */
+static gpg_error_t
+wait_for_sock (assuan_context_t ctx, const char *sockname, int secs,
+               int for_dirmngr, int verbose, int *did_success_msg)
+{
+  gpg_error_t err;
+  unsigned int delay = 0;    /* Next delay in microseconds.  */
+  unsigned long waited = 0;  /* Total delay in microseconds.  */
+  int lastsecs = -1;
+
+  for (;;)
+    {
+      if (verbose && (int)(waited / 1000000) != lastsecs)
+        {
+          lastsecs = waited / 1000000;
+          if (for_dirmngr)
+            log_info (_("waiting for the dirmngr "
+                        "to come up ... (%ds)\n"), secs - lastsecs);
+          else
+            log_info (_("waiting for the agent to come up ... (%ds)\n"),
+                      secs - lastsecs);
+        }
+
+      delay = delay? delay * 2 : 1000;
+      if (delay > 250000)
+        delay = 250000;
+      gnupg_usleep (delay);
+      waited += delay;
+
+      err = assuan_socket_connect (ctx, sockname, 0, 0);
+      if (!err)
+        {
+          if (verbose)
+            {
+              if (for_dirmngr)
+                log_info (_("connection to the dirmngr established\n"));
+              else
+                log_info (_("connection to agent established\n"));
+              *did_success_msg = 1;
+            }
+          break;
+        }
+      if (waited >= (unsigned long)secs * 1000000)
+        break;
+    }
+
+  return err;
+}
+
+
 /* Try to connect to the agent via socket or start it if it is not
    running and AUTOSTART is set.  Handle the server's initial
    greeting.  Returns a new assuan context at R_CTX or an error
@@ -463,25 +519,8 @@ start_new_gpg_agent (assuan_context_t *r_ctx,
             log_error ("failed to start agent '%s': %s\n",
                        agent_program, gpg_strerror (err));
           else
-            {
-              for (i=0; i < SECS_TO_WAIT_FOR_AGENT; i++)
-                {
-                  if (verbose)
-                    log_info (_("waiting for the agent to come up ... (%ds)\n"),
-                              SECS_TO_WAIT_FOR_AGENT - i);
-                  gnupg_sleep (1);
-                  err = assuan_socket_connect (ctx, sockname, 0, 0);
-                  if (!err)
-                    {
-                      if (verbose)
-                        {
-                          log_info (_("connection to agent established\n"));
-                          did_success_msg = 1;
-                        }
-                      break;
-                    }
-                }
-            }
+            err = wait_for_sock (ctx, sockname, SECS_TO_WAIT_FOR_AGENT, 0,
+                                 verbose, &did_success_msg);
         }
 
       unlock_spawning (&lock, "agent");
@@ -648,29 +687,8 @@ start_new_dirmngr (assuan_context_t *r_ctx,
             log_error ("failed to start the dirmngr '%s': %s\n",
                        dirmngr_program, gpg_strerror (err));
           else
-            {
-              int i;
-
-              for (i=0; i < SECS_TO_WAIT_FOR_DIRMNGR; i++)
-                {
-                  if (verbose)
-                    log_info (_("waiting for the dirmngr "
-                                "to come up ... (%ds)\n"),
-                              SECS_TO_WAIT_FOR_DIRMNGR - i);
-                  gnupg_sleep (1);
-                  err = assuan_socket_connect (ctx, sockname, 0, 0);
-                  if (!err)
-                    {
-                      if (verbose)
-                        {
-                          log_info (_("connection to the dirmngr"
-                                      " established\n"));
-                          did_success_msg = 1;
-                        }
-                      break;
-                    }
-                }
-            }
+            err = wait_for_sock (ctx, sockname, SECS_TO_WAIT_FOR_DIRMNGR, 1,
+                                 verbose, &did_success_msg);
         }
 
       unlock_spawning (&lock, "dirmngr");
@@ -36,6 +36,7 @@
 
 #include "i18n.h"
 #include "util.h"
+#include "radix64.h"
 
 
 /* The reverse base-64 list used for base-64 decoding. */
@@ -123,6 +124,19 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
 
   for (s=d=buffer; length && !state->stop_seen; length--, s++)
     {
+      if (ds == s_b64_0 && length >= 4)
+        {
+          /* Decode all complete groups in one go; anything else is
+             handled character by character below.  */
+          size_t nread;
+
+          d += radix64_decode (d, s, length, &nread);
+          s += nread;
+          length -= nread;
+          if (!length)
+            break;
+        }
+
       switch (ds)
         {
         case s_idle:
@@ -67,6 +67,11 @@
 # include <sys/stat.h>
 #endif
 
+#ifdef __linux__
+# include <sys/types.h>
+# include <sys/syscall.h>
+#endif /*__linux__ */
+
 #include "util.h"
 #include "i18n.h"
 #include "sysutils.h"
@@ -128,6 +133,66 @@ get_max_fds (void)
 }
 
 
+#if defined(__linux__) && defined(SYS_getdents64)
+/* The record returned by the getdents64 system call.  The C library
+   does not declare it.  */
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+#endif
+
+
+/* Return the highest open file descriptor plus one; i.e. a limit
+   suitable to loop over all open file descriptors.  If that can't be
+   determined cheaply get_max_fds is returned.  With a high
+   RLIMIT_NOFILE, looping up to get_max_fds may take up to millions
+   of system calls, whereas usually only a handful of descriptors are
+   open.  This function is called in the child after a fork and thus
+   does not allocate memory: /proc/self/fd is read using the raw
+   getdents64 system call into a buffer on the stack.  */
+static int
+get_open_fds_limit (void)
+{
+#if defined(__linux__) && defined(SYS_getdents64)
+  uint64_t buffer[512];  /* Aligned for struct linux_dirent64.  */
+  struct linux_dirent64 *dent;
+  const char *s;
+  int dir_fd, fd;
+  long nread, pos;
+  int limit = 0;
+
+  dir_fd = open ("/proc/self/fd", O_RDONLY | O_DIRECTORY);
+  if (dir_fd != -1)
+    {
+      while ((nread = syscall (SYS_getdents64, dir_fd,
+                               buffer, sizeof buffer)) > 0)
+        {
+          for (pos = 0; pos < nread; pos += dent->d_reclen)
+            {
+              dent = (struct linux_dirent64 *)((char *)buffer + pos);
+              if (!digitp (dent->d_name))
+                continue;
+              for (fd = 0, s = dent->d_name; digitp (s); s++)
+                fd = fd * 10 + atoi_1 (s);
+              if (fd != dir_fd && fd >= limit)
+                limit = fd + 1;
+            }
+        }
+      close (dir_fd);
+      if (!nread)
+        return limit;
+    }
+#endif /*__linux__*/
+
+  return get_max_fds ();
+}
+
+
 /* Close all file descriptors starting with descriptor FIRST.  If
    EXCEPT is not NULL, it is expected to be a list of file descriptors
    which shall not be closed.  This list shall be sorted in ascending
@@ -135,33 +200,51 @@ get_max_fds (void)
 void
 close_all_fds (int first, int *except)
 {
-  int max_fd = get_max_fds ();
-  int fd, i, except_start;
+  int max_fd;
+  int fd;
 
+  /* Exceptions below FIRST are not relevant.  */
   if (except)
+    while (*except != -1 && *except < first)
+      except++;
+
+#ifdef HAVE_CLOSE_RANGE
+  {
+    int *ex;
+
+    /* Close the ranges between the exceptions using one system call
+       each.  On failure (e.g. ENOSYS from an old kernel) we fall back
+       to closing the descriptors one by one.  */
+    fd = first;
+    for (ex = except; ex && *ex != -1; ex++)
+      {
+        if (*ex > fd && close_range (fd, *ex - 1, 0))
+          goto fallback;
+        if (*ex >= fd)
+          fd = *ex + 1;
+      }
+    if (!close_range (fd, ~0U, 0))
+      {
+        gpg_err_set_errno (0);
+        return;
+      }
+  }
+ fallback:
+#endif /*HAVE_CLOSE_RANGE*/
+
+  max_fd = get_open_fds_limit ();
+  for (fd=first; fd < max_fd; fd++)
     {
-      except_start = 0;
-      for (fd=first; fd < max_fd; fd++)
+      if (except)
         {
-          for (i=except_start; except[i] != -1; i++)
-            {
-              if (except[i] == fd)
-                {
-                  /* If we found the descriptor in the exception list
-                     we can start the next compare run at the next
-                     index because the exception list is ordered.  */
-                except_start = i + 1;
-                break;
-                }
-            }
-          if (except[i] == -1)
-            close (fd);
+          /* The exception list is ordered; thus we only need to skip
+             ahead in it.  */
+          while (*except != -1 && *except < fd)
+            except++;
+          if (*except == fd)
+            continue;
         }
-    }
-  else
-    {
-      for (fd=first; fd < max_fd; fd++)
-        close (fd);
+      close (fd);
     }
 
   gpg_err_set_errno (0);
@@ -187,7 +270,7 @@ get_all_open_fds (void)
 #else /*HAVE_STAT*/
   struct stat statbuf;
 
-  max_fd = get_max_fds ();
+  max_fd = get_open_fds_limit ();
   narray = 32;  /* If you change this change also t-exechelp.c.  */
   array = calloc (narray, sizeof *array);
   if (!array)
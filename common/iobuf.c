@@ -1361,11 +1361,12 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
-  fcx->keep_open = keep_open;
   sprintf (fcx->fname, "[fd %d]", fd);
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+  /* Set this only after the init call, which resets it.  */
+  fcx->keep_open = keep_open;
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: fdopen%s '%s'\n",
                a->no, a->subno, keep_open? "_nc":"", fcx->fname);
@@ -1399,11 +1400,12 @@ iobuf_esopen (estream_t estream, const char *mode, int keep_open)
   fcx = xtrymalloc (sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
-  fcx->keep_open = keep_open;
   sprintf (fcx->fname, "[fd %p]", estream);
   a->filter = file_es_filter;
   a->filter_ov = fcx;
   file_es_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+  /* Set this only after the init call, which resets it.  */
+  fcx->keep_open = keep_open;
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: esopen%s '%s'\n",
                a->no, a->subno, keep_open? "_nc":"", fcx->fname);
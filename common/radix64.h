@@ -0,0 +1,49 @@
+/* radix64.h - Definitions for the bulk radix64 codec
+ * Copyright (C) 2015 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_RADIX64_H
+#define GNUPG_COMMON_RADIX64_H
+
+/* The initial value of the OpenPGP CRC-24 (RFC-4880, 6.1).  */
+#define CRC24_INIT 0xB704CE
+
+/* Update the CRC-24 value CRC with LENGTH bytes from BUFFER.  */
+u32 crc24_update (u32 crc, const void *buffer, size_t length);
+
+/* Encode the complete 3 byte groups of BUFFER to DST and return the
+   number of characters written.  */
+size_t radix64_encode (char *dst, const void *buffer, size_t length);
+
+/* Decode the complete groups of 4 valid radix64 characters of SRC to
+   DST.  The number of consumed characters is stored at R_NREAD; the
+   number of bytes written is returned.  */
+size_t radix64_decode (void *dst, const char *src, size_t length,
+                       size_t *r_nread);
+
+#endif /*GNUPG_COMMON_RADIX64_H*/
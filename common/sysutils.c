@@ -54,6 +54,13 @@
 # include <sys/time.h>
 # include <sys/resource.h>
 #endif
+#ifndef HAVE_W32_SYSTEM
+# include <time.h>
+# include <sys/time.h>
+# ifdef HAVE_SYS_SELECT_H
+#  include <sys/select.h>
+# endif
+#endif
 #ifdef HAVE_W32_SYSTEM
 # if WINVER < 0x0500
 #   define WINVER 0x0500  /* Required for AllowSetForegroundWindow.  */
@@ -287,6 +294,33 @@ gnupg_sleep (unsigned int seconds)
 }
 
 
+/* Wrapper around the platform's sleep function for sleeping USECS
+   microseconds.  USECS should be less than one second.  When build
+   with nPth it suspends only the current thread.  */
+void
+gnupg_usleep (unsigned int usecs)
+{
+#ifdef USE_NPTH
+  npth_usleep (usecs);
+#elif defined(HAVE_W32_SYSTEM)
+  Sleep ((usecs + 999) / 1000);
+#elif defined(HAVE_NANOSLEEP)
+  struct timespec req, rem;
+
+  req.tv_sec  = usecs / 1000000;
+  req.tv_nsec = (usecs % 1000000) * 1000;
+  while (nanosleep (&req, &rem) == -1 && errno == EINTR)
+    req = rem;
+#else
+  struct timeval tv;
+
+  tv.tv_sec  = usecs / 1000000;
+  tv.tv_usec = usecs % 1000000;
+  select (0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+
 /* This function is a NOP for POSIX systems but required under Windows
    as the file handles as returned by OS calls (like CreateFile) are
    different from the libc file descriptors (like open). This function
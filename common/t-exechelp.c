@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "util.h"
 #include "exechelp.h"
@@ -167,6 +168,82 @@ test_close_all_fds (void)
         }
     }
 
+  /* Check that descriptors far above the others are closed too and
+     that an exception in the middle is kept.  */
+  if (get_max_fds () > 300)
+    {
+      int except[] = { 100, -1 };
+
+      close_all_fds (3, NULL);
+      if (dup2 (1, 100) != 100 || dup2 (1, 280) != 280)
+        {
+          fprintf (stderr, "%s:%d: dup2 failed: %s\n",
+                   __FILE__, __LINE__, strerror (errno));
+          exit (1);
+        }
+      close_all_fds (3, except);
+      array = xget_all_open_fds ();
+      if (verbose)
+        print_open_fds (array);
+      for (count=n=0; array[n] != -1; n++)
+        if (array[n] == 280)
+          count++;
+        else if (array[n] == 100)
+          count += 2;
+      free (array);
+      if (count != 2)
+        {
+          fprintf (stderr, "%s:%d: close_all_fds failed\n",
+                   __FILE__, __LINE__);
+          exit (1);
+        }
+      close (100);
+    }
+}
+
+
+/* Measure the time required to spawn and wait for a trivial process.
+   This mainly shows the cost of closing the descriptors in the child
+   which depends on the descriptor limit.  */
+static void
+bench_spawn (int count)
+{
+  const char *pgmname = "/bin/true";
+  const char *argv[] = { NULL };
+  struct timeval start, stop;
+  gpg_error_t err;
+  pid_t pid;
+  int i, exitcode;
+  double elapsed;
+
+  if (access (pgmname, X_OK))
+    {
+      printf ("skipping spawn benchmark: %s not found\n", pgmname);
+      return;
+    }
+
+  gettimeofday (&start, NULL);
+  for (i=0; i < count; i++)
+    {
+      err = gnupg_spawn_process_fd (pgmname, argv, -1, -1, -1, &pid);
+      if (!err)
+        {
+          err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
+          gnupg_release_process (pid);
+        }
+      if (err)
+        {
+          fprintf (stderr, "%s:%d: spawning '%s' failed: %s\n",
+                   __FILE__, __LINE__, pgmname, gpg_strerror (err));
+          exit (1);
+        }
+    }
+  gettimeofday (&stop, NULL);
+
+  elapsed = (stop.tv_sec - start.tv_sec) * 1e6
+            + (stop.tv_usec - start.tv_usec);
+  printf ("max. file descriptors: %d, spawns: %d, %.1f us per spawn\n",
+          get_max_fds (), count, elapsed / count);
 }
 
 
@@ -181,6 +258,13 @@ main (int argc, char **argv)
       argc--; argv++;
     }
 
+  if (argc && !strcmp (argv[0], "--bench"))
+    {
+      argc--; argv++;
+      bench_spawn (argc? atoi (argv[0]) : 100);
+      return 0;
+    }
+
   test_close_all_fds ();
 
   return 0;
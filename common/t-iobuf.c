@@ -3,6 +3,8 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "iobuf.h"
 
@@ -374,5 +376,28 @@ main (int argc, char *argv[])
     assert (buffer[1] == '7');
   }
 
+  /* An iobuf created with iobuf_fdopen_nc must not close the fd, not
+     even after EOF has been reached.  */
+  {
+    iobuf_t iobuf;
+    int fds[2];
+    int n;
+
+    if (pipe (fds))
+      abort ();
+    assert (write (fds[1], "abc", 3) == 3);
+    close (fds[1]);
+
+    iobuf = iobuf_fdopen_nc (fds[0], "rb");
+    assert (iobuf);
+    for (n = 0; iobuf_get (iobuf) != -1; n ++)
+      ;
+    assert (n == 3);
+    iobuf_close (iobuf);
+
+    assert (fcntl (fds[0], F_GETFD) != -1);
+    close (fds[0]);
+  }
+
   return 0;
 }
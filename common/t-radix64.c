@@ -0,0 +1,192 @@
+/* t-radix64.c - Module test for radix64.c
+ * Copyright (C) 2015 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "radix64.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* The straightforward bitwise CRC-24 from RFC-4880.  */
+static u32
+crc24_reference (const unsigned char *p, size_t length)
+{
+  u32 crc = CRC24_INIT;
+  int i;
+
+  while (length--)
+    {
+      crc ^= (u32)*p++ << 16;
+      for (i = 0; i < 8; i++)
+        {
+          crc <<= 1;
+          if (crc & 0x1000000)
+            crc ^= 0x1864CFB;
+        }
+    }
+  return crc & 0xFFFFFF;
+}
+
+
+static void
+test_crc24 (void)
+{
+  unsigned char buf[100];
+  size_t len, off;
+  u32 crc;
+  int i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i * 37 + 11;
+
+  /* The value for the empty string and "123456789".  */
+  if (crc24_update (CRC24_INIT, "", 0) != CRC24_INIT)
+    fail (0);
+  if (crc24_update (CRC24_INIT, "123456789", 9) != 0x21CF02)
+    fail (1);
+
+  /* Compare all lengths and split points against the reference.  */
+  for (len = 0; len <= sizeof buf; len++)
+    for (off = 0; off <= len; off += 5)
+      {
+        crc = crc24_update (CRC24_INIT, buf, off);
+        crc = crc24_update (crc, buf + off, len - off);
+        if (crc != crc24_reference (buf, len))
+          fail (2);
+      }
+}
+
+
+static void
+test_encode (void)
+{
+  static struct {
+    const char *data;
+    const char *expected;
+  } tests[] = {
+    { "", "" },
+    { "f", "" },
+    { "fo", "" },
+    { "foo", "Zm9v" },
+    { "foob", "Zm9v" },
+    { "foobar", "Zm9vYmFy" },
+    { "\xff\xfe\xfd\x00\x01\x02", "//79AAEC" }
+  };
+  char out[20];
+  size_t n, len;
+  int tidx;
+
+  for (tidx = 0; tidx < DIM(tests); tidx++)
+    {
+      len = strlen (tests[tidx].data);
+      if (tidx == DIM(tests) - 1)
+        len = 6;
+      n = radix64_encode (out, tests[tidx].data, len);
+      if (n != strlen (tests[tidx].expected)
+          || memcmp (out, tests[tidx].expected, n))
+        fail (tidx);
+    }
+}
+
+
+static void
+test_decode (void)
+{
+  static struct {
+    const char *data;
+    const char *expected;
+    size_t nread;
+  } tests[] = {
+    { "", "", 0 },
+    { "Zm9", "", 0 },
+    { "Zm9v", "foo", 4 },
+    { "Zm9vYmFy", "foobar", 8 },
+    { "Zm9vYmF", "foo", 4 },
+    { "Zm9v\nYmFy", "foo", 4 },
+    { "Zm9vYm==", "foo", 4 },
+    { "Zm9vYm=2", "foo", 4 },
+    { "Zm9vY\xe1" "Fy", "foo", 4 },
+    { "Zm 9vYmFy", "", 0 }
+  };
+  char buf[20];
+  size_t n, nread;
+  int tidx;
+
+  for (tidx = 0; tidx < DIM(tests); tidx++)
+    {
+      n = radix64_decode (buf, tests[tidx].data, strlen (tests[tidx].data),
+                          &nread);
+      if (nread != tests[tidx].nread
+          || n != strlen (tests[tidx].expected)
+          || memcmp (buf, tests[tidx].expected, n))
+        fail (tidx);
+
+      /* Check in-place decoding.  */
+      strcpy (buf, tests[tidx].data);
+      n = radix64_decode (buf, buf, strlen (buf), &nread);
+      if (nread != tests[tidx].nread
+          || n != strlen (tests[tidx].expected)
+          || memcmp (buf, tests[tidx].expected, n))
+        fail (tidx);
+    }
+}
+
+
+static void
+test_roundtrip (void)
+{
+  unsigned char data[300], back[300];
+  char enc[400];
+  size_t n, m, nread;
+  int i;
+
+  for (i = 0; i < sizeof data; i++)
+    data[i] = i ^ 0x5a;
+
+  n = radix64_encode (enc, data, sizeof data);
+  if (n != sizeof data / 3 * 4)
+    fail (0);
+  m = radix64_decode (back, enc, n, &nread);
+  if (nread != n || m != sizeof data || memcmp (back, data, m))
+    fail (1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_crc24 ();
+  test_encode ();
+  test_decode ();
+  test_roundtrip ();
+
+  return 0;
+}
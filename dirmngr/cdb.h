@@ -71,11 +71,16 @@ struct cdb_make {
   char cdb_buf[4096];		/* write buffer */
   char *cdb_bpos;		/* current buf position */
   struct cdb_rl *cdb_rec[256];	/* list of arrays of record infos */
+  void (*cdb_hash_fnc)(void *, const void *, size_t); /* optional hasher */
+  void *cdb_hash_fnc_arg;
 };
 
 
 
 int cdb_make_start(struct cdb_make *cdbmp, int fd);
+void cdb_make_set_hash_function(struct cdb_make *cdbmp,
+                                void (*hash_fnc)(void *, const void *, size_t),
+                                void *hash_fnc_arg);
 int cdb_make_add(struct cdb_make *cdbmp,
 		 const void *key, cdbi_t klen,
 		 const void *val, cdbi_t vlen);
@@ -762,6 +762,23 @@ cdb_make_start(struct cdb_make *cdbmp, int fd)
 }
 
 
+/* Register HASH_FNC to be called with all data written to the
+   database.  The data and index sections are passed in the order
+   they are written; the 2048 byte toc, which is written last but
+   located at the start of the file, is passed last by
+   cdb_make_finish.  This allows to compute a checksum over the file
+   without reading it back.  Must be called right after
+   cdb_make_start. */
+void
+cdb_make_set_hash_function(struct cdb_make *cdbmp,
+                           void (*hash_fnc)(void *, const void *, size_t),
+                           void *hash_fnc_arg)
+{
+  cdbmp->cdb_hash_fnc = hash_fnc;
+  cdbmp->cdb_hash_fnc_arg = hash_fnc_arg;
+}
+
+
 static int
 ewrite(int fd, const char *buf, int len)
 {
@@ -782,6 +799,8 @@ static int
 make_write(struct cdb_make *cdbmp, const char *ptr, cdbi_t len)
 {
   cdbi_t l = sizeof(cdbmp->cdb_buf) - (cdbmp->cdb_bpos - cdbmp->cdb_buf);
+  if (cdbmp->cdb_hash_fnc)
+    cdbmp->cdb_hash_fnc(cdbmp->cdb_hash_fnc_arg, ptr, len);
   cdbmp->cdb_dpos += len;
   if (len > l) {
     memcpy(cdbmp->cdb_bpos, ptr, l);
@@ -882,6 +901,8 @@ cdb_make_finish_internal(struct cdb_make *cdbmp)
     cdb_pack(hpos[t], p + (t << 3));
     cdb_pack(hcnt[t], p + (t << 3) + 4);
   }
+  if (cdbmp->cdb_hash_fnc)
+    cdbmp->cdb_hash_fnc(cdbmp->cdb_hash_fnc_arg, p, 2048);
   if (lseek(cdbmp->cdb_fd, 0, 0) != 0 ||
       ewrite(cdbmp->cdb_fd, p, 2048) != 0)
     return -1;
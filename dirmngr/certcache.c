@@ -35,6 +35,10 @@
 
 #define MAX_EXTRA_CACHED_CERTS 1000
 
+/* The number of buckets of the secondary indexes.  Must be a power
+   of 2.  */
+#define CERT_INDEX_BUCKETS 1024
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -56,16 +60,25 @@ enum pattern_class
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are also linked into secondary indexes to allow a fast
+   lookup by issuer and serial number, by subject and by subject key
+   identifier. */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
+  struct cert_item_s *next_bysn;      /* Next item in the same bucket */
+  struct cert_item_s *next_bysubject; /* of the respective secondary  */
+  struct cert_item_s *next_byski;     /* index.                       */
   ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
                                not a valid item.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t subject_keyid;/* The malloced subject key identifier -
+                               maybe NULL.  */
+  unsigned long lru_stamp;  /* Value of LRU_CLOCK at the last use.  */
   struct
   {
     unsigned int loaded:1;  /* It has been explicitly loaded.  */
@@ -78,6 +91,20 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indexes.  They are indexed by a hash of the issuer
+   DN and the serial number, of the subject DN, and of the subject
+   key identifier.  */
+static cert_item_t cert_index_bysn[CERT_INDEX_BUCKETS];
+static cert_item_t cert_index_bysubject[CERT_INDEX_BUCKETS];
+static cert_item_t cert_index_byski[CERT_INDEX_BUCKETS];
+
+/* A counter used to track the last use of the items.  It is bumped
+   with each successful lookup.  Note that the lookups update the
+   item's LRU_STAMP while holding only the read lock; this is okay
+   because nPth runs only one thread at a time and the update does
+   not involve a context switch.  */
+static unsigned long lru_clock;
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -153,6 +180,122 @@ compare_serialno (ksba_sexp_t serial1, ksba_sexp_t serial2 )
 
 
 
+/* Return the FNV-1a hash of LENGTH bytes at BUFFER continuing with
+   the hash value HASH.  Use 2166136261 for the first call.  */
+static unsigned int
+index_hash (const void *buffer, size_t length, unsigned int hash)
+{
+  const unsigned char *p = buffer;
+
+  for (; length; length--, p++)
+    {
+      hash ^= *p;
+      hash *= 16777619;
+    }
+  return hash;
+}
+
+/* Return the index into CERT_INDEX_BYSN for ISSUER_DN and SN.  */
+static unsigned int
+bysn_index (const char *issuer_dn, ksba_sexp_t sn)
+{
+  unsigned int hash;
+
+  hash = index_hash (issuer_dn, strlen (issuer_dn), 2166136261U);
+  hash = index_hash (sn, gcry_sexp_canon_len (sn, 0, NULL, NULL), hash);
+  return hash & (CERT_INDEX_BUCKETS - 1);
+}
+
+/* Return the index into CERT_INDEX_BYSUBJECT for SUBJECT_DN.  */
+static unsigned int
+bysubject_index (const char *subject_dn)
+{
+  return (index_hash (subject_dn, strlen (subject_dn), 2166136261U)
+          & (CERT_INDEX_BUCKETS - 1));
+}
+
+/* Return the index into CERT_INDEX_BYSKI for KEYID.  */
+static unsigned int
+byski_index (ksba_sexp_t keyid)
+{
+  return (index_hash (keyid, gcry_sexp_canon_len (keyid, 0, NULL, NULL),
+                      2166136261U)
+          & (CERT_INDEX_BUCKETS - 1));
+}
+
+
+/* Link the item CI into the secondary indexes.  */
+static void
+link_cert_item (cert_item_t ci)
+{
+  unsigned int idx;
+
+  idx = bysn_index (ci->issuer_dn, ci->sn);
+  ci->next_bysn = cert_index_bysn[idx];
+  cert_index_bysn[idx] = ci;
+
+  if (ci->subject_dn)
+    {
+      idx = bysubject_index (ci->subject_dn);
+      ci->next_bysubject = cert_index_bysubject[idx];
+      cert_index_bysubject[idx] = ci;
+    }
+
+  if (ci->subject_keyid)
+    {
+      idx = byski_index (ci->subject_keyid);
+      ci->next_byski = cert_index_byski[idx];
+      cert_index_byski[idx] = ci;
+    }
+}
+
+
+/* Remove the item CI from the secondary indexes.  */
+static void
+unlink_cert_item (cert_item_t ci)
+{
+  cert_item_t *pp;
+
+  if (ci->issuer_dn && ci->sn)
+    for (pp = cert_index_bysn + bysn_index (ci->issuer_dn, ci->sn);
+         *pp; pp = &(*pp)->next_bysn)
+      if (*pp == ci)
+        {
+          *pp = ci->next_bysn;
+          break;
+        }
+
+  if (ci->subject_dn)
+    for (pp = cert_index_bysubject + bysubject_index (ci->subject_dn);
+         *pp; pp = &(*pp)->next_bysubject)
+      if (*pp == ci)
+        {
+          *pp = ci->next_bysubject;
+          break;
+        }
+
+  if (ci->subject_keyid)
+    for (pp = cert_index_byski + byski_index (ci->subject_keyid);
+         *pp; pp = &(*pp)->next_byski)
+      if (*pp == ci)
+        {
+          *pp = ci->next_byski;
+          break;
+        }
+
+  ci->next_bysn = ci->next_bysubject = ci->next_byski = NULL;
+}
+
+
+/* Mark the item CI as used.  */
+static void
+touch_cert_item (cert_item_t ci)
+{
+  ci->lru_stamp = ++lru_clock;
+}
+
+
+
 /* Return a malloced canonical S-Expression with the serial number
    converted from the hex string HEXSN.  Return NULL on memory
    error. */
@@ -215,6 +358,9 @@ clean_cache_slot (cert_item_t ci)
   if (!ci->cert)
     return; /* Already cleaned.  */
 
+  unlink_cert_item (ci);
+  ksba_free (ci->subject_keyid);
+  ci->subject_keyid = NULL;
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
@@ -228,6 +374,65 @@ clean_cache_slot (cert_item_t ci)
 }
 
 
+/* Helper for qsort to sort LRU stamps.  */
+static int
+compare_lru_stamps (const void *arg_a, const void *arg_b)
+{
+  unsigned long a = *(const unsigned long *)arg_a;
+  unsigned long b = *(const unsigned long *)arg_b;
+
+  return a < b? -1 : a > b? 1 : 0;
+}
+
+
+/* Drop 5 percent of the not explicitly loaded certificates from the
+   cache.  The least recently used certificates are dropped first.
+   It is assumed that the cache is locked while this function is
+   called.  */
+static void
+drop_extra_certs (void)
+{
+  unsigned long *stamps, threshold;
+  unsigned int count, drop_count;
+  cert_item_t ci;
+  int i;
+
+  drop_count = MAX_EXTRA_CACHED_CERTS / 20;
+  if (drop_count < 2)
+    drop_count = 2;
+
+  /* Find the LRU stamp of the DROP_COUNT-th oldest certificate.  */
+  stamps = xtrycalloc (total_extra_certificates, sizeof *stamps);
+  if (!stamps)
+    return;  /* Try again with the next certificate.  */
+  count = 0;
+  for (i=0; i < 256; i++)
+    for (ci = cert_cache[i]; ci; ci = ci->next)
+      if (ci->cert && !ci->flags.loaded && count < total_extra_certificates)
+        stamps[count++] = ci->lru_stamp;
+  if (!count)
+    {
+      xfree (stamps);
+      return;
+    }
+  qsort (stamps, count, sizeof *stamps, compare_lru_stamps);
+  if (drop_count > count)
+    drop_count = count;
+  threshold = stamps[drop_count - 1];
+  xfree (stamps);
+
+  log_info (_("dropping %u certificates from the cache\n"), drop_count);
+  for (i=0; i < 256 && drop_count; i++)
+    for (ci = cert_cache[i]; ci && drop_count; ci = ci->next)
+      if (ci->cert && !ci->flags.loaded && ci->lru_stamp <= threshold)
+        {
+          clean_cache_slot (ci);
+          drop_count--;
+          total_extra_certificates--;
+        }
+}
+
+
 /* Put the certificate CERT into the cache.  It is assumed that the
    cache is locked while this function is called. If FPR_BUFFER is not
    NULL the fingerprint of the certificate will be stored there.
@@ -243,48 +448,9 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
   fpr = fpr_buffer? fpr_buffer : &help_fpr_buffer;
 
   /* If we already reached the caching limit, drop a couple of certs
-     from the cache.  Our dropping strategy is simple: We keep a
-     static index counter and use this to start looking for
-     certificates, then we drop 5 percent of the oldest certificates
-     starting at that index.  For a large cache this is a fair way of
-     removing items. An LRU strategy would be better of course.
-     Because we append new entries to the head of the list and we want
-     to remove old ones first, we need to do this from the tail.  The
-     implementation is not very efficient but compared to the long
-     time it takes to retrieve a certifciate from an external resource
-     it seems to be reasonable. */
+     from the cache.  */
   if (!is_loaded && total_extra_certificates >= MAX_EXTRA_CACHED_CERTS)
-    {
-      static int idx;
-      cert_item_t ci_mark;
-      int i;
-      unsigned int drop_count;
-
-      drop_count = MAX_EXTRA_CACHED_CERTS / 20;
-      if (drop_count < 2)
-        drop_count = 2;
-
-      log_info (_("dropping %u certificates from the cache\n"), drop_count);
-      assert (idx < 256);
-      for (i=idx; drop_count; i = ((i+1)%256))
-        {
-          ci_mark = NULL;
-          for (ci = cert_cache[i]; ci; ci = ci->next)
-            if (ci->cert && !ci->flags.loaded)
-              ci_mark = ci;
-          if (ci_mark)
-            {
-              clean_cache_slot (ci_mark);
-              drop_count--;
-              total_extra_certificates--;
-            }
-        }
-      if (i==idx)
-        idx++;
-      else
-        idx = i;
-      idx %= 256;
-    }
+    drop_extra_certs ();
 
   cert_compute_fpr (cert, fpr);
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
@@ -316,8 +482,12 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
       return gpg_error (GPG_ERR_INV_CERT_OBJ);
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->subject_keyid))
+    ci->subject_keyid = NULL;
   ci->flags.loaded  = !!is_loaded;
   ci->flags.trusted = !!is_trusted;
+  touch_cert_item (ci);
+  link_cert_item (ci);
 
   if (is_loaded)
     total_loaded_certificates++;
@@ -478,6 +648,10 @@ cert_cache_deinit (int full)
           cert_cache[i] = NULL;
         }
     }
+  /* All items have been unlinked by clean_cache_slot; but be safe.  */
+  memset (cert_index_bysn, 0, sizeof cert_index_bysn);
+  memset (cert_index_bysubject, 0, sizeof cert_index_bysubject);
+  memset (cert_index_byski, 0, sizeof cert_index_byski);
 
   total_loaded_certificates = 0;
   total_extra_certificates = 0;
@@ -551,6 +725,7 @@ get_cert_byfpr (const unsigned char *fpr)
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
     if (ci->cert && !memcmp (ci->fpr, fpr, 20))
       {
+        touch_cert_item (ci);
         ksba_cert_ref (ci->cert);
         release_cache_lock ();
         return ci->cert;
@@ -606,22 +781,19 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=cert_index_bysn[bysn_index (issuer_dn, serialno)];
+       ci; ci = ci->next_bysn)
+    if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        touch_cert_item (ci);
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -660,26 +832,49 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=cert_index_bysubject[bysubject_index (subject_dn)];
+       ci; ci = ci->next_bysubject)
+    if (ci->cert && ci->subject_dn
+        && !strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          touch_cert_item (ci);
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
+
+  release_cache_lock ();
+  return NULL;
+}
+
+
+/* Return the certificate matching the subject key identifier KEYID.
+   If SUBJECT_DN is not NULL the certificate must also have this
+   subject DN.  */
+static ksba_cert_t
+get_cert_byski (const char *subject_dn, ksba_sexp_t keyid)
+{
+  cert_item_t ci;
+
+  acquire_cache_read_lock ();
+  for (ci=cert_index_byski[byski_index (keyid)]; ci; ci = ci->next_byski)
+    if (ci->cert && ci->subject_keyid
+        && !cmp_simple_canon_sexp (ci->subject_keyid, keyid)
+        && (!subject_dn
+            || (ci->subject_dn && !strcmp (ci->subject_dn, subject_dn))))
+      {
+        touch_cert_item (ci);
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -1104,7 +1299,6 @@ ksba_cert_t
 find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
 {
   gpg_error_t err;
-  int seq;
   ksba_cert_t cert = NULL;
   cert_fetch_context_t context = NULL;
   ksba_sexp_t subj;
@@ -1119,21 +1313,21 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=cert_index_bysubject[bysubject_index (subject_dn)];
+           ci; ci = ci->next_bysubject)
+        if (ci->cert && ci->subject_dn
+            && !strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                touch_cert_item (ci);
+                ksba_cert_ref (ci->cert);
+                release_cache_lock ();
+                return ci->cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
@@ -1141,19 +1335,10 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
 
 
   /* First we check whether the certificate is cached.  */
-  for (seq=0; (cert = get_cert_bysubject (subject_dn, seq)); seq++)
-    {
-      if (!keyid)
-        break; /* No keyid requested, so return the first one found. */
-      if (!ksba_cert_get_subj_key_id (cert, NULL, &subj)
-          && !cmp_simple_canon_sexp (keyid, subj))
-        {
-          xfree (subj);
-          break; /* Found matching cert. */
-        }
-      xfree (subj);
-      ksba_cert_release (cert);
-    }
+  if (keyid)
+    cert = get_cert_byski (subject_dn, keyid);
+  else
+    cert = get_cert_bysubject (subject_dn, 0);
   if (cert)
     return cert; /* Done.  */
 
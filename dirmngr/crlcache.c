@@ -42,7 +42,9 @@
    1.2. Version record
 
         Field 1: Constant "v"
-        Field 2: Version number of this file.  Must be 1.
+        Field 2: Version number of this file.  Must be 2.  Version 1
+                 caches hashed the DB files in file order; they are
+                 removed when found.
 
         This record must be the first non-comment record record and
         there shall only exist one record of this type.
@@ -68,6 +70,11 @@
         Field 9:  AuthorityKeyID.issuer, each Name separated by 0x01
         Field 10: AuthorityKeyID.serial
         Field 11: Hex fingerprint of trust anchor if field 1 is 'u'.
+        Field 12: Hexadecimal encoded MD-5 hash of the delta DB file or
+                  empty if no delta CRL has been applied.  If a delta
+                  CRL has been applied, fields 5 and 6 carry the update
+                  times of the delta CRL.
+        Field 13: CRL number of the applied delta CRL as a hex string.
 
    2. Layout of the standard CRL Cache DB file:
 
@@ -84,6 +91,22 @@
       SHA-1 hash value of the issuer DN prefixed with a "crl-" and
       suffixed with a ".db".  Thus the length of the filename is 47.
 
+      The MD-5 hash stored in the DIR file is computed over the data
+      and index sections of the file followed by the 2048 byte table
+      of contents at the start of the file.  This is the order in
+      which the file is written and allows to compute the hash while
+      creating the file.
+
+   3. Layout of the delta CRL DB file:
+
+      A delta CRL (RFC-5280, 5.2.4) is stored in a separate DB file
+      which overlays the DB file of its base CRL.  The records use the
+      same layout as the standard DB file; however an entry with the
+      reason removeFromCRL is stored with an empty record to indicate
+      that the serial number listed in the base CRL is not anymore
+      revoked.  The filename is the same as for the standard DB file
+      but suffixed with ".delta.db" instead of ".db".
+
 
 */
 
@@ -101,6 +124,7 @@
 #ifndef HAVE_W32_SYSTEM
 #include <sys/utsname.h>
 #endif
+#include <npth.h>
 #ifdef MKDIR_TAKES_ONE_ARG
 #undef mkdir
 #define mkdir(a,b) mkdir(a)
@@ -113,22 +137,36 @@
 #include "crlfetch.h"
 #include "misc.h"
 #include "cdb.h"
+#include "../common/tlv.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D (opt.system_daemon? "crls.d" : "dirmngr-cache.d")
 #define DBDIRFILE "DIR.txt"
-#define DBDIRVERSION 1
+#define DBDIRVERSION 2
 
-/* The number of DB files we may have open at one time.  We need to
-   limit this because there is no guarantee that the number of issuers
-   has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+/* CRLs which will expire within this number of seconds are fetched
+   again by crl_cache_prefetch.  This is also the minimum time
+   between two attempts to fetch the same CRL.  */
+#define CRL_PREFETCH_LEAD (60*60)
+
+/* The maximum number of CRLs crl_cache_prefetch fetches in
+   parallel.  */
+#define CRL_PREFETCH_THREADS 4
+
+/* The number of DB files we may have open at one time is taken from
+   opt.max_open_crl_files.  We need to limit this because there is no
+   guarantee that the number of issuers has a upper limit.  We are
+   currently using mmap, so it is a good idea anyway to limit the
+   number of opened cache files.  Note that this is a soft limit: if
+   all open files are in use by other threads we open one more file
+   instead of failing the request. */
 
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
 static const char oidstr_issuingDistributionPoint[] = "2.5.29.28";
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
+static const char oidstr_freshestCRL[] = "2.5.29.46";
 
 
 /* Definition of one cached item. */
@@ -143,6 +181,10 @@ struct crl_cache_entry_s
   char *issuer;       /* Ditto. */
   char *issuer_hash;  /* Ditto. */
   char *dbfile_hash;  /* MD5 sum of the cache file, points into RELEASE_PTR.*/
+  char *delta_dbfile_hash; /* MD5 sum of the delta cache file or NULL,
+                              points into RELEASE_PTR.  */
+  char *delta_crl_number;  /* CRL number of the delta CRL or NULL; points
+                              into RELEASE_PTR.  */
   int invalid;        /* Can't use this CRL. */
   int user_trust_req; /* User supplied root certificate required.  */
   char *check_trust_anchor;  /* Malloced fingerprint.  */
@@ -154,11 +196,15 @@ struct crl_cache_entry_s
   char *authority_serialno;
 
   struct cdb *cdb;             /* The cache file handle or NULL if not open. */
+  struct cdb *delta_cdb;       /* The delta cache file handle or NULL.  */
 
   unsigned int cdb_use_count;  /* Current use count. */
-  unsigned int cdb_lru_count;  /* Used for LRU purposes. */
-  int dbfile_checked;          /* Set to true if the dbfile_hash value has
-                                  been checked one. */
+  unsigned int cdb_lru_count;  /* Value of the cache's LRU clock at
+                                  the last lock_db_file.  */
+  int dbfile_checked;          /* Set to true if the dbfile_hash value
+                                  and the delta_dbfile_hash value have
+                                  been checked once. */
+  time_t last_prefetch;        /* Time of the last prefetch attempt.  */
 };
 
 
@@ -166,6 +212,11 @@ struct crl_cache_entry_s
 struct crl_cache_s
 {
   crl_cache_entry_t entries;
+
+  unsigned int lru_clock;      /* Incremented for each lock_db_file.  */
+  unsigned long db_hits;       /* Number of locks on an open file.  */
+  unsigned long db_misses;     /* Number of locks which had to open it. */
+  unsigned long db_evictions;  /* Number of files closed to make room.  */
 };
 
 typedef struct crl_cache_s *crl_cache_t;
@@ -358,20 +409,39 @@ next_line_from_file (estream_t fp, gpg_error_t *r_err)
 }
 
 
+/* Close the cache file handle at CDBP and set it to NULL.  */
+static void
+close_one_db_file (struct cdb **cdbp)
+{
+  int fd;
+
+  if (!*cdbp)
+    return;
+  fd = cdb_fileno (*cdbp);
+  cdb_free (*cdbp);
+  xfree (*cdbp);
+  *cdbp = NULL;
+  if (close (fd))
+    log_error (_("error closing cache file: %s\n"), strerror(errno));
+}
+
+
+/* Close the cache file and the delta cache file of ENTRY.  */
+static void
+close_db_files (crl_cache_entry_t entry)
+{
+  close_one_db_file (&entry->cdb);
+  close_one_db_file (&entry->delta_cdb);
+}
+
+
 /* Release one cache entry.  */
 static void
 release_one_cache_entry (crl_cache_entry_t entry)
 {
   if (entry)
     {
-      if (entry->cdb)
-        {
-          int fd = cdb_fileno (entry->cdb);
-          cdb_free (entry->cdb);
-          xfree (entry->cdb);
-          if (close (fd))
-            log_error (_("error closing cache file: %s\n"), strerror(errno));
-        }
+      close_db_files (entry);
       xfree (entry->release_ptr);
       xfree (entry->check_trust_anchor);
       xfree (entry);
@@ -610,6 +680,8 @@ open_dir (crl_cache_t *r_cache)
                   if (*p)
                     entry->check_trust_anchor = xtrystrdup (p);
                   break;
+                case 12: if (*p) entry->delta_dbfile_hash = p; break;
+                case 13: if (*p) entry->delta_crl_number = p; break;
                 default:
                   if (*p)
                     log_info (_("extra field detected in crl record of "
@@ -688,7 +760,9 @@ open_dir (crl_cache_t *r_cache)
         }
 
       /* Checks not leading to an immediate fail. */
-      if (strlen (entry->dbfile_hash) != 32)
+      if (strlen (entry->dbfile_hash) != 32
+          || (entry->delta_dbfile_hash
+              && strlen (entry->delta_dbfile_hash) != 32))
         log_info (_("WARNING: invalid cache file hash in '%s' line %u\n"),
                   fname, entry->lineno);
     }
@@ -762,6 +836,14 @@ write_dir_line_crl (estream_t fp, crl_cache_entry_t e)
   es_putc (':', fp);
   if (e->check_trust_anchor && e->user_trust_req)
     es_fputs (e->check_trust_anchor, fp);
+  if (e->delta_dbfile_hash)
+    {
+      es_putc (':', fp);
+      es_fputs (e->delta_dbfile_hash, fp);
+      es_putc (':', fp);
+      if (e->delta_crl_number)
+        es_fputs (e->delta_crl_number, fp);
+    }
   es_putc ('\n', fp);
 }
 
@@ -970,31 +1052,84 @@ update_dir (crl_cache_t cache)
 
 
 /* Create the filename for the cache file from the 40 byte ISSUER_HASH
-   string. Caller must release the return string. */
+   string.  If DELTA is set the name of the delta cache file is
+   returned.  Caller must release the return string. */
 static char *
-make_db_file_name (const char *issuer_hash)
+make_db_file_name (const char *issuer_hash, int delta)
 {
-  char bname[50];
+  char bname[60];
 
   assert (strlen (issuer_hash) == 40);
   memcpy (bname, "crl-", 4);
   memcpy (bname + 4, issuer_hash, 40);
-  strcpy (bname + 44, ".db");
+  strcpy (bname + 44, delta? ".delta.db" : ".db");
   return make_filename (opt.homedir_cache, DBDIR_D, bname, NULL);
 }
 
 
+/* Start a hash context for a cache file in MD5.  Returns 0 on
+   success. */
+static int
+start_dbfile_hash (gcry_md_hd_t *md5)
+{
+  gpg_error_t err;
+  char prefix[210];
+
+  err = gcry_md_open (md5, GCRY_MD_MD5, 0);
+  if (err)
+    {
+      log_error (_("error setting up MD5 hash context: %s\n"),
+                 gpg_strerror (err));
+      return -1;
+    }
+
+  /* We better hash some information about the cache file layout in. */
+  sprintf (prefix, "%.100s/%.100s:%d", DBDIR_D, DBDIRFILE, DBDIRVERSION);
+  gcry_md_write (*md5, prefix, strlen (prefix));
+  return 0;
+}
+
+
+/* Helper for hash_dbfile to hash LENGTH bytes or up to the end of
+   the file if LENGTH is 0 from FP into MD5 using BUFFER of 65536
+   bytes. */
+static int
+hash_dbfile_part (estream_t fp, const char *fname, gcry_md_hd_t md5,
+                  char *buffer, size_t length)
+{
+  size_t n;
+
+  for (;;)
+    {
+      n = es_fread (buffer, 1, (length && length < 65536)? length : 65536,
+                    fp);
+      if (!n && es_ferror (fp))
+        {
+          log_error (_("error hashing '%s': %s\n"), fname, strerror (errno));
+          return -1;
+        }
+      if (!n)
+        break;
+      gcry_md_write (md5, buffer, n);
+      if (length && !(length -= n))
+        break;
+    }
+  return 0;
+}
+
+
 /* Hash the file FNAME and return the MD5 digest in MD5BUFFER. The
-   caller must allocate MD%buffer wityh at least 16 bytes. Returns 0
+   caller must allocate MD%buffer wityh at least 16 bytes.  The table
+   of contents at the start of the file is hashed last; see the
+   description of the file format at the top of this file.  Returns 0
    on success. */
 static int
 hash_dbfile (const char *fname, unsigned char *md5buffer)
 {
   estream_t fp;
   char *buffer;
-  size_t n;
   gcry_md_hd_t md5;
-  gpg_error_t err;
+  int rc;
 
   buffer = xtrymalloc (65536);
   fp = buffer? es_fopen (fname, "rb") : NULL;
@@ -1005,37 +1140,34 @@ hash_dbfile (const char *fname, unsigned char *md5buffer)
       return -1;
     }
 
-  err = gcry_md_open (&md5, GCRY_MD_MD5, 0);
-  if (err)
+  if (start_dbfile_hash (&md5))
     {
-      log_error (_("error setting up MD5 hash context: %s\n"),
-                 gpg_strerror (err));
       xfree (buffer);
       es_fclose (fp);
       return -1;
     }
 
-  /* We better hash some information about the cache file layout in. */
-  sprintf (buffer, "%.100s/%.100s:%d", DBDIR_D, DBDIRFILE, DBDIRVERSION);
-  gcry_md_write (md5, buffer, strlen (buffer));
-
-  for (;;)
+  if (es_fseek (fp, 2048, SEEK_SET))
+    {
+      log_error (_("error hashing '%s': %s\n"), fname, strerror (errno));
+      rc = -1;
+    }
+  else
     {
-      n = es_fread (buffer, 1, 65536, fp);
-      if (n < 65536 && es_ferror (fp))
+      rc = hash_dbfile_part (fp, fname, md5, buffer, 0);
+      if (!rc)
         {
-          log_error (_("error hashing '%s': %s\n"), fname, strerror (errno));
-          xfree (buffer);
-          es_fclose (fp);
-          gcry_md_close (md5);
-          return -1;
+          es_rewind (fp);
+          rc = hash_dbfile_part (fp, fname, md5, buffer, 2048);
         }
-      if (!n)
-        break;
-      gcry_md_write (md5, buffer, n);
     }
   es_fclose (fp);
   xfree (buffer);
+  if (rc)
+    {
+      gcry_md_close (md5);
+      return -1;
+    }
   gcry_md_final (md5);
 
   memcpy (md5buffer, gcry_md_read (md5, GCRY_MD_MD5), 16);
@@ -1059,110 +1191,139 @@ check_dbfile (const char *fname, const char *md5hexvalue)
 
   if (hash_dbfile (fname, buffer2))
     return -1;
-
   return memcmp (buffer1, buffer2, 16);
 }
 
 
+/* Open the cache file FNAME and return a new handle for it or NULL
+   on error.  */
+static struct cdb *
+open_one_db_file (const char *fname)
+{
+  struct cdb *cdb;
+  int fd;
+
+  cdb = xtrycalloc (1, sizeof *cdb);
+  if (!cdb)
+    return NULL;
+  fd = open (fname, O_RDONLY);
+  if (fd == -1)
+    {
+      log_error (_("error opening cache file '%s': %s\n"),
+                 fname, strerror (errno));
+      xfree (cdb);
+      return NULL;
+    }
+  if (cdb_init (cdb, fd))
+    {
+      log_error (_("error initializing cache file '%s' for reading: %s\n"),
+                 fname, strerror (errno));
+      xfree (cdb);
+      close (fd);
+      return NULL;
+    }
+  return cdb;
+}
+
+
+/* Return the number of cache entries with open DB files.  */
+static unsigned int
+count_open_db_files (crl_cache_t cache)
+{
+  crl_cache_entry_t e;
+  unsigned int count = 0;
+
+  for (e = cache->entries; e; e = e->next)
+    if (e->cdb)
+      count++;
+  return count;
+}
+
+
 /* Open the cache file for ENTRY.  This function implements a caching
    strategy and might close unused cache files. It is required to use
-   unlock_db_file after using the file. */
+   unlock_db_file after using the file.  If ENTRY has a delta CRL, its
+   cache file is opened as well and available at ENTRY->DELTA_CDB. */
 static struct cdb *
 lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
 {
-  char *fname;
-  int fd;
-  int open_count;
+  char *fname, *delta_fname;
+  unsigned int open_count;
   crl_cache_entry_t e;
 
   if (entry->cdb)
     {
       entry->cdb_use_count++;
+      entry->cdb_lru_count = ++cache->lru_clock;
+      cache->db_hits++;
       return entry->cdb;
     }
+  cache->db_misses++;
 
-  for (open_count = 0, e = cache->entries; e; e = e->next)
-    {
-      if (e->cdb)
-        open_count++;
-/*       log_debug ("CACHE: cdb=%p use_count=%u lru_count=%u\n", */
-/*                  e->cdb,e->cdb_use_count,e->cdb_lru_count); */
-    }
+  open_count = count_open_db_files (cache);
 
   /* If there are too many file open, find the least recent used DB
      file and close it.  Note that for Pth thread safeness we need to
-     use a loop here. */
-  while (open_count >= MAX_OPEN_DB_FILES )
+     use a loop here.  If all files are in use we exceed the limit
+     for now; the next call will bring us back below it.  */
+  while (open_count >= opt.max_open_crl_files)
     {
       crl_cache_entry_t last_e = NULL;
-      unsigned int last_lru = (unsigned int)(-1);
+      unsigned int last_lru = 0;
 
       for (e = cache->entries; e; e = e->next)
-        if (e->cdb && !e->cdb_use_count && e->cdb_lru_count < last_lru)
+        if (e->cdb && !e->cdb_use_count
+            && (!last_e
+                || (int)(e->cdb_lru_count - last_lru) < 0))
           {
             last_lru = e->cdb_lru_count;
             last_e = e;
           }
       if (!last_e)
         {
-          log_error (_("too many open cache files; can't open anymore\n"));
-          return NULL;
+          if (opt.verbose)
+            log_info ("all %u open cache files are in use\n", open_count);
+          break;
         }
 
 /*       log_debug ("CACHE: closing file at cdb=%p\n", last_e->cdb); */
 
-      fd = cdb_fileno (last_e->cdb);
-      cdb_free (last_e->cdb);
-      xfree (last_e->cdb);
-      last_e->cdb = NULL;
-      if (close (fd))
-        log_error (_("error closing cache file: %s\n"), strerror(errno));
+      close_db_files (last_e);
+      cache->db_evictions++;
       open_count--;
     }
 
 
-  fname = make_db_file_name (entry->issuer_hash);
+  fname = make_db_file_name (entry->issuer_hash, 0);
+  delta_fname = (entry->delta_dbfile_hash
+                 ? make_db_file_name (entry->issuer_hash, 1) : NULL);
   if (opt.verbose)
     log_info (_("opening cache file '%s'\n"), fname );
 
   if (!entry->dbfile_checked)
     {
-      if (!check_dbfile (fname, entry->dbfile_hash))
+      if (!check_dbfile (fname, entry->dbfile_hash)
+          && (!delta_fname
+              || !check_dbfile (delta_fname, entry->delta_dbfile_hash)))
         entry->dbfile_checked = 1;
       /* Note, in case of an error we don't print an error here but
          let require the caller to do that check. */
     }
 
-  entry->cdb = xtrycalloc (1, sizeof *entry->cdb);
-  if (!entry->cdb)
-    {
-      xfree (fname);
-      return NULL;
-    }
-  fd = open (fname, O_RDONLY);
-  if (fd == -1)
-    {
-      log_error (_("error opening cache file '%s': %s\n"),
-                 fname, strerror (errno));
-      xfree (entry->cdb);
-      entry->cdb = NULL;
-      xfree (fname);
-      return NULL;
-    }
-  if (cdb_init (entry->cdb, fd))
+  entry->cdb = open_one_db_file (fname);
+  if (entry->cdb && delta_fname)
     {
-      log_error (_("error initializing cache file '%s' for reading: %s\n"),
-                 fname, strerror (errno));
-      xfree (entry->cdb);
-      entry->cdb = NULL;
-      close (fd);
-      xfree (fname);
-      return NULL;
+      entry->delta_cdb = open_one_db_file (delta_fname);
+      if (!entry->delta_cdb)
+        close_db_files (entry);
     }
   xfree (fname);
+  xfree (delta_fname);
+  if (!entry->cdb)
+    return NULL;
 
   entry->cdb_use_count = 1;
-  entry->cdb_lru_count = 0;
+  entry->cdb_lru_count = ++cache->lru_clock;
 
   return entry->cdb;
 }
@@ -1176,26 +1337,22 @@ unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   else if (!entry->cdb_use_count)
     log_error (_("calling unlock_db_file on an unlocked file\n"));
   else
-    {
-      entry->cdb_use_count--;
-      entry->cdb_lru_count++;
-    }
+    entry->cdb_use_count--;
 
   /* If the entry was marked for deletion in the meantime do it now.
      We do this for the sake of Pth thread safeness. */
   if (!entry->cdb_use_count && entry->deleted)
     {
-      crl_cache_entry_t eprev, enext;
+      crl_cache_entry_t *eprev;
 
-      enext = entry->next;
-      for (eprev = cache->entries;
-           eprev && eprev->next != entry; eprev = eprev->next)
+      for (eprev = &cache->entries; *eprev && *eprev != entry;
+           eprev = &(*eprev)->next)
         ;
-      assert (eprev);
-      if (eprev == cache->entries)
-        cache->entries = enext;
-      else
-        eprev->next = enext;
+      assert (*eprev);
+      *eprev = entry->next;
+      /* The entry is not anymore in the list and thus not accounted
+         for by lock_db_file; close its files right away.  */
+      close_db_files (entry);
       /* FIXME: Do we leak ENTRY? */
     }
 }
@@ -1338,8 +1495,28 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
       return CRL_CACHE_DONTKNOW;
     }
 
-  rc = cdb_find (cdb, sn, snlen);
-  if (rc == 1)
+  /* A delta CRL takes precedence over its base CRL.  */
+  rc = 0;
+  if (entry->delta_cdb)
+    {
+      rc = cdb_find (entry->delta_cdb, sn, snlen);
+      if (rc == 1)
+        cdb = entry->delta_cdb;
+    }
+  if (!rc)
+    rc = cdb_find (cdb, sn, snlen);
+  if (rc == 1 && cdb == entry->delta_cdb && !cdb_datalen (cdb))
+    {
+      if (opt.verbose)
+        {
+          char *serialno = hexify_data (sn, snlen);
+          log_info (_("S/N %s is valid, it has been removed from the CRL\n"),
+                    serialno );
+          xfree (serialno);
+        }
+      retval = CRL_CACHE_VALID;
+    }
+  else if (rc == 1)
     {
       n = cdb_datalen (cdb);
       if (n != 16)
@@ -1444,6 +1621,29 @@ crl_cache_isvalid (ctrl_t ctrl, const char *issuer_hash, const char *serialno,
 }
 
 
+/* Store the hex encoded SHA-1 hash of the issuer DN of CERT at
+   R_HASHHEX which must provide space for 41 bytes.  */
+static gpg_error_t
+get_issuer_hash (ksba_cert_t cert, char *r_hashhex)
+{
+  unsigned char issuerhash[20];
+  char *tmp;
+  int i;
+
+  tmp = ksba_cert_get_issuer (cert, 0);
+  if (!tmp)
+    {
+      log_error ("oops: issuer missing in certificate\n");
+      return gpg_error (GPG_ERR_INV_CERT_OBJ);
+    }
+  gcry_md_hash_buffer (GCRY_MD_SHA1, issuerhash, tmp, strlen (tmp));
+  xfree (tmp);
+  for (i=0,tmp=r_hashhex; i < 20; i++, tmp += 2)
+    sprintf (tmp, "%02X", issuerhash[i]);
+  return 0;
+}
+
+
 /* Check whether the certificate CERT is valid; i.e. not listed in our
    cache.  With FORCE_REFRESH set to true, a new CRL will be retrieved
    even if the cache has not yet expired.  We use a 30 minutes
@@ -1455,25 +1655,16 @@ crl_cache_cert_isvalid (ctrl_t ctrl, ksba_cert_t cert,
 {
   gpg_error_t err;
   crl_cache_result_t result;
-  unsigned char issuerhash[20];
   char issuerhash_hex[41];
   ksba_sexp_t serial;
   unsigned char *sn;
   size_t snlen;
-  char *endp, *tmp;
-  int i;
+  char *endp;
 
   /* Compute the hash value of the issuer name.  */
-  tmp = ksba_cert_get_issuer (cert, 0);
-  if (!tmp)
-    {
-      log_error ("oops: issuer missing in certificate\n");
-      return gpg_error (GPG_ERR_INV_CERT_OBJ);
-    }
-  gcry_md_hash_buffer (GCRY_MD_SHA1, issuerhash, tmp, strlen (tmp));
-  xfree (tmp);
-  for (i=0,tmp=issuerhash_hex; i < 20; i++, tmp += 2)
-    sprintf (tmp, "%02X", issuerhash[i]);
+  err = get_issuer_hash (cert, issuerhash_hex);
+  if (err)
+    return err;
 
   /* Get the serial number.  */
   serial = ksba_cert_get_serial (cert);
@@ -1752,7 +1943,11 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
               BUG ();
             record[0] = (reason & 0xff);
             memcpy (record+1, rdate, 15);
-            rc = cdb_make_add (cdb, p, n, record, 1+15);
+            /* Entries removed by a delta CRL are stored with an empty
+               record.  */
+            rc = cdb_make_add (cdb, p, n, record,
+                               (reason & KSBA_CRLREASON_REMOVE_FROM_CRL)?
+                               0 : 1+15);
             if (rc)
               {
                 err = gpg_error_from_errno (errno);
@@ -1950,9 +2145,48 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 
 
 
+/* Return the BaseCRLNumber from the deltaCRLIndicator extension value
+   given by DER and DERLEN as an allocated hex string or NULL if it is
+   not a valid value.  */
+static char *
+get_delta_base_number (const unsigned char *der, size_t derlen)
+{
+  int class, tag, constructed, ndef;
+  size_t objlen, hdrlen;
+
+  if (parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                        &ndef, &objlen, &hdrlen)
+      || class != CLASS_UNIVERSAL || tag != TAG_INTEGER
+      || constructed || ndef || !objlen || objlen > derlen)
+    return NULL;
+  return hexify_data (der, objlen);
+}
+
+
+/* Compare the CRL numbers A and B given as hex strings.  Returns a
+   value less than, equal to, or greater than zero if A is less than,
+   equal to, or greater than B.  */
+static int
+compare_crl_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
-   expected in binary format.
+   expected in binary format.  If the CRL is a delta CRL, it is stored
+   as an overlay for the already cached base CRL.
 
    Called by:
       crl_cache_load
@@ -1975,17 +2209,23 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   char *newfname = NULL;
   struct cdb_make cdb;
   int fd_cdb = -1;
+  gcry_md_hd_t md5 = NULL;
   char *issuer = NULL;
   char *issuer_hash = NULL;
   ksba_isotime_t thisupdate, nextupdate;
   crl_cache_entry_t entry = NULL;
   crl_cache_entry_t e;
+  crl_cache_entry_t base = NULL;
   gnupg_isotime_t current_time;
   char *checksum = NULL;
+  char *delta_base = NULL;
+  char *delta_number = NULL;
   int invalidate_crl = 0;
   int idx;
   const char *oid;
   int critical;
+  const unsigned char *der;
+  size_t derlen;
   char *trust_anchor = NULL;
 
   /* FIXME: We should acquire a mutex for the URL, so that we don't
@@ -2058,6 +2298,16 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   cdb_make_start(&cdb, fd_cdb);
 
+  /* Compute the checksum while writing the file so that we don't
+     need to read it back.  */
+  if (start_dbfile_hash (&md5))
+    {
+      err = gpg_error (GPG_ERR_CHECKSUM);
+      cdb_make_finish (&cdb);
+      goto leave;
+    }
+  cdb_make_set_hash_function (&cdb, HASH_FNC, md5);
+
   err = crl_parse_insert (ctrl, crl, &cdb, fname,
                           &issuer, thisupdate, nextupdate, &trust_anchor);
   if (err)
@@ -2087,16 +2337,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 
 
   /* Create a checksum. */
-  {
-    unsigned char md5buf[16];
-
-    if (hash_dbfile (fname, md5buf))
-      {
-        err = gpg_error (GPG_ERR_CHECKSUM);
-        goto leave;
-      }
-    checksum = hexify_data (md5buf, 16);
-  }
+  gcry_md_final (md5);
+  checksum = hexify_data (gcry_md_read (md5, GCRY_MD_MD5), 16);
 
 
   /* Check whether that new CRL is still not expired. */
@@ -2118,8 +2360,20 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 
   /* Check for unknown critical extensions. */
   for (idx=0; !(err=ksba_crl_get_extension (crl, idx, &oid, &critical,
-                                              NULL, NULL)); idx++)
+                                              &der, &derlen)); idx++)
     {
+      if (!strcmp (oid, oidstr_deltaCRLIndicator))
+        {
+          xfree (delta_base);
+          delta_base = get_delta_base_number (der, derlen);
+          if (!delta_base)
+            {
+              log_error (_("invalid delta CRL indicator\n"));
+              err = gpg_error (GPG_ERR_INV_CRL);
+              goto leave;
+            }
+          continue;
+        }
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
           || !strcmp (oid, oidstr_crlNumber) )
@@ -2143,6 +2397,36 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
      used as the key for the cache. */
   issuer_hash = hashify_data (issuer, strlen (issuer));
 
+  /* A delta CRL may only be applied to a cached base CRL which is at
+     least as new as the base CRL the delta has been created for.  */
+  if (delta_base)
+    {
+      delta_number = get_crl_number (crl);
+      base = find_entry (cache->entries, issuer_hash);
+      if (!base || base->invalid || !base->crl_number)
+        {
+          log_error (_("no usable base CRL for delta CRL\n"));
+          err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+          goto leave;
+        }
+      if (!delta_number
+          || compare_crl_numbers (base->crl_number, delta_base) < 0
+          || compare_crl_numbers (delta_number, base->crl_number) <= 0)
+        {
+          log_error (_("delta CRL %s does not match base CRL %s\n"),
+                     delta_number? delta_number : "?", base->crl_number);
+          err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+          goto leave;
+        }
+      if (base->delta_crl_number
+          && compare_crl_numbers (delta_number, base->delta_crl_number) <= 0)
+        {
+          log_info (_("delta CRL %s is not newer than the cached one\n"),
+                    delta_number);
+          goto leave;
+        }
+    }
+
   /* Create an ENTRY. */
   entry = xtrycalloc (1, sizeof *entry);
   if (!entry)
@@ -2150,10 +2434,22 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  entry->release_ptr = xtrymalloc (strlen (issuer_hash) + 1
-                                   + strlen (issuer) + 1
-                                   + strlen (url) + 1
-                                   + strlen (checksum) + 1);
+  if (base)
+    {
+      /* The entry keeps the base CRL's DB file and the properties of
+         the base CRL but uses the update times of the delta CRL.  */
+      entry->release_ptr = xtrymalloc (strlen (issuer_hash) + 1
+                                       + strlen (issuer) + 1
+                                       + strlen (base->url) + 1
+                                       + strlen (base->dbfile_hash) + 1
+                                       + strlen (checksum) + 1
+                                       + strlen (delta_number) + 1);
+    }
+  else
+    entry->release_ptr = xtrymalloc (strlen (issuer_hash) + 1
+                                     + strlen (issuer) + 1
+                                     + strlen (url) + 1
+                                     + strlen (checksum) + 1);
   if (!entry->release_ptr)
     {
       err = gpg_error_from_syserror ();
@@ -2163,14 +2459,37 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   entry->issuer_hash = entry->release_ptr;
   entry->issuer = stpcpy (entry->issuer_hash, issuer_hash) + 1;
-  entry->url = stpcpy (entry->issuer, issuer) + 1;
-  entry->dbfile_hash = stpcpy (entry->url, url) + 1;
-  strcpy (entry->dbfile_hash, checksum);
+  if (base)
+    {
+      entry->url = stpcpy (entry->issuer, issuer) + 1;
+      entry->dbfile_hash = stpcpy (entry->url, base->url) + 1;
+      entry->delta_dbfile_hash = stpcpy (entry->dbfile_hash,
+                                         base->dbfile_hash) + 1;
+      entry->delta_crl_number = stpcpy (entry->delta_dbfile_hash,
+                                        checksum) + 1;
+      strcpy (entry->delta_crl_number, delta_number);
+      entry->crl_number = xtrystrdup (base->crl_number);
+      entry->authority_issuer = (base->authority_issuer
+                                 ? xtrystrdup (base->authority_issuer)
+                                 : NULL);
+      entry->authority_serialno = (base->authority_serialno
+                                   ? xtrystrdup (base->authority_serialno)
+                                   : NULL);
+      /* The new delta DB file has not yet been checked.  */
+      entry->dbfile_checked = 0;
+    }
+  else
+    {
+      entry->url = stpcpy (entry->issuer, issuer) + 1;
+      entry->dbfile_hash = stpcpy (entry->url, url) + 1;
+      strcpy (entry->dbfile_hash, checksum);
+      entry->crl_number = get_crl_number (crl);
+      entry->authority_issuer = get_auth_key_id (crl,
+                                                 &entry->authority_serialno);
+    }
   gnupg_copy_time (entry->this_update, thisupdate);
   gnupg_copy_time (entry->next_update, nextupdate);
   gnupg_copy_time (entry->last_refresh, current_time);
-  entry->crl_number = get_crl_number (crl);
-  entry->authority_issuer = get_auth_key_id (crl, &entry->authority_serialno);
   entry->invalid = invalidate_crl;
   entry->user_trust_req = !!trust_anchor;
   entry->check_trust_anchor = trust_anchor;
@@ -2183,34 +2502,16 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     e->deleted = 1;
 
   /* Rename the temporary DB to the real name. */
-  newfname = make_db_file_name (entry->issuer_hash);
+  newfname = make_db_file_name (entry->issuer_hash, !!base);
   if (opt.verbose)
     log_info (_("creating cache file '%s'\n"), newfname);
 
   /* Just in case close unused matching files.  Actually we need this
      only under Windows but saving file descriptors is never bad.  */
-  {
-    int any;
-    do
-      {
-        any = 0;
-        for (e = cache->entries; e; e = e->next)
-          if (!e->cdb_use_count && e->cdb
-              && !strcmp (e->issuer_hash, entry->issuer_hash))
-            {
-              int fd = cdb_fileno (e->cdb);
-              cdb_free (e->cdb);
-              xfree (e->cdb);
-              e->cdb = NULL;
-              if (close (fd))
-                log_error (_("error closing cache file: %s\n"),
-                           strerror(errno));
-              any = 1;
-              break;
-            }
-      }
-    while (any);
-  }
+  for (e = cache->entries; e; e = e->next)
+    if (!e->cdb_use_count && e->cdb
+        && !strcmp (e->issuer_hash, entry->issuer_hash))
+      close_db_files (e);
 #ifdef HAVE_W32_SYSTEM
   gnupg_remove (newfname);
 #endif
@@ -2223,11 +2524,25 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   xfree (fname); fname = NULL; /*(let the cleanup code not try to remove it)*/
 
+  /* A full CRL replaces a delta CRL applied to the former base CRL;
+     thus remove a stale delta DB file.  */
+  if (!base)
+    {
+      fname = make_db_file_name (entry->issuer_hash, 1);
+      if (gnupg_remove (fname) && errno != ENOENT)
+        log_error ("failed to remove '%s': %s\n", fname, strerror (errno));
+      xfree (fname);
+      fname = NULL;
+    }
+
   /* Link the new entry in. */
   entry->next = cache->entries;
   cache->entries = entry;
   entry = NULL;
 
+  /* Former validation results may be affected by the new CRL.  */
+  validate_flush_cache ();
+
   err = update_dir (cache);
   if (err)
     {
@@ -2247,10 +2562,13 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       xfree (fname);
     }
   xfree (newfname);
+  gcry_md_close (md5);
   ksba_crl_release (crl);
   xfree (issuer);
   xfree (issuer_hash);
   xfree (checksum);
+  xfree (delta_base);
+  xfree (delta_number);
   xfree (trust_anchor);
   return err ? err : err2;
 }
@@ -2274,6 +2592,8 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   es_fprintf (fp, " This Update:\t%s\n", e->this_update );
   es_fprintf (fp, " Next Update:\t%s\n", e->next_update );
   es_fprintf (fp, " CRL Number :\t%s\n", e->crl_number? e->crl_number: "none");
+  if (e->delta_crl_number)
+    es_fprintf (fp, " Delta CRL  :\t%s\n", e->delta_crl_number);
   es_fprintf (fp, " AuthKeyId  :\t%s\n",
               e->authority_serialno? e->authority_serialno:"none");
   if (e->authority_serialno && e->authority_issuer)
@@ -2395,10 +2715,38 @@ crl_cache_list (estream_t fp)
        entry = entry->next )
     err = list_one_crl_entry (cache, entry, fp);
 
+  if (!err)
+    {
+      es_fprintf (fp, _("Cache files: %u open (max. %u), %lu hits,"
+                        " %lu misses, %lu evictions\n"),
+                  count_open_db_files (cache), opt.max_open_crl_files,
+                  cache->db_hits, cache->db_misses, cache->db_evictions);
+      es_putc ('\n', fp);
+    }
+
   return err;
 }
 
 
+/* Return the usage statistics of the cache file handles.  Any of the
+   arguments may be NULL.  */
+void
+crl_cache_get_stats (unsigned int *r_open, unsigned long *r_hits,
+                     unsigned long *r_misses, unsigned long *r_evictions)
+{
+  crl_cache_t cache = get_current_cache ();
+
+  if (r_open)
+    *r_open = count_open_db_files (cache);
+  if (r_hits)
+    *r_hits = cache->db_hits;
+  if (r_misses)
+    *r_misses = cache->db_misses;
+  if (r_evictions)
+    *r_evictions = cache->db_evictions;
+}
+
+
 /* Load the CRL containing the file named FILENAME into our CRL cache. */
 gpg_error_t
 crl_cache_load (ctrl_t ctrl, const char *filename)
@@ -2426,8 +2774,186 @@ crl_cache_load (ctrl_t ctrl, const char *filename)
 }
 
 
+/* Return true if the CRL distribution point URI may be used.  */
+static int
+dp_uri_is_usable (const char *uri)
+{
+  if (!strncmp (uri, "ldap:", 5)
+      || !strncmp (uri, "ldaps:", 6))
+    return !opt.ignore_ldap_dp;
+  else if (!strncmp (uri, "http:", 5)
+           || !strncmp (uri, "https:", 6))
+    return !opt.ignore_http_dp;
+  else
+    return 0; /* Unknown scheme. */
+}
+
+
+/* Store the URIs of the full names of all distribution points of the
+   freshestCRL extension of CERT at R_URIS.  */
+static gpg_error_t
+get_freshest_crl_uris (ksba_cert_t cert, strlist_t *r_uris)
+{
+  gpg_error_t err;
+  const char *oid;
+  int idx, crit;
+  size_t off, derlen, imagelen;
+  const unsigned char *der, *image, *dp;
+  int class, tag, constructed, ndef;
+  size_t objlen, hdrlen, dplen, namelen;
+  char *uri;
+
+  *r_uris = NULL;
+  for (idx=0; !(err=ksba_cert_get_extension (cert, idx, &oid, &crit,
+                                             &off, &derlen)); idx++)
+    if (!strcmp (oid, oidstr_freshestCRL))
+      break;
+  if (err)
+    return err;
+  image = ksba_cert_get_image (cert, &imagelen);
+  if (!image || off > imagelen || derlen > imagelen - off)
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
+  der = image + off;
+
+  /* CRLDistributionPoints ::= SEQUENCE SIZE (1..MAX) OF
+                                 DistributionPoint  */
+  err = parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                          &ndef, &objlen, &hdrlen);
+  if (!err && (class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE
+               || !constructed || ndef || objlen > derlen))
+    err = gpg_error (GPG_ERR_INV_CERT_OBJ);
+  derlen = objlen;
+  while (!err && derlen)
+    {
+      /* DistributionPoint ::= SEQUENCE {
+           distributionPoint [0] DistributionPointName OPTIONAL, ...}  */
+      err = parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                              &ndef, &objlen, &hdrlen);
+      if (err)
+        break;
+      if (class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE
+          || !constructed || ndef || objlen > derlen)
+        {
+          err = gpg_error (GPG_ERR_INV_CERT_OBJ);
+          break;
+        }
+      dp = der;
+      dplen = objlen;
+      der += objlen;
+      derlen -= objlen;
+      /* DistributionPointName ::= CHOICE {
+           fullName [0] GeneralNames, ... }  */
+      if (parse_ber_header (&dp, &dplen, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || class != CLASS_CONTEXT || tag != 0 || !constructed || ndef
+          || objlen > dplen
+          || parse_ber_header (&dp, &dplen, &class, &tag, &constructed,
+                               &ndef, &namelen, &hdrlen)
+          || class != CLASS_CONTEXT || tag != 0 || !constructed || ndef
+          || namelen > dplen)
+        continue;  /* No fullName.  */
+
+      /* GeneralName ::= CHOICE {
+           uniformResourceIdentifier [6] IA5String, ... }  */
+      while (namelen
+             && !parse_ber_header (&dp, &namelen, &class, &tag,
+                                   &constructed, &ndef, &objlen, &hdrlen)
+             && !ndef && objlen <= namelen)
+        {
+          if (class == CLASS_CONTEXT && tag == 6 && !constructed)
+            {
+              uri = xtrymalloc (objlen + 1);
+              if (!uri)
+                {
+                  err = gpg_error_from_syserror ();
+                  break;
+                }
+              memcpy (uri, dp, objlen);
+              uri[objlen] = 0;
+              add_to_strlist (r_uris, uri);
+              xfree (uri);
+            }
+          dp += objlen;
+          namelen -= objlen;
+        }
+    }
+
+  if (err)
+    {
+      free_strlist (*r_uris);
+      *r_uris = NULL;
+    }
+  return err;
+}
+
+
+/* Try to update the cached CRL for the issuer of CERT using a delta
+   CRL from the freshestCRL extension of CERT.  Returns 0 if the
+   cached CRL is up to date after that.  */
+static gpg_error_t
+reload_delta_crl (ctrl_t ctrl, ksba_cert_t cert)
+{
+  crl_cache_t cache = get_current_cache ();
+  gpg_error_t err;
+  char issuer_hash[41];
+  crl_cache_entry_t entry;
+  strlist_t uris, sl;
+  ksba_reader_t reader;
+  gnupg_isotime_t current_time;
+
+  err = get_issuer_hash (cert, issuer_hash);
+  if (err)
+    return err;
+  entry = find_entry (cache->entries, issuer_hash);
+  if (!entry || entry->invalid || !entry->crl_number)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  err = get_freshest_crl_uris (cert, &uris);
+  if (err)
+    return err;
+
+  err = gpg_error (GPG_ERR_NOT_FOUND);
+  for (sl = uris; sl; sl = sl->next)
+    {
+      if (!dp_uri_is_usable (sl->d))
+        continue;
+
+      if (opt.verbose)
+        log_info ("fetching delta CRL from '%s'\n", sl->d);
+      err = crl_fetch (ctrl, sl->d, &reader);
+      if (err)
+        {
+          log_error (_("crl_fetch via DP failed: %s\n"), gpg_strerror (err));
+          continue;
+        }
+      err = crl_cache_insert (ctrl, sl->d, reader);
+      crl_close_reader (reader);
+      if (err)
+        {
+          log_error (_("crl_cache_insert via DP failed: %s\n"),
+                     gpg_strerror (err));
+          continue;
+        }
+
+      /* Check that the delta CRL actually brought the cache up to
+         date.  */
+      entry = find_entry (cache->entries, issuer_hash);
+      gnupg_get_isotime (current_time);
+      if (entry && !entry->invalid
+          && strcmp (entry->next_update, current_time) >= 0)
+        break;
+      err = gpg_error (GPG_ERR_CRL_TOO_OLD);
+    }
+
+  free_strlist (uris);
+  return err;
+}
+
+
 /* Locate the corresponding CRL for the certificate CERT, read and
-   verify the CRL and store it in the cache.  */
+   verify the CRL and store it in the cache.  A delta CRL is tried
+   first if the certificate references one and we have a suitable
+   base CRL.  */
 gpg_error_t
 crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
 {
@@ -2441,6 +2967,9 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   int any_dist_point = 0;
   int seq;
 
+  if (!reload_delta_crl (ctrl, cert))
+    return 0;
+
   /* Loop over all distribution points, get the CRLs and put them into
      the cache. */
   if (opt.verbose)
@@ -2473,20 +3002,8 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
           if (!distpoint_uri)
             continue;
 
-          if (!strncmp (distpoint_uri, "ldap:", 5)
-              || !strncmp (distpoint_uri, "ldaps:", 6))
-            {
-              if (opt.ignore_ldap_dp)
-                continue;
-            }
-          else if (!strncmp (distpoint_uri, "http:", 5)
-                   || !strncmp (distpoint_uri, "https:", 6))
-            {
-              if (opt.ignore_http_dp)
-                continue;
-            }
-          else
-            continue; /* Skip unknown schemes. */
+          if (!dp_uri_is_usable (distpoint_uri))
+            continue;
 
           any_dist_point = 1;
 
@@ -2581,3 +3098,135 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_free (issuer);
   return err;
 }
+
+
+/* Return true if the CRL of ENTRY shall be fetched in the
+   background at CURTIME.  */
+static int
+prefetch_due_p (crl_cache_entry_t entry, time_t curtime)
+{
+  ksba_isotime_t duetime;
+  time_t refreshed;
+
+  if (entry->deleted || !*entry->next_update)
+    return 0;
+  /* Only CRLs retrieved from a distribution point can be fetched
+     again; LOADCRL stores the file name as URL.  Distribution points
+     disabled by the admin are not contacted either.  */
+  if (!dp_uri_is_usable (entry->url))
+    return 0;
+  if (entry->last_prefetch
+      && entry->last_prefetch + CRL_PREFETCH_LEAD > curtime)
+    return 0;
+  if (*entry->last_refresh)
+    {
+      refreshed = isotime2epoch (entry->last_refresh);
+      if (refreshed != (time_t)(-1) && refreshed + CRL_PREFETCH_LEAD > curtime)
+        return 0;
+    }
+
+  epoch2isotime (duetime, curtime + CRL_PREFETCH_LEAD);
+  return strcmp (entry->next_update, duetime) <= 0;
+}
+
+
+/* The worker thread for crl_cache_prefetch.  ARG is the address of
+   the list of URLs still to be fetched.  Note that we take items from
+   that list without locking; this is okay because nPth runs only one
+   thread at a time and we don't call any npth function while
+   accessing the list.  */
+static void *
+prefetch_worker (void *arg)
+{
+  strlist_t *queue = arg;
+  strlist_t sl;
+  struct server_control_s ctrlbuf;
+  gpg_error_t err;
+  ksba_reader_t reader;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+
+  while ((sl = *queue))
+    {
+      *queue = sl->next;
+      sl->next = NULL;
+
+      if (opt.verbose)
+        log_info ("prefetching CRL from '%s'\n", sl->d);
+      err = crl_fetch (&ctrlbuf, sl->d, &reader);
+      if (err)
+        log_error (_("fetching CRL from '%s' failed: %s\n"),
+                   sl->d, gpg_strerror (err));
+      else
+        {
+          err = crl_cache_insert (&ctrlbuf, sl->d, reader);
+          if (err)
+            log_error (_("processing CRL from '%s' failed: %s\n"),
+                       sl->d, gpg_strerror (err));
+          crl_close_reader (reader);
+        }
+      free_strlist (sl);
+    }
+
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  return NULL;
+}
+
+
+/* Fetch all CRLs from the cache which will expire soon.  This
+   function is called by the housekeeping thread with the current time
+   in CURTIME.  Up to CRL_PREFETCH_THREADS CRLs are fetched in
+   parallel; the function returns after all fetches are done.  */
+void
+crl_cache_prefetch (time_t curtime)
+{
+  crl_cache_t cache = get_current_cache ();
+  crl_cache_entry_t e;
+  strlist_t queue = NULL;
+  npth_t threads[CRL_PREFETCH_THREADS];
+  npth_attr_t tattr;
+  int nthreads, count, i, err;
+
+  count = 0;
+  for (e = cache->entries; e; e = e->next)
+    if (prefetch_due_p (e, curtime))
+      {
+        e->last_prefetch = curtime;
+        if (!strlist_find (queue, e->url))
+          {
+            add_to_strlist (&queue, e->url);
+            count++;
+          }
+      }
+  if (!queue)
+    return;
+
+  if (opt.verbose)
+    log_info ("prefetching %d CRLs\n", count);
+
+  nthreads = 0;
+  if (count > 1 && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthreads < count && nthreads < CRL_PREFETCH_THREADS; nthreads++)
+        {
+          err = npth_create (&threads[nthreads], &tattr,
+                             prefetch_worker, &queue);
+          if (err)
+            {
+              log_error ("error spawning CRL prefetch thread: %s\n",
+                         strerror (err));
+              break;
+            }
+        }
+      npth_attr_destroy (&tattr);
+    }
+
+  /* Do the remaining work ourself; this is also the fallback in case
+     we could not create any thread.  */
+  prefetch_worker (&queue);
+
+  for (i=0; i < nthreads; i++)
+    npth_join (threads[i], NULL);
+}
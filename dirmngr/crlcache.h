@@ -61,10 +61,15 @@ gpg_error_t crl_cache_insert (ctrl_t ctrl, const char *url,
                               ksba_reader_t reader);
 
 gpg_error_t crl_cache_list (estream_t fp);
+void crl_cache_get_stats (unsigned int *r_open, unsigned long *r_hits,
+                          unsigned long *r_misses,
+                          unsigned long *r_evictions);
 
 gpg_error_t crl_cache_load (ctrl_t ctrl, const char *filename);
 
 gpg_error_t crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert);
 
+void crl_cache_prefetch (time_t curtime);
+
 
 #endif /* CRLCACHE_H */
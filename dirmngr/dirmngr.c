@@ -58,6 +58,7 @@
 #include "certcache.h"
 #include "crlcache.h"
 #include "crlfetch.h"
+#include "validate.h"
 #include "misc.h"
 #if USE_LDAP
 # include "ldapserver.h"
@@ -133,6 +134,8 @@ enum cmd_and_opt_values {
   oOCSPMaxPeriod,
   oOCSPCurrentPeriod,
   oMaxReplies,
+  oMaxOpenCRLFiles,
+  oNoCRLPrefetch,
   oHkpCaCert,
   oFakedSystemTime,
   oForce,
@@ -215,6 +218,10 @@ static ARGPARSE_OPTS opts[] = {
 
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
+  ARGPARSE_s_i (oMaxOpenCRLFiles, "max-open-crl-files",
+                N_("|N|keep at most N CRL cache files open")),
+  ARGPARSE_s_n (oNoCRLPrefetch, "no-crl-prefetch",
+                N_("do not fetch CRLs in the background")),
 
   ARGPARSE_s_s (oNameServer, "nameserver", "@"),
   ARGPARSE_s_s (oKeyServer, "keyserver", "@"),
@@ -259,6 +266,7 @@ static struct debug_flags_s debug_flags [] =
   };
 
 #define DEFAULT_MAX_REPLIES 10
+#define DEFAULT_MAX_OPEN_CRL_FILES 20
 #define DEFAULT_LDAP_TIMEOUT 100 /* arbitrary large timeout */
 
 /* For the cleanup handler we need to keep track of the socket's name.  */
@@ -531,6 +539,8 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
       opt.max_replies = DEFAULT_MAX_REPLIES;
+      opt.max_open_crl_files = DEFAULT_MAX_OPEN_CRL_FILES;
+      opt.no_crl_prefetch = 0;
       while (opt.ocsp_signer)
         {
           fingerprint_list_t tmp = opt.ocsp_signer->next;
@@ -594,6 +604,10 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
+    case oMaxOpenCRLFiles:
+      opt.max_open_crl_files = pargs->r.ret_int > 0? pargs->r.ret_int : 1;
+      break;
+    case oNoCRLPrefetch: opt.no_crl_prefetch = 1; break;
 
     case oHkpCaCert:
       {
@@ -1430,6 +1444,9 @@ main (int argc, char **argv)
               flags | GC_OPT_FLAG_DEFAULT, DEFAULT_LDAP_TIMEOUT);
       es_printf ("max-replies:%lu:%u\n",
               flags | GC_OPT_FLAG_DEFAULT, DEFAULT_MAX_REPLIES);
+      es_printf ("max-open-crl-files:%lu:%u\n",
+              flags | GC_OPT_FLAG_DEFAULT, DEFAULT_MAX_OPEN_CRL_FILES);
+      es_printf ("no-crl-prefetch:%lu:\n", flags | GC_OPT_FLAG_NONE);
       es_printf ("allow-ocsp:%lu:\n", flags | GC_OPT_FLAG_NONE);
       es_printf ("ocsp-responder:%lu:\n", flags | GC_OPT_FLAG_NONE);
       es_printf ("ocsp-signer:%lu:\n", flags | GC_OPT_FLAG_NONE);
@@ -1808,6 +1825,7 @@ dirmngr_sighup_action (void)
   crl_cache_deinit ();
   cert_cache_init ();
   crl_cache_init ();
+  validate_flush_cache ();
 }
 
 
@@ -1881,6 +1899,8 @@ housekeeping_thread (void *arg)
     log_info ("starting housekeeping\n");
 
   ks_hkp_housekeeping (curtime);
+  if (!opt.no_crl_prefetch)
+    crl_cache_prefetch (curtime);
 
   if (opt.verbose)
     log_info ("ready with housekeeping\n");
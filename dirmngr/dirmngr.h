@@ -116,6 +116,10 @@ struct
   int allow_ocsp;     /* Allow using OCSP. */
 
   int max_replies;
+  unsigned int max_open_crl_files; /* Number of CRL cache files we
+                                      keep open.  */
+  int no_crl_prefetch;    /* Do not fetch expiring CRLs in the
+                             background.  */
   unsigned int ldaptimeout;
 
   ldap_server_t ldapservers;
@@ -2190,7 +2190,10 @@ static const char hlp_getinfo[] =
   "version     - Return the version of the program.\n"
   "pid         - Return the process id of the server.\n"
   "tor         - Return OK if running in Tor mode\n"
-  "socket_name - Return the name of the socket.\n";
+  "socket_name - Return the name of the socket.\n"
+  "crl_cache_stats - Return the number of open CRL cache files, the\n"
+  "              configured maximum, and the number of hits, misses\n"
+  "              and evictions, separated by spaces.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -2221,6 +2224,17 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       else
         err = gpg_error (GPG_ERR_NO_DATA);
     }
+  else if (!strcmp (line, "crl_cache_stats"))
+    {
+      char numbuf[100];
+      unsigned int nopen;
+      unsigned long hits, misses, evictions;
+
+      crl_cache_get_stats (&nopen, &hits, &misses, &evictions);
+      snprintf (numbuf, sizeof numbuf, "%u %u %lu %lu %lu",
+                nopen, opt.max_open_crl_files, hits, misses, evictions);
+      err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
   else if (!strcmp (line, "tor"))
     {
       if (opt.use_tor)
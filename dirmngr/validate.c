@@ -33,6 +33,21 @@
 #include "validate.h"
 #include "misc.h"
 
+/* The maximum length of a certificate chain.  */
+#define MAX_CHAIN_DEPTH 10
+
+/* The number of buckets of the validation caches and the maximum
+   number of items we keep in each bucket.  The buckets are indexed
+   by the first byte of the subject's fingerprint.  */
+#define VALCACHE_BUCKETS   256
+#define VALCACHE_BUCKETLEN 8
+
+/* The number of seconds we rely on a former validation result.  This
+   limits the time a revocation may go unnoticed if no new CRL has
+   been fetched in the meantime.  */
+#define VALCACHE_TTL (30*60)
+
+
 /* While running the validation function we need to keep track of the
    certificates and the validation outcome of each.  We use this type
    for it.  */
@@ -43,10 +58,53 @@ struct chain_item_s
   unsigned char fpr[20]; /* Fingerprint of the certificate.  */
   int is_self_signed;    /* This certificate is self-signed.  */
   int is_valid;          /* The certifiate is valid except for revocations.  */
+  int chainlen;          /* The pathLenConstraint of the certificate or -1. */
+  ksba_isotime_t not_after; /* The expiration time of the certificate
+                               or, if IS_CACHED is set, the nearest
+                               expiration time up to the root.  */
+  int is_cached;         /* The chain up to the root has been taken
+                            from the chain cache.  */
+  int cached_length;     /* The values from the chain cache item if */
+  int cached_max_depth;  /* IS_CACHED is set.                        */
 };
 typedef struct chain_item_s *chain_item_t;
 
 
+/* An item of the signature cache.  Such an item records that the
+   signature of the certificate SUBJECT_FPR has been verified
+   successfully using the certificate ISSUER_FPR.  The fingerprints
+   cover the entire certificates and thus the result will never
+   change.  */
+struct sig_cache_item_s
+{
+  struct sig_cache_item_s *next;
+  unsigned char issuer_fpr[20];
+  unsigned char subject_fpr[20];
+};
+typedef struct sig_cache_item_s *sig_cache_item_t;
+
+/* An item of the chain cache.  Such an item records that the chain
+   from the certificate FPR up to a trusted root certificate has been
+   validated, including the revocation checks.  */
+struct chain_cache_item_s
+{
+  struct chain_cache_item_s *next;
+  unsigned char fpr[20];
+  time_t expires;          /* Do not use the item after this time.  */
+  ksba_isotime_t exptime;  /* Nearest expiration time of the
+                              certificates up to the root.  */
+  int length;              /* Number of certificates from this one up
+                              to the root.  */
+  int max_depth;           /* The maximum depth at which this
+                              certificate may appear as an issuer.  */
+};
+typedef struct chain_cache_item_s *chain_cache_item_t;
+
+/* The signature cache and the chain cache.  */
+static sig_cache_item_t sig_cache[VALCACHE_BUCKETS];
+static chain_cache_item_t chain_cache[VALCACHE_BUCKETS];
+
+
 /* A couple of constants with Object Identifiers.  */
 static const char oid_kp_serverAuth[]     = "1.3.6.1.5.5.7.3.1";
 static const char oid_kp_clientAuth[]     = "1.3.6.1.5.5.7.3.2";
@@ -61,6 +119,207 @@ static gpg_error_t check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert);
 
 
 
+/* Return true if the signature of the certificate with SUBJECT_FPR
+   made by the certificate with ISSUER_FPR has already been verified.  */
+static int
+sig_cache_lookup (const unsigned char *issuer_fpr,
+                  const unsigned char *subject_fpr)
+{
+  sig_cache_item_t *bucket = sig_cache + *subject_fpr;
+  sig_cache_item_t item, prev;
+
+  for (prev = NULL, item = *bucket; item; prev = item, item = item->next)
+    if (!memcmp (item->subject_fpr, subject_fpr, 20)
+        && !memcmp (item->issuer_fpr, issuer_fpr, 20))
+      {
+        if (prev)
+          { /* Move it to the front.  */
+            prev->next = item->next;
+            item->next = *bucket;
+            *bucket = item;
+          }
+        return 1;
+      }
+  return 0;
+}
+
+
+/* Record a good signature in the signature cache.  */
+static void
+sig_cache_put (const unsigned char *issuer_fpr,
+               const unsigned char *subject_fpr)
+{
+  sig_cache_item_t *bucket = sig_cache + *subject_fpr;
+  sig_cache_item_t item, prev;
+  int count;
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;  /* Ignore; this is only a cache.  */
+  memcpy (item->issuer_fpr, issuer_fpr, 20);
+  memcpy (item->subject_fpr, subject_fpr, 20);
+  item->next = *bucket;
+  *bucket = item;
+
+  /* Drop the least recently used items.  */
+  for (count = 0, prev = item; prev->next; prev = prev->next)
+    if (++count == VALCACHE_BUCKETLEN)
+      {
+        sig_cache_item_t tmp;
+
+        while ((tmp = prev->next))
+          {
+            prev->next = tmp->next;
+            xfree (tmp);
+          }
+        break;
+      }
+}
+
+
+/* Return the chain cache item for the certificate FPR if it is still
+   fresh with respect to CURRENT_TIME.  Stale items are removed.  */
+static chain_cache_item_t
+chain_cache_lookup (const unsigned char *fpr,
+                    const ksba_isotime_t current_time)
+{
+  chain_cache_item_t *bucket = chain_cache + *fpr;
+  chain_cache_item_t item, prev;
+
+  for (prev = NULL, item = *bucket; item; prev = item, item = item->next)
+    if (!memcmp (item->fpr, fpr, 20))
+      break;
+  if (!item)
+    return NULL;
+
+  if (prev)
+    prev->next = item->next;
+  else
+    *bucket = item->next;
+  if (item->expires < gnupg_get_time ()
+      || (*item->exptime && strcmp (current_time, item->exptime) > 0))
+    {
+      xfree (item);
+      return NULL;
+    }
+  item->next = *bucket;
+  *bucket = item;
+  return item;
+}
+
+
+/* Record the values for the validated chain starting at the
+   certificate FPR in the chain cache.  */
+static void
+chain_cache_put (const unsigned char *fpr, const ksba_isotime_t exptime,
+                 int length, int max_depth)
+{
+  chain_cache_item_t *bucket = chain_cache + *fpr;
+  chain_cache_item_t item, prev;
+  int count;
+
+  for (prev = NULL, item = *bucket; item; prev = item, item = item->next)
+    if (!memcmp (item->fpr, fpr, 20))
+      break;
+  if (item)
+    {
+      if (prev)
+        prev->next = item->next;
+      else
+        *bucket = item->next;
+    }
+  else
+    {
+      item = xtrycalloc (1, sizeof *item);
+      if (!item)
+        return;  /* Ignore; this is only a cache.  */
+      memcpy (item->fpr, fpr, 20);
+    }
+  item->expires = gnupg_get_time () + VALCACHE_TTL;
+  gnupg_copy_time (item->exptime, exptime);
+  item->length = length;
+  item->max_depth = max_depth;
+  item->next = *bucket;
+  *bucket = item;
+
+  /* Drop the least recently used items.  */
+  for (count = 0, prev = item; prev->next; prev = prev->next)
+    if (++count == VALCACHE_BUCKETLEN)
+      {
+        chain_cache_item_t tmp;
+
+        while ((tmp = prev->next))
+          {
+            prev->next = tmp->next;
+            xfree (tmp);
+          }
+        break;
+      }
+}
+
+
+/* Store all certificates of the validated CHAIN in the chain cache.
+   The first item of CHAIN is either the root certificate or a
+   certificate taken from the chain cache.  */
+static void
+chain_cache_put_chain (chain_item_t chain)
+{
+  chain_item_t ci, parent;
+  ksba_isotime_t exptime;
+  int length, max_depth;
+
+  ci = chain;
+  gnupg_copy_time (exptime, ci->not_after);
+  if (ci->is_cached)
+    {
+      length = ci->cached_length;
+      max_depth = ci->cached_max_depth;
+    }
+  else
+    {
+      length = 1;
+      max_depth = MAX_CHAIN_DEPTH;
+      chain_cache_put (ci->fpr, exptime, length, max_depth);
+    }
+
+  for (parent = ci, ci = ci->next; ci; parent = ci, ci = ci->next)
+    {
+      /* The depth at which CI may be used is limited by the total
+         chain length and by the pathLenConstraints of all
+         certificates above it.  */
+      length++;
+      max_depth--;
+      if (parent->chainlen >= 0 && parent->chainlen < max_depth)
+        max_depth = parent->chainlen;
+      if (*ci->not_after && (!*exptime || strcmp (ci->not_after, exptime) < 0))
+        gnupg_copy_time (exptime, ci->not_after);
+      chain_cache_put (ci->fpr, exptime, length, max_depth);
+    }
+}
+
+
+/* Flush the cache of validated certificate chains.  This needs to be
+   called if the trusted certificates or the CRLs change.  The cache
+   of verified signatures does not need to be flushed.  */
+void
+validate_flush_cache (void)
+{
+  chain_cache_item_t item, tmp;
+  int i;
+
+  for (i=0; i < VALCACHE_BUCKETS; i++)
+    {
+      for (item = chain_cache[i]; item; item = tmp)
+        {
+          tmp = item->next;
+          xfree (item);
+        }
+      chain_cache[i] = NULL;
+    }
+}
+
+
+
 
 /* Check whether CERT contains critical extensions we don't know
    about.  */
@@ -373,6 +632,11 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
   int any_expired = 0;
   int any_no_policy_match = 0;
   chain_item_t chain;
+  ksba_isotime_t not_after;
+  int subject_chainlen = -1;
+  int issuer_chainlen = -1;
+  chain_cache_item_t cached;
+  unsigned char issuer_fpr[20];
 
 
   if (r_exptime)
@@ -426,7 +690,7 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
       else
         {
           /* If the validation is not older than 30 minutes we are ready. */
-          if (validated_at < gnupg_get_time () + (30*60))
+          if (validated_at + VALCACHE_TTL > gnupg_get_time ())
             {
               if (opt.verbose)
                 log_info ("certificate is good (cached)\n");
@@ -442,7 +706,7 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
 
   /* We walk up the chain until we find a trust anchor. */
   subject_cert = cert;
-  maxdepth = 10;
+  maxdepth = MAX_CHAIN_DEPTH;
   chain = NULL;
   depth = 0;
   for (;;)
@@ -463,7 +727,7 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
 
       /* Handle the notBefore and notAfter timestamps.  */
       {
-        ksba_isotime_t not_before, not_after;
+        ksba_isotime_t not_before;
 
         err = ksba_cert_get_validity (subject_cert, 0, not_before);
         if (!err)
@@ -582,6 +846,8 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
             ksba_cert_ref (subject_cert);
             ci->cert = subject_cert;
             cert_compute_fpr (subject_cert, ci->fpr);
+            ci->chainlen = subject_chainlen;
+            gnupg_copy_time (ci->not_after, not_after);
             ci->next = chain;
             chain = ci;
           }
@@ -687,6 +953,7 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
         err = allowed_ca (issuer_cert, &chainlen);
         if (err)
           goto leave;
+        issuer_chainlen = chainlen;
         if (chainlen >= 0 && (depth - 1) > chainlen)
           {
             log_error (_("certificate chain longer than allowed by CA (%d)"),
@@ -714,6 +981,8 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
         ksba_cert_ref (subject_cert);
         ci->cert = subject_cert;
         cert_compute_fpr (subject_cert, ci->fpr);
+        ci->chainlen = subject_chainlen;
+        gnupg_copy_time (ci->not_after, not_after);
         ci->next = chain;
         chain = ci;
       }
@@ -721,9 +990,46 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
       if (opt.verbose)
         log_info (_("certificate is good\n"));
 
+      /* If the chain starting at the issuer certificate has recently
+         been validated we can stop here.  The issuer certificate is
+         put at the top of our list so that check_revocations treats
+         it like a root certificate.  */
+      cert_compute_fpr (issuer_cert, issuer_fpr);
+      cached = chain_cache_lookup (issuer_fpr, current_time);
+      if (cached && depth <= cached->max_depth)
+        {
+          chain_item_t ci;
+
+          ci = xtrycalloc (1, sizeof *ci);
+          if (!ci)
+            {
+              err = gpg_error_from_errno (errno);
+              goto leave;
+            }
+          ci->cert = issuer_cert;
+          issuer_cert = NULL;
+          memcpy (ci->fpr, issuer_fpr, 20);
+          ci->chainlen = issuer_chainlen;
+          gnupg_copy_time (ci->not_after, cached->exptime);
+          ci->is_cached = 1;
+          ci->cached_length = cached->length;
+          ci->cached_max_depth = cached->max_depth;
+          ci->next = chain;
+          chain = ci;
+
+          if (*cached->exptime
+              && (!*exptime || strcmp (cached->exptime, exptime) < 0))
+            gnupg_copy_time (exptime, cached->exptime);
+
+          if (opt.verbose)
+            log_info ("issuer certificate chain is good (cached)\n");
+          break;
+        }
+
       /* Now to the next level up.  */
       subject_cert = issuer_cert;
       issuer_cert = NULL;
+      subject_chainlen = issuer_chainlen;
     }
 
   if (!err)
@@ -796,6 +1102,11 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
               err = 0;
             }
         }
+
+      /* The chain cache may only be used for chains which passed
+         the revocation checks.  */
+      if (chain && mode != VALIDATE_MODE_CRL)
+        chain_cache_put_chain (chain);
     }
 
   if (r_exptime)
@@ -860,7 +1171,7 @@ pk_algo_from_sexp (gcry_sexp_t pkey)
    does only test the cryptographic signature and nothing else.  It is
    assumed that the ISSUER_CERT is valid. */
 static gpg_error_t
-check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
+do_check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
 {
   gpg_error_t err;
   const char *algoid;
@@ -998,6 +1309,39 @@ check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
 }
 
 
+/* Check the signature on CERT using the ISSUER_CERT.  This is a
+   wrapper around do_check_cert_sig which uses the signature cache.  */
+static gpg_error_t
+check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
+{
+  static const unsigned char dummy_fpr[20] =
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  gpg_error_t err;
+  unsigned char issuer_fpr[20];
+  unsigned char subject_fpr[20];
+  int use_cache;
+
+  /* cert_compute_fpr returns all 0xff on error; don't cache that.  */
+  cert_compute_fpr (issuer_cert, issuer_fpr);
+  cert_compute_fpr (cert, subject_fpr);
+  use_cache = (memcmp (issuer_fpr, dummy_fpr, 20)
+               && memcmp (subject_fpr, dummy_fpr, 20));
+
+  if (use_cache && sig_cache_lookup (issuer_fpr, subject_fpr))
+    {
+      if (DBG_X509)
+        log_debug ("signature is good (cached)\n");
+      return 0;
+    }
+
+  err = do_check_cert_sig (issuer_cert, cert);
+  if (!err && use_cache)
+    sig_cache_put (issuer_fpr, subject_fpr);
+  return err;
+}
+
+
 
 /* Return 0 if the cert is usable for encryption.  A MODE of 0 checks
    for signing, a MODE of 1 checks for encryption, a MODE of 2 checks
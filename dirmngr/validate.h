@@ -41,6 +41,9 @@ gpg_error_t validate_cert_chain (ctrl_t ctrl,
                                  ksba_cert_t cert, ksba_isotime_t r_exptime,
                                  int mode, char **r_trust_anchor);
 
+/* Flush the cache of validated certificate chains.  */
+void validate_flush_cache (void);
+
 /* Return 0 if the certificate CERT is usable for certification.  */
 gpg_error_t cert_use_cert_p (ksba_cert_t cert);
 
@@ -30,6 +30,7 @@
 #include "status.h"
 #include "iobuf.h"
 #include "util.h"
+#include "radix64.h"
 #include "filter.h"
 #include "packet.h"
 #include "options.h"
@@ -39,13 +40,6 @@
 
 #define MAX_LINELEN 20000
 
-#define CRCINIT 0xB704CE
-#define CRCPOLY 0X864CFB
-#define CRCUPDATE(a,c) do {						    \
-			a = ((a) << 8) ^ crc_table[((a)&0xff >> 16) ^ (c)]; \
-			a &= 0x00ffffff;				    \
-		    } while(0)
-static u32 crc_table[256];
 static byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 			 "abcdefghijklmnopqrstuvwxyz"
 			 "0123456789+/";
@@ -163,25 +157,9 @@ push_armor_filter (armor_filter_context_t *afx, iobuf_t iobuf)
 static void
 initialize(void)
 {
-    int i, j;
-    u32 t;
+    int i;
     byte *s;
 
-    /* init the crc lookup table */
-    crc_table[0] = 0;
-    for(i=j=0; j < 128; j++ ) {
-	t = crc_table[j];
-	if( t & 0x00800000 ) {
-	    t <<= 1;
-	    crc_table[i++] = t ^ CRCPOLY;
-	    crc_table[i++] = t;
-	}
-	else {
-	    t <<= 1;
-	    crc_table[i++] = t;
-	    crc_table[i++] = t ^ CRCPOLY;
-	}
-    }
     /* build the helptable for radix64 to bin conversion */
     for(i=0; i < 256; i++ )
 	asctobin[i] = 255; /* used to detect invalid characters */
@@ -546,7 +524,7 @@ check_input( armor_filter_context_t *afx, IOBUF a )
 	afx->faked = 1;
     else {
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -722,7 +700,7 @@ fake_packet( armor_filter_context_t *afx, IOBUF a,
 	    }
 	}
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -751,7 +729,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     int checkcrc=0;
     int rc = 0;
     size_t n = 0;
-    int  idx, i, onlypad=0;
+    int  idx, onlypad=0;
     u32 crc;
 
     crc = afx->crc;
@@ -759,6 +737,22 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     val = afx->radbuf[0];
     for( n=0; n < size; ) {
 
+	if( !idx && size - n >= 3
+	    && afx->buffer_pos + 4 <= afx->buffer_len ) {
+	    /* Decode complete groups in one go; white space, pad and
+	     * invalid characters are handled one by one below. */
+	    size_t nread, max = afx->buffer_len - afx->buffer_pos;
+
+	    if( max > (size - n) / 3 * 4 )
+		max = (size - n) / 3 * 4;
+	    n += radix64_decode( buf + n,
+				 (char*)afx->buffer + afx->buffer_pos,
+				 max, &nread );
+	    afx->buffer_pos += nread;
+	    if( nread )
+		continue;
+	}
+
 	if( afx->buffer_pos < afx->buffer_len )
 	    c = afx->buffer[afx->buffer_pos++];
 	else { /* read the next line */
@@ -817,10 +811,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	idx = (idx+1) % 4;
     }
 
-    for(i=0; i < n; i++ )
-	crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-    crc &= 0x00ffffff;
-    afx->crc = crc;
+    afx->crc = crc24_update( crc, buf, n );
     afx->idx = idx;
     afx->radbuf[0] = val;
 
@@ -1121,7 +1112,7 @@ armor_filter( void *opaque, int control,
 	    afx->status++;
 	    afx->idx = 0;
 	    afx->idx2 = 0;
-	    afx->crc = CRCINIT;
+	    afx->crc = CRC24_INIT;
 
 	}
 	crc = afx->crc;
@@ -1130,28 +1121,37 @@ armor_filter( void *opaque, int control,
 	for(i=0; i < idx; i++ )
 	    radbuf[i] = afx->radbuf[i];
 
-	for(i=0; i < size; i++ )
-	    crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-	crc &= 0x00ffffff;
-
-	for( ; size; buf++, size-- ) {
-	    radbuf[idx++] = *buf;
-	    if( idx > 2 ) {
+	crc = crc24_update( crc, buf, size );
+
+	while( size ) {
+	    char line[64];
+
+	    if( !idx && size >= 3 ) {
+		/* Encode the complete groups up to the end of the line
+		 * at once. */
+		n = (64/4) - idx2;
+		if( n > size / 3 )
+		    n = size / 3;
+		idx2 += n;
+		n *= 3;
+		iobuf_write( a, line, radix64_encode( line, buf, n ) );
+		buf += n;
+		size -= n;
+	    }
+	    else {
+		radbuf[idx++] = *buf++;
+		size--;
+		if( idx < 3 )
+		    continue;
 		idx = 0;
-		c = bintoasc[(*radbuf >> 2) & 077];
-		iobuf_put(a, c);
-		c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-		iobuf_put(a, c);
-		c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-		iobuf_put(a, c);
-		c = bintoasc[radbuf[2]&077];
-		iobuf_put(a, c);
-		if( ++idx2 >= (64/4) )
-		  { /* pgp doesn't like 72 here */
-		    iobuf_writestr(a,afx->eol);
-		    idx2=0;
-		  }
+		iobuf_write( a, line, radix64_encode( line, radbuf, 3 ) );
+		idx2++;
 	    }
+	    if( idx2 >= (64/4) )
+	      { /* pgp doesn't like 72 here */
+		iobuf_writestr(a,afx->eol);
+		idx2=0;
+	      }
 	}
 	for(i=0; i < idx; i++ )
 	    afx->radbuf[i] = radbuf[i];
@@ -1217,14 +1217,11 @@ armor_filter( void *opaque, int control,
 	    radbuf[0] = crc >>16;
 	    radbuf[1] = crc >> 8;
 	    radbuf[2] = crc;
-	    c = bintoasc[(*radbuf >> 2) & 077];
-	    iobuf_put(a, c);
-	    c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-	    iobuf_put(a, c);
-	    c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-	    iobuf_put(a, c);
-	    c = bintoasc[radbuf[2]&077];
-	    iobuf_put(a, c);
+	    {
+		char tmp[4];
+
+		iobuf_write( a, tmp, radix64_encode( tmp, radbuf, 3 ) );
+	    }
 	    iobuf_writestr(a,afx->eol);
 	    /* and the the trailer */
 	    if( afx->what >= DIM(tail_strings) )
@@ -1265,12 +1262,9 @@ make_radix64_string( const byte *data, size_t len )
     char *buffer, *p;
 
     buffer = p = xmalloc( (len+2)/3*4 + 1 );
-    for( ; len >= 3 ; len -= 3, data += 3 ) {
-	*p++ = bintoasc[(data[0] >> 2) & 077];
-	*p++ = bintoasc[(((data[0] <<4)&060)|((data[1] >> 4)&017))&077];
-	*p++ = bintoasc[(((data[1]<<2)&074)|((data[2]>>6)&03))&077];
-	*p++ = bintoasc[data[2]&077];
-    }
+    p += radix64_encode( p, data, len );
+    data += len / 3 * 3;
+    len %= 3;
     if( len == 2 ) {
 	*p++ = bintoasc[(data[0] >> 2) & 077];
 	*p++ = bintoasc[(((data[0] <<4)&060)|((data[1] >> 4)&017))&077];
@@ -1393,7 +1387,7 @@ unarmor_pump (UnarmorPump x, int c)
         /* i.e. wait for one empty line */
         if ( c == '\n' ) {
             x->state = STA_read_data;
-            x->crc = CRCINIT;
+            x->crc = CRC24_INIT;
             x->val = 0;
             x->pos = 0;
         }
@@ -1494,8 +1488,9 @@ unarmor_pump (UnarmorPump x, int c)
     }
 
     if ( !(rval & ~255) ) { /* compute the CRC */
-        x->crc = (x->crc << 8) ^ crc_table[((x->crc >> 16)&0xff) ^ rval];
-        x->crc &= 0x00ffffff;
+        byte b = rval;
+
+        x->crc = crc24_update (x->crc, &b, 1);
     }
 
     return rval;
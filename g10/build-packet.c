@@ -804,7 +804,14 @@ build_sig_subpkt (PKT_signature *sig, sigsubpkttype_t type,
     /* Calculate new size of the area and allocate */
     n0 = oldarea? oldarea->len : 0;
     n = n0 + nlen + 1 + buflen; /* length, type, buffer */
-    if (oldarea && n <= oldarea->size) { /* fits into the unused space */
+    if (oldarea && kbarena_owned_p (oldarea)) {
+        /* Arena memory can't be reallocated; move it to the heap.  */
+        newarea = xmalloc (sizeof (*newarea) + n - 1);
+        newarea->size = n;
+        memcpy (newarea->data, oldarea->data, n0);
+        kbarena_free (oldarea);
+    }
+    else if (oldarea && n <= oldarea->size) { /* fits into the unused space */
         newarea = oldarea;
         /*log_debug ("updating area for type %d\n", type );*/
     }
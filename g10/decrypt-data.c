@@ -296,14 +296,37 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 
 
 
+/* Read up to LENGTH bytes from A into BUF.  For a fixed length
+   packet not more than the remaining length of the packet is read.
+   Returns the number of bytes read; this is less than requested only
+   at EOF or at the end of the packet.  */
+static size_t
+fill_buffer (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t length)
+{
+  int n;
+
+  if (!dfx->partial && length > dfx->length)
+    length = dfx->length;
+  if (!length)
+    return 0;
+
+  n = iobuf_read (a, buf, length);
+  if (n < 0)
+    n = 0;  /* EOF.  */
+  if (!dfx->partial)
+    dfx->length -= n;
+
+  return n;
+}
+
+
 static int
 mdc_decode_filter (void *opaque, int control, IOBUF a,
                    byte *buf, size_t *ret_len)
 {
   decode_filter_ctx_t dfx = opaque;
-  size_t n, size = *ret_len;
+  size_t n, m, want, size = *ret_len;
   int rc = 0;
-  int c;
 
   /* Note: We need to distinguish between a partial and a fixed length
      packet.  The first is the usual case as created by GPG.  However
@@ -324,25 +347,7 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
       assert (size > 44); /* Our code requires at least this size.  */
 
       /* Get at least 22 bytes and put it ahead in the buffer.  */
-      if (dfx->partial)
-        {
-          for (n=22; n < 44; n++)
-            {
-              if ( (c = iobuf_get(a)) == -1 )
-                break;
-              buf[n] = c;
-            }
-        }
-      else
-        {
-          for (n=22; n < 44 && dfx->length; n++, dfx->length--)
-            {
-              c = iobuf_get (a);
-              if (c == -1)
-                break; /* Premature EOF.  */
-              buf[n] = c;
-            }
-        }
+      n = 22 + fill_buffer (dfx, a, buf+22, 22);
       if (n == 44)
         {
           /* We have enough stuff - flush the deferred stuff.  */
@@ -356,33 +361,20 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
               memcpy (buf, dfx->defer, 22);
 	    }
           /* Fill up the buffer. */
+          want = size - n;
+          if (!dfx->partial && want > dfx->length)
+            want = dfx->length;
+          m = fill_buffer (dfx, a, buf+n, want);
+          n += m;
           if (dfx->partial)
             {
-              for (; n < size; n++ )
-                {
-                  if ( (c = iobuf_get(a)) == -1 )
-                    {
-                      dfx->eof_seen = 1; /* Normal EOF. */
-                      break;
-                    }
-                  buf[n] = c;
-                }
-            }
-          else
-            {
-              for (; n < size && dfx->length; n++, dfx->length--)
-                {
-                  c = iobuf_get(a);
-                  if (c == -1)
-                    {
-                      dfx->eof_seen = 3; /* Premature EOF. */
-                      break;
-                    }
-                  buf[n] = c;
-                }
-              if (!dfx->length)
-                dfx->eof_seen = 1; /* Normal EOF.  */
+              if (n < size)
+                dfx->eof_seen = 1; /* Normal EOF. */
             }
+          else if (m < want)
+            dfx->eof_seen = 3; /* Premature EOF. */
+          else if (!dfx->length)
+            dfx->eof_seen = 1; /* Normal EOF.  */
 
           /* Move the trailing 22 bytes back to the defer buffer.  We
              have at least 44 bytes thus a memmove is not needed.  */
@@ -436,8 +428,8 @@ decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
 {
   decode_filter_ctx_t fc = opaque;
   size_t size = *ret_len;
-  size_t n;
-  int c, rc = 0;
+  size_t n, want;
+  int rc = 0;
 
 
   if ( control == IOBUFCTRL_UNDERFLOW && fc->eof_seen )
@@ -449,34 +441,19 @@ decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
     {
       assert(a);
 
+      want = size;
+      if (!fc->partial && want > fc->length)
+        want = fc->length;
+      n = fill_buffer (fc, a, buf, want);
       if (fc->partial)
         {
-          for (n=0; n < size; n++ )
-            {
-              c = iobuf_get(a);
-              if (c == -1)
-                {
-                  fc->eof_seen = 1; /* Normal EOF. */
-                  break;
-                }
-              buf[n] = c;
-            }
-        }
-      else
-        {
-          for (n=0; n < size && fc->length; n++, fc->length--)
-            {
-              c = iobuf_get(a);
-              if (c == -1)
-                {
-                  fc->eof_seen = 3; /* Premature EOF. */
-                  break;
-                }
-              buf[n] = c;
-            }
-          if (!fc->length)
-            fc->eof_seen = 1; /* Normal EOF.  */
+          if (n < size)
+            fc->eof_seen = 1; /* Normal EOF. */
         }
+      else if (n < want)
+        fc->eof_seen = 3; /* Premature EOF. */
+      else if (!fc->length)
+        fc->eof_seen = 1; /* Normal EOF.  */
       if (n)
         {
           if (fc->cipher_hd)
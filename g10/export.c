@@ -62,6 +62,12 @@ static int do_export_stream (ctrl_t ctrl, iobuf_t out,
                              strlist_t users, int secret,
                              kbnode_t *keyblock_out, unsigned int options,
 			     export_stats_t stats, int *any);
+static int export_keyblocks (ctrl_t ctrl, iobuf_t out,
+                             strlist_t users, int secret,
+                             kbnode_t *keyblock_out, unsigned int options,
+                             export_stats_t stats, int *any,
+                             KEYDB_HANDLE range_hd,
+                             unsigned long range_count);
 
 
 
@@ -155,6 +161,28 @@ export_pubkeys (ctrl_t ctrl, strlist_t users, unsigned int options,
 }
 
 
+/*
+ * Export public keys to the stream OUT.  No armor filter is pushed;
+ * that is up to the caller.  If USERS is NULL, all keys will be
+ * exported.  Returns GPG_ERR_NOT_FOUND if nothing has been exported.
+ * STATS is either an export stats object for update or NULL.
+ *
+ * This function is used by the server.
+ */
+gpg_error_t
+export_pubkeys_stream (ctrl_t ctrl, iobuf_t out, strlist_t users,
+                       unsigned int options, export_stats_t stats)
+{
+  gpg_error_t err;
+  int any = 0;
+
+  err = do_export_stream (ctrl, out, users, 0, NULL, options, stats, &any);
+  if (!err && !any)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  return err;
+}
+
+
 /*
  * Export secret keys (to stdout or to --output FILE).
  *
@@ -825,6 +853,99 @@ print_status_exported (PKT_public_key *pk)
 }
 
 
+/* The result of an export worker.  */
+struct export_result_s
+{
+  struct export_stats_s stats;
+  int any;
+};
+
+/* The parameters for a parallel export.  */
+struct export_parm_s
+{
+  ctrl_t ctrl;
+  iobuf_t out;
+  unsigned int options;
+  struct export_result_s total;
+};
+
+
+/* The worker function for a parallel export.  */
+static gpg_error_t
+export_worker (void *opaque, KEYDB_HANDLE hd, unsigned long count,
+               const char *prevres, int fd, void *result)
+{
+  struct export_parm_s *parm = opaque;
+  struct export_result_s *res = result;
+  gpg_error_t err;
+  iobuf_t out;
+
+  (void)prevres;
+
+  out = iobuf_fdopen_nc (fd, "wb");
+  if (!out)
+    return gpg_error_from_syserror ();
+  err = export_keyblocks (parm->ctrl, out, NULL, 0, NULL, parm->options,
+                          &res->stats, &res->any, hd, count);
+  if (err)
+    iobuf_cancel (out);
+  else
+    err = iobuf_close (out);
+  return err;
+}
+
+
+/* The merge function for a parallel export.  */
+static gpg_error_t
+export_merge (void *opaque, estream_t fp, void *result)
+{
+  struct export_parm_s *parm = opaque;
+  struct export_result_s *res = result;
+  gpg_error_t err = 0;
+  char buffer[4096];
+  size_t nread;
+
+  while (!err && !es_read (fp, buffer, sizeof buffer, &nread) && nread)
+    err = iobuf_write (parm->out, buffer, nread);
+  if (!err && es_ferror (fp))
+    err = gpg_error_from_syserror ();
+
+  parm->total.stats.count += res->stats.count;
+  parm->total.stats.exported += res->stats.exported;
+  if (res->any)
+    parm->total.any = 1;
+  return err;
+}
+
+
+/* Export all public keys to OUT using worker processes.  Returns
+   GPG_ERR_NOT_SUPPORTED if that is not possible.  */
+static gpg_error_t
+export_parallel (ctrl_t ctrl, iobuf_t out, unsigned int options,
+                 export_stats_t stats, int *any)
+{
+  gpg_error_t err;
+  struct export_parm_s parm;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.out = out;
+  parm.options = options;
+  err = keydb_parallel_scan (opt.keydb_jobs, sizeof (struct export_result_s),
+                             export_worker, export_merge, &parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    return err;
+
+  if (stats)
+    {
+      stats->count += parm.total.stats.count;
+      stats->exported += parm.total.stats.exported;
+    }
+  *any = parm.total.any;
+  return err;
+}
+
+
 /* Export the keys identified by the list of strings in USERS to the
    stream OUT.  If Secret is false public keys will be exported.  With
    secret true secret keys will be exported; in this case 1 means the
@@ -838,6 +959,31 @@ static int
 do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
 		  kbnode_t *keyblock_out, unsigned int options,
                   export_stats_t stats, int *any)
+{
+  gpg_error_t err;
+
+  err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (opt.keydb_jobs > 1 && !users && !secret && !keyblock_out)
+    err = export_parallel (ctrl, out, options, stats, any);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    err = export_keyblocks (ctrl, out, users, secret, keyblock_out, options,
+                            stats, any, NULL, 0);
+
+  if (!*any)
+    log_info (_("WARNING: nothing exported\n"));
+  return err;
+}
+
+
+/* The worker of do_export_stream.  The arguments are the same as
+   for do_export_stream.  If RANGE_HD is not NULL, USERS must be NULL
+   and only the RANGE_COUNT keyblocks starting at the current position
+   of RANGE_HD are exported.  */
+static int
+export_keyblocks (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
+                  kbnode_t *keyblock_out, unsigned int options,
+                  export_stats_t stats, int *any,
+                  KEYDB_HANDLE range_hd, unsigned long range_count)
 {
   gpg_error_t err = 0;
   PACKET pkt;
@@ -856,7 +1002,7 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
     stats = &dummystats;
   *any = 0;
   init_packet (&pkt);
-  kdbhd = keydb_new ();
+  kdbhd = range_hd? range_hd : keydb_new ();
 
   /* For the DANE format override the options.  */
   if ((options & EXPORT_DANE_FORMAT))
@@ -937,7 +1083,20 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       u32 keyid[2];
       PKT_public_key *pk;
 
-      err = keydb_search (kdbhd, desc, ndesc, &descindex);
+      if (range_hd)
+        {
+          /* The handle is already positioned at the first keyblock
+             of the range.  */
+          if (!range_count--)
+            break;
+          if (desc[0].mode == KEYDB_SEARCH_MODE_FIRST)
+            err = 0;
+          else
+            err = keydb_search (kdbhd, desc, ndesc, NULL);
+          descindex = 0;
+        }
+      else
+        err = keydb_search (kdbhd, desc, ndesc, &descindex);
       if (!users)
         desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
       if (err)
@@ -1327,11 +1486,10 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_close (cipherhd);
   release_subkey_list (subkey_list);
   xfree(desc);
-  keydb_release (kdbhd);
+  if (!range_hd)
+    keydb_release (kdbhd);
   if (err || !keyblock_out)
     release_kbnode( keyblock );
   xfree (cache_nonce);
-  if( !*any )
-    log_info(_("WARNING: nothing exported\n"));
   return err;
 }
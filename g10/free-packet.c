@@ -75,8 +75,8 @@ free_seckey_enc( PKT_signature *sig )
     mpi_release( sig->data[i] );
 
   xfree(sig->revkey);
-  xfree(sig->hashed);
-  xfree(sig->unhashed);
+  kbarena_free (sig->hashed);
+  kbarena_free (sig->unhashed);
 
   if (sig->pka_info)
     {
@@ -84,7 +84,7 @@ free_seckey_enc( PKT_signature *sig )
       xfree (sig->pka_info);
     }
 
-  xfree(sig);
+  kbarena_free (sig);
 }
 
 
@@ -141,7 +141,7 @@ free_public_key (PKT_public_key *pk)
   if (pk)
     {
       release_public_key_parts (pk);
-      xfree(pk);
+      kbarena_free (pk);
     }
 }
 
@@ -309,7 +309,7 @@ free_user_id (PKT_user_id *uid)
     free_attributes(uid);
     xfree (uid->prefs);
     xfree (uid->namehash);
-    xfree (uid);
+    kbarena_free (uid);
 }
 
 void
@@ -412,7 +412,7 @@ free_packet( PACKET *pkt )
 	free_plaintext( pkt->pkt.plaintext );
 	break;
       default:
-	xfree( pkt->pkt.generic );
+	kbarena_free (pkt->pkt.generic);
 	break;
     }
     pkt->pkt.generic = NULL;
@@ -366,6 +366,40 @@ getkey_disable_caches ()
 }
 
 
+/* For documentation see keydb.h.  */
+void
+getkey_flush_caches (void)
+{
+  user_id_db_t r, r2;
+
+#if MAX_PK_CACHE_ENTRIES
+  {
+    pk_cache_entry_t ce, ce2;
+
+    for (ce = pk_cache; ce; ce = ce2)
+      {
+	ce2 = ce->next;
+	free_public_key (ce->pk);
+	xfree (ce);
+      }
+    pk_cache_entries = 0;
+    pk_cache = NULL;
+  }
+#endif
+
+  for (r = user_id_db; r; r = r2)
+    {
+      r2 = r->next;
+      release_keyid_list (r->keyids);
+      xfree (r);
+    }
+  user_id_db = NULL;
+  uid_cache_entries = 0;
+
+  keydb_flush_caches ();
+}
+
+
 static void
 pk_from_block (GETKEY_CTX ctx, PKT_public_key * pk, KBNODE keyblock,
 	       KBNODE found_key)
@@ -424,6 +458,7 @@ get_pubkey (PKT_public_key * pk, u32 * keyid)
     ctx.exact = 1; /* Use the key ID exactly as given.  */
     ctx.not_allocated = 1;
     ctx.kr_handle = keydb_new ();
+    keydb_enable_arena (ctx.kr_handle);
     ctx.nitems = 1;
     ctx.items[0].mode = KEYDB_SEARCH_MODE_LONG_KID;
     ctx.items[0].u.kid[0] = keyid[0];
@@ -482,6 +517,7 @@ get_pubkey_fast (PKT_public_key * pk, u32 * keyid)
 #endif
 
   hd = keydb_new ();
+  keydb_enable_arena (hd);
   rc = keydb_search_kid (hd, keyid);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
@@ -528,6 +564,7 @@ get_pubkeyblock (u32 * keyid)
   /* No need to set exact here because we want the entire block.  */
   ctx.not_allocated = 1;
   ctx.kr_handle = keydb_new ();
+  keydb_enable_arena (ctx.kr_handle);
   ctx.nitems = 1;
   ctx.items[0].mode = KEYDB_SEARCH_MODE_LONG_KID;
   ctx.items[0].u.kid[0] = keyid[0];
@@ -552,6 +589,7 @@ get_seckey (PKT_public_key *pk, u32 *keyid)
   ctx.exact = 1; /* Use the key ID exactly as given.  */
   ctx.not_allocated = 1;
   ctx.kr_handle = keydb_new ();
+  keydb_enable_arena (ctx.kr_handle);
   ctx.nitems = 1;
   ctx.items[0].mode = KEYDB_SEARCH_MODE_LONG_KID;
   ctx.items[0].u.kid[0] = keyid[0];
@@ -748,6 +786,7 @@ key_byname (GETKEY_CTX *retctx, strlist_t namelist,
 
   ctx->want_secret = want_secret;
   ctx->kr_handle = keydb_new ();
+  keydb_enable_arena (ctx->kr_handle);
   if (!ret_kb)
     ret_kb = &help_kb;
 
@@ -1068,6 +1107,7 @@ get_pubkey_byfprint (PKT_public_key *pk, kbnode_t *r_keyblock,
       ctx.exact = 1;
       ctx.not_allocated = 1;
       ctx.kr_handle = keydb_new ();
+      keydb_enable_arena (ctx.kr_handle);
       ctx.nitems = 1;
       ctx.items[0].mode = fprint_len == 16 ? KEYDB_SEARCH_MODE_FPR16
 	: KEYDB_SEARCH_MODE_FPR20;
@@ -1093,6 +1133,29 @@ get_pubkey_byfprint (PKT_public_key *pk, kbnode_t *r_keyblock,
 int
 get_pubkey_byfprint_fast (PKT_public_key * pk,
 			  const byte * fprint, size_t fprint_len)
+{
+  int rc;
+  KBNODE keyblock;
+
+  rc = get_keyblock_byfprint_fast (&keyblock, fprint, fprint_len);
+  if (rc)
+    return rc;
+
+  if (pk)
+    copy_public_key (pk, keyblock->pkt->pkt.public_key);
+  release_kbnode (keyblock);
+
+  /* Not caching key here since it won't have all of the fields
+     properly set. */
+
+  return 0;
+}
+
+
+/* For documentation see keydb.h.  */
+int
+get_keyblock_byfprint_fast (kbnode_t *r_keyblock,
+                            const byte *fprint, size_t fprint_len)
 {
   int rc = 0;
   KEYDB_HANDLE hd;
@@ -1100,12 +1163,15 @@ get_pubkey_byfprint_fast (PKT_public_key * pk,
   byte fprbuf[MAX_FINGERPRINT_LEN];
   int i;
 
+  *r_keyblock = NULL;
+
   for (i = 0; i < MAX_FINGERPRINT_LEN && i < fprint_len; i++)
     fprbuf[i] = fprint[i];
   while (i < MAX_FINGERPRINT_LEN)
     fprbuf[i++] = 0;
 
   hd = keydb_new ();
+  keydb_enable_arena (hd);
   rc = keydb_search_fpr (hd, fprbuf);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
@@ -1122,13 +1188,7 @@ get_pubkey_byfprint_fast (PKT_public_key * pk,
 
   assert (keyblock->pkt->pkttype == PKT_PUBLIC_KEY
 	  || keyblock->pkt->pkttype == PKT_PUBLIC_SUBKEY);
-  if (pk)
-    copy_public_key (pk, keyblock->pkt->pkt.public_key);
-  release_kbnode (keyblock);
-
-  /* Not caching key here since it won't have all of the fields
-     properly set. */
-
+  *r_keyblock = keyblock;
   return 0;
 }
 
@@ -292,6 +292,8 @@ enum cmd_and_opt_values
     oLockOnce,
     oLockMultiple,
     oLockNever,
+    oKeydbJobs,
+    oKeydbScanMin,
     oKeyServer,
     oKeyServerOptions,
     oImportOptions,
@@ -706,6 +708,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oLockOnce,     "lock-once", "@"),
   ARGPARSE_s_n (oLockMultiple, "lock-multiple", "@"),
   ARGPARSE_s_n (oLockNever,    "lock-never", "@"),
+  ARGPARSE_s_i (oKeydbJobs,    "keydb-jobs", "@"),
+  ARGPARSE_s_i (oKeydbScanMin, "keydb-scan-min", "@"),
   ARGPARSE_s_i (oLoggerFD,   "logger-fd", "@"),
   ARGPARSE_s_s (oLoggerFile, "log-file", "@"),
   ARGPARSE_s_s (oLoggerFile, "logger-file", "@"),  /* 1.4 compatibility.  */
@@ -3141,6 +3145,12 @@ main (int argc, char **argv)
 	  case oLockNever:
             dotlock_disable ();
             break;
+	  case oKeydbJobs:
+            opt.keydb_jobs = pargs.r.ret_int < 0? 0 : pargs.r.ret_int;
+            break;
+	  case oKeydbScanMin:
+            opt.keydb_scan_min = pargs.r.ret_int < 0? 0 : pargs.r.ret_int;
+            break;
 	  case oLockMultiple:
 #ifndef __riscos__
 	    opt.lock_once = 0;
@@ -4154,6 +4164,10 @@ main (int argc, char **argv)
 
       case aVerify:
         rc = 0;
+#ifdef USE_TOFU
+        /* Record the TOFU data of all signatures in one transaction.  */
+        tofu_begin_batch_update ();
+#endif
 	if (multifile)
 	  {
 	    if ((rc = verify_files (ctrl, argc, argv)))
@@ -4164,6 +4178,9 @@ main (int argc, char **argv)
 	    if ((rc = verify_signatures (ctrl, argc, argv)))
 	      log_error("verify signatures failed: %s\n", gpg_strerror (rc) );
 	  }
+#ifdef USE_TOFU
+        tofu_end_batch_update ();
+#endif
         if (rc)
           write_status_failure ("verify", rc);
 	break;
@@ -4272,21 +4289,21 @@ main (int argc, char **argv)
 	sl = NULL;
 	for( ; argc; argc--, argv++ )
 	    add_to_strlist2( &sl, *argv, utf8_strings );
-	public_key_list (ctrl, sl, 0);
+	public_key_list (ctrl, sl, 0, es_stdout);
 	free_strlist(sl);
 	break;
       case aListSecretKeys:
 	sl = NULL;
 	for( ; argc; argc--, argv++ )
 	    add_to_strlist2( &sl, *argv, utf8_strings );
-	secret_key_list (ctrl, sl);
+	secret_key_list (ctrl, sl, es_stdout);
 	free_strlist(sl);
 	break;
       case aLocateKeys:
 	sl = NULL;
 	for (; argc; argc--, argv++)
           add_to_strlist2( &sl, *argv, utf8_strings );
-	public_key_list (ctrl, sl, 1);
+	public_key_list (ctrl, sl, 1, es_stdout);
 	free_strlist (sl);
 	break;
 
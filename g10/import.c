@@ -58,6 +58,12 @@ struct stats_s
   ulong n_sigs_cleaned;
   ulong n_uids_cleaned;
   ulong v3keys;   /* Number of V3 keys seen.  */
+
+  /* In bulk import mode this is the locked database handle used for
+     all updates; NULL otherwise.  */
+  KEYDB_HANDLE bulk_hd;
+  /* Set if a trustdb revalidation was deferred by bulk import.  */
+  int revalidation_pending;
 };
 
 
@@ -121,6 +127,9 @@ parse_import_options(char *str,unsigned int *options,int noisy)
       {"import-minimal",IMPORT_MINIMAL|IMPORT_CLEAN,NULL,
        N_("remove as much as possible from key after import")},
 
+      {"bulk-import",IMPORT_BULK,NULL,
+       N_("hold the keyring lock for the entire import")},
+
       /* Aliases for backward compatibility */
       {"allow-local-sigs",IMPORT_LOCAL_SIGS,NULL,NULL},
       {"repair-hkp-subkey-bug",IMPORT_REPAIR_PKS_SUBKEY_BUG,NULL,NULL},
@@ -151,6 +160,96 @@ import_release_stats_handle (void *p)
 }
 
 
+/* Return the database handle to be used for updating the keyring.
+   In bulk import mode this is the handle locked by begin_bulk_import;
+   otherwise a new handle is created.  */
+static KEYDB_HANDLE
+get_update_handle (struct stats_s *stats)
+{
+  KEYDB_HANDLE hd;
+
+  if (stats->bulk_hd)
+    {
+      keydb_search_reset (stats->bulk_hd);
+      return stats->bulk_hd;
+    }
+
+  hd = keydb_new ();
+  if (hd)
+    {
+      keydb_disable_caching (hd);
+      keydb_enable_arena (hd);
+    }
+  return hd;
+}
+
+
+/* Release a handle returned by get_update_handle.  */
+static void
+release_update_handle (struct stats_s *stats, KEYDB_HANDLE hd)
+{
+  if (hd != stats->bulk_hd)
+    keydb_release (hd);
+}
+
+
+/* Mark the trustdb for revalidation.  In bulk import mode this is
+   deferred until end_bulk_import.  */
+static void
+import_revalidation_mark (struct stats_s *stats)
+{
+  if (stats->bulk_hd)
+    stats->revalidation_pending = 1;
+  else
+    revalidation_mark ();
+}
+
+
+/* Start a bulk import by creating one database handle and locking it
+   for all following updates.  Returns true if bulk mode has been
+   entered.  */
+static int
+begin_bulk_import (struct stats_s *stats)
+{
+  KEYDB_HANDLE hd;
+  gpg_error_t err;
+
+  if (stats->bulk_hd)
+    return 0;  /* Already in bulk mode.  */
+
+  hd = keydb_new ();
+  if (!hd)
+    return 0;
+  keydb_disable_caching (hd);
+  keydb_enable_arena (hd);
+  err = keydb_lock (hd);
+  if (err)
+    {
+      log_info (_("can't lock the keyring for bulk import: %s\n"),
+                gpg_strerror (err));
+      keydb_release (hd);
+      return 0;
+    }
+  stats->bulk_hd = hd;
+  return 1;
+}
+
+
+/* Finish a bulk import started by begin_bulk_import: release the lock
+   and do the deferred trustdb marking.  */
+static void
+end_bulk_import (struct stats_s *stats)
+{
+  keydb_release (stats->bulk_hd);
+  stats->bulk_hd = NULL;
+  if (stats->revalidation_pending)
+    {
+      stats->revalidation_pending = 0;
+      revalidation_mark ();
+    }
+}
+
+
 /*
  * Import the public keys from the given filename. Input may be armored.
  * This function rejects all keys which are not validly self signed on at
@@ -189,11 +288,15 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 {
   int i;
   int rc = 0;
+  int bulk = 0;
   struct stats_s *stats = stats_handle;
 
   if (!stats)
     stats = import_new_stats_handle ();
 
+  if ((options & IMPORT_BULK) && !opt.dry_run)
+    bulk = begin_bulk_import (stats);
+
   if (inp)
     {
       rc = import (ctrl, inp, "[stream]", stats, fpr, fpr_len, options,
@@ -235,6 +338,9 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 	}
     }
 
+  if (bulk)
+    end_bulk_import (stats);
+
   if (!stats_handle)
     {
       import_print_stats (stats);
@@ -355,8 +461,18 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct stats_s *stats,
       else if (rc)
         break;
 
-      if (!(++stats->count % 100) && !opt.quiet)
-        log_info (_("%lu keys processed so far\n"), stats->count );
+      if (!(++stats->count % 100))
+        {
+          if (!opt.quiet)
+            log_info (_("%lu keys processed so far\n"), stats->count );
+          if (stats->bulk_hd && is_status_enabled ())
+            {
+              char buf[50];
+
+              snprintf (buf, sizeof buf, "import ? %lu 0", stats->count);
+              write_status_text (STATUS_PROGRESS, buf);
+            }
+        }
     }
   stats->v3keys += v3keys;
   if (rc == -1)
@@ -527,9 +643,14 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
   PACKET *pkt;
   kbnode_t root = NULL;
   int in_cert, in_v3key;
+  kbarena_t arena, old_arena;
 
   *r_v3keys = 0;
 
+  /* The packets of the keyblock keep the arena alive.  */
+  arena = kbarena_new ();
+  old_arena = kbarena_activate (arena);
+
   if (*pending_pkt)
     {
       root = new_kbnode( *pending_pkt );
@@ -539,7 +660,7 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
   else
     in_cert = 0;
 
-  pkt = xmalloc (sizeof *pkt);
+  pkt = kbarena_alloc (sizeof *pkt);
   init_packet (pkt);
   in_v3key = 0;
   while ((rc=parse_packet(a, pkt)) != -1)
@@ -629,7 +750,7 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
                   root = new_kbnode (pkt);
 		else
                   add_kbnode (root, new_kbnode (pkt));
-		pkt = xmalloc (sizeof *pkt);
+		pkt = kbarena_alloc (sizeof *pkt);
               }
 	    init_packet(pkt);
 	    break;
@@ -645,7 +766,9 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
   else
     *ret_root = root;
   free_packet( pkt );
-  xfree( pkt );
+  kbarena_free (pkt);
+  kbarena_activate (old_arena);
+  kbarena_release (arena);
   return rc;
 }
 
@@ -923,6 +1046,110 @@ check_prefs (ctrl_t ctrl, kbnode_t keyblock)
 }
 
 
+/* Return true if the signatures A and B are identical.  Unlike
+   cmp_signatures this also compares the hashed data so that the
+   result of a signature check on A is also valid for B if both are
+   made over the same data.  */
+static int
+same_signature_p (PKT_signature *a, PKT_signature *b)
+{
+  if (cmp_signatures (a, b))
+    return 0;
+  if (a->version != b->version
+      || a->sig_class != b->sig_class
+      || a->digest_algo != b->digest_algo
+      || a->timestamp != b->timestamp)
+    return 0;
+  if (!a->hashed != !b->hashed)
+    return 0;
+  if (a->hashed && (a->hashed->len != b->hashed->len
+                    || memcmp (a->hashed->data, b->hashed->data,
+                               a->hashed->len)))
+    return 0;
+  return 1;
+}
+
+
+/* Return the node in STORED which corresponds to the user ID or
+   subkey node CTX of another keyblock of the same key.  If CTX is
+   NULL the primary key node of STORED is returned.  */
+static kbnode_t
+find_matching_context (kbnode_t stored, kbnode_t ctx)
+{
+  kbnode_t node;
+
+  if (!ctx)
+    return stored;
+
+  for (node = stored->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype != ctx->pkt->pkttype)
+        continue;
+      if (node->pkt->pkttype == PKT_USER_ID
+          && !cmp_user_ids (node->pkt->pkt.user_id, ctx->pkt->pkt.user_id))
+        return node;
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          && !cmp_public_keys (node->pkt->pkt.public_key,
+                               ctx->pkt->pkt.public_key))
+        return node;
+    }
+  return NULL;
+}
+
+
+/* Copy the cached results of successful self-signature checks from
+   STORED, which is our copy of the key, to the identical signatures
+   of KEYBLOCK.  Only signatures made over the same user ID or subkey
+   are considered.  Re-importing a key, which is the common case when
+   loading keyserver dumps, does then not verify the known
+   self-signatures again.  */
+static void
+reuse_sig_checks (kbnode_t keyblock, kbnode_t stored)
+{
+  kbnode_t node, snode;
+  kbnode_t ctx = NULL;
+  kbnode_t sctx = stored;
+  PKT_signature *sig, *ssig;
+  u32 keyid[2];
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, keyid);
+  for (node = keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_USER_ID
+          || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          ctx = node;
+          sctx = find_matching_context (stored, ctx);
+          continue;
+        }
+      if (!sctx || node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked
+          || keyid[0] != sig->keyid[0] || keyid[1] != sig->keyid[1])
+        continue;
+
+      for (snode = sctx->next; snode; snode = snode->next)
+        {
+          if (snode->pkt->pkttype == PKT_USER_ID
+              || snode->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            break;
+          if (snode->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+          ssig = snode->pkt->pkt.signature;
+          if (ssig->flags.checked && ssig->flags.valid
+              && same_signature_p (sig, ssig))
+            {
+              sig->flags.checked = 1;
+              sig->flags.valid = 1;
+              break;
+            }
+        }
+    }
+}
+
+
 /*
  * Try to import one keyblock. Return an error only in serious cases,
  * but never for an invalid keyblock.  It uses log_error to increase
@@ -945,6 +1172,8 @@ import_one (ctrl_t ctrl,
   size_t fpr2len;
   u32 keyid[2];
   int rc = 0;
+  int lookup_rc;
+  kbnode_t stored;
   int new_key = 0;
   int mod_key = 0;
   int same_key = 0;
@@ -1021,9 +1250,25 @@ import_one (ctrl_t ctrl,
     log_info (_("key %s: PKS subkey corruption repaired\n"),
               keystr_from_pk(pk));
 
+  /* Do we have this key already in one of our pubrings ?  This is
+     looked up before checking the self-signatures so that the checks
+     already done for our copy need not be repeated.  */
+  pk_orig = xmalloc_clear( sizeof *pk_orig );
+  lookup_rc = get_keyblock_byfprint_fast (&stored, fpr2, fpr2len);
+  if (!lookup_rc)
+    {
+      copy_public_key (pk_orig, stored->pkt->pkt.public_key);
+      if (!opt.no_sig_cache)
+        reuse_sig_checks (keyblock, stored);
+      release_kbnode (stored);
+    }
+
   rc = chk_self_sigs( fname, keyblock , pk, keyid, &non_self );
   if (rc )
-    return rc== -1? 0:rc;
+    {
+      free_public_key (pk_orig);
+      return rc== -1? 0:rc;
+    }
 
   /* If we allow such a thing, mark unsigned uids as valid */
   if (opt.allow_non_selfsigned_uid)
@@ -1049,12 +1294,11 @@ import_one (ctrl_t ctrl,
             log_info(_("this may be caused by a missing self-signature\n"));
         }
       stats->no_user_id++;
+      free_public_key (pk_orig);
       return 0;
     }
 
-  /* Do we have this key already in one of our pubrings ? */
-  pk_orig = xmalloc_clear( sizeof *pk_orig );
-  rc = get_pubkey_byfprint_fast (pk_orig, fpr2, fpr2len);
+  rc = lookup_rc;
   if (rc && gpg_err_code (rc) != GPG_ERR_NO_PUBKEY
       && gpg_err_code (rc) != GPG_ERR_UNUSABLE_PUBKEY )
     {
@@ -1071,13 +1315,13 @@ import_one (ctrl_t ctrl,
     }
   else if (rc )  /* Insert this key. */
     {
-      KEYDB_HANDLE hd = keydb_new ();
+      KEYDB_HANDLE hd = get_update_handle (stats);
 
       rc = keydb_locate_writable (hd);
       if (rc)
         {
           log_error (_("no writable keyring found: %s\n"), gpg_strerror (rc));
-          keydb_release (hd);
+          release_update_handle (stats, hd);
           return GPG_ERR_GENERAL;
 	}
       if (opt.verbose > 1 )
@@ -1097,9 +1341,9 @@ import_one (ctrl_t ctrl,
 
           clear_ownertrusts (pk);
           if (non_self)
-            revalidation_mark ();
+            import_revalidation_mark (stats);
         }
-      keydb_release (hd);
+      release_update_handle (stats, hd);
 
       /* We are ready.  */
       if (!opt.quiet && !silent)
@@ -1135,14 +1379,13 @@ import_one (ctrl_t ctrl,
 
       /* Now read the original keyblock again so that we can use
          that handle for updating the keyblock.  */
-      hd = keydb_new ();
-      keydb_disable_caching (hd);
+      hd = get_update_handle (stats);
       rc = keydb_search_fpr (hd, fpr2);
       if (rc )
         {
           log_error (_("key %s: can't locate original keyblock: %s\n"),
                      keystr(keyid), gpg_strerror (rc));
-          keydb_release (hd);
+          release_update_handle (stats, hd);
           goto leave;
         }
       rc = keydb_get_keyblock (hd, &keyblock_orig);
@@ -1150,7 +1393,7 @@ import_one (ctrl_t ctrl,
         {
           log_error (_("key %s: can't read original keyblock: %s\n"),
                      keystr(keyid), gpg_strerror (rc));
-          keydb_release (hd);
+          release_update_handle (stats, hd);
           goto leave;
         }
 
@@ -1167,7 +1410,7 @@ import_one (ctrl_t ctrl,
                          keyid, &n_uids, &n_sigs, &n_subk );
       if (rc )
         {
-          keydb_release (hd);
+          release_update_handle (stats, hd);
           goto leave;
         }
 
@@ -1184,7 +1427,7 @@ import_one (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (rc) );
           else if (non_self)
-            revalidation_mark ();
+            import_revalidation_mark (stats);
 
           /* We are ready.  */
           if (!opt.quiet && !silent)
@@ -1248,7 +1491,7 @@ import_one (ctrl_t ctrl,
           stats->unchanged++;
         }
 
-      keydb_release (hd); hd = NULL;
+      release_update_handle (stats, hd); hd = NULL;
     }
 
   leave:
@@ -1845,7 +2088,7 @@ import_revoke_cert( const char *fname, kbnode_t node, struct stats_s *stats )
     }
 
   /* Read the original keyblock. */
-  hd = keydb_new ();
+  hd = get_update_handle (stats);
   {
     byte afp[MAX_FINGERPRINT_LEN];
     size_t an;
@@ -1901,7 +2144,7 @@ import_revoke_cert( const char *fname, kbnode_t node, struct stats_s *stats )
   if (rc)
     log_error (_("error writing keyring '%s': %s\n"),
                keydb_get_resource_name (hd), gpg_strerror (rc) );
-  keydb_release (hd);
+  release_update_handle (stats, hd);
   hd = NULL;
 
   /* we are ready */
@@ -1920,10 +2163,11 @@ import_revoke_cert( const char *fname, kbnode_t node, struct stats_s *stats )
   if(get_ownertrust(pk)==TRUST_ULTIMATE)
     clear_ownertrusts(pk);
 
-  revalidation_mark ();
+  import_revalidation_mark (stats);
 
  leave:
-  keydb_release (hd);
+  if (hd)
+    release_update_handle (stats, hd);
   release_kbnode( keyblock );
   free_public_key( pk );
   return rc;
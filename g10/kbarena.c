@@ -0,0 +1,352 @@
+/* kbarena.c - Arena allocator for the packets of a keyblock
+ * Copyright (C) 2015 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Parsing a keyblock allocates a PACKET, the packet structure and
+   often a subpacket area for each of its many packets.  To cut down
+   the number of malloc calls, the keyblock readers may activate an
+   arena while parsing.  All objects allocated by kbarena_alloc are
+   then carved out of a few large chunks owned by the arena.
+
+   An arena counts the objects living in it.  The memory is released
+   in one go when the last object has been freed with kbarena_free
+   and the creator has called kbarena_release.  Thus objects may
+   outlive the keyblock they were read with (e.g. a user ID shared
+   with scopy_user_id) as long as they are freed with kbarena_free.
+   kbarena_free accepts heap memory as well; the code freeing packets
+   does not need to know where they were allocated.  Arena memory may
+   however never be passed to xrealloc.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "gpg.h"
+#include "util.h"
+#include "packet.h"
+
+/* All chunks have the same size.  A chunk thus covers at most two
+   of the CHUNK_SIZE aligned pages of the address space.  */
+#define CHUNK_SHIFT      12
+#define CHUNK_SIZE       (1 << CHUNK_SHIFT)
+
+/* Objects larger than this are allocated from the heap.  */
+#define MAX_OBJECT_SIZE  2048
+
+/* The alignment of objects in the arena.  */
+#define ARENA_ALIGN      16
+
+/* The initial number of buckets of the chunk table.  */
+#define FIRST_TABLE_SIZE 256
+
+/* An entry of the chunk table.  */
+struct chunk_ref_s
+{
+  struct chunk_ref_s *next;
+  struct kbarena_chunk_s *chunk;
+};
+
+struct kbarena_chunk_s
+{
+  struct kbarena_chunk_s *next;
+  kbarena_t arena;         /* The arena owning this chunk.  */
+  size_t used;             /* Used bytes of DATA.  */
+  struct chunk_ref_s ref[2];  /* The entries for the pages of DATA.  */
+  union {
+    double d;
+    void *p;
+    unsigned char data[CHUNK_SIZE];
+  } u;
+};
+typedef struct kbarena_chunk_s *kbarena_chunk_t;
+
+struct kbarena_s
+{
+  kbarena_chunk_t chunks;  /* The current chunk is the first one.  */
+  unsigned int refcount;   /* The creator plus the live objects.  */
+};
+
+/* A hash table mapping the pages of the address space to the chunks
+   overlapping them.  kbarena_free uses it to find the arena owning
+   an object in constant time.  */
+static struct chunk_ref_s **chunk_table;
+static size_t chunk_table_size;   /* Number of buckets; a power of 2.  */
+static size_t chunk_table_count;  /* Number of entries.  */
+
+/* The arena used by kbarena_alloc or NULL.  */
+static kbarena_t active_arena;
+
+
+
+static size_t
+page_of (const void *p)
+{
+  return (size_t)((uintptr_t)p >> CHUNK_SHIFT);
+}
+
+
+/* Return the page of the chunk table entry REF.  */
+static size_t
+page_of_ref (struct chunk_ref_s *ref)
+{
+  kbarena_chunk_t chunk = ref->chunk;
+
+  if (ref == &chunk->ref[0])
+    return page_of (chunk->u.data);
+  else
+    return page_of (chunk->u.data + CHUNK_SIZE - 1);
+}
+
+
+/* Move the entries of the chunk table to a table of NEWSIZE buckets.
+   Returns 0 on success.  */
+static int
+resize_chunk_table (size_t newsize)
+{
+  struct chunk_ref_s **newtable, *ref, *next;
+  size_t i, idx;
+
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return -1;
+  for (i = 0; i < chunk_table_size; i++)
+    for (ref = chunk_table[i]; ref; ref = next)
+      {
+        next = ref->next;
+        idx = page_of_ref (ref) & (newsize - 1);
+        ref->next = newtable[idx];
+        newtable[idx] = ref;
+      }
+  xfree (chunk_table);
+  chunk_table = newtable;
+  chunk_table_size = newsize;
+  return 0;
+}
+
+
+/* Enter CHUNK into the chunk table.  Returns 0 on success.  */
+static int
+register_chunk (kbarena_chunk_t chunk)
+{
+  size_t page[2], idx;
+  int i;
+
+  if (chunk_table_count + 2 > 2 * chunk_table_size
+      && resize_chunk_table (chunk_table_size? 2 * chunk_table_size
+                             : FIRST_TABLE_SIZE))
+    return -1;
+
+  page[0] = page_of (chunk->u.data);
+  page[1] = page_of (chunk->u.data + CHUNK_SIZE - 1);
+  for (i = 0; i < 2; i++)
+    {
+      chunk->ref[i].chunk = chunk;
+      chunk->ref[i].next = NULL;
+      if (i && page[1] == page[0])
+        continue;
+      idx = page[i] & (chunk_table_size - 1);
+      chunk->ref[i].next = chunk_table[idx];
+      chunk_table[idx] = &chunk->ref[i];
+      chunk_table_count++;
+    }
+  return 0;
+}
+
+
+/* Remove CHUNK from the chunk table.  */
+static void
+unregister_chunk (kbarena_chunk_t chunk)
+{
+  struct chunk_ref_s **refp;
+  size_t page[2];
+  int i;
+
+  page[0] = page_of (chunk->u.data);
+  page[1] = page_of (chunk->u.data + CHUNK_SIZE - 1);
+  for (i = 0; i < 2; i++)
+    {
+      if (i && page[1] == page[0])
+        continue;
+      for (refp = &chunk_table[page[i] & (chunk_table_size - 1)];
+           *refp; refp = &(*refp)->next)
+        if (*refp == &chunk->ref[i])
+          {
+            *refp = chunk->ref[i].next;
+            chunk_table_count--;
+            break;
+          }
+    }
+}
+
+
+/* Create a new arena.  The arena is not used before it has been
+   activated with kbarena_activate.  */
+kbarena_t
+kbarena_new (void)
+{
+  kbarena_t arena;
+
+  arena = xcalloc (1, sizeof *arena);
+  arena->refcount = 1;
+  return arena;
+}
+
+
+static void
+unref_arena (kbarena_t arena)
+{
+  kbarena_chunk_t chunk, next;
+
+  assert (arena->refcount);
+  if (--arena->refcount)
+    return;
+
+  assert (arena != active_arena);
+  for (chunk = arena->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      unregister_chunk (chunk);
+      xfree (chunk);
+    }
+  xfree (arena);
+}
+
+
+/* Drop the creator's reference of ARENA.  The memory is released as
+   soon as all objects allocated from it have been freed.  Passing
+   NULL is allowed.  */
+void
+kbarena_release (kbarena_t arena)
+{
+  if (arena)
+    unref_arena (arena);
+}
+
+
+/* Make ARENA the arena used by kbarena_alloc and return the
+   previously active arena.  Passing NULL deactivates the arena; this
+   must be done before the arena is released.  */
+kbarena_t
+kbarena_activate (kbarena_t arena)
+{
+  kbarena_t old = active_arena;
+
+  active_arena = arena;
+  return old;
+}
+
+
+/* Allocate N bytes of cleared memory.  The memory is taken from the
+   active arena if there is one and from the heap otherwise.  It must
+   be freed using kbarena_free.  Returns NULL and sets ERRNO on
+   error.  */
+void *
+kbarena_tryalloc (size_t n)
+{
+  kbarena_t arena = active_arena;
+  kbarena_chunk_t chunk;
+  void *p;
+
+  if (!arena || n > MAX_OBJECT_SIZE)
+    return xtrycalloc (1, n);
+
+  n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  chunk = arena->chunks;
+  if (!chunk || CHUNK_SIZE - chunk->used < n)
+    {
+      chunk = xtrymalloc (sizeof *chunk);
+      if (!chunk)
+        return NULL;
+      if (register_chunk (chunk))
+        {
+          xfree (chunk);
+          return NULL;
+        }
+      chunk->arena = arena;
+      chunk->used = 0;
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+    }
+
+  p = chunk->u.data + chunk->used;
+  chunk->used += n;
+  arena->refcount++;
+  memset (p, 0, n);
+  return p;
+}
+
+
+/* Same as kbarena_tryalloc but terminates the process on error.  */
+void *
+kbarena_alloc (size_t n)
+{
+  void *p = kbarena_tryalloc (n);
+
+  if (!p)
+    log_fatal ("kbarena_alloc: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+  return p;
+}
+
+
+/* Return the arena owning P or NULL if P is not arena memory.  */
+static kbarena_t
+find_owner (const void *p)
+{
+  const unsigned char *s = p;
+  struct chunk_ref_s *ref;
+
+  if (!chunk_table_count)
+    return NULL;
+
+  for (ref = chunk_table[page_of (p) & (chunk_table_size - 1)];
+       ref; ref = ref->next)
+    if (s >= ref->chunk->u.data && s < ref->chunk->u.data + ref->chunk->used)
+      return ref->chunk->arena;
+
+  return NULL;
+}
+
+
+/* Free P which has been allocated with kbarena_alloc or with one of
+   the standard allocation functions.  Passing NULL is allowed.  */
+void
+kbarena_free (void *p)
+{
+  kbarena_t arena;
+
+  if (!p)
+    return;
+
+  arena = find_owner (p);
+  if (arena)
+    unref_arena (arena);
+  else
+    xfree (p);
+}
+
+
+/* Return true if P has been allocated from an arena.  */
+int
+kbarena_owned_p (const void *p)
+{
+  return p && find_owner (p);
+}
@@ -119,7 +119,7 @@ release_kbnode( KBNODE n )
 	n2 = n->next;
 	if( !is_cloned_kbnode(n) ) {
 	    free_packet( n->pkt );
-	    xfree( n->pkt );
+	    kbarena_free( n->pkt );
 	}
 	free_node( n );
 	n = n2;
@@ -290,7 +290,7 @@ commit_kbnode( KBNODE *root )
 		nl->next = n->next;
 	    if( !is_cloned_kbnode(n) ) {
 		free_packet( n->pkt );
-		xfree( n->pkt );
+		kbarena_free( n->pkt );
 	    }
 	    free_node( n );
 	    changed = 1;
@@ -314,7 +314,7 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		nl->next = n->next;
 	    if( !is_cloned_kbnode(n) ) {
 		free_packet( n->pkt );
-		xfree( n->pkt );
+		kbarena_free( n->pkt );
 	    }
 	    free_node( n );
 	}
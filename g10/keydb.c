@@ -27,6 +27,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
 
 #include "gpg.h"
 #include "util.h"
@@ -90,6 +93,10 @@ struct keydb_handle
      / keybox_lock, as appropriate).  */
   int locked;
 
+  /* If set the lock taken by keydb_lock is kept until the handle is
+     released; this is used to group several updates.  */
+  int keep_lock;
+
   /* The index into ACTIVE of the resources in which the last search
      result was found.  Initially -1.  */
   int found;
@@ -105,6 +112,10 @@ struct keydb_handle
   /* If set, this disables the use of the keyblock cache.  */
   int no_caching;
 
+  /* If set, the packets of each keyblock returned by
+     keydb_get_keyblock are allocated from an arena.  */
+  int use_arena;
+
   /* Whether the next search will be from the beginning of the
      database (and thus consider all records).  */
   int is_reset;
@@ -237,6 +248,14 @@ kid_not_found_flush (void)
 }
 
 
+/* For documentation see keydb.h.  */
+void
+keydb_flush_caches (void)
+{
+  kid_not_found_flush ();
+}
+
+
 static void
 keyblock_cache_clear (struct keydb_handle *hd)
 {
@@ -710,8 +729,26 @@ keydb_add_resource (const char *url, unsigned int flags)
                 all_resources[used_resources].u.kb = NULL; /* Not used here */
                 all_resources[used_resources].token = token;
 
-                /* FIXME: Do a compress run if needed and no other
-                   user is currently using the keybox. */
+                /* Do a compress run if needed and the file is not
+                   locked.  This reclaims the space of the blobs
+                   replaced by keybox_update_keyblock.  */
+                if (!read_only)
+                  {
+                    dotlock_t lockhd = dotlock_create (filename, 0);
+
+                    if (lockhd && !dotlock_take (lockhd, 0))
+                      {
+                        KEYBOX_HANDLE kbxhd = keybox_new_openpgp (token, 0);
+
+                        if (kbxhd)
+                          {
+                            keybox_compress (kbxhd);
+                            keybox_release (kbxhd);
+                          }
+                        dotlock_release (lockhd);
+                      }
+                    dotlock_destroy (lockhd);
+                  }
 
                 used_resources++;
               }
@@ -846,6 +883,33 @@ keydb_disable_caching (KEYDB_HANDLE hd)
 }
 
 
+void
+keydb_enable_arena (KEYDB_HANDLE hd)
+{
+  if (hd)
+    hd->use_arena = 1;
+}
+
+
+/* Take the lock on all writable resources of HD and keep it until
+   the handle is released.  Subsequent updates, inserts and deletes
+   using HD do not lock and unlock the resources again.  */
+gpg_error_t
+keydb_lock (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  err = lock_all (hd);
+  if (!err)
+    hd->keep_lock = 1;
+
+  return err;
+}
+
+
 const char *
 keydb_get_resource_name (KEYDB_HANDLE hd)
 {
@@ -1028,7 +1092,7 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
 
   *r_keyblock = NULL;
 
-  pkt = xtrymalloc (sizeof *pkt);
+  pkt = kbarena_tryalloc (sizeof *pkt);
   if (!pkt)
     return gpg_error_from_syserror ();
   init_packet (pkt);
@@ -1149,7 +1213,7 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
       else
         *tail = node;
       tail = &node->next;
-      pkt = xtrymalloc (sizeof *pkt);
+      pkt = kbarena_tryalloc (sizeof *pkt);
       if (!pkt)
         {
           err = gpg_error_from_syserror ();
@@ -1173,21 +1237,16 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
   else
     *r_keyblock = keyblock;
   free_packet (pkt);
-  xfree (pkt);
+  kbarena_free (pkt);
   return err;
 }
 
 
-gpg_error_t
-keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
+static gpg_error_t
+get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 {
   gpg_error_t err = 0;
 
-  *ret_kb = NULL;
-
-  if (!hd)
-    return gpg_error (GPG_ERR_INV_ARG);
-
   if (DBG_CLOCK)
     log_clock ("keydb_get_keybock enter");
 
@@ -1266,6 +1325,31 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 }
 
 
+gpg_error_t
+keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
+{
+  gpg_error_t err;
+  kbarena_t arena, old_arena;
+
+  *ret_kb = NULL;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (!hd->use_arena)
+    return get_keyblock (hd, ret_kb);
+
+  /* The arena is kept alive by the packets allocated from it; we
+     can drop our reference right away.  */
+  arena = kbarena_new ();
+  old_arena = kbarena_activate (arena);
+  err = get_keyblock (hd, ret_kb);
+  kbarena_activate (old_arena);
+  kbarena_release (arena);
+  return err;
+}
+
+
 /* Build a keyblock image from KEYBLOCK.  Returns 0 on success and
    only then stores a new iobuf object at R_IOBUF and a signature
    status vecotor at R_SIGSTATUS.  */
@@ -1373,9 +1457,12 @@ keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (opt.dry_run)
     return 0;
 
-  err = lock_all (hd);
-  if (err)
-    return err;
+  if (!hd->locked)
+    {
+      err = lock_all (hd);
+      if (err)
+        return err;
+    }
 
   switch (hd->active[hd->found].type)
     {
@@ -1401,7 +1488,8 @@ keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
-  unlock_all (hd);
+  if (!hd->keep_lock)
+    unlock_all (hd);
   return err;
 }
 
@@ -1428,9 +1516,12 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   else
     return gpg_error (GPG_ERR_GENERAL);
 
-  err = lock_all (hd);
-  if (err)
-    return err;
+  if (!hd->locked)
+    {
+      err = lock_all (hd);
+      if (err)
+        return err;
+    }
 
   switch (hd->active[idx].type)
     {
@@ -1462,7 +1553,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
-  unlock_all (hd);
+  if (!hd->keep_lock)
+    unlock_all (hd);
   return err;
 }
 
@@ -1484,9 +1576,12 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (opt.dry_run)
     return 0;
 
-  rc = lock_all (hd);
-  if (rc)
-    return rc;
+  if (!hd->locked)
+    {
+      rc = lock_all (hd);
+      if (rc)
+        return rc;
+    }
 
   switch (hd->active[hd->found].type)
     {
@@ -1501,7 +1596,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       break;
     }
 
-  unlock_all (hd);
+  if (!hd->keep_lock)
+    unlock_all (hd);
   return rc;
 }
 
@@ -1814,3 +1910,269 @@ keydb_search_fpr (KEYDB_HANDLE hd, const byte *fpr)
   memcpy (desc.u.fpr, fpr, MAX_FINGERPRINT_LEN);
   return keydb_search (hd, &desc, 1, NULL);
 }
+
+
+/* The minimum number of keyblocks a worker of a parallel scan shall
+   process.  Forking for fewer keyblocks does not pay off.  The test
+   suite lowers this with --keydb-scan-min.  */
+#define SCAN_MIN_KEYBLOCKS 256
+
+#ifndef HAVE_W32_SYSTEM
+/* Write or read exactly LENGTH bytes of BUFFER to or from FD.  */
+static gpg_error_t
+pipe_xfer (int fd, void *buffer, size_t length, int do_write)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      if (do_write)
+        n = write (fd, p, length);
+      else
+        n = read (fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      if (!n)
+        return gpg_error (GPG_ERR_EOF);
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* The child part of keydb_parallel_scan.  Process COUNT keyblocks
+   starting with the keyblock following file offset OFFSET of the
+   keybox RESOURCE or, if RESOURCE is -1, with the first keyblock.
+   PREVRES is the resource name of the keyblock before the first
+   one.  Write the error code and the result to the pipe RFD and
+   terminate the process.  */
+static void
+run_scan_worker (keydb_scan_worker_t worker, void *opaque,
+                 int resource, off_t offset, const char *prevres,
+                 unsigned long count, int fd, int rfd, size_t resultlen)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE hd;
+  char *buffer;
+
+  buffer = xcalloc (1, sizeof err + resultlen);
+
+  hd = keydb_new ();
+  if (!hd)
+    err = gpg_error (GPG_ERR_GENERAL);
+  else
+    {
+      keydb_enable_arena (hd);
+      if (resource < 0)
+        err = keydb_search_first (hd);
+      else
+        {
+          err = keydb_search_reset (hd);
+          if (!err)
+            {
+              hd->current = resource;
+              err = keybox_seek (hd->active[resource].u.kb, offset);
+            }
+          if (!err)
+            err = keydb_search_next (hd);
+        }
+      if (!err)
+        err = worker (opaque, hd, count, prevres, fd, buffer + sizeof err);
+      keydb_release (hd);
+    }
+
+  es_fflush (es_stdout);
+  log_flush ();
+  memcpy (buffer, &err, sizeof err);
+  if (pipe_xfer (rfd, buffer, sizeof err + resultlen, 1))
+    _exit (2);
+  /* Do not run the atexit handlers of the parent.  */
+  _exit (0);
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+gpg_error_t
+keydb_parallel_scan (unsigned int nworkers, size_t resultlen,
+                     keydb_scan_worker_t worker, keydb_scan_merge_t merge,
+                     void *opaque)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)nworkers;
+  (void)resultlen;
+  (void)worker;
+  (void)merge;
+  (void)opaque;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else /*!HAVE_W32_SYSTEM*/
+  gpg_error_t err, err2;
+  KEYDB_HANDLE hd;
+  unsigned long total, start, n;
+  unsigned int nshards, i;
+  struct {
+    unsigned long count;   /* Number of keyblocks to process.  */
+    int resource;          /* Position of the first keyblock.  */
+    off_t offset;
+    const char *prevres;
+    estream_t fp;
+    pid_t pid;
+    int rfd;
+  } *shards;
+  char *buffer;
+  int rp[2];
+  int status;
+
+  /* The workers may not talk to the status-fd because the lines
+     would not come out in order.  Keyrings are not supported because
+     they keep their file descriptors in the iobuf cache, which would
+     be shared with the worker processes.  */
+  if (nworkers < 2 || is_status_enabled ())
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (i = 0; i < used_resources; i++)
+    if (all_resources[i].type != KEYDB_RESOURCE_TYPE_KEYBOX)
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* Count the keyblocks.  This only reads the blobs and is cheap
+     compared to parsing them.  */
+  hd = keydb_new ();
+  if (!hd)
+    return gpg_error (GPG_ERR_GENERAL);
+  total = 0;
+  for (err = keydb_search_first (hd); !err; err = keydb_search_next (hd))
+    total++;
+  keydb_release (hd);
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    return err;
+
+  nshards = total / (opt.keydb_scan_min? opt.keydb_scan_min
+                     : SCAN_MIN_KEYBLOCKS);
+  if (nshards > nworkers)
+    nshards = nworkers;
+  if (nshards < 2)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (opt.verbose > 1)
+    log_info ("processing %lu keyblocks using %u workers\n",
+              total, nshards);
+
+  shards = xtrycalloc (nshards, sizeof *shards);
+  if (!shards)
+    return gpg_error_from_syserror ();
+  buffer = xtrymalloc (sizeof err + resultlen);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (shards);
+      return err;
+    }
+
+  /* Split the keyblocks into consecutive ranges and remember the scan
+     position at the end of the keyblock preceding each range.  A
+     worker can thus seek directly to its first keyblock.  */
+  err = 0;
+  hd = keydb_new ();
+  if (!hd)
+    err = gpg_error (GPG_ERR_GENERAL);
+  n = 0;
+  for (i = 0, start = 0; !err && i < nshards; i++)
+    {
+      shards[i].count = total / nshards + (i < total % nshards);
+      shards[i].resource = -1;
+      for (; !err && n < start; n++)
+        err = n? keydb_search_next (hd) : keydb_search_first (hd);
+      if (!err && start)
+        {
+          shards[i].resource = hd->found;
+          shards[i].offset = keybox_offset (hd->active[hd->found].u.kb);
+          shards[i].prevres = keydb_get_resource_name (hd);
+        }
+      start += shards[i].count;
+    }
+  keydb_release (hd);
+  if (err)
+    {
+      log_error ("error splitting the keyblocks: %s\n", gpg_strerror (err));
+      xfree (buffer);
+      xfree (shards);
+      return err;
+    }
+
+  /* Nothing buffered may be written twice.  */
+  es_fflush (es_stdout);
+  log_flush ();
+
+  for (i = 0; i < nshards; i++)
+    {
+      shards[i].rfd = -1;
+      shards[i].fp = es_tmpfile ();
+      if (!shards[i].fp)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      if (pipe (rp))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      shards[i].pid = fork ();
+      if (shards[i].pid == (pid_t)(-1))
+        {
+          err = gpg_error_from_syserror ();
+          close (rp[0]);
+          close (rp[1]);
+          break;
+        }
+      if (!shards[i].pid)
+        {
+          close (rp[0]);
+          run_scan_worker (worker, opaque, shards[i].resource,
+                           shards[i].offset, shards[i].prevres,
+                           shards[i].count, es_fileno (shards[i].fp),
+                           rp[1], resultlen);
+        }
+      close (rp[1]);
+      shards[i].rfd = rp[0];
+    }
+  if (err)
+    log_error ("error starting a keydb worker: %s\n", gpg_strerror (err));
+
+  /* Collect the results in order.  The workers keep running while we
+     wait for the earlier ones.  */
+  for (i = 0; i < nshards && shards[i].fp; i++)
+    {
+      if (shards[i].rfd == -1)
+        break;
+
+      err2 = pipe_xfer (shards[i].rfd, buffer, sizeof err + resultlen, 0);
+      close (shards[i].rfd);
+      while (waitpid (shards[i].pid, &status, 0) == -1 && errno == EINTR)
+        ;
+      if (!err2 && !(WIFEXITED (status) && !WEXITSTATUS (status)))
+        err2 = gpg_error (GPG_ERR_GENERAL);
+      if (err2)
+        log_error ("keydb worker %u failed: %s\n", i, gpg_strerror (err2));
+      else
+        memcpy (&err2, buffer, sizeof err2);
+
+      if (!err2 && !err)
+        {
+          es_rewind (shards[i].fp);
+          err2 = merge (opaque, shards[i].fp, buffer + sizeof err);
+        }
+      if (err2 && !err)
+        err = err2;
+    }
+
+  for (i = 0; i < nshards; i++)
+    if (shards[i].fp)
+      es_fclose (shards[i].fp);
+  xfree (buffer);
+  xfree (shards);
+  return err;
+#endif /*!HAVE_W32_SYSTEM*/
+}
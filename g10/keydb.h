@@ -186,6 +186,10 @@ gpg_error_t keydb_add_resource (const char *url, unsigned int flags);
 /* Dump some statistics to the log.  */
 void keydb_dump_stats (void);
 
+/* Drop the cache of key ids which are known not to be in the
+   database.  */
+void keydb_flush_caches (void);
+
 /* Create a new database handle.  A database handle is similar to a
    file handle: it contains a local file position.  This is used when
    searching: subsequent searches resume where the previous search
@@ -200,6 +204,16 @@ void keydb_release (KEYDB_HANDLE hd);
    Using a new parameter for keydb_new might be a better solution.  */
 void keydb_disable_caching (KEYDB_HANDLE hd);
 
+/* Set a flag on the handle to allocate the packets of the keyblocks
+   returned by keydb_get_keyblock from a per-keyblock arena.  This
+   is meant for code reading many keyblocks.  */
+void keydb_enable_arena (KEYDB_HANDLE hd);
+
+/* Lock the database and keep the lock until HD is released.  This
+   is used to group a large number of updates (e.g. a bulk import)
+   under a single lock.  */
+gpg_error_t keydb_lock (KEYDB_HANDLE hd);
+
 /* Save the last found state and invalidate the current selection
    (i.e., the entry selected by keydb_search() is invalidated and
    something like keydb_get_keyblock() will return an error).  This
@@ -288,6 +302,36 @@ void keydb_rebuild_caches (int noisy);
    read from a keybox) since the last search reset.  */
 unsigned long keydb_get_skipped_counter (KEYDB_HANDLE hd);
 
+/* The worker function of a parallel scan.  HD is positioned at the
+   first keyblock of the range; the function shall process COUNT
+   keyblocks using keydb_search_next to advance.  PREVRES is the
+   resource name of the keyblock preceding the range or NULL.  The
+   output is to be written to the file descriptor FD and a summary
+   to the RESULT buffer.  */
+typedef gpg_error_t (*keydb_scan_worker_t) (void *opaque, KEYDB_HANDLE hd,
+                                            unsigned long count,
+                                            const char *prevres,
+                                            int fd, void *result);
+
+/* The merge function of a parallel scan.  It is called in the
+   original order of the ranges with the output FP and the RESULT of
+   a worker.  */
+typedef gpg_error_t (*keydb_scan_merge_t) (void *opaque, estream_t fp,
+                                           void *result);
+
+/* Process all keyblocks of the database using up to NWORKERS worker
+   processes.  The keyblocks are split into consecutive ranges which
+   are processed by WORKER in a child process each.  The results are
+   then passed to MERGE in the original order.  RESULTLEN is the size
+   of the result buffer passed to the worker and the merge functions.
+
+   Returns GPG_ERR_NOT_SUPPORTED without calling any of the functions
+   if a parallel scan is not possible or not worth it; the caller
+   shall then process the keyblocks itself.  */
+gpg_error_t keydb_parallel_scan (unsigned int nworkers, size_t resultlen,
+                                 keydb_scan_worker_t worker,
+                                 keydb_scan_merge_t merge, void *opaque);
+
 /* Clears the current search result and resets the handle's position
    so that the next search starts at the beginning of the database
    (the start of the first resource).
@@ -423,6 +467,11 @@ void cache_public_key( PKT_public_key *pk );
    to reenable this cache.  */
 void getkey_disable_caches(void);
 
+/* Drop the contents of the public key cache, the user id cache and
+   the caches of the key database.  This needs to be done if the key
+   database may have been changed by another process.  */
+void getkey_flush_caches (void);
+
 /* Return the public key with the key id KEYID and store it in *PK.
    The resources in *PK should be released using
    release_public_key_parts().  This function also stores a copy of
@@ -580,6 +629,12 @@ int get_pubkey_byfprint (PKT_public_key *pk,  kbnode_t *r_keyblock,
 int get_pubkey_byfprint_fast (PKT_public_key *pk,
                               const byte *fprint, size_t fprint_len);
 
+/* This function is similar to get_pubkey_byfprint_fast, but it
+   returns the keyblock as stored in the database at R_KEYBLOCK.  The
+   caller must free it using release_kbnode().  */
+int get_keyblock_byfprint_fast (kbnode_t *r_keyblock,
+                                const byte *fprint, size_t fprint_len);
+
 /* Return whether a secret key is available for the public key with
    key id KEYID.  This function ignores legacy keys.  Note: this is
    just a fast check and does not tell us whether the secret key is
@@ -180,7 +180,7 @@ print_and_check_one_sig_colon (KBNODE keyblock, KBNODE node,
                  sig->flags.exportable ? 'x' : 'l');
 
       if (opt.show_subpackets)
-	print_subpackets_colon (sig);
+	print_subpackets_colon (es_stdout, sig);
     }
 
   return (sigrc == '!');
@@ -277,11 +277,11 @@ print_and_check_one_sig (KBNODE keyblock, KBNODE node,
 
       if (sig->flags.policy_url
           && ((opt.list_options & LIST_SHOW_POLICY_URLS) || extended))
-	show_policy_url (sig, 3, 0);
+	show_policy_url (NULL, sig, 3, 0);
 
       if (sig->flags.notation
           && ((opt.list_options & LIST_SHOW_NOTATIONS) || extended))
-	show_notation (sig, 3, 0,
+	show_notation (NULL, sig, 3, 0,
 		       ((opt.
 			 list_options & LIST_SHOW_STD_NOTATIONS) ? 1 : 0) +
 		       ((opt.
@@ -289,7 +289,7 @@ print_and_check_one_sig (KBNODE keyblock, KBNODE node,
 
       if (sig->flags.pref_ks
           && ((opt.list_options & LIST_SHOW_KEYSERVER_URLS) || extended))
-	show_keyserver_url (sig, 3, 0);
+	show_keyserver_url (NULL, sig, 3, 0);
 
       if (extended)
         {
@@ -2325,8 +2325,9 @@ keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 }
 
 
-/* Change the passphrase of the secret key identified by USERNAME.  */
-void
+/* Change the passphrase of the secret key identified by USERNAME.
+   Returns an error code.  */
+gpg_error_t
 keyedit_passwd (ctrl_t ctrl, const char *username)
 {
   gpg_error_t err;
@@ -2356,6 +2357,7 @@ leave:
     }
   else
     write_status_text (STATUS_SUCCESS, "keyedit.passwd");
+  return err;
 }
 
 
@@ -4088,7 +4090,7 @@ menu_expire (KBNODE pub_keyblock)
 	      newpkt->pkttype = PKT_SIGNATURE;
 	      newpkt->pkt.signature = newsig;
 	      free_packet (node->pkt);
-	      xfree (node->pkt);
+	      kbarena_free (node->pkt);
 	      node->pkt = newpkt;
 	      sub_pk = NULL;
 	    }
@@ -4187,7 +4189,7 @@ menu_backsign (KBNODE pub_keyblock)
 	      newpkt->pkttype = PKT_SIGNATURE;
 	      newpkt->pkt.signature = newsig;
 	      free_packet (sig_pk->pkt);
-	      xfree (sig_pk->pkt);
+	      kbarena_free (sig_pk->pkt);
 	      sig_pk->pkt = newpkt;
 
 	      modified = 1;
@@ -4345,7 +4347,7 @@ menu_set_primary_uid (KBNODE pub_keyblock)
 		      newpkt->pkttype = PKT_SIGNATURE;
 		      newpkt->pkt.signature = newsig;
 		      free_packet (node->pkt);
-		      xfree (node->pkt);
+		      kbarena_free (node->pkt);
 		      node->pkt = newpkt;
 		      modified = 1;
 		    }
@@ -4434,7 +4436,7 @@ menu_set_preferences (KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  kbarena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 		}
@@ -4570,7 +4572,7 @@ menu_set_keyserver_url (const char *url, KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  kbarena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 		}
@@ -4771,7 +4773,7 @@ menu_set_notation (const char *string, KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  kbarena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 
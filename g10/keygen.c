@@ -3232,11 +3232,13 @@ proc_parameter_file (ctrl_t ctrl, struct para_data_s *para, const char *fname,
 
 /****************
  * Kludge to allow non interactive key generation controlled
- * by a parameter file.
+ * by a parameter file read from FP; FNAME is only used for
+ * diagnostics.  Returns an error if the file could not be parsed or
+ * a key could not be created.
  * Note, that string parameters are expected to be in UTF-8
  */
-static void
-read_parameter_file (ctrl_t ctrl, const char *fname )
+gpg_error_t
+generate_keypair_stream (ctrl_t ctrl, iobuf_t fp, const char *fname)
 {
     static struct { const char *name;
 		    enum para_name key;
@@ -3261,7 +3263,6 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
 	{ "Keyserver",      pKEYSERVER },
 	{ NULL, 0 }
     };
-    IOBUF fp;
     byte *line;
     unsigned int maxlen, nline;
     char *p;
@@ -3270,26 +3271,11 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
     struct para_data_s *para, *r;
     int i;
     struct output_control_s outctrl;
+    gpg_error_t rc = 0;
 
     memset( &outctrl, 0, sizeof( outctrl ) );
     outctrl.pub.afx = new_armor_context ();
 
-    if( !fname || !*fname)
-      fname = "-";
-
-    fp = iobuf_open (fname);
-    if (fp && is_secured_file (iobuf_get_fd (fp)))
-      {
-        iobuf_close (fp);
-        fp = NULL;
-        gpg_err_set_errno (EPERM);
-      }
-    if (!fp) {
-      log_error (_("can't open '%s': %s\n"), fname, strerror(errno) );
-      return;
-    }
-    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
-
     lnr = 0;
     err = NULL;
     para = NULL;
@@ -3332,8 +3318,11 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
 	    else if( !ascii_strcasecmp( keyword, "%commit" ) ) {
 		outctrl.lnr = lnr;
 		if (proc_parameter_file (ctrl, para, fname, &outctrl, 0 ))
-                  print_status_key_not_created
-                    (get_parameter_value (para, pHANDLE));
+                  {
+                    print_status_key_not_created
+                      (get_parameter_value (para, pHANDLE));
+                    rc = gpg_error (GPG_ERR_GENERAL);
+                  }
 		release_parameter_list( para );
 		para = NULL;
 	    }
@@ -3388,8 +3377,11 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
 	if( keywords[i].key == pKEYTYPE && para ) {
 	    outctrl.lnr = lnr;
 	    if (proc_parameter_file (ctrl, para, fname, &outctrl, 0 ))
-              print_status_key_not_created
-                (get_parameter_value (para, pHANDLE));
+              {
+                print_status_key_not_created
+                  (get_parameter_value (para, pHANDLE));
+                rc = gpg_error (GPG_ERR_GENERAL);
+              }
 	    release_parameter_list( para );
 	    para = NULL;
 	}
@@ -3410,15 +3402,20 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
 	r->next = para;
 	para = r;
     }
-    if( err )
+    if( err ) {
 	log_error("%s:%d: %s\n", fname, lnr, err );
+        rc = gpg_error (GPG_ERR_GENERAL);
+    }
     else if( iobuf_error (fp) ) {
 	log_error("%s:%d: read error\n", fname, lnr);
+        rc = iobuf_error (fp);
     }
     else if( para ) {
 	outctrl.lnr = lnr;
-	if (proc_parameter_file (ctrl, para, fname, &outctrl, 0 ))
+	if (proc_parameter_file (ctrl, para, fname, &outctrl, 0 )) {
           print_status_key_not_created (get_parameter_value (para, pHANDLE));
+          rc = gpg_error (GPG_ERR_GENERAL);
+        }
     }
 
     if( outctrl.use_files ) { /* close open streams */
@@ -3434,8 +3431,36 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
     }
 
     release_parameter_list( para );
-    iobuf_close (fp);
     release_armor_context (outctrl.pub.afx);
+    return rc;
+}
+
+
+/* Read the key generation parameters from the file FNAME.  */
+static void
+read_parameter_file (ctrl_t ctrl, const char *fname )
+{
+  iobuf_t fp;
+
+  if (!fname || !*fname)
+    fname = "-";
+
+  fp = iobuf_open (fname);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      log_error (_("can't open '%s': %s\n"), fname, strerror(errno) );
+      return;
+    }
+  iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+
+  generate_keypair_stream (ctrl, fp, fname);
+  iobuf_close (fp);
 }
 
 
@@ -47,11 +47,11 @@
 #include "tofu.h"
 
 
-static void list_all (ctrl_t, int, int);
-static void list_one (ctrl_t ctrl,
-                      strlist_t names, int secret, int mark_secret);
-static void locate_one (ctrl_t ctrl, strlist_t names);
-static void print_card_serialno (const char *serialno);
+static void list_all (ctrl_t, int, int, estream_t);
+static void list_one (ctrl_t ctrl, strlist_t names, int secret,
+                      int mark_secret, estream_t fp);
+static void locate_one (ctrl_t ctrl, strlist_t names, estream_t fp);
+static void print_card_serialno (estream_t fp, const char *serialno);
 
 struct keylist_context
 {
@@ -65,7 +65,8 @@ struct keylist_context
 
 static void list_keyblock (ctrl_t ctrl,
                            kbnode_t keyblock, int secret, int has_secret,
-                           int fpr, struct keylist_context *listctx);
+                           int fpr, struct keylist_context *listctx,
+                           estream_t fp);
 
 
 /* The stream used to write attribute packets to.  */
@@ -84,7 +85,7 @@ keylist_context_release (struct keylist_context *listctx)
    With LOCATE_MODE set the locate algorithm is used to find a
    key.  */
 void
-public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
+public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode, estream_t fp)
 {
 #ifndef NO_TRUST_MODELS
   if (opt.with_colons)
@@ -95,34 +96,34 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
       read_trust_options (&trust_model, &created, &nextcheck,
 			  &marginals, &completes, &cert_depth, &min_cert_level);
 
-      es_fprintf (es_stdout, "tru:");
+      es_fprintf (fp, "tru:");
 
       if (nextcheck && nextcheck <= make_timestamp ())
-	es_fprintf (es_stdout, "o");
+	es_fprintf (fp, "o");
       if (trust_model != opt.trust_model)
-	es_fprintf (es_stdout, "t");
+	es_fprintf (fp, "t");
       if (opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
 	  || opt.trust_model == TM_TOFU_PGP)
 	{
 	  if (marginals != opt.marginals_needed)
-	    es_fprintf (es_stdout, "m");
+	    es_fprintf (fp, "m");
 	  if (completes != opt.completes_needed)
-	    es_fprintf (es_stdout, "c");
+	    es_fprintf (fp, "c");
 	  if (cert_depth != opt.max_cert_depth)
-	    es_fprintf (es_stdout, "d");
+	    es_fprintf (fp, "d");
 	  if (min_cert_level != opt.min_cert_level)
-	    es_fprintf (es_stdout, "l");
+	    es_fprintf (fp, "l");
 	}
 
-      es_fprintf (es_stdout, ":%d:%lu:%lu", trust_model, created, nextcheck);
+      es_fprintf (fp, ":%d:%lu:%lu", trust_model, created, nextcheck);
 
       /* Only show marginals, completes, and cert_depth in the classic
          or PGP trust models since they are not meaningful
          otherwise. */
 
       if (trust_model == TM_PGP || trust_model == TM_CLASSIC)
-	es_fprintf (es_stdout, ":%d:%d:%d", marginals, completes, cert_depth);
-      es_fprintf (es_stdout, "\n");
+	es_fprintf (fp, ":%d:%d:%d", marginals, completes, cert_depth);
+      es_fprintf (fp, "\n");
     }
 #endif /*!NO_TRUST_MODELS*/
 
@@ -138,11 +139,11 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
 #endif
 
   if (locate_mode)
-    locate_one (ctrl, list);
+    locate_one (ctrl, list, fp);
   else if (!list)
-    list_all (ctrl, 0, opt.with_secret);
+    list_all (ctrl, 0, opt.with_secret, fp);
   else
-    list_one (ctrl, list, 0, opt.with_secret);
+    list_one (ctrl, list, 0, opt.with_secret, fp);
 
 #ifdef USE_TOFU
   tofu_end_batch_update ();
@@ -151,16 +152,16 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
 
 
 void
-secret_key_list (ctrl_t ctrl, strlist_t list)
+secret_key_list (ctrl_t ctrl, strlist_t list, estream_t fp)
 {
   (void)ctrl;
 
   check_trustdb_stale ();
 
   if (!list)
-    list_all (ctrl, 1, 0);
+    list_all (ctrl, 1, 0, fp);
   else				/* List by user id */
-    list_one (ctrl, list, 1, 0);
+    list_one (ctrl, list, 1, 0, fp);
 }
 
 char *
@@ -304,17 +305,21 @@ status_one_subpacket (sigsubpkttype_t type, size_t len, int flags,
 
 
 /* Print a policy URL.  Allowed values for MODE are:
- *   0 - print to stdout.
+ *   0 - print to FP or to stdout if FP is NULL.
  *   1 - use log_info and emit status messages.
  *   2 - emit only status messages.
  */
 void
-show_policy_url (PKT_signature * sig, int indent, int mode)
+show_policy_url (estream_t fp, PKT_signature *sig, int indent, int mode)
 {
   const byte *p;
   size_t len;
   int seq = 0, crit;
-  estream_t fp = mode ? log_get_stream () : es_stdout;
+
+  if (mode)
+    fp = log_get_stream ();
+  else if (!fp)
+    fp = es_stdout;
 
   while ((p =
 	  enum_sig_subpkt (sig->hashed, SIGSUBPKT_POLICY, &len, &seq, &crit)))
@@ -346,18 +351,22 @@ show_policy_url (PKT_signature * sig, int indent, int mode)
 
 
 /*
-  mode=0 for stdout.
+  mode=0 for FP or stdout if FP is NULL.
   mode=1 for log_info + status messages
   mode=2 for status messages only
 */
 /* TODO: use this */
 void
-show_keyserver_url (PKT_signature * sig, int indent, int mode)
+show_keyserver_url (estream_t fp, PKT_signature *sig, int indent, int mode)
 {
   const byte *p;
   size_t len;
   int seq = 0, crit;
-  estream_t fp = mode ? log_get_stream () : es_stdout;
+
+  if (mode)
+    fp = log_get_stream ();
+  else if (!fp)
+    fp = es_stdout;
 
   while ((p =
 	  enum_sig_subpkt (sig->hashed, SIGSUBPKT_PREF_KS, &len, &seq,
@@ -369,7 +378,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 	  const char *str;
 
 	  for (i = 0; i < indent; i++)
-	    es_putc (' ', es_stdout);
+	    es_putc (' ', fp);
 
 	  if (crit)
 	    str = _("Critical preferred keyserver: ");
@@ -378,7 +387,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 	  if (mode)
 	    log_info ("%s", str);
 	  else
-	    es_fprintf (es_stdout, "%s", str);
+	    es_fprintf (fp, "%s", str);
 	  print_utf8_buffer (fp, p, len);
 	  es_fprintf (fp, "\n");
 	}
@@ -390,7 +399,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 }
 
 /*
-  mode=0 for stdout.
+  mode=0 for FP or stdout if FP is NULL.
   mode=1 for log_info + status messages
   mode=2 for status messages only
 
@@ -399,11 +408,16 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
     2 == user notations
 */
 void
-show_notation (PKT_signature * sig, int indent, int mode, int which)
+show_notation (estream_t fp, PKT_signature *sig, int indent, int mode,
+               int which)
 {
-  estream_t fp = mode ? log_get_stream () : es_stdout;
   struct notation *nd, *notations;
 
+  if (mode)
+    fp = log_get_stream ();
+  else if (!fp)
+    fp = es_stdout;
+
   if (which == 0)
     which = 3;
 
@@ -422,7 +436,7 @@ show_notation (PKT_signature * sig, int indent, int mode, int which)
 	      const char *str;
 
 	      for (i = 0; i < indent; i++)
-		es_putc (' ', es_stdout);
+		es_putc (' ', fp);
 
 	      if (nd->flags.critical)
 		str = _("Critical signature notation: ");
@@ -431,7 +445,7 @@ show_notation (PKT_signature * sig, int indent, int mode, int which)
 	      if (mode)
 		log_info ("%s", str);
 	      else
-		es_fprintf (es_stdout, "%s", str);
+		es_fprintf (fp, "%s", str);
 	      /* This is all UTF8 */
 	      print_utf8_buffer (fp, nd->name, strlen (nd->name));
 	      es_fprintf (fp, "=");
@@ -486,36 +500,19 @@ print_signature_stats (struct keylist_context *s)
 }
 
 
-/* List all keys.  If SECRET is true only secret keys are listed.  If
-   MARK_SECRET is true secret keys are indicated in a public key
-   listing.  */
-static void
-list_all (ctrl_t ctrl, int secret, int mark_secret)
+/* List COUNT keyblocks or, if COUNT is 0, all keyblocks starting at
+   the current position of HD.  LASTRESNAME is the resource name of
+   the previously listed keyblock.  */
+static gpg_error_t
+list_all_range (ctrl_t ctrl, KEYDB_HANDLE hd, unsigned long count,
+                int secret, int mark_secret, const char *lastresname,
+                struct keylist_context *listctx, estream_t fp)
 {
-  KEYDB_HANDLE hd;
+  gpg_error_t rc;
   KBNODE keyblock = NULL;
-  int rc = 0;
   int any_secret;
-  const char *lastresname, *resname;
-  struct keylist_context listctx;
-
-  memset (&listctx, 0, sizeof (listctx));
-  if (opt.check_sigs)
-    listctx.check_sigs = 1;
-
-  hd = keydb_new ();
-  if (!hd)
-    rc = gpg_error (GPG_ERR_GENERAL);
-  else
-    rc = keydb_search_first (hd);
-  if (rc)
-    {
-      if (gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
-	log_error ("keydb_search_first failed: %s\n", gpg_strerror (rc));
-      goto leave;
-    }
+  const char *resname;
 
-  lastresname = NULL;
   do
     {
       rc = keydb_get_keyblock (hd, &keyblock);
@@ -524,7 +521,7 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
           if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
             continue;  /* Skip legacy keys.  */
 	  log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
-	  goto leave;
+	  return rc;
 	}
 
       if (secret || mark_secret)
@@ -543,40 +540,189 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
                 {
                   int i;
 
-                  es_fprintf (es_stdout, "%s\n", resname);
+                  es_fprintf (fp, "%s\n", resname);
                   for (i = strlen (resname); i; i--)
-                    es_putc ('-', es_stdout);
-                  es_putc ('\n', es_stdout);
+                    es_putc ('-', fp);
+                  es_putc ('\n', fp);
                   lastresname = resname;
                 }
             }
           merge_keys_and_selfsig (keyblock);
           list_keyblock (ctrl, keyblock, secret, any_secret, opt.fingerprint,
-                         &listctx);
+                         listctx, fp);
         }
       release_kbnode (keyblock);
       keyblock = NULL;
     }
-  while (!(rc = keydb_search_next (hd)));
-  es_fflush (es_stdout);
+  while (--count && !(rc = keydb_search_next (hd)));
+
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
-    log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
-  if (keydb_get_skipped_counter (hd))
+    {
+      log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
+      return rc;
+    }
+  return 0;
+}
+
+
+/* The result of a list_all worker.  */
+struct list_all_result_s
+{
+  unsigned long skipped;
+  struct keylist_context listctx;
+};
+
+/* The parameters for a parallel list_all.  */
+struct list_all_parm_s
+{
+  ctrl_t ctrl;
+  estream_t fp;
+  struct list_all_result_s total;
+};
+
+
+/* The worker function for a parallel list_all.  */
+static gpg_error_t
+list_all_worker (void *opaque, KEYDB_HANDLE hd, unsigned long count,
+                 const char *prevres, int fd, void *result)
+{
+  struct list_all_parm_s *parm = opaque;
+  struct list_all_result_s *res = result;
+  gpg_error_t err;
+
+  /* We are running in a forked process: Write the listing to the
+     worker's file and do not share the trustdb file offset.  */
+  if (dup2 (fd, es_fileno (es_stdout)) == -1)
+    return gpg_error_from_syserror ();
+  reopen_trustdb ();
+
+  res->listctx.check_sigs = opt.check_sigs;
+  err = list_all_range (parm->ctrl, hd, count, 0, 0, prevres,
+                        &res->listctx, es_stdout);
+  res->skipped = keydb_get_skipped_counter (hd);
+  es_fflush (es_stdout);
+  return err;
+}
+
+
+/* The merge function for a parallel list_all.  */
+static gpg_error_t
+list_all_merge (void *opaque, estream_t fp, void *result)
+{
+  struct list_all_parm_s *parm = opaque;
+  struct list_all_result_s *res = result;
+  char buffer[4096];
+  size_t nread;
+
+  while (!es_read (fp, buffer, sizeof buffer, &nread) && nread)
+    es_write (parm->fp, buffer, nread, NULL);
+  if (es_ferror (fp))
+    return gpg_error_from_syserror ();
+
+  parm->total.skipped += res->skipped;
+  parm->total.listctx.good_sigs += res->listctx.good_sigs;
+  parm->total.listctx.inv_sigs  += res->listctx.inv_sigs;
+  parm->total.listctx.no_key    += res->listctx.no_key;
+  parm->total.listctx.oth_err   += res->listctx.oth_err;
+  return 0;
+}
+
+
+/* List all public keys using worker processes.  On success the
+   number of skipped keyblocks is stored at R_SKIPPED and the
+   signature counters are added to LISTCTX.  Returns
+   GPG_ERR_NOT_SUPPORTED if a parallel listing is not possible.  */
+static gpg_error_t
+list_all_parallel (ctrl_t ctrl, struct keylist_context *listctx,
+                   unsigned long *r_skipped, estream_t fp)
+{
+  gpg_error_t err;
+  struct list_all_parm_s parm;
+
+  /* TOFU uses an SQLite database which may not be shared with forked
+     processes; photo viewers and the attribute-fd would not see the
+     keys in order.  */
+  if (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP
+      || (opt.list_options & LIST_SHOW_PHOTOS) || attrib_fp)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.fp = fp;
+  err = keydb_parallel_scan (opt.keydb_jobs, sizeof (struct list_all_result_s),
+                             list_all_worker, list_all_merge, &parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    return err;
+
+  *r_skipped = parm.total.skipped;
+  listctx->good_sigs += parm.total.listctx.good_sigs;
+  listctx->inv_sigs  += parm.total.listctx.inv_sigs;
+  listctx->no_key    += parm.total.listctx.no_key;
+  listctx->oth_err   += parm.total.listctx.oth_err;
+  return err;
+}
+
+
+/* List all keys.  If SECRET is true only secret keys are listed.  If
+   MARK_SECRET is true secret keys are indicated in a public key
+   listing.  */
+static void
+list_all (ctrl_t ctrl, int secret, int mark_secret, estream_t fp)
+{
+  KEYDB_HANDLE hd = NULL;
+  gpg_error_t rc = 0;
+  unsigned long skipped = 0;
+  struct keylist_context listctx;
+
+  memset (&listctx, 0, sizeof (listctx));
+  if (opt.check_sigs)
+    listctx.check_sigs = 1;
+
+  if (opt.keydb_jobs > 1 && !secret && !mark_secret)
+    {
+      rc = list_all_parallel (ctrl, &listctx, &skipped, fp);
+      if (gpg_err_code (rc) != GPG_ERR_NOT_SUPPORTED)
+        goto stats;
+    }
+
+  hd = keydb_new ();
+  if (!hd)
+    rc = gpg_error (GPG_ERR_GENERAL);
+  else
+    {
+      keydb_enable_arena (hd);
+      rc = keydb_search_first (hd);
+    }
+  if (rc)
+    {
+      if (gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
+	log_error ("keydb_search_first failed: %s\n", gpg_strerror (rc));
+      goto leave;
+    }
+
+  rc = list_all_range (ctrl, hd, 0, secret, mark_secret, NULL, &listctx, fp);
+  skipped = keydb_get_skipped_counter (hd);
+  keydb_release (hd);
+  hd = NULL;
+
+ stats:
+  es_fflush (fp);
+  if (skipped)
     log_info (_("Warning: %lu key(s) skipped due to their large size\n"),
-              keydb_get_skipped_counter (hd));
+              skipped);
 
   if (opt.check_sigs && !opt.with_colons)
     print_signature_stats (&listctx);
 
  leave:
   keylist_context_release (&listctx);
-  release_kbnode (keyblock);
   keydb_release (hd);
 }
 
 
 static void
-list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
+list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret,
+          estream_t fp)
 {
   int rc = 0;
   KBNODE keyblock = NULL;
@@ -612,13 +758,13 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
       if ((opt.list_options & LIST_SHOW_KEYRING) && !opt.with_colons)
         {
           resname = keydb_get_resource_name (get_ctx_handle (ctx));
-          es_fprintf (es_stdout, "%s: %s\n", keyring_str, resname);
+          es_fprintf (fp, "%s: %s\n", keyring_str, resname);
           for (i = strlen (resname) + strlen (keyring_str) + 2; i; i--)
-            es_putc ('-', es_stdout);
-          es_putc ('\n', es_stdout);
+            es_putc ('-', fp);
+          es_putc ('\n', fp);
         }
-      list_keyblock (ctrl,
-                     keyblock, secret, mark_secret, opt.fingerprint, &listctx);
+      list_keyblock (ctrl, keyblock, secret, mark_secret, opt.fingerprint,
+                     &listctx, fp);
       release_kbnode (keyblock);
     }
   while (!getkey_next (ctx, NULL, &keyblock));
@@ -632,7 +778,7 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
 
 
 static void
-locate_one (ctrl_t ctrl, strlist_t names)
+locate_one (ctrl_t ctrl, strlist_t names, estream_t fp)
 {
   int rc = 0;
   strlist_t sl;
@@ -659,7 +805,7 @@ locate_one (ctrl_t ctrl, strlist_t names)
 	{
 	  do
 	    {
-	      list_keyblock (ctrl, keyblock, 0, 0, opt.fingerprint, &listctx);
+	      list_keyblock (ctrl, keyblock, 0, 0, opt.fingerprint, &listctx, fp);
 	      release_kbnode (keyblock);
 	    }
 	  while (ctx && !getkey_next (ctx, NULL, &keyblock));
@@ -676,35 +822,35 @@ locate_one (ctrl_t ctrl, strlist_t names)
 
 
 static void
-print_key_data (PKT_public_key * pk)
+print_key_data (estream_t fp, PKT_public_key *pk)
 {
   int n = pk ? pubkey_get_npkey (pk->pubkey_algo) : 0;
   int i;
 
   for (i = 0; i < n; i++)
     {
-      es_fprintf (es_stdout, "pkd:%d:%u:", i, mpi_get_nbits (pk->pkey[i]));
-      mpi_print (es_stdout, pk->pkey[i], 1);
-      es_putc (':', es_stdout);
-      es_putc ('\n', es_stdout);
+      es_fprintf (fp, "pkd:%d:%u:", i, mpi_get_nbits (pk->pkey[i]));
+      mpi_print (fp, pk->pkey[i], 1);
+      es_putc (':', fp);
+      es_putc ('\n', fp);
     }
 }
 
 static void
-print_capabilities (PKT_public_key *pk, KBNODE keyblock)
+print_capabilities (estream_t fp, PKT_public_key *pk, KBNODE keyblock)
 {
   unsigned int use = pk->pubkey_usage;
   int c_printed = 0;
 
   if (use & PUBKEY_USAGE_ENC)
-    es_putc ('e', es_stdout);
+    es_putc ('e', fp);
 
   if (use & PUBKEY_USAGE_SIG)
     {
-      es_putc ('s', es_stdout);
+      es_putc ('s', fp);
       if (pk->flags.primary)
         {
-          es_putc ('c', es_stdout);
+          es_putc ('c', fp);
           /* The PUBKEY_USAGE_CERT flag was introduced later and we
              used to always print 'c' for a primary key.  To avoid any
              regression here we better track whether we printed 'c'
@@ -714,13 +860,13 @@ print_capabilities (PKT_public_key *pk, KBNODE keyblock)
     }
 
   if ((use & PUBKEY_USAGE_CERT) && !c_printed)
-    es_putc ('c', es_stdout);
+    es_putc ('c', fp);
 
   if ((use & PUBKEY_USAGE_AUTH))
-    es_putc ('a', es_stdout);
+    es_putc ('a', fp);
 
   if ((use & PUBKEY_USAGE_UNKNOWN))
-    es_putc ('?', es_stdout);
+    es_putc ('?', fp);
 
   if (keyblock)
     {
@@ -756,46 +902,46 @@ print_capabilities (PKT_public_key *pk, KBNODE keyblock)
 	    }
 	}
       if (enc)
-	es_putc ('E', es_stdout);
+	es_putc ('E', fp);
       if (sign)
-	es_putc ('S', es_stdout);
+	es_putc ('S', fp);
       if (cert)
-	es_putc ('C', es_stdout);
+	es_putc ('C', fp);
       if (auth)
-	es_putc ('A', es_stdout);
+	es_putc ('A', fp);
       if (disabled)
-	es_putc ('D', es_stdout);
+	es_putc ('D', fp);
     }
 
-  es_putc (':', es_stdout);
+  es_putc (':', fp);
 }
 
 
 /* FLAGS: 0x01 hashed
           0x02 critical  */
 static void
-print_one_subpacket (sigsubpkttype_t type, size_t len, int flags,
+print_one_subpacket (estream_t fp, sigsubpkttype_t type, size_t len, int flags,
 		     const byte * buf)
 {
   size_t i;
 
-  es_fprintf (es_stdout, "spk:%d:%u:%u:", type, flags, (unsigned int) len);
+  es_fprintf (fp, "spk:%d:%u:%u:", type, flags, (unsigned int) len);
 
   for (i = 0; i < len; i++)
     {
       /* printable ascii other than : and % */
       if (buf[i] >= 32 && buf[i] <= 126 && buf[i] != ':' && buf[i] != '%')
-	es_fprintf (es_stdout, "%c", buf[i]);
+	es_fprintf (fp, "%c", buf[i]);
       else
-	es_fprintf (es_stdout, "%%%02X", buf[i]);
+	es_fprintf (fp, "%%%02X", buf[i]);
     }
 
-  es_fprintf (es_stdout, "\n");
+  es_fprintf (fp, "\n");
 }
 
 
 void
-print_subpackets_colon (PKT_signature * sig)
+print_subpackets_colon (estream_t fp, PKT_signature *sig)
 {
   byte *i;
 
@@ -810,12 +956,12 @@ print_subpackets_colon (PKT_signature * sig)
       seq = 0;
 
       while ((p = enum_sig_subpkt (sig->hashed, *i, &len, &seq, &crit)))
-	print_one_subpacket (*i, len, 0x01 | (crit ? 0x02 : 0), p);
+	print_one_subpacket (fp, *i, len, 0x01 | (crit ? 0x02 : 0), p);
 
       seq = 0;
 
       while ((p = enum_sig_subpkt (sig->unhashed, *i, &len, &seq, &crit)))
-	print_one_subpacket (*i, len, 0x00 | (crit ? 0x02 : 0), p);
+	print_one_subpacket (fp, *i, len, 0x00 | (crit ? 0x02 : 0), p);
     }
 }
 
@@ -862,7 +1008,7 @@ dump_attribs (const PKT_user_id *uid, PKT_public_key *pk)
 
 /* Print IPGP cert records instead of a standard key listing.  */
 static void
-list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
+list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock, estream_t fp)
 {
   kbnode_t kbctx;
   kbnode_t node;
@@ -885,10 +1031,10 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
   pk = node->pkt->pkt.public_key;
 
   /* First print an overview of the key with all userids.  */
-  es_fprintf (es_stdout, ";; pub  %s/%s %s\n;;",
+  es_fprintf (fp, ";; pub  %s/%s %s\n;;",
               pubkey_string (pk, pkstrbuf, sizeof pkstrbuf),
               keystr_from_pk (pk), datestr_from_pk (pk));
-  print_fingerprint (NULL, pk, 10);
+  print_fingerprint (fp, pk, 10);
   for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
     {
       if (node->pkt->pkttype == PKT_USER_ID)
@@ -899,9 +1045,9 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
 	      && !(opt.list_options & LIST_SHOW_UNUSABLE_UIDS))
             continue;
 
-          es_fputs (";; uid  ", es_stdout);
-          print_utf8_buffer (es_stdout, uid->name, uid->len);
-          es_putc ('\n', es_stdout);
+          es_fputs (";; uid  ", fp);
+          print_utf8_buffer (fp, uid->name, uid->len);
+          es_putc ('\n', fp);
         }
     }
 
@@ -956,17 +1102,17 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
               *p++ = 0;
               if (opt.print_pka_records)
                 {
-                  es_fprintf (es_stdout, "$ORIGIN _pka.%s.\n; %s\n; ",
+                  es_fprintf (fp, "$ORIGIN _pka.%s.\n; %s\n; ",
                               p, hexfpr);
-                  print_utf8_buffer (es_stdout, uid->name, uid->len);
-                  es_putc ('\n', es_stdout);
+                  print_utf8_buffer (fp, uid->name, uid->len);
+                  es_putc ('\n', fp);
                   gcry_md_hash_buffer (GCRY_MD_SHA1, hashbuf,
                                        mbox, strlen (mbox));
                   hash = zb32_encode (hashbuf, 8*20);
                   if (hash)
                     {
                       len = strlen (hexfpr)/2;
-                      es_fprintf (es_stdout,
+                      es_fprintf (fp,
                                   "%s TYPE37 \\# %u 0006 0000 00 %02X %s\n",
                                   hash, 6 + len, len, hexfpr);
                       xfree (hash);
@@ -974,28 +1120,28 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
                 }
               if (opt.print_dane_records && hexkeyblock)
                 {
-                  es_fprintf (es_stdout, "$ORIGIN _openpgpkey.%s.\n; %s\n; ",
+                  es_fprintf (fp, "$ORIGIN _openpgpkey.%s.\n; %s\n; ",
                               p, hexfpr);
-                  print_utf8_buffer (es_stdout, uid->name, uid->len);
-                  es_putc ('\n', es_stdout);
+                  print_utf8_buffer (fp, uid->name, uid->len);
+                  es_putc ('\n', fp);
                   gcry_md_hash_buffer (GCRY_MD_SHA256, hashbuf,
                                        mbox, strlen (mbox));
                   hash = bin2hex (hashbuf, 28, NULL);
                   if (hash)
                     {
                       ascii_strlwr (hash);
-                      es_fprintf (es_stdout, "%s TYPE61 \\# %u (\n",
+                      es_fprintf (fp, "%s TYPE61 \\# %u (\n",
                                   hash, hexkeyblocklen);
                       xfree (hash);
                       s = hexkeyblock;
                       for (;;)
                         {
-                          es_fprintf (es_stdout, "\t%.64s\n", s);
+                          es_fprintf (fp, "\t%.64s\n", s);
                           if (strlen (s) < 64)
                             break;
                           s += 64;
                         }
-                      es_fputs ("\t)\n", es_stdout);
+                      es_fputs ("\t)\n", fp);
                     }
                 }
             }
@@ -1003,7 +1149,7 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
 	}
 
     }
-  es_putc ('\n', es_stdout);
+  es_putc ('\n', fp);
 
   xfree (hexkeyblock);
   xfree (hexfpr);
@@ -1012,7 +1158,7 @@ list_keyblock_pka (ctrl_t ctrl, kbnode_t keyblock)
 
 static void
 list_keyblock_print (KBNODE keyblock, int secret, int fpr,
-                     struct keylist_context *listctx)
+                     struct keylist_context *listctx, estream_t fp)
 {
   int rc;
   KBNODE kbctx;
@@ -1055,7 +1201,7 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
   check_trustdb_stale ();
 
 
-  es_fprintf (es_stdout, "%s%c  %s/%s %s",
+  es_fprintf (fp, "%s%c  %s/%s %s",
               secret? "sec":"pub",
               s2k_char,
               pubkey_string (pk, pkstrbuf, sizeof pkstrbuf),
@@ -1063,25 +1209,25 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 
   if ((opt.list_options & LIST_SHOW_USAGE))
     {
-      es_fprintf (es_stdout, " [%s]", usagestr_from_pk (pk, 0));
+      es_fprintf (fp, " [%s]", usagestr_from_pk (pk, 0));
     }
   if (pk->flags.revoked)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("revoked: %s"), revokestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (fp, " [");
+      es_fprintf (fp, _("revoked: %s"), revokestr_from_pk (pk));
+      es_fprintf (fp, "]");
     }
   else if (pk->has_expired)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("expired: %s"), expirestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (fp, " [");
+      es_fprintf (fp, _("expired: %s"), expirestr_from_pk (pk));
+      es_fprintf (fp, "]");
     }
   else if (pk->expiredate)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("expires: %s"), expirestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (fp, " [");
+      es_fprintf (fp, _("expires: %s"), expirestr_from_pk (pk));
+      es_fprintf (fp, "]");
     }
 
 #if 0
@@ -1090,26 +1236,26 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
   if (opt.list_options & LIST_SHOW_VALIDITY)
     {
       int validity = get_validity (pk, NULL, NULL, 0);
-      es_fprintf (es_stdout, " [%s]", trust_value_to_string (validity));
+      es_fprintf (fp, " [%s]", trust_value_to_string (validity));
     }
 #endif
 
   if (pk->pubkey_algo >= 100)
-    es_fprintf (es_stdout, " [experimental algorithm %d]", pk->pubkey_algo);
+    es_fprintf (fp, " [experimental algorithm %d]", pk->pubkey_algo);
 
-  es_fprintf (es_stdout, "\n");
+  es_fprintf (fp, "\n");
 
   if (fpr)
-    print_fingerprint (NULL, pk, 0);
+    print_fingerprint (fp, pk, 0);
 
   if (opt.with_keygrip && hexgrip)
-    es_fprintf (es_stdout, "      Keygrip = %s\n", hexgrip);
+    es_fprintf (fp, "      Keygrip = %s\n", hexgrip);
 
   if (serialno)
-    print_card_serialno (serialno);
+    print_card_serialno (fp, serialno);
 
   if (opt.with_key_data)
-    print_key_data (pk);
+    print_key_data (fp, pk);
 
   for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
     {
@@ -1143,14 +1289,14 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 	      if (indent < 0 || indent > 40)
 		indent = 0;
 
-	      es_fprintf (es_stdout, "uid%*s%s ", indent, "", validity);
+	      es_fprintf (fp, "uid%*s%s ", indent, "", validity);
 	    }
 	  else
-	    es_fprintf (es_stdout, "uid%*s",
+	    es_fprintf (fp, "uid%*s",
                         (int) keystrlen () + (opt.legacy_list_mode? 10:12), "");
 
-	  print_utf8_buffer (es_stdout, uid->name, uid->len);
-	  es_putc ('\n', es_stdout);
+	  print_utf8_buffer (fp, uid->name, uid->len);
+	  es_putc ('\n', fp);
 
 	  if ((opt.list_options & LIST_SHOW_PHOTOS) && uid->attribs != NULL)
 	    show_photos (uid->attribs, uid->numattribs, pk, uid);
@@ -1187,7 +1333,7 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
           else
             s2k_char = ' ';
 
-	  es_fprintf (es_stdout, "%s%c  %s/%s %s",
+	  es_fprintf (fp, "%s%c  %s/%s %s",
                   secret? "ssb":"sub",
                   s2k_char,
                   pubkey_string (pk2, pkstrbuf, sizeof pkstrbuf),
@@ -1195,37 +1341,37 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 
           if ((opt.list_options & LIST_SHOW_USAGE))
             {
-              es_fprintf (es_stdout, " [%s]", usagestr_from_pk (pk2, 0));
+              es_fprintf (fp, " [%s]", usagestr_from_pk (pk2, 0));
             }
 	  if (pk2->flags.revoked)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("revoked: %s"), revokestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (fp, " [");
+	      es_fprintf (fp, _("revoked: %s"), revokestr_from_pk (pk2));
+	      es_fprintf (fp, "]");
 	    }
 	  else if (pk2->has_expired)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("expired: %s"), expirestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (fp, " [");
+	      es_fprintf (fp, _("expired: %s"), expirestr_from_pk (pk2));
+	      es_fprintf (fp, "]");
 	    }
 	  else if (pk2->expiredate)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("expires: %s"), expirestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (fp, " [");
+	      es_fprintf (fp, _("expires: %s"), expirestr_from_pk (pk2));
+	      es_fprintf (fp, "]");
 	    }
-	  es_putc ('\n', es_stdout);
+	  es_putc ('\n', fp);
 	  if (fpr > 1)
             {
-              print_fingerprint (NULL, pk2, 0);
+              print_fingerprint (fp, pk2, 0);
               if (serialno)
-                print_card_serialno (serialno);
+                print_card_serialno (fp, serialno);
             }
           if (opt.with_keygrip && hexgrip)
-            es_fprintf (es_stdout, "      Keygrip = %s\n", hexgrip);
+            es_fprintf (fp, "      Keygrip = %s\n", hexgrip);
 	  if (opt.with_key_data)
-	    print_key_data (pk2);
+	    print_key_data (fp, pk2);
 	}
       else if (opt.list_sigs
 	       && node->pkt->pkttype == PKT_SIGNATURE && !skip_sigs)
@@ -1278,14 +1424,14 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 	    sigstr = "sig";
 	  else
 	    {
-	      es_fprintf (es_stdout, "sig                             "
+	      es_fprintf (fp, "sig                             "
 		      "[unexpected signature class 0x%02x]\n",
 		      sig->sig_class);
 	      continue;
 	    }
 
-	  es_fputs (sigstr, es_stdout);
-	  es_fprintf (es_stdout, "%c%c %c%c%c%c%c%c %s %s",
+	  es_fputs (sigstr, fp);
+	  es_fprintf (fp, "%c%c %c%c%c%c%c%c %s %s",
 		  sigrc, (sig->sig_class - 0x10 > 0 &&
 			  sig->sig_class - 0x10 <
 			  4) ? '0' + sig->sig_class - 0x10 : ' ',
@@ -1299,27 +1445,27 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 		  sig->trust_depth : ' ', keystr (sig->keyid),
 		  datestr_from_sig (sig));
 	  if (opt.list_options & LIST_SHOW_SIG_EXPIRE)
-	    es_fprintf (es_stdout, " %s", expirestr_from_sig (sig));
-	  es_fprintf (es_stdout, "  ");
+	    es_fprintf (fp, " %s", expirestr_from_sig (sig));
+	  es_fprintf (fp, "  ");
 	  if (sigrc == '%')
-	    es_fprintf (es_stdout, "[%s] ", gpg_strerror (rc));
+	    es_fprintf (fp, "[%s] ", gpg_strerror (rc));
 	  else if (sigrc == '?')
 	    ;
 	  else if (!opt.fast_list_mode)
 	    {
 	      size_t n;
 	      char *p = get_user_id (sig->keyid, &n);
-	      print_utf8_buffer (es_stdout, p, n);
+	      print_utf8_buffer (fp, p, n);
 	      xfree (p);
 	    }
-	  es_putc ('\n', es_stdout);
+	  es_putc ('\n', fp);
 
 	  if (sig->flags.policy_url
 	      && (opt.list_options & LIST_SHOW_POLICY_URLS))
-	    show_policy_url (sig, 3, 0);
+	    show_policy_url (fp, sig, 3, 0);
 
 	  if (sig->flags.notation && (opt.list_options & LIST_SHOW_NOTATIONS))
-	    show_notation (sig, 3, 0,
+	    show_notation (fp, sig, 3, 0,
 			   ((opt.
 			     list_options & LIST_SHOW_STD_NOTATIONS) ? 1 : 0)
 			   +
@@ -1329,12 +1475,12 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr,
 
 	  if (sig->flags.pref_ks
 	      && (opt.list_options & LIST_SHOW_KEYSERVER_URLS))
-	    show_keyserver_url (sig, 3, 0);
+	    show_keyserver_url (fp, sig, 3, 0);
 
 	  /* fixme: check or list other sigs here */
 	}
     }
-  es_putc ('\n', es_stdout);
+  es_putc ('\n', fp);
   xfree (serialno);
   xfree (hexgrip);
 }
@@ -1369,7 +1515,8 @@ print_revokers (estream_t fp, PKT_public_key * pk)
    record (i.e. requested via --list-secret-key).  If HAS_SECRET a
    secret key is available even if SECRET is not set.  */
 static void
-list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
+list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr,
+                     estream_t fp)
 {
   int rc;
   KBNODE kbctx;
@@ -1405,13 +1552,13 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
     stubkey = 1;  /* Key not found.  */
 
   keyid_from_pk (pk, keyid);
-  es_fputs (secret? "sec:":"pub:", es_stdout);
+  es_fputs (secret? "sec:":"pub:", fp);
   if (!pk->flags.valid)
-    es_putc ('i', es_stdout);
+    es_putc ('i', fp);
   else if (pk->flags.revoked)
-    es_putc ('r', es_stdout);
+    es_putc ('r', fp);
   else if (pk->has_expired)
-    es_putc ('e', es_stdout);
+    es_putc ('e', fp);
   else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
     ;
   else
@@ -1419,35 +1566,35 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
       trustletter = get_validity_info (pk, NULL);
       if (trustletter == 'u')
         ulti_hack = 1;
-      es_putc (trustletter, es_stdout);
+      es_putc (trustletter, fp);
     }
 
-  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s::",
+  es_fprintf (fp, ":%u:%d:%08lX%08lX:%s:%s::",
           nbits_from_pk (pk),
           pk->pubkey_algo,
           (ulong) keyid[0], (ulong) keyid[1],
           colon_datestr_from_pk (pk), colon_strtime (pk->expiredate));
 
   if (!opt.fast_list_mode && !opt.no_expensive_trust_checks)
-    es_putc (get_ownertrust_info (pk), es_stdout);
-  es_putc (':', es_stdout);
-
-  es_putc (':', es_stdout);
-  es_putc (':', es_stdout);
-  print_capabilities (pk, keyblock);
-  es_putc (':', es_stdout);		/* End of field 13. */
-  es_putc (':', es_stdout);		/* End of field 14. */
+    es_putc (get_ownertrust_info (pk), fp);
+  es_putc (':', fp);
+
+  es_putc (':', fp);
+  es_putc (':', fp);
+  print_capabilities (fp, pk, keyblock);
+  es_putc (':', fp);		/* End of field 13. */
+  es_putc (':', fp);		/* End of field 14. */
   if (secret || has_secret)
     {
       if (stubkey)
-	es_putc ('#', es_stdout);
+	es_putc ('#', fp);
       else if (serialno)
-        es_fputs (serialno, es_stdout);
+        es_fputs (serialno, fp);
       else if (has_secret)
-        es_putc ('+', es_stdout);
+        es_putc ('+', fp);
     }
-  es_putc (':', es_stdout);		/* End of field 15. */
-  es_putc (':', es_stdout);		/* End of field 16. */
+  es_putc (':', fp);		/* End of field 15. */
+  es_putc (':', fp);		/* End of field 16. */
   if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA
       || pk->pubkey_algo == PUBKEY_ALGO_EDDSA
       || pk->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -1456,22 +1603,22 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
       const char *name = openpgp_oid_to_curve (curve, 0);
       if (!name)
         name = curve;
-      es_fputs (name, es_stdout);
+      es_fputs (name, fp);
       xfree (curve);
     }
-  es_putc (':', es_stdout);		/* End of field 17. */
-  es_putc (':', es_stdout);		/* End of field 18. */
-  es_putc ('\n', es_stdout);
+  es_putc (':', fp);		/* End of field 17. */
+  es_putc (':', fp);		/* End of field 18. */
+  es_putc ('\n', fp);
 
-  print_revokers (es_stdout, pk);
+  print_revokers (fp, pk);
   if (fpr)
-    print_fingerprint (NULL, pk, 0);
+    print_fingerprint (fp, pk, 0);
   if (opt.with_key_data || opt.with_keygrip)
     {
       if (hexgrip)
-        es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+        es_fprintf (fp, "grp:::::::::%s:\n", hexgrip);
       if (opt.with_key_data)
-        print_key_data (pk);
+        print_key_data (fp, pk);
     }
 
   for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
@@ -1488,11 +1635,11 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
 	   */
 	  str = uid->attrib_data ? "uat" : "uid";
 	  if (uid->is_revoked)
-	    es_fprintf (es_stdout, "%s:r::::", str);
+	    es_fprintf (fp, "%s:r::::", str);
 	  else if (uid->is_expired)
-	    es_fprintf (es_stdout, "%s:e::::", str);
+	    es_fprintf (fp, "%s:e::::", str);
 	  else if (opt.no_expensive_trust_checks)
-	    es_fprintf (es_stdout, "%s:::::", str);
+	    es_fprintf (fp, "%s:::::", str);
 	  else
 	    {
 	      int uid_validity;
@@ -1501,35 +1648,35 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
 		uid_validity = get_validity_info (pk, uid);
 	      else
 		uid_validity = 'u';
-	      es_fprintf (es_stdout, "%s:%c::::", str, uid_validity);
+	      es_fprintf (fp, "%s:%c::::", str, uid_validity);
 	    }
 
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->created));
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->expiredate));
+	  es_fprintf (fp, "%s:", colon_strtime (uid->created));
+	  es_fprintf (fp, "%s:", colon_strtime (uid->expiredate));
 
 	  namehash_from_uid (uid);
 
 	  for (i = 0; i < 20; i++)
-	    es_fprintf (es_stdout, "%02X", uid->namehash[i]);
+	    es_fprintf (fp, "%02X", uid->namehash[i]);
 
-	  es_fprintf (es_stdout, "::");
+	  es_fprintf (fp, "::");
 
 	  if (uid->attrib_data)
-	    es_fprintf (es_stdout, "%u %lu", uid->numattribs, uid->attrib_len);
+	    es_fprintf (fp, "%u %lu", uid->numattribs, uid->attrib_len);
 	  else
-	    es_write_sanitized (es_stdout, uid->name, uid->len, ":", NULL);
-	  es_fprintf (es_stdout, "::::::::");
+	    es_write_sanitized (fp, uid->name, uid->len, ":", NULL);
+	  es_fprintf (fp, "::::::::");
 	  if (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP)
 	    {
 #ifdef USE_TOFU
 	      enum tofu_policy policy;
 	      if (! tofu_get_policy (pk, uid, &policy)
 		  && policy != TOFU_POLICY_NONE)
-		es_fprintf (es_stdout, "%s", tofu_policy_str (policy));
+		es_fprintf (fp, "%s", tofu_policy_str (policy));
 #endif /*USE_TOFU*/
 	    }
-	  es_putc (':', es_stdout);
-	  es_putc ('\n', es_stdout);
+	  es_putc (':', fp);
+	  es_putc ('\n', fp);
 	}
       else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
 	{
@@ -1552,42 +1699,42 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
             stubkey = 1;  /* Key not found.  */
 
 	  keyid_from_pk (pk2, keyid2);
-	  es_fputs (secret? "ssb:":"sub:", es_stdout);
+	  es_fputs (secret? "ssb:":"sub:", fp);
 	  if (!pk2->flags.valid)
-	    es_putc ('i', es_stdout);
+	    es_putc ('i', fp);
 	  else if (pk2->flags.revoked)
-	    es_putc ('r', es_stdout);
+	    es_putc ('r', fp);
 	  else if (pk2->has_expired)
-	    es_putc ('e', es_stdout);
+	    es_putc ('e', fp);
 	  else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
 	    ;
 	  else
 	    {
 	      /* TRUSTLETTER should always be defined here. */
 	      if (trustletter)
-		es_fprintf (es_stdout, "%c", trustletter);
+		es_fprintf (fp, "%c", trustletter);
 	    }
-	  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s:::::",
+	  es_fprintf (fp, ":%u:%d:%08lX%08lX:%s:%s:::::",
 		  nbits_from_pk (pk2),
 		  pk2->pubkey_algo,
 		  (ulong) keyid2[0], (ulong) keyid2[1],
 		  colon_datestr_from_pk (pk2), colon_strtime (pk2->expiredate)
 		  /* fixme: add LID and ownertrust here */
 	    );
-	  print_capabilities (pk2, NULL);
-          es_putc (':', es_stdout);	/* End of field 13. */
-          es_putc (':', es_stdout);	/* End of field 14. */
+	  print_capabilities (fp, pk2, NULL);
+          es_putc (':', fp);	/* End of field 13. */
+          es_putc (':', fp);	/* End of field 14. */
           if (secret || has_secret)
             {
               if (stubkey)
-                es_putc ('#', es_stdout);
+                es_putc ('#', fp);
               else if (serialno)
-                es_fputs (serialno, es_stdout);
+                es_fputs (serialno, fp);
               else if (has_secret)
-                es_putc ('+', es_stdout);
+                es_putc ('+', fp);
             }
-          es_putc (':', es_stdout);	/* End of field 15. */
-          es_putc (':', es_stdout);	/* End of field 16. */
+          es_putc (':', fp);	/* End of field 15. */
+          es_putc (':', fp);	/* End of field 16. */
           if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA
               || pk->pubkey_algo == PUBKEY_ALGO_EDDSA
               || pk->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -1596,19 +1743,19 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
               const char *name = openpgp_oid_to_curve (curve, 0);
               if (!name)
                 name = curve;
-              es_fputs (name, es_stdout);
+              es_fputs (name, fp);
               xfree (curve);
             }
-          es_putc (':', es_stdout);	/* End of field 17. */
-	  es_putc ('\n', es_stdout);
+          es_putc (':', fp);	/* End of field 17. */
+	  es_putc ('\n', fp);
 	  if (fpr > 1)
-	    print_fingerprint (NULL, pk2, 0);
+	    print_fingerprint (fp, pk2, 0);
 	  if (opt.with_key_data || opt.with_keygrip)
             {
               if (hexgrip)
-                es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+                es_fprintf (fp, "grp:::::::::%s:\n", hexgrip);
               if (opt.with_key_data)
-                print_key_data (pk2);
+                print_key_data (fp, pk2);
             }
 	}
       else if (opt.list_sigs && node->pkt->pkttype == PKT_SIGNATURE)
@@ -1630,7 +1777,7 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
 	    sigstr = "sig";
 	  else
 	    {
-	      es_fprintf (es_stdout, "sig::::::::::%02x%c:\n",
+	      es_fprintf (fp, "sig::::::::::%02x%c:\n",
 		      sig->sig_class, sig->flags.exportable ? 'x' : 'l');
 	      continue;
 	    }
@@ -1677,48 +1824,48 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
 	      rc = 0;
 	      sigrc = ' ';
 	    }
-	  es_fputs (sigstr, es_stdout);
-	  es_putc (':', es_stdout);
+	  es_fputs (sigstr, fp);
+	  es_putc (':', fp);
 	  if (sigrc != ' ')
-	    es_putc (sigrc, es_stdout);
-	  es_fprintf (es_stdout, "::%d:%08lX%08lX:%s:%s:", sig->pubkey_algo,
+	    es_putc (sigrc, fp);
+	  es_fprintf (fp, "::%d:%08lX%08lX:%s:%s:", sig->pubkey_algo,
 		  (ulong) sig->keyid[0], (ulong) sig->keyid[1],
 		  colon_datestr_from_sig (sig),
 		  colon_expirestr_from_sig (sig));
 
 	  if (sig->trust_depth || sig->trust_value)
-	    es_fprintf (es_stdout, "%d %d", sig->trust_depth, sig->trust_value);
-	  es_fprintf (es_stdout, ":");
+	    es_fprintf (fp, "%d %d", sig->trust_depth, sig->trust_value);
+	  es_fprintf (fp, ":");
 
 	  if (sig->trust_regexp)
-	    es_write_sanitized (es_stdout, sig->trust_regexp,
+	    es_write_sanitized (fp, sig->trust_regexp,
                                 strlen (sig->trust_regexp), ":", NULL);
-	  es_fprintf (es_stdout, ":");
+	  es_fprintf (fp, ":");
 
 	  if (sigrc == '%')
-	    es_fprintf (es_stdout, "[%s] ", gpg_strerror (rc));
+	    es_fprintf (fp, "[%s] ", gpg_strerror (rc));
 	  else if (sigrc == '?')
 	    ;
 	  else if (!opt.fast_list_mode)
 	    {
 	      size_t n;
 	      p = get_user_id (sig->keyid, &n);
-	      es_write_sanitized (es_stdout, p, n, ":", NULL);
+	      es_write_sanitized (fp, p, n, ":", NULL);
 	      xfree (p);
 	    }
-	  es_fprintf (es_stdout, ":%02x%c::", sig->sig_class,
+	  es_fprintf (fp, ":%02x%c::", sig->sig_class,
 		  sig->flags.exportable ? 'x' : 'l');
 
 	  if (opt.no_sig_cache && opt.check_sigs && fprokay)
 	    {
 	      for (i = 0; i < fplen; i++)
-		es_fprintf (es_stdout, "%02X", fparray[i]);
+		es_fprintf (fp, "%02X", fparray[i]);
 	    }
 
-	  es_fprintf (es_stdout, ":::%d:\n", sig->digest_algo);
+	  es_fprintf (fp, ":::%d:\n", sig->digest_algo);
 
 	  if (opt.show_subpackets)
-	    print_subpackets_colon (sig);
+	    print_subpackets_colon (fp, sig);
 
 	  /* fixme: check or list other sigs here */
 	}
@@ -1787,17 +1934,17 @@ reorder_keyblock (KBNODE keyblock)
 static void
 list_keyblock (ctrl_t ctrl,
                KBNODE keyblock, int secret, int has_secret, int fpr,
-               struct keylist_context *listctx)
+               struct keylist_context *listctx, estream_t fp)
 {
   reorder_keyblock (keyblock);
   if (opt.print_pka_records || opt.print_dane_records)
-    list_keyblock_pka (ctrl, keyblock);
+    list_keyblock_pka (ctrl, keyblock, fp);
   else if (opt.with_colons)
-    list_keyblock_colon (keyblock, secret, has_secret, fpr);
+    list_keyblock_colon (keyblock, secret, has_secret, fpr, fp);
   else
-    list_keyblock_print (keyblock, secret, fpr, listctx);
+    list_keyblock_print (keyblock, secret, fpr, listctx, fp);
   if (secret)
-    es_fflush (es_stdout);
+    es_fflush (fp);
 }
 
 
@@ -1809,7 +1956,7 @@ list_keyblock_direct (ctrl_t ctrl,
   struct keylist_context listctx;
 
   memset (&listctx, 0, sizeof (listctx));
-  list_keyblock (ctrl, keyblock, secret, has_secret, fpr, &listctx);
+  list_keyblock (ctrl, keyblock, secret, has_secret, fpr, &listctx, es_stdout);
   keylist_context_release (&listctx);
 }
 
@@ -1949,25 +2096,25 @@ print_fingerprint (estream_t override_fp, PKT_public_key *pk, int mode)
 
 /* Print the serial number of an OpenPGP card if available.  */
 static void
-print_card_serialno (const char *serialno)
+print_card_serialno (estream_t fp, const char *serialno)
 {
   if (!serialno)
     return;
   if (opt.with_colons)
     return; /* Handled elsewhere. */
 
-  es_fputs (_("      Card serial no. ="), es_stdout);
-  es_putc (' ', es_stdout);
+  es_fputs (_("      Card serial no. ="), fp);
+  es_putc (' ', fp);
   if (strlen (serialno) == 32 && !strncmp (serialno, "D27600012401", 12))
     {
       /* This is an OpenPGP card.  Print the relevant part.  */
       /* Example: D2760001240101010001000003470000 */
       /*                          xxxxyyyyyyyy     */
-      es_fprintf (es_stdout, "%.*s %.*s", 4, serialno+16, 8, serialno+20);
+      es_fprintf (fp, "%.*s %.*s", 4, serialno+16, 8, serialno+20);
     }
  else
-   es_fputs (serialno, es_stdout);
-  es_putc ('\n', es_stdout);
+   es_fputs (serialno, fp);
+  es_putc ('\n', fp);
 }
 
 
@@ -236,6 +236,8 @@ int complete_sig (PKT_signature *sig, PKT_public_key *pksk, gcry_md_hd_t md,
                   const char *cache_nonce);
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+int sign_fd (ctrl_t ctrl, int filefd, int detached, strlist_t locusr,
+             int outputfd);
 int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
@@ -267,7 +269,7 @@ gpg_error_t delete_keys (strlist_t names, int secret, int allow_both);
 /*-- keyedit.c --*/
 void keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 		   strlist_t commands, int quiet, int seckey_check );
-void keyedit_passwd (ctrl_t ctrl, const char *username);
+gpg_error_t keyedit_passwd (ctrl_t ctrl, const char *username);
 void keyedit_quick_adduid (ctrl_t ctrl, const char *username,
                            const char *newuid);
 void keyedit_quick_sign (ctrl_t ctrl, const char *fpr,
@@ -281,6 +283,8 @@ u32 ask_expiredate(void);
 void quick_generate_keypair (ctrl_t ctrl, const char *uid);
 void generate_keypair (ctrl_t ctrl, int full, const char *fname,
                        const char *card_serialno, int card_backup_key);
+gpg_error_t generate_keypair_stream (ctrl_t ctrl, iobuf_t fp,
+                                     const char *fname);
 int keygen_set_std_prefs (const char *string,int personal);
 PKT_user_id *keygen_get_std_prefs (void);
 int keygen_add_key_expire( PKT_signature *sig, void *opaque );
@@ -350,6 +354,9 @@ int parse_export_options(char *str,unsigned int *options,int noisy);
 
 int export_pubkeys (ctrl_t ctrl, strlist_t users, unsigned int options,
                     export_stats_t stats);
+gpg_error_t export_pubkeys_stream (ctrl_t ctrl, iobuf_t out, strlist_t users,
+                                   unsigned int options,
+                                   export_stats_t stats);
 int export_seckeys (ctrl_t ctrl, strlist_t users, export_stats_t stats);
 int export_secsubkeys (ctrl_t ctrl, strlist_t users, export_stats_t stats);
 
@@ -374,17 +381,20 @@ struct revocation_reason_info *
 void release_revocation_reason_info( struct revocation_reason_info *reason );
 
 /*-- keylist.c --*/
-void public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode );
-void secret_key_list (ctrl_t ctrl, strlist_t list );
-void print_subpackets_colon(PKT_signature *sig);
+void public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode,
+                      estream_t fp);
+void secret_key_list (ctrl_t ctrl, strlist_t list, estream_t fp);
+void print_subpackets_colon (estream_t fp, PKT_signature *sig);
 void reorder_keyblock (KBNODE keyblock);
 void list_keyblock_direct (ctrl_t ctrl, kbnode_t keyblock, int secret,
                            int has_secret, int fpr);
 void print_fingerprint (estream_t fp, PKT_public_key *pk, int mode);
 void print_revokers (estream_t fp, PKT_public_key *pk);
-void show_policy_url(PKT_signature *sig,int indent,int mode);
-void show_keyserver_url(PKT_signature *sig,int indent,int mode);
-void show_notation(PKT_signature *sig,int indent,int mode,int which);
+void show_policy_url (estream_t fp, PKT_signature *sig, int indent, int mode);
+void show_keyserver_url (estream_t fp, PKT_signature *sig, int indent,
+                         int mode);
+void show_notation (estream_t fp, PKT_signature *sig, int indent, int mode,
+                    int which);
 void dump_attribs (const PKT_user_id *uid, PKT_public_key *pk);
 void set_attrib_fd(int fd);
 char *format_seckey_info (PKT_public_key *pk);
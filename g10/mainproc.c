@@ -1986,22 +1986,22 @@ check_sig_and_print (CTX c, kbnode_t node)
       if (!rc)
         {
           if ((opt.verify_options & VERIFY_SHOW_POLICY_URLS))
-            show_policy_url (sig, 0, 1);
+            show_policy_url (NULL, sig, 0, 1);
           else
-            show_policy_url (sig, 0, 2);
+            show_policy_url (NULL, sig, 0, 2);
 
           if ((opt.verify_options & VERIFY_SHOW_KEYSERVER_URLS))
-            show_keyserver_url (sig, 0, 1);
+            show_keyserver_url (NULL, sig, 0, 1);
           else
-            show_keyserver_url (sig, 0, 2);
+            show_keyserver_url (NULL, sig, 0, 2);
 
           if ((opt.verify_options & VERIFY_SHOW_NOTATIONS))
             show_notation
-              (sig, 0, 1,
+              (NULL, sig, 0, 1,
                (((opt.verify_options&VERIFY_SHOW_STD_NOTATIONS)?1:0)
                 + ((opt.verify_options&VERIFY_SHOW_USER_NOTATIONS)?2:0)));
           else
-            show_notation (sig, 0, 2, 0);
+            show_notation (NULL, sig, 0, 2, 0);
         }
 
       /* For good signatures print the VALIDSIG status line.  */
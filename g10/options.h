@@ -151,6 +151,11 @@ struct
   int not_dash_escaped;
   int escape_from;
   int lock_once;
+  unsigned int keydb_jobs;  /* Number of worker processes to use when
+                               listing or exporting all keys.  */
+  unsigned int keydb_scan_min; /* Minimum number of keyblocks per
+                                  worker; 0 for the default.  Only
+                                  used by the test suite.  */
   keyserver_spec_t keyserver;  /* The list of configured keyservers.  */
   struct
   {
@@ -341,6 +346,7 @@ EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 #define IMPORT_CLEAN                     (1<<6)
 #define IMPORT_NO_SECKEY                 (1<<7)
 #define IMPORT_KEEP_OWNERTTRUST          (1<<8)
+#define IMPORT_BULK                      (1<<9)
 
 #define EXPORT_LOCAL_SIGS                (1<<0)
 #define EXPORT_ATTRIBUTES                (1<<1)
@@ -617,6 +617,16 @@ struct notation *string_to_notation(const char *string,int is_utf8);
 struct notation *sig_to_notation(PKT_signature *sig);
 void free_notation(struct notation *notation);
 
+/*-- kbarena.c --*/
+typedef struct kbarena_s *kbarena_t;
+kbarena_t kbarena_new (void);
+void kbarena_release (kbarena_t arena);
+kbarena_t kbarena_activate (kbarena_t arena);
+void *kbarena_tryalloc (size_t n);
+void *kbarena_alloc (size_t n);
+void kbarena_free (void *p);
+int kbarena_owned_p (const void *p);
+
 /*-- free-packet.c --*/
 void free_symkey_enc( PKT_symkey_enc *enc );
 void free_pubkey_enc( PKT_pubkey_enc *enc );
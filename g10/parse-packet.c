@@ -716,7 +716,7 @@ parse (IOBUF inp, PACKET * pkt, int onlykeypkts, off_t * retpos,
     case PKT_PUBLIC_SUBKEY:
     case PKT_SECRET_KEY:
     case PKT_SECRET_SUBKEY:
-      pkt->pkt.public_key = xmalloc_clear (sizeof *pkt->pkt.public_key);
+      pkt->pkt.public_key = kbarena_alloc (sizeof *pkt->pkt.public_key);
       rc = parse_key (inp, pkttype, pktlen, hdr, hdrlen, pkt);
       break;
     case PKT_SYMKEY_ENC:
@@ -726,7 +726,7 @@ parse (IOBUF inp, PACKET * pkt, int onlykeypkts, off_t * retpos,
       rc = parse_pubkeyenc (inp, pkttype, pktlen, pkt);
       break;
     case PKT_SIGNATURE:
-      pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
+      pkt->pkt.signature = kbarena_alloc (sizeof *pkt->pkt.signature);
       rc = parse_signature (inp, pkttype, pktlen, pkt->pkt.signature);
       break;
     case PKT_ONEPASS_SIG:
@@ -1821,7 +1821,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	}
       if (n)
 	{
-	  sig->hashed = xmalloc (sizeof (*sig->hashed) + n - 1);
+	  sig->hashed = kbarena_alloc (sizeof (*sig->hashed) + n - 1);
 	  sig->hashed->size = n;
 	  sig->hashed->len = n;
 	  if (iobuf_read (inp, sig->hashed->data, n) != n)
@@ -1851,7 +1851,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	}
       if (n)
 	{
-	  sig->unhashed = xmalloc (sizeof (*sig->unhashed) + n - 1);
+	  sig->unhashed = kbarena_alloc (sizeof (*sig->unhashed) + n - 1);
 	  sig->unhashed->size = n;
 	  sig->unhashed->len = n;
 	  if (iobuf_read (inp, sig->unhashed->data, n) != n)
@@ -2624,7 +2624,7 @@ parse_user_id (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * packet)
       return GPG_ERR_INV_PACKET;
     }
 
-  packet->pkt.user_id = xmalloc_clear (sizeof *packet->pkt.user_id + pktlen);
+  packet->pkt.user_id = kbarena_alloc (sizeof *packet->pkt.user_id + pktlen);
   packet->pkt.user_id->len = pktlen;
   packet->pkt.user_id->ref = 1;
 
@@ -2780,7 +2780,7 @@ parse_trust (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * pkt)
 
   (void) pkttype;
 
-  pkt->pkt.ring_trust = xmalloc (sizeof *pkt->pkt.ring_trust);
+  pkt->pkt.ring_trust = kbarena_alloc (sizeof *pkt->pkt.ring_trust);
   if (pktlen)
     {
       c = iobuf_get_noeof (inp);
@@ -522,51 +522,64 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 }
 
 
+/* Hash the LENGTH bytes at BUFFER into MD2 while converting a single
+   LF or a single CR to CR,LF.  LC holds the last character of the
+   previous buffer; the last character of BUFFER is returned.  Runs of
+   characters which need no conversion are hashed with one call.  */
+static int
+hash_crlf_canon (gcry_md_hd_t md2, const byte *buffer, size_t length, int lc)
+{
+  size_t i, start;
+  int c;
+
+  for (i = start = 0; i < length; i++)
+    {
+      c = buffer[i];
+      if (lc == '\r' && c != '\n')
+        {
+          gcry_md_write (md2, buffer + start, i - start);
+          gcry_md_putc (md2, '\n');
+          start = i;
+        }
+      else if (c == '\n' && lc != '\r')
+        {
+          gcry_md_write (md2, buffer + start, i - start);
+          gcry_md_putc (md2, '\r');
+          start = i;
+        }
+      lc = c;
+    }
+  gcry_md_write (md2, buffer + start, length - start);
+
+  return lc;
+}
+
+
 static void
 do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
 {
   text_filter_context_t tfx;
-  int c;
+  byte *buffer;
+  int n;
+  int lc = -1;
 
   if (textmode)
     {
       memset (&tfx, 0, sizeof tfx);
       iobuf_push_filter (fp, text_filter, &tfx);
     }
-  if (md2)
-    {				/* work around a strange behaviour in pgp2 */
-      /* It seems that at least PGP5 converts a single CR to a CR,LF too */
-      int lc = -1;
-      while ((c = iobuf_get (fp)) != -1)
-	{
-	  if (c == '\n' && lc == '\r')
-	    gcry_md_putc (md2, c);
-	  else if (c == '\n')
-	    {
-	      gcry_md_putc (md2, '\r');
-	      gcry_md_putc (md2, c);
-	    }
-	  else if (c != '\n' && lc == '\r')
-	    {
-	      gcry_md_putc (md2, '\n');
-	      gcry_md_putc (md2, c);
-	    }
-	  else
-	    gcry_md_putc (md2, c);
 
-	  if (md)
-	    gcry_md_putc (md, c);
-	  lc = c;
-	}
-    }
-  else
+  buffer = xmalloc (32768);
+  while ((n = iobuf_read (fp, buffer, 32768)) != -1)
     {
-      while ((c = iobuf_get (fp)) != -1)
-	{
-	  if (md)
-	    gcry_md_putc (md, c);
-	}
+      if (md)
+        gcry_md_write (md, buffer, n);
+      /* Work around a strange behaviour in pgp2.  It seems that at
+         least PGP5 converts a single CR to a CR,LF too.  */
+      if (md2)
+        lc = hash_crlf_canon (md2, buffer, n, lc);
     }
+  xfree (buffer);
 }
 
 
@@ -34,6 +34,10 @@
 #include "options.h"
 #include "../common/sysutils.h"
 #include "status.h"
+#include "iobuf.h"
+#include "filter.h"
+#include "main.h"
+#include "trustdb.h"
 
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
@@ -50,12 +54,32 @@ struct server_local_s
   /* List of prepared recipients.  */
   pk_list_t recplist;
 
+  /* List of signers as set by the SIGNER command.  */
+  strlist_t signerlist;
+
   /* Set if pinentry notifications should be passed back to the
      client. */
   int allow_pinentry_notify;
+
+  /* Set if key listings shall be written to the output fd instead of
+     being sent as data lines.  */
+  int list_to_output;
 };
 
 
+/* Cookie definition for assuan data line output.  */
+static gpgrt_ssize_t data_line_cookie_write (void *cookie,
+                                             const void *buffer, size_t size);
+static int data_line_cookie_close (void *cookie);
+static es_cookie_io_functions_t data_line_cookie_functions =
+  {
+    NULL,
+    data_line_cookie_write,
+    NULL,
+    data_line_cookie_close
+  };
+
+
 
 /* Helper to close the message fd if it is open. */
 static void
@@ -69,6 +93,40 @@ close_message_fd (ctrl_t ctrl)
 }
 
 
+/* A write handler used by es_fopencookie to write assuan data
+   lines.  */
+static gpgrt_ssize_t
+data_line_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  assuan_context_t ctx = cookie;
+
+  if (assuan_send_data (ctx, buffer, size))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  return (gpgrt_ssize_t)size;
+}
+
+
+/* A close handler used by es_fopencookie to flush the pending assuan
+   data line.  */
+static int
+data_line_cookie_close (void *cookie)
+{
+  assuan_context_t ctx = cookie;
+
+  if (assuan_send_data (ctx, NULL, 0))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  return 0;
+}
+
+
 /* Skip over options.  Blanks after the options are also removed.  */
 static char *
 skip_options (const char *line)
@@ -86,6 +144,37 @@ skip_options (const char *line)
 }
 
 
+/* Break LINE down into a list of percent-plus escaped patterns and
+   store it at R_LIST.  */
+static gpg_error_t
+parse_patterns (char *line, strlist_t *r_list)
+{
+  strlist_t list = NULL;
+  char *p;
+
+  for (p=line; *p; line = p)
+    {
+      while (*p && *p != ' ')
+        p++;
+      if (*p)
+        *p++ = 0;
+      if (*line)
+        {
+          percent_plus_unescape_inplace (line, 0);
+          if (!add_to_strlist_try (&list, line))
+            {
+              gpg_error_t err = gpg_error_from_syserror ();
+              free_strlist (list);
+              return err;
+            }
+        }
+    }
+
+  *r_list = list;
+  return 0;
+}
+
+
 /* Check whether the option NAME appears in LINE.  */
 static int
 has_option (const char *line, const char *name)
@@ -138,6 +227,10 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
     {
       /* This is for now a dummy option. */
     }
+  else if (!strcmp (key, "list-to-output"))
+    {
+      ctrl->server_local->list_to_output = *value? atoi (value) : 1;
+    }
   else if (!strcmp (key, "allow-pinentry-notify"))
     {
       ctrl->server_local->allow_pinentry_notify = 1;
@@ -149,6 +242,21 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 }
 
 
+/* Called by libassuan before each command.  Another process may have
+   changed the keyring, the trustdb or the TOFU database since the
+   last command; thus the in-memory caches are flushed.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  (void)ctx;
+  (void)cmd;
+
+  flush_trust_caches ();
+  getkey_flush_caches ();
+  return 0;
+}
+
+
 /* Called by libassuan for RESET commands. */
 static gpg_error_t
 reset_notify (assuan_context_t ctx, char *line)
@@ -159,6 +267,8 @@ reset_notify (assuan_context_t ctx, char *line)
 
   release_pk_list (ctrl->server_local->recplist);
   ctrl->server_local->recplist = NULL;
+  free_strlist (ctrl->server_local->signerlist);
+  ctrl->server_local->signerlist = NULL;
 
   close_message_fd (ctrl);
   assuan_close_input_fd (ctx);
@@ -265,9 +375,34 @@ cmd_recipient (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_signer (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t sl = NULL;
+  SK_LIST sk_list = NULL;
+
+  line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user ID given");
+
+  if (!add_to_strlist_try (&sl, line))
+    return gpg_error_from_syserror ();
+
+  /* Check the key now so that the client learns about an unusable
+     key right away.  */
+  err = build_sk_list (ctrl, sl, &sk_list, PUBKEY_USAGE_SIG);
+  release_sk_list (sk_list);
+  if (err)
+    {
+      free_strlist (sl);
+      log_error ("command '%s' failed: %s\n", "SIGNER", gpg_strerror (err));
+      return err;
+    }
+
+  if (ctrl->server_local->signerlist)
+    strlist_last (ctrl->server_local->signerlist)->next = sl;
+  else
+    ctrl->server_local->signerlist = sl;
+  return 0;
 }
 
 
@@ -459,9 +594,33 @@ cmd_verify (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_sign (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd, out_fd;
+  int detached;
+
+  detached = has_option (line, "--detached");
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+  out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+  if (out_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+
+  /* The signers are not reset; see SIGNER.  If no signer has been
+     set the default key is used.  */
+  err = sign_fd (ctrl, inp_fd, detached, ctrl->server_local->signerlist,
+                 out_fd);
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGN", gpg_strerror (err));
+  return err;
 }
 
 
@@ -473,9 +632,36 @@ cmd_sign (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_import (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd;
+  iobuf_t inp;
+
+  (void)line; /* LINE is not used.  */
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+
+  inp = iobuf_fdopen_nc (inp_fd, "rb");
+  if (!inp)
+    err = set_error (gpg_err_code_from_syserror (), "fdopen() failed");
+  else
+    {
+      /* Passing no stats handle prints the IMPORT_RES status.  */
+      err = import_keys_stream (ctrl, inp, NULL, NULL, NULL,
+                                opt.import_options);
+      iobuf_close (inp);
+    }
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "IMPORT", gpg_strerror (err));
+  return err;
 }
 
 
@@ -486,30 +672,130 @@ cmd_import (assuan_context_t ctx, char *line)
    public keys matching PATTERN.  The output is send to the output fd
    unless the --data option has been used in which case the output
    gets send inline using regular data lines.  The options "--armor"
-   and "--base" ospecify an output format if "--data" has been used.
-   Recall that in general the output format is set with the OUTPUT
-   command.
+   and "--base" ospecify an output format if "--data" has been used;
+   "--base64" is not yet supported.  Recall that in general the output
+   format is set with the OUTPUT command.
  */
 static gpg_error_t
 cmd_export (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int use_data, armor;
+  int out_fd;
+  strlist_t list = NULL;
+  iobuf_t out = NULL;
+  armor_filter_context_t *afx = NULL;
+
+  use_data = has_option (line, "--data");
+  if (use_data)
+    {
+      if (has_option (line, "--base64"))
+        return set_error (GPG_ERR_NOT_SUPPORTED, "--base64");
+      armor = opt.armor || has_option (line, "--armor");
+    }
+  else
+    armor = opt.armor;
+  line = skip_options (line);
+
+  err = parse_patterns (line, &list);
+  if (err)
+    return err;
+
+  if (use_data)
+    out = iobuf_temp ();
+  else
+    {
+      out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+      if (out_fd == -1)
+        {
+          err = set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+          goto leave;
+        }
+      out = iobuf_fdopen_nc (out_fd, "wb");
+      if (!out)
+        {
+          err = set_error (gpg_err_code_from_syserror (), "fdopen() failed");
+          goto leave;
+        }
+    }
+
+  if (armor)
+    {
+      afx = new_armor_context ();
+      afx->what = 1;
+      push_armor_filter (afx, out);
+    }
+
+  err = export_pubkeys_stream (ctrl, out, list, opt.export_options, NULL);
+  if (!err && use_data)
+    {
+      iobuf_flush_temp (out);
+      err = assuan_send_data (ctx, iobuf_get_temp_buffer (out),
+                              iobuf_get_temp_length (out));
+    }
+
+ leave:
+  if (err && !use_data)
+    iobuf_cancel (out);
+  else
+    {
+      gpg_error_t err2 = iobuf_close (out);
+      if (!err)
+        err = err2;
+    }
+  release_armor_context (afx);
+  free_strlist (list);
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "EXPORT", gpg_strerror (err));
+  return err;
 }
 
 
 
-/*  DELKEYS
-
-    Fixme
+/*  DELKEYS [--allow-secret] [--] <patterns>
+
+    Delete the public keys specified by PATTERNS.  Each pattern shall
+    be a percent-plus escaped key specification.  Because the server
+    runs in batch mode, the keys need to be given by fingerprint
+    unless gpg has been started with --yes.  If a key has a secret
+    key, the command fails unless "--allow-secret" has been given, in
+    which case the secret key is deleted as well.
 */
 static gpg_error_t
 cmd_delkeys (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int allow_secret;
+  strlist_t list;
+
+  allow_secret = has_option (line, "--allow-secret");
+  line = skip_options (line);
+
+  err = parse_patterns (line, &list);
+  if (err)
+    return err;
+  if (!list)
+    return set_error (GPG_ERR_NO_USER_ID, "no key given");
+
+  err = delete_keys (list, 0, allow_secret);
+  free_strlist (list);
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "DELKEYS", gpg_strerror (err));
+  return err;
 }
 
 
@@ -539,16 +825,77 @@ cmd_message (assuan_context_t ctx, char *line)
 /* LISTKEYS [<patterns>]
    LISTSECRETKEYS [<patterns>]
 
-   fixme
+   List the public or secret keys matching the percent-plus escaped
+   PATTERNS or all keys if no pattern is given.  The listing is
+   always done in colon format with the fingerprints of all keys and
+   sent inline using regular data lines, or to the output fd if the
+   option "list-to-output" has been set.  MODE is 3 for public and 2
+   for secret keys.
 */
 static gpg_error_t
 do_listkeys (assuan_context_t ctx, char *line, int mode)
 {
-  (void)ctx;
-  (void)line;
-  (void)mode;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t list;
+  estream_t fp;
+  int save_with_colons, save_fingerprint;
+
+  line = skip_options (line);
+  err = parse_patterns (line, &list);
+  if (err)
+    return err;
+
+  if (ctrl->server_local->list_to_output)
+    {
+      int outfd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+
+      if (outfd == -1)
+        {
+          free_strlist (list);
+          return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+        }
+      fp = es_fdopen_nc (outfd, "w");
+      if (!fp)
+        {
+          free_strlist (list);
+          return set_error (gpg_err_code_from_syserror (),
+                            "es_fdopen() failed");
+        }
+    }
+  else
+    {
+      fp = es_fopencookie (ctx, "w", data_line_cookie_functions);
+      if (!fp)
+        {
+          free_strlist (list);
+          return set_error (GPG_ERR_ASS_GENERAL,
+                            "error setting up a data stream");
+        }
+    }
+
+  save_with_colons = opt.with_colons;
+  save_fingerprint = opt.fingerprint;
+  opt.with_colons = 1;
+  if (opt.fingerprint < 2)
+    opt.fingerprint = 2;
+  if (mode == 2)
+    secret_key_list (ctrl, list, fp);
+  else
+    public_key_list (ctrl, list, 0, fp);
+  opt.with_colons = save_with_colons;
+  opt.fingerprint = save_fingerprint;
 
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  free_strlist (list);
+  if (es_fclose (fp) && !err)
+    err = set_error (gpg_err_code_from_syserror (), "writing listing failed");
+  if (ctrl->server_local->list_to_output)
+    assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n",
+               mode == 2? "LISTSECRETKEYS":"LISTKEYS", gpg_strerror (err));
+  return err;
 }
 
 
@@ -570,14 +917,41 @@ cmd_listsecretkeys (assuan_context_t ctx, char *line)
 /* GENKEY
 
    Read the parameters in native format from the input fd and create a
-   new OpenPGP key.
+   new OpenPGP key.  The format of the parameters is the same as used
+   with "gpg --batch --gen-key"; KEY_CREATED or KEY_NOT_CREATED status
+   lines are emitted for each key.
  */
 static gpg_error_t
 cmd_genkey (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd;
+  iobuf_t inp;
+
+  (void)line; /* LINE is not used.  */
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+
+  inp = iobuf_fdopen_nc (inp_fd, "rb");
+  if (!inp)
+    err = set_error (gpg_err_code_from_syserror (), "fdopen() failed");
+  else
+    {
+      err = generate_keypair_stream (ctrl, inp, "[input]");
+      iobuf_close (inp);
+    }
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "GENKEY", gpg_strerror (err));
+  return err;
 }
 
 
@@ -619,14 +993,16 @@ static const char hlp_passwd[] =
 static gpg_error_t
 cmd_passwd (assuan_context_t ctx, char *line)
 {
-  /* ctrl_t ctrl = assuan_get_pointer (ctx); */
+  ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err;
 
-  (void)ctx;
   line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user ID given");
 
-  err = gpg_error (GPG_ERR_NOT_SUPPORTED);
-
+  err = keyedit_passwd (ctrl, line);
+  if (err)
+    log_error ("command '%s' failed: %s\n", "PASSWD", gpg_strerror (err));
   return err;
 }
 
@@ -743,6 +1119,7 @@ gpg_server (ctrl_t ctrl)
     }
   else
     assuan_set_hello_line (ctx, hello);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_input_notify (ctx, input_notify);
   assuan_register_output_notify (ctx, output_notify);
@@ -783,6 +1160,7 @@ gpg_server (ctrl_t ctrl)
   if (ctrl->server_local)
     {
       release_pk_list (ctrl->server_local->recplist);
+      free_strlist (ctrl->server_local->signerlist);
 
       xfree (ctrl->server_local);
       ctrl->server_local = NULL;
@@ -51,6 +51,10 @@
 
 static int recipient_digest_algo=0;
 
+static int do_sign_file (ctrl_t ctrl, strlist_t filenames, int filefd,
+                         int detached, strlist_t locusr, int encryptflag,
+                         strlist_t remusr, const char *outfile, int outputfd);
+
 /****************
  * Create notations and other stuff.  It is assumed that the stings in
  * STRLIST are already checked to contain only printable data and have
@@ -724,6 +728,35 @@ write_signature_packets (SK_LIST sk_list, IOBUF out, gcry_md_hd_t hash,
 int
 sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	   int encryptflag, strlist_t remusr, const char *outfile )
+{
+  return do_sign_file (ctrl, filenames, -1, detached, locusr,
+                       encryptflag, remusr, outfile, -1);
+}
+
+
+/* Sign the data read from the file descriptor FILEFD and write the
+ * signed data or, if DETACHED is true, a detached signature to the
+ * file descriptor OUTPUTFD.  LOCUSR is used as with sign_file.  This
+ * is used by the server.
+ */
+int
+sign_fd (ctrl_t ctrl, int filefd, int detached, strlist_t locusr,
+         int outputfd)
+{
+  return do_sign_file (ctrl, NULL, filefd, detached, locusr,
+                       0, NULL, NULL, outputfd);
+}
+
+
+/* The core of sign_file and sign_fd.  If FILEFD is not -1 the data
+ * is read from that file descriptor and FILENAMES must be NULL.  If
+ * OUTPUTFD is not -1 the output is written to that file descriptor
+ * and OUTFILE must be NULL.
+ */
+static int
+do_sign_file (ctrl_t ctrl, strlist_t filenames, int filefd, int detached,
+              strlist_t locusr, int encryptflag, strlist_t remusr,
+              const char *outfile, int outputfd)
 {
     const char *fname;
     armor_filter_context_t *afx;
@@ -779,6 +812,20 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     /* prepare iobufs */
     if( multifile )  /* have list of filenames */
 	inp = NULL; /* we do it later */
+    else if (filefd != -1)
+      {
+        inp = iobuf_fdopen_nc (filefd, "rb");
+        if (!inp)
+          {
+            char xname[64];
+
+            rc = gpg_error_from_syserror ();
+            snprintf (xname, sizeof xname, "[fd %d]", filefd);
+            log_error (_("can't open '%s': %s\n"), xname, gpg_strerror (rc));
+            goto leave;
+          }
+        handle_progress (pfx, inp, NULL);
+      }
     else {
       inp = iobuf_open(fname);
       if (inp && is_secured_file (iobuf_get_fd (inp)))
@@ -814,7 +861,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	else if( opt.verbose )
 	    log_info(_("writing to '%s'\n"), outfile );
     }
-    else if( (rc = open_outfile (-1, fname,
+    else if( (rc = open_outfile (outputfd, fname,
                                  opt.armor? 1: detached? 2:0, 0, &out)))
 	goto leave;
 
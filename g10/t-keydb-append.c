@@ -0,0 +1,225 @@
+/* t-keydb-append.c - Tests for keybox updates and journal recovery
+ * Copyright (C) 2015 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.c"
+
+#include "keydb.h"
+
+#define KBXNAME  "./t-keydb-append.kbx"
+#define KEYFPR   "2689 5E25 E844 6D44 A26D  8FAF 2F79 98F3 DBFC 6AD9"
+
+
+/* Read the file FNAME into a malloced buffer.  */
+static unsigned char *
+read_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  struct stat st;
+  unsigned char *buf;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    ABORT ("Failed to open file.");
+  buf = malloc (st.st_size? st.st_size : 1);
+  if (!buf || fread (buf, st.st_size, 1, fp) != 1)
+    ABORT ("Failed to read file.");
+  fclose (fp);
+  *r_len = st.st_size;
+  return buf;
+}
+
+
+/* Write LEN bytes of BUF to the file FNAME.  */
+static void
+write_file (const char *fname, const void *buf, size_t len)
+{
+  FILE *fp;
+
+  fp = fopen (fname, "wb");
+  if (!fp || fwrite (buf, len, 1, fp) != 1 || fclose (fp))
+    ABORT ("Failed to write file.");
+}
+
+
+static unsigned long
+get_u32 (const unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+static size_t
+file_size (const char *fname)
+{
+  struct stat st;
+
+  if (stat (fname, &st))
+    ABORT ("Failed to stat file.");
+  return st.st_size;
+}
+
+
+/* Replace the key KEYFPR by itself.  */
+static void
+update_key (void)
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  KBNODE kb;
+  int rc;
+
+  hd = keydb_new ();
+  if (classify_user_id (KEYFPR, &desc, 0))
+    ABORT ("Failed to convert fingerprint.");
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (rc)
+    ABORT ("Failed to lookup key.");
+  rc = keydb_get_keyblock (hd, &kb);
+  if (rc)
+    ABORT ("Failed to get keyblock.");
+  rc = keydb_update_keyblock (hd, kb);
+  TEST_P ("Updating the keyblock", !rc);
+  release_kbnode (kb);
+  keydb_release (hd);
+}
+
+
+/* Return the number of keyblocks for KEYFPR.  */
+static int
+count_key (void)
+{
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  int count = 0;
+
+  hd = keydb_new ();
+  if (classify_user_id (KEYFPR, &desc, 0))
+    ABORT ("Failed to convert fingerprint.");
+  while (!keydb_search (hd, &desc, 1, NULL))
+    count++;
+  keydb_release (hd);
+  return count;
+}
+
+
+/* Write a journal for an append of the blob at ORIGLEN of length
+   BLOBLEN which replaces the blob at OLD_OFFSET.  */
+static void
+write_journal (size_t origlen, size_t bloblen, size_t old_offset)
+{
+  unsigned char image[24];
+  int i;
+
+  memcpy (image, "KBXJ", 4);
+  for (i=0; i < 8; i++)
+    image[4+i] = (unsigned long long)origlen >> (8 * (7 - i));
+  for (i=0; i < 4; i++)
+    image[12+i] = bloblen >> (8 * (3 - i));
+  for (i=0; i < 8; i++)
+    image[16+i] = (unsigned long long)old_offset >> (8 * (7 - i));
+  write_file (KBXNAME ".jnl", image, sizeof image);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  char *fname;
+  unsigned char *image, *before, *after;
+  size_t initial, len, before_len, after_len, maxsize, off, old_offset;
+  int rc, i;
+
+  (void) argc;
+  (void) argv;
+
+  fname = prepend_srcdir ("t-keydb-keyring.kbx");
+  image = read_file (fname, &initial);
+  test_free (fname);
+  write_file (KBXNAME, image, initial);
+  free (image);
+  remove (KBXNAME ".jnl");
+
+  rc = keydb_add_resource (KBXNAME, 0);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+  TEST_P ("Key is found once", count_key () == 1);
+
+  /* Repeated updates must not let the keybox grow without bounds.  */
+  maxsize = 0;
+  for (i=0; i < 50; i++)
+    {
+      update_key ();
+      len = file_size (KBXNAME);
+      if (len > maxsize)
+        maxsize = len;
+    }
+  TEST_P ("Keybox size is bounded", maxsize < 3 * initial);
+  TEST_P ("Key is found once after updates", count_key () == 1);
+
+  /* Do an update which does not trigger a compress run and find the
+     new and the old blob.  */
+  do
+    {
+      before = read_file (KBXNAME, &before_len);
+      update_key ();
+      after = read_file (KBXNAME, &after_len);
+      if (after_len > before_len)
+        break;
+      free (before);
+      free (after);
+    }
+  while (1);
+
+  old_offset = 0;
+  for (off=0; off + 5 <= before_len; off += get_u32 (before+off))
+    {
+      if (get_u32 (before+off) < 5)
+        ABORT ("Invalid blob length.");
+      if (before[off+4] && !after[off+4])
+        old_offset = off;
+    }
+  if (!old_offset)
+    ABORT ("Replaced blob not found.");
+
+  /* Simulate a crash after the new blob has been written but before
+     the old blob has been marked as deleted.  */
+  after[old_offset+4] = before[old_offset+4];
+  write_file (KBXNAME, after, after_len);
+  write_journal (before_len, after_len - before_len, old_offset);
+  TEST_P ("Key is found once after an interrupted append",
+          count_key () == 1);
+
+  /* Simulate a crash while the new blob is being written.  */
+  write_file (KBXNAME, after, before_len + 10);
+  TEST_P ("Key is found once after a torn append", count_key () == 1);
+
+  /* The next write operation rolls back the torn append.  */
+  update_key ();
+  TEST_P ("Journal has been removed", access (KBXNAME ".jnl", F_OK));
+  TEST_P ("Key is found once after recovery", count_key () == 1);
+
+  free (before);
+  free (after);
+  remove (KBXNAME);
+  remove (KBXNAME "~");
+  remove (KBXNAME ".jnl");
+}
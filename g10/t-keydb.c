@@ -25,11 +25,12 @@ static void
 do_test (int argc, char *argv[])
 {
   int rc;
-  KEYDB_HANDLE hd1, hd2;
+  KEYDB_HANDLE hd1, hd2, hd3;
   KEYDB_SEARCH_DESC desc1, desc2;
-  KBNODE kb1, kb2;
+  KBNODE kb1, kb2, kb3, node;
   char *uid1;
   char *uid2;
+  char *uid3;
   char *fname;
 
   (void) argc;
@@ -90,4 +91,27 @@ do_test (int argc, char *argv[])
     }
 
   TEST_P ("cache consistency", strcmp (uid1, uid2) != 0);
+
+  /* Read the first keyblock again with its packets allocated from an
+     arena.  */
+  hd3 = keydb_new ();
+  keydb_enable_arena (hd3);
+  rc = keydb_search (hd3, &desc1, 1, NULL);
+  if (rc)
+    ABORT ("Failed to lookup key associated with DBFC6AD9");
+  rc = keydb_get_keyblock (hd3, &kb3);
+  if (rc)
+    ABORT ("Failed to get keyblock for DBFC6AD9 using an arena");
+
+  for (node = kb3; node && node->pkt->pkttype != PKT_USER_ID;
+       node = node->next)
+    ;
+  if (! node)
+    ABORT ("DBFC6AD9 has no user id packet");
+  uid3 = node->pkt->pkt.user_id->name;
+
+  TEST_P ("arena", strcmp (uid1, uid3) == 0);
+
+  release_kbnode (kb3);
+  keydb_release (hd3);
 }
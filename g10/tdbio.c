@@ -117,6 +117,11 @@ static int  db_fd = -1;
 /* A flag indicating that a transaction is active.  */
 static int in_transaction;
 
+/* A counter bumped whenever a record is written or another trustdb
+   is selected.  Users caching information derived from the trustdb
+   compare it to detect stale data.  */
+static ulong write_generation;
+
 
 
 static void open_db (void);
@@ -607,6 +612,7 @@ tdbio_set_dbname (const char *new_dbname, int create, int *r_nofile)
   struct stat statbuf;
   static int initialized = 0;
 
+  write_generation++;
   if (!initialized)
     {
       atexit (cleanup);
@@ -735,6 +741,33 @@ tdbio_get_dbname ()
 }
 
 
+/*
+ * Close the file descriptor of the trustdb so that it will be opened
+ * again on its next use.  This is required in a forked process which
+ * must not share the file offset with its parent.
+ */
+void
+tdbio_reopen (void)
+{
+  if (db_fd != -1)
+    {
+      close (db_fd);
+      db_fd = -1;
+    }
+}
+
+
+/*
+ * Return the current write generation of the trustdb.  The value
+ * changes whenever a record has been written.
+ */
+ulong
+tdbio_get_generation (void)
+{
+  return write_generation;
+}
+
+
 /*
  * Open the trustdb.  This may only be called if it has not yet been
  * opened and after a successful call to tdbio_set_dbname.  On return
@@ -1583,6 +1616,7 @@ tdbio_write_record( TRUSTREC *rec )
   if (db_fd == -1)
     open_db ();
 
+  write_generation++;
   memset (buf, 0, TRUST_RECORD_LEN);
   p = buf;
   *p++ = rec->rectype; p++;
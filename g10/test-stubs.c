@@ -95,6 +95,11 @@ check_trustdb_stale(void)
 {
 }
 
+void
+reopen_trustdb (void)
+{
+}
+
 int
 get_validity_info (PKT_public_key *pk, PKT_user_id *uid)
 {
@@ -101,8 +101,11 @@ struct db
     sqlite3_stmt *get_trust_bindings_with_this_email;
     sqlite3_stmt *get_trust_gather_other_user_ids;
     sqlite3_stmt *get_trust_gather_other_keys;
+    sqlite3_stmt *get_trust_conflict_to_ask;
+    sqlite3_stmt *get_trust_conflict_to_ask2;
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_insert;
+    sqlite3_stmt *show_statistics;
   } s;
 
 #if DEBUG_TOFU_CACHE
@@ -121,6 +124,28 @@ static struct db *db_cache;
 static int db_cache_count;
 #define DB_CACHE_ENTRIES 16
 
+/* An in-memory cache of the policies of the bindings.  When
+   verifying many messages the same few bindings are looked up over
+   and over again; this saves the query and, for bindings with the
+   policy auto, the lookup of the key to check whether it is
+   ultimately trusted.  An entry is dropped whenever a binding with
+   its email address is updated.  */
+struct policy_cache_s
+{
+  struct policy_cache_s *next;
+  enum tofu_policy policy;
+  char *conflict;  /* The conflicting fingerprint or NULL.  */
+  int utk;         /* -1 = not known, 0 = no UTK, 1 = UTK.  */
+  char *email;     /* Points into NAME.  */
+  char name[1];    /* The fingerprint, a Nul and the email address.  */
+};
+typedef struct policy_cache_s *policy_cache_t;
+
+#define POLICY_CACHE_BUCKETS 256
+#define POLICY_CACHE_MAX     4096
+static policy_cache_t policy_cache[POLICY_CACHE_BUCKETS];
+static unsigned int policy_cache_count;
+
 static void tofu_cache_dump (struct db *db) GPGRT_ATTR_USED;
 
 static void
@@ -218,8 +243,30 @@ tofu_policy_to_trust_level (enum tofu_policy policy)
 static int batch_update;
 static time_t batch_update_started;
 
+/* The number of open inner transactions.  The batch transactions may
+   only be committed if there is none.  */
+static int inner_transactions;
+
 static gpg_error_t end_transaction (struct db *db, int only_batch);
 
+/* Commit the batch transactions on all cached connections and on the
+   connections in the list DB.  They are retaken by the next call to
+   begin_transaction.  */
+static void
+commit_batch_transactions (struct db *db)
+{
+  struct db *t;
+
+  for (t = db_cache; t; t = t->next)
+    if (t->batch_update)
+      end_transaction (t, 2);
+  for (t = db; t; t = t->next)
+    if (t->batch_update)
+      end_transaction (t, 2);
+
+  batch_update_started = gnupg_get_time ();
+}
+
 /* Start a transaction on DB.  */
 static gpg_error_t
 begin_transaction (struct db *db, int only_batch)
@@ -227,7 +274,8 @@ begin_transaction (struct db *db, int only_batch)
   int rc;
   char *err = NULL;
 
-  if (batch_update && batch_update_started != gnupg_get_time ())
+  if (batch_update && !inner_transactions
+      && batch_update_started != gnupg_get_time ())
     /* We've been in batch update mode for a while (on average, more
        than 500 ms).  To prevent starving other gpg processes, we drop
        and retake the batch lock.
@@ -235,16 +283,7 @@ begin_transaction (struct db *db, int only_batch)
        Note: if we wanted higher resolution, we could use
        npth_clock_gettime.  */
     {
-      struct db *t;
-
-      for (t = db_cache; t; t = t->next)
-        if (t->batch_update)
-          end_transaction (t, 1);
-      for (t = db; t; t = t->next)
-        if (t->batch_update)
-          end_transaction (t, 1);
-
-      batch_update_started = gnupg_get_time ();
+      commit_batch_transactions (db);
 
       /* Yield to allow another process a chance to run.  */
       sched_yield ();
@@ -293,6 +332,7 @@ begin_transaction (struct db *db, int only_batch)
       return gpg_error (GPG_ERR_GENERAL);
     }
 
+  inner_transactions ++;
   return 0;
 }
 
@@ -326,12 +366,16 @@ end_transaction (struct db *db, int only_batch)
 
       /* Releasing an outer transaction releases an open inner
          transactions.  We're done.  */
+      if (!only_batch && inner_transactions)
+        inner_transactions --;
       return 0;
     }
 
   if (only_batch)
     return 0;
 
+  if (inner_transactions)
+    inner_transactions --;
   rc = sqlite3_stepx (db->db, &db->s.savepoint_inner_commit,
                       NULL, NULL, &err,
                       "release inner;", SQLITE_ARG_END);
@@ -353,6 +397,8 @@ rollback_transaction (struct db *db)
   int rc;
   char *err = NULL;
 
+  if (inner_transactions)
+    inner_transactions --;
   if (db->batch_update)
     /* Just undo the most recent update; don't revert any progress
        made by the batch transaction.  */
@@ -1038,6 +1084,101 @@ closedbs (struct dbs *dbs)
 }
 
 
+static unsigned int
+policy_cache_hash (const char *fingerprint, const char *email)
+{
+  const unsigned char *s;
+  unsigned int h = 0;
+
+  for (s = (const unsigned char *)fingerprint; *s; s++)
+    h = h * 31 + *s;
+  for (s = (const unsigned char *)email; *s; s++)
+    h = h * 31 + *s;
+  return h % POLICY_CACHE_BUCKETS;
+}
+
+/* Return the cache entry for the binding <FINGERPRINT, EMAIL> or NULL
+   if it is not cached.  */
+static policy_cache_t
+policy_cache_get (const char *fingerprint, const char *email)
+{
+  policy_cache_t e;
+
+  for (e = policy_cache[policy_cache_hash (fingerprint, email)]; e;
+       e = e->next)
+    if (!strcmp (e->name, fingerprint) && !strcmp (e->email, email))
+      return e;
+  return NULL;
+}
+
+/* Drop the entries for all bindings with EMAIL from the cache.  If
+   EMAIL is NULL, the entire cache is flushed.  */
+static void
+policy_cache_forget (const char *email)
+{
+  policy_cache_t e, *ep;
+  int i;
+
+  for (i = 0; i < POLICY_CACHE_BUCKETS; i++)
+    for (ep = &policy_cache[i]; (e = *ep); )
+      {
+        if (email && strcmp (e->email, email))
+          {
+            ep = &e->next;
+            continue;
+          }
+        *ep = e->next;
+        xfree (e->conflict);
+        xfree (e);
+        policy_cache_count--;
+      }
+}
+
+/* Store POLICY and CONFLICT for the binding <FINGERPRINT, EMAIL> in
+   the cache.  Caching is best effort; errors are ignored.  */
+static void
+policy_cache_put (const char *fingerprint, const char *email,
+                  enum tofu_policy policy, const char *conflict)
+{
+  policy_cache_t e;
+  unsigned int h;
+
+  if (policy_cache_count >= POLICY_CACHE_MAX)
+    policy_cache_forget (NULL);
+
+  e = xtrymalloc (sizeof *e + strlen (fingerprint) + 1 + strlen (email));
+  if (!e)
+    return;
+  strcpy (e->name, fingerprint);
+  e->email = e->name + strlen (fingerprint) + 1;
+  strcpy (e->email, email);
+  e->policy = policy;
+  e->utk = -1;
+  e->conflict = NULL;
+  if (conflict && *conflict)
+    {
+      e->conflict = xtrystrdup (conflict);
+      if (!e->conflict)
+        {
+          xfree (e);
+          return;
+        }
+    }
+
+  h = policy_cache_hash (fingerprint, email);
+  e->next = policy_cache[h];
+  policy_cache[h] = e;
+  policy_cache_count++;
+}
+
+/* Flush the policy cache.  */
+void
+tofu_flush_caches (void)
+{
+  policy_cache_forget (NULL);
+}
+
+
 /* Collect results of a select min (foo) ...; style query.  Aborts if
    the argument is not a valid integer (or real of the form X.0).  */
 static int
@@ -1094,6 +1235,8 @@ record_binding (struct dbs *dbs, const char *fingerprint, const char *email,
   if (! db_email)
     return gpg_error (GPG_ERR_GENERAL);
 
+  policy_cache_forget (email);
+
   if (opt.tofu_db_format == TOFU_DB_SPLIT)
     /* In the split format, we need to update two DBs.  To keep them
        consistent, we start a transaction on each.  Note: this is the
@@ -1468,6 +1611,20 @@ get_policy (struct dbs *dbs, const char *fingerprint, const char *email,
   strlist_t strlist = NULL;
   char *tail = NULL;
   enum tofu_policy policy = _tofu_GET_POLICY_ERROR;
+  policy_cache_t cached;
+
+  cached = policy_cache_get (fingerprint, email);
+  if (cached)
+    {
+      if (conflict && cached->policy != TOFU_POLICY_NONE)
+        {
+          if (cached->policy == TOFU_POLICY_ASK && cached->conflict)
+            *conflict = xstrdup (cached->conflict);
+          else
+            *conflict = NULL;
+        }
+      return cached->policy;
+    }
 
   db = getdb (dbs, email, DB_EMAIL);
   if (! db)
@@ -1545,6 +1702,10 @@ get_policy (struct dbs *dbs, const char *fingerprint, const char *email,
     }
 
  out:
+  if (policy != _tofu_GET_POLICY_ERROR)
+    policy_cache_put (fingerprint, email, policy,
+                      policy == TOFU_POLICY_NONE? NULL : strlist->next->d);
+
   assert (policy == _tofu_GET_POLICY_ERROR
 	  || policy == TOFU_POLICY_NONE
 	  || policy == TOFU_POLICY_AUTO
@@ -1608,10 +1769,18 @@ get_trust (struct dbs *dbs, const char *fingerprint, const char *email,
   if (policy == TOFU_POLICY_AUTO || policy == TOFU_POLICY_NONE)
     /* See if the key is ultimately trusted.  If so, we're done.  */
     {
+      policy_cache_t cached = policy_cache_get (fingerprint, email);
       PKT_public_key *pk;
       u32 kid[2];
       char fpr_bin[MAX_FINGERPRINT_LEN+1];
       size_t fpr_bin_len;
+      int is_utk;
+
+      if (cached && cached->utk != -1)
+        {
+          is_utk = cached->utk;
+          goto have_utk;
+        }
 
       if (!hex2str (fingerprint, fpr_bin, sizeof fpr_bin, &fpr_bin_len))
         {
@@ -1643,7 +1812,12 @@ get_trust (struct dbs *dbs, const char *fingerprint, const char *email,
       keyid_from_pk (pk, kid);
       free_public_key (pk);
 
-      if (tdb_keyid_is_utk (kid))
+      is_utk = !!tdb_keyid_is_utk (kid);
+      if (cached)
+        cached->utk = is_utk;
+
+    have_utk:
+      if (is_utk)
         {
           if (policy == TOFU_POLICY_NONE)
             {
@@ -2057,6 +2231,10 @@ get_trust (struct dbs *dbs, const char *fingerprint, const char *email,
     if (es_fclose_snatch (fp, (void **) &prompt, NULL))
       log_fatal ("error snatching memory stream\n");
 
+    /* Don't keep other processes waiting while we ask the user.  */
+    if (batch_update && !inner_transactions)
+      commit_batch_transactions (dbs->db);
+
     while (1)
       {
 	char *response;
@@ -2126,19 +2304,26 @@ get_trust (struct dbs *dbs, const char *fingerprint, const char *email,
       if (! may_ask)
 	/* If we weren't allowed to ask, also update this key as
 	   conflicting with itself.  */
-	rc = sqlite3_exec_printf
-	  (db->db, NULL, NULL, &err,
-	   "update bindings set policy = %d, conflict = %Q"
-	   " where email = %Q"
-	   "  and (policy = %d or (policy = %d and fingerprint = %Q));",
-	   TOFU_POLICY_ASK, fingerprint, email, TOFU_POLICY_AUTO,
-	   TOFU_POLICY_ASK, fingerprint);
+	rc = sqlite3_stepx
+	  (db->db, &db->s.get_trust_conflict_to_ask, NULL, NULL, &err,
+	   "update bindings set policy = ?, conflict = ?"
+	   " where email = ?"
+	   "  and (policy = ? or (policy = ? and fingerprint = ?));",
+	   SQLITE_ARG_INT, (int) TOFU_POLICY_ASK,
+           SQLITE_ARG_STRING, fingerprint, SQLITE_ARG_STRING, email,
+           SQLITE_ARG_INT, (int) TOFU_POLICY_AUTO,
+	   SQLITE_ARG_INT, (int) TOFU_POLICY_ASK,
+           SQLITE_ARG_STRING, fingerprint, SQLITE_ARG_END);
       else
-	rc = sqlite3_exec_printf
-	  (db->db, NULL, NULL, &err,
-	   "update bindings set policy = %d, conflict = %Q"
-	   " where email = %Q and fingerprint != %Q and policy = %d;",
-	   TOFU_POLICY_ASK, fingerprint, email, fingerprint, TOFU_POLICY_AUTO);
+	rc = sqlite3_stepx
+	  (db->db, &db->s.get_trust_conflict_to_ask2, NULL, NULL, &err,
+	   "update bindings set policy = ?, conflict = ?"
+	   " where email = ? and fingerprint != ? and policy = ?;",
+	   SQLITE_ARG_INT, (int) TOFU_POLICY_ASK,
+           SQLITE_ARG_STRING, fingerprint, SQLITE_ARG_STRING, email,
+           SQLITE_ARG_STRING, fingerprint,
+           SQLITE_ARG_INT, (int) TOFU_POLICY_AUTO, SQLITE_ARG_END);
+      policy_cache_forget (email);
       if (rc)
 	{
 	  log_error (_("error changing TOFU policy: %s\n"), err);
@@ -2318,19 +2503,19 @@ show_statistics (struct dbs *dbs, const char *fingerprint,
 
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
-  rc = sqlite3_exec_printf
-    (db->db, strings_collect_cb, &strlist, &err,
-     "select count (*), strftime('%%s','now') - min (signatures.time),\n"
-     "  strftime('%%s','now') - max (signatures.time)\n"
+  rc = sqlite3_stepx
+    (db->db, &db->s.show_statistics, strings_collect_cb2, &strlist, &err,
+     "select count (*), strftime('%s','now') - min (signatures.time),\n"
+     "  strftime('%s','now') - max (signatures.time)\n"
      " from signatures\n"
      " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q and sig_digest %s%s%s;",
-     fingerprint, email,
+     " where fingerprint = ? and email = ? and sig_digest is not NULL\n"
      /* We want either: sig_digest != 'SIG_EXCLUDE' or sig_digest is
 	not NULL.  */
-     sig_exclude ? "!= '" : "is not NULL",
-     sig_exclude ? sig_exclude : "",
-     sig_exclude ? "'" : "");
+     "  and (? is NULL or sig_digest != ?);",
+     SQLITE_ARG_STRING, fingerprint, SQLITE_ARG_STRING, email,
+     SQLITE_ARG_STRING, sig_exclude, SQLITE_ARG_STRING, sig_exclude,
+     SQLITE_ARG_END);
   if (rc)
     {
       log_error (_("error reading from TOFU database"
@@ -111,4 +111,8 @@ gpg_error_t tofu_get_policy (PKT_public_key *pk, PKT_user_id *user_id,
 void tofu_begin_batch_update (void);
 void tofu_end_batch_update (void);
 
+/* Flush the in-memory caches; e.g. because another process may have
+   changed the database.  */
+void tofu_flush_caches (void);
+
 #endif /*G10_TOFU_H*/
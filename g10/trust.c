@@ -33,6 +33,7 @@
 #include "main.h"
 #include "i18n.h"
 #include "trustdb.h"
+#include "tofu.h"
 #include "host2net.h"
 
 
@@ -283,6 +284,32 @@ check_trustdb_stale (void)
 }
 
 
+/* Re-open the trustdb on its next use.  This needs to be called by a
+   forked process.  */
+void
+reopen_trustdb (void)
+{
+#ifndef NO_TRUST_MODELS
+  tdb_reopen ();
+#endif
+}
+
+
+/* Flush the in-memory caches of the trustdb and the TOFU database.
+   A server calls this before each command so that changes done by
+   other processes are seen.  */
+void
+flush_trust_caches (void)
+{
+#ifndef NO_TRUST_MODELS
+  tdb_flush_caches ();
+#endif
+#ifdef USE_TOFU
+  tofu_flush_caches ();
+#endif
+}
+
+
 void
 check_or_update_trustdb (void)
 {
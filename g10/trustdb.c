@@ -71,6 +71,32 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 
 static int pending_check_trustdb;
 
+/* The validity cache.  It holds the ownertrust values and the
+   validity of the user IDs as stored in the trustdb for recently
+   used keys.  This avoids walking the trust and validity records for
+   each user ID when listing keys.  The cache is flushed whenever the
+   trustdb has been written.  */
+#define VALIDITY_CACHE_BUCKETS 1024
+#define VALIDITY_CACHE_MAX_ENTRIES 8192
+struct validity_cache_s
+{
+  struct validity_cache_s *next;
+  byte fpr[20];            /* The fingerprint padded with zeroes.  */
+  int found;               /* True if there is a trust record.  */
+  byte ownertrust;         /* The ownertrust of the trust record.  */
+  byte min_ownertrust;     /* The min_ownertrust of the trust record.  */
+  unsigned int nuids;      /* The number of items in UIDS.  */
+  struct
+  {
+    byte namehash[20];
+    byte validity;
+  } uids[1];
+};
+typedef struct validity_cache_s *validity_cache_t;
+static validity_cache_t validity_cache[VALIDITY_CACHE_BUCKETS];
+static unsigned int validity_cache_entries;
+static ulong validity_cache_generation;
+
 static int validate_keys (int interactive);
 
 
@@ -634,6 +660,110 @@ read_trust_record (PKT_public_key *pk, TRUSTREC *rec)
   return 0;
 }
 
+
+/* Remove all entries from the validity cache.  */
+static void
+flush_validity_cache (void)
+{
+  validity_cache_t vc, vc2;
+  int i;
+
+  if (!validity_cache_entries)
+    return;
+
+  for (i=0; i < VALIDITY_CACHE_BUCKETS; i++)
+    {
+      for (vc = validity_cache[i]; vc; vc = vc2)
+        {
+          vc2 = vc->next;
+          xfree (vc);
+        }
+      validity_cache[i] = NULL;
+    }
+  validity_cache_entries = 0;
+}
+
+
+/*
+ * Return the cached trustdb information for the primary key PK at
+ * R_VC.  On a cache miss the trust record and the validity records
+ * of PK are read and put into the cache.  If there is no trust record
+ * for PK, an entry with FOUND cleared is returned.
+ */
+static gpg_error_t
+get_validity_cache (PKT_public_key *pk, validity_cache_t *r_vc)
+{
+  gpg_error_t err;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  unsigned int hash;
+  validity_cache_t vc;
+  TRUSTREC trec, vrec;
+  ulong recno;
+  unsigned int n;
+
+  *r_vc = NULL;
+
+  if (validity_cache_generation != tdbio_get_generation ())
+    {
+      flush_validity_cache ();
+      validity_cache_generation = tdbio_get_generation ();
+    }
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  for (; fprlen < 20; fprlen++)
+    fpr[fprlen] = 0;
+  hash = ((fpr[18] << 8) | fpr[19]) % VALIDITY_CACHE_BUCKETS;
+
+  for (vc = validity_cache[hash]; vc; vc = vc->next)
+    if (!memcmp (vc->fpr, fpr, 20))
+      {
+        *r_vc = vc;
+        return 0;
+      }
+
+  err = read_trust_record (pk, &trec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      n = 0;
+      trec.r.trust.validlist = 0;
+      trec.r.trust.ownertrust = 0;
+      trec.r.trust.min_ownertrust = 0;
+    }
+  else if (err)
+    return err;
+  else
+    {
+      for (n = 0, recno = trec.r.trust.validlist; recno;
+           recno = vrec.r.valid.next, n++)
+        read_record (recno, &vrec, RECTYPE_VALID);
+    }
+
+  if (validity_cache_entries >= VALIDITY_CACHE_MAX_ENTRIES)
+    flush_validity_cache ();
+
+  vc = xmalloc (sizeof *vc + (n? n - 1 : 0) * sizeof vc->uids[0]);
+  memcpy (vc->fpr, fpr, 20);
+  vc->found = !err;
+  vc->ownertrust = trec.r.trust.ownertrust;
+  vc->min_ownertrust = trec.r.trust.min_ownertrust;
+  vc->nuids = n;
+  for (n = 0, recno = trec.r.trust.validlist; recno;
+       recno = vrec.r.valid.next, n++)
+    {
+      /* The records are in the tdbio cache now.  */
+      read_record (recno, &vrec, RECTYPE_VALID);
+      memcpy (vc->uids[n].namehash, vrec.r.valid.namehash, 20);
+      vc->uids[n].validity = vrec.r.valid.validity;
+    }
+  vc->next = validity_cache[hash];
+  validity_cache[hash] = vc;
+  validity_cache_entries++;
+
+  *r_vc = vc;
+  return 0;
+}
+
 /****************
  * Return the assigned ownertrust value for the given public key.
  * The key should be the primary key.
@@ -641,44 +771,44 @@ read_trust_record (PKT_public_key *pk, TRUSTREC *rec)
 unsigned int
 tdb_get_ownertrust ( PKT_public_key *pk)
 {
-  TRUSTREC rec;
+  validity_cache_t vc;
   gpg_error_t err;
 
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return TRUST_UNKNOWN;
 
-  err = read_trust_record (pk, &rec);
-  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
-    return TRUST_UNKNOWN; /* no record yet */
+  err = get_validity_cache (pk, &vc);
   if (err)
     {
       tdbio_invalid ();
       return TRUST_UNKNOWN; /* actually never reached */
     }
+  if (!vc->found)
+    return TRUST_UNKNOWN; /* no record yet */
 
-  return rec.r.trust.ownertrust;
+  return vc->ownertrust;
 }
 
 
 unsigned int
 tdb_get_min_ownertrust (PKT_public_key *pk)
 {
-  TRUSTREC rec;
+  validity_cache_t vc;
   gpg_error_t err;
 
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return TRUST_UNKNOWN;
 
-  err = read_trust_record (pk, &rec);
-  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
-    return TRUST_UNKNOWN; /* no record yet */
+  err = get_validity_cache (pk, &vc);
   if (err)
     {
       tdbio_invalid ();
       return TRUST_UNKNOWN; /* actually never reached */
     }
+  if (!vc->found)
+    return TRUST_UNKNOWN; /* no record yet */
 
-  return rec.r.trust.min_ownertrust;
+  return vc->min_ownertrust;
 }
 
 
@@ -940,6 +1070,24 @@ tdb_cache_disabled_value (PKT_public_key *pk)
 }
 
 
+/* Make sure that the trustdb is opened again on its next use.  */
+void
+tdb_reopen (void)
+{
+  tdbio_reopen ();
+}
+
+
+/* Flush the in-memory caches of the trustdb.  This is used by a
+   long running process because another process may have changed the
+   trustdb.  */
+void
+tdb_flush_caches (void)
+{
+  flush_validity_cache ();
+}
+
+
 void
 tdb_check_trustdb_stale (void)
 {
@@ -989,9 +1137,7 @@ tdb_get_validity_core (PKT_public_key *pk, PKT_user_id *uid,
 		       PKT_signature *sig,
 		       int may_ask)
 {
-  TRUSTREC trec, vrec;
   gpg_error_t err;
-  ulong recno;
 #ifdef USE_TOFU
   unsigned int tofu_validity = TRUST_UNKNOWN;
 #endif
@@ -1099,13 +1245,16 @@ tdb_get_validity_core (PKT_public_key *pk, PKT_user_id *uid,
       || opt.trust_model == TM_CLASSIC
       || opt.trust_model == TM_PGP)
     {
-      err = read_trust_record (main_pk, &trec);
-      if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+      validity_cache_t vc;
+      unsigned int n;
+
+      err = get_validity_cache (main_pk, &vc);
+      if (err)
 	{
 	  tdbio_invalid ();
 	  return 0;
 	}
-      if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+      if (!vc->found)
 	{
 	  /* No record found.  */
 	  validity = TRUST_UNKNOWN;
@@ -1113,21 +1262,18 @@ tdb_get_validity_core (PKT_public_key *pk, PKT_user_id *uid,
 	}
 
       /* Loop over all user IDs */
-      recno = trec.r.trust.validlist;
       validity = 0;
-      while (recno)
+      for (n = 0; n < vc->nuids; n++)
 	{
-	  read_record (recno, &vrec, RECTYPE_VALID);
-
 	  if(uid)
 	    {
 	      /* If a user ID is given we return the validity for that
 		 user ID ONLY.  If the namehash is not found, then
 		 there is no validity at all (i.e. the user ID wasn't
 		 signed). */
-	      if(memcmp(vrec.r.valid.namehash,uid->namehash,20)==0)
+	      if(memcmp(vc->uids[n].namehash,uid->namehash,20)==0)
 		{
-		  validity=(vrec.r.valid.validity & TRUST_MASK);
+		  validity=(vc->uids[n].validity & TRUST_MASK);
 		  break;
 		}
 	    }
@@ -1135,14 +1281,12 @@ tdb_get_validity_core (PKT_public_key *pk, PKT_user_id *uid,
 	    {
 	      /* If no user ID is given, we take the maximum validity
 		 over all user IDs */
-	      if (validity < (vrec.r.valid.validity & TRUST_MASK))
-		validity = (vrec.r.valid.validity & TRUST_MASK);
+	      if (validity < (vc->uids[n].validity & TRUST_MASK))
+		validity = (vc->uids[n].validity & TRUST_MASK);
 	    }
-
-	  recno = vrec.r.valid.next;
 	}
 
-      if ((trec.r.trust.ownertrust & TRUST_FLAG_DISABLED))
+      if ((vc->ownertrust & TRUST_FLAG_DISABLED))
 	{
 	  validity |= TRUST_FLAG_DISABLED;
 	  pk->flags.disabled = 1;
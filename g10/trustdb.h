@@ -89,6 +89,8 @@ int clear_ownertrusts (PKT_public_key *pk);
 
 void revalidation_mark (void);
 void check_trustdb_stale (void);
+void reopen_trustdb (void);
+void flush_trust_caches (void);
 void check_or_update_trustdb (void);
 
 unsigned int get_validity (PKT_public_key *pk, PKT_user_id *uid,
@@ -119,6 +121,8 @@ int setup_trustdb( int level, const char *dbname );
 void how_to_fix_the_trustdb (void);
 void init_trustdb( void );
 void tdb_check_trustdb_stale (void);
+void tdb_reopen (void);
+void tdb_flush_caches (void);
 void sync_trustdb( void );
 
 void tdb_revalidation_mark (void);
@@ -49,7 +49,8 @@
    - u32  RFU
    - u32  file_created_at
    - u32  last_maintenance_run
-   - u32  RFU
+   - u32  Number of bytes in blobs flagged as deleted since the last
+          maintenance run.  This is used to schedule a compress run.
    - u32  RFU
 
 ** The OpenPGP and X.509 blobs
@@ -1041,6 +1042,9 @@ _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp)
       blob->blob[20+2] = (val >>  8);
       blob->blob[20+3] = (val      );
 
+      /* A maintenance run removes all deleted blobs.  */
+      memset (blob->blob+24, 0, 4);
+
       if (for_openpgp)
         blob->blob[7] |= 0x02;  /* OpenPGP data may be available.  */
     }
@@ -94,6 +94,8 @@ struct keybox_handle {
   int error;
   int ephemeral;
   int for_openpgp;        /* Used by gpg.  */
+  off_t read_limit;       /* Ignore blobs at or after this offset.  */
+  off_t read_skip;        /* Ignore the blob at this offset.  */
   struct keybox_found_s found;
   struct keybox_found_s saved_found;
   struct {
@@ -183,6 +185,10 @@ int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp);
 int _keybox_read_blob2 (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
 
+/*-- keybox-update.c --*/
+void _keybox_get_read_limits (const char *fname, FILE *fp,
+                              off_t *r_limit, off_t *r_skip);
+
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
@@ -89,6 +89,8 @@ do_keybox_new (KB_NAME resource, int secret, int for_openpgp)
     {
       hd->kb = resource;
       hd->secret = !!secret;
+      hd->read_limit = (off_t)(-1);
+      hd->read_skip = (off_t)(-1);
       hd->for_openpgp = for_openpgp;
       if (!resource->handle_table)
         {
@@ -36,6 +36,13 @@
                      *(p) <= 'F'? (*(p)-'A'+10):(*(p)-'a'+10))
 #define xtoi_2(p)   ((xtoi_1(p) * 16) + xtoi_1((p)+1))
 
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+# define fseeko(a,b,c) fseek ((a), (long)(b), (c))
+#endif
+#if !defined(HAVE_FTELLO) && !defined(ftello)
+# define ftello(a)     ((off_t)ftell ((a)))
+#endif
+
 
 struct sn_array_s {
     int snlen;
@@ -757,6 +764,48 @@ keybox_search_reset (KEYBOX_HANDLE hd)
 }
 
 
+/* Open the keybox file of HD for reading.  */
+static gpg_error_t
+open_file (KEYBOX_HANDLE hd)
+{
+  hd->fp = fopen (hd->kb->fname, "rb");
+  if (!hd->fp)
+    return gpg_error_from_syserror ();
+  _keybox_get_read_limits (hd->kb->fname, hd->fp,
+                           &hd->read_limit, &hd->read_skip);
+  return 0;
+}
+
+
+/* Return the position of the scan of HD.  This is the file offset
+   of the blob following the one found by the last search.  */
+off_t
+keybox_offset (KEYBOX_HANDLE hd)
+{
+  if (!hd->fp)
+    return 0;
+  return ftello (hd->fp);
+}
+
+
+/* Continue the scan of HD at file offset OFFSET, which must have been
+   returned by keybox_offset.  A following search for the next blob
+   starts at this blob.  */
+gpg_error_t
+keybox_seek (KEYBOX_HANDLE hd, off_t offset)
+{
+  keybox_search_reset (hd);
+  if (!offset)
+    return 0;
+
+  if ((hd->error = open_file (hd)))
+    return hd->error;
+  if (fseeko (hd->fp, offset, SEEK_SET))
+    return (hd->error = gpg_error_from_syserror ());
+  return 0;
+}
+
+
 /* Note: When in ephemeral mode the search function does visit all
    blobs but in standard mode, blobs flagged as ephemeral are ignored.
    If WANT_BLOBTYPE is not 0 only blobs of this type are considered.
@@ -819,10 +868,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (!hd->fp)
     {
-      hd->fp = fopen (hd->kb->fname, "rb");
-      if (!hd->fp)
+      hd->error = open_file (hd);
+      if (hd->error)
         {
-          hd->error = gpg_error_from_syserror ();
           xfree (sn_array);
           return hd->error;
         }
@@ -896,6 +944,12 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
+      if (hd->read_limit != (off_t)(-1)
+          && ftello (hd->fp) >= hd->read_limit)
+        {
+          rc = -1;  /* Treat the rest of the file as not existing.  */
+          break;
+        }
       rc = _keybox_read_blob (&blob, hd->fp);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
@@ -904,9 +958,21 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
           continue; /* Skip too large records.  */
         }
 
+      if (rc && rc != -1 && hd->read_limit != (off_t)(-1)
+          && ftello (hd->fp) > hd->read_limit)
+        rc = -1;  /* A partly written blob after deleted ones.  */
       if (rc)
         break;
 
+      if (hd->read_limit != (off_t)(-1)
+          && _keybox_get_blob_fileoffset (blob) >= hd->read_limit)
+        {
+          rc = -1;
+          break;
+        }
+      if (_keybox_get_blob_fileoffset (blob) == hd->read_skip)
+        continue;  /* Replaced by a blob of an interrupted update.  */
+
       blobtype = blob_get_type (blob);
       if (blobtype == KEYBOX_BLOBTYPE_HEADER)
         continue;
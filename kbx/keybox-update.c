@@ -25,10 +25,12 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
 #include "../common/host2net.h"
+#include "../common/logging.h"
 
 #define EXTSEP_S "."
 
@@ -36,6 +38,14 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* The journal file used by blob_append.  It has a fixed length and
+   consists of the magic "KBXJ", the original length of the keybox
+   (8 bytes), the length of the appended blob (4 bytes) and the offset
+   of the blob to be marked as deleted (8 bytes, all ones if none).
+   All numbers are big endian.  */
+#define JOURNAL_MAGIC   "KBXJ"
+#define JOURNAL_LENGTH  24
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -212,6 +222,424 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
 
 
+/* Return a malloced string with the name of the journal file for the
+   keybox FNAME or NULL on error.  */
+static char *
+journal_fname (const char *fname)
+{
+  char *jname;
+
+# ifdef USE_ONLY_8DOT3
+  if (strlen (fname) > 4
+      && !strcmp (fname+strlen(fname)-4, EXTSEP_S "kbx") )
+    {
+      jname = xtrymalloc (strlen (fname) + 1);
+      if (jname)
+        {
+          strcpy (jname, fname);
+          strcpy (jname+strlen(fname)-4, EXTSEP_S "kbj");
+        }
+      return jname;
+    }
+# endif /* USE_ONLY_8DOT3 */
+  jname = xtrymalloc (strlen (fname) + 5);
+  if (jname)
+    strcpy (stpcpy (jname, fname), EXTSEP_S "jnl");
+  return jname;
+}
+
+
+/* Flush FP and make sure that the data has been written to disk.  */
+static gpg_error_t
+sync_file (FILE *fp)
+{
+  if (fflush (fp))
+    return gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  if (fsync (fileno (fp)))
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
+
+
+/* Mark the blob at offset OFF of the keybox FP as deleted.  This is
+   done by setting the blob type to 0 which makes the reading
+   functions skip it.  The length of the blob is added to the count
+   of deleted bytes in the header blob, which is used to decide when
+   to compress the file.  */
+static gpg_error_t
+mark_blob_deleted (FILE *fp, off_t off)
+{
+  unsigned char buf[28];
+  size_t bloblen;
+  u32 deleted;
+
+  if (fseeko (fp, off, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fread (buf, 5, 1, fp) != 1)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  if (!buf[4])
+    return 0;  /* Already deleted.  */
+  bloblen = buf32_to_size_t (buf);
+  if (fseeko (fp, off + 4, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (putc (0, fp) == EOF)
+    return gpg_error_from_syserror ();
+
+  if (fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fread (buf, 28, 1, fp) != 1
+      || buf[4] != KEYBOX_BLOBTYPE_HEADER || buf32_to_size_t (buf) < 32)
+    return 0;  /* No header blob; the count is only a hint.  */
+  deleted = buf32_to_u32 (buf+24);
+  deleted = deleted + bloblen < deleted? 0xffffffff : deleted + bloblen;
+  buf[0] = deleted >> 24;
+  buf[1] = deleted >> 16;
+  buf[2] = deleted >>  8;
+  buf[3] = deleted;
+  if (fseeko (fp, 24, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fwrite (buf, 4, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Write the journal JNAME for an append operation.  */
+static gpg_error_t
+write_journal (const char *jname,
+               off_t origlen, size_t bloblen, off_t old_offset)
+{
+  unsigned char image[JOURNAL_LENGTH];
+  unsigned long long val;
+  FILE *fp;
+  gpg_error_t err;
+  int i;
+
+  memcpy (image, JOURNAL_MAGIC, 4);
+  val = origlen;
+  for (i=0; i < 8; i++)
+    image[4+i] = val >> (8 * (7 - i));
+  image[12] = bloblen >> 24;
+  image[13] = bloblen >> 16;
+  image[14] = bloblen >>  8;
+  image[15] = bloblen;
+  val = old_offset == (off_t)(-1)? ~0ULL : (unsigned long long)old_offset;
+  for (i=0; i < 8; i++)
+    image[16+i] = val >> (8 * (7 - i));
+
+  fp = fopen (jname, "wb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fwrite (image, JOURNAL_LENGTH, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  else
+    err = sync_file (fp);
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    gnupg_remove (jname);
+  return err;
+}
+
+
+/* Read the journal JNAME.  Returns GPG_ERR_ENOENT if there is no
+   journal and GPG_ERR_NO_DATA if the journal has not been written
+   completely; in the latter case the keybox has not yet been
+   changed.  */
+static gpg_error_t
+read_journal (const char *jname,
+              off_t *r_origlen, size_t *r_bloblen, off_t *r_old_offset)
+{
+  unsigned char image[JOURNAL_LENGTH];
+  unsigned long long val;
+  FILE *fp;
+  int i;
+
+  fp = fopen (jname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fread (image, JOURNAL_LENGTH, 1, fp) != 1
+      || memcmp (image, JOURNAL_MAGIC, 4))
+    {
+      fclose (fp);
+      return gpg_error (GPG_ERR_NO_DATA);
+    }
+  fclose (fp);
+
+  for (val=0, i=0; i < 8; i++)
+    val = (val << 8) | image[4+i];
+  *r_origlen = val;
+  *r_bloblen = buf32_to_size_t (image+12);
+  for (val=0, i=0; i < 8; i++)
+    val = (val << 8) | image[16+i];
+  *r_old_offset = val == ~0ULL? (off_t)(-1) : (off_t)val;
+  return 0;
+}
+
+
+/* Return true if the keybox FP of length CURLEN holds a complete blob
+   of length BLOBLEN at offset ORIGLEN.  */
+static int
+journal_blob_complete (FILE *fp, off_t curlen, off_t origlen, size_t bloblen)
+{
+  unsigned char head[4];
+
+  if (curlen < origlen + (off_t)bloblen || bloblen < 5)
+    return 0;
+  if (fseeko (fp, origlen, SEEK_SET))
+    return 0;
+  return (fread (head, 4, 1, fp) == 1 && buf32_to_size_t (head) == bloblen);
+}
+
+
+/* Check whether a journal exists for the keybox FNAME and if so
+   finish the interrupted append operation.  If the new blob has
+   been written completely, the replaced blob is marked as deleted;
+   otherwise the keybox is truncated to its original length.  */
+static gpg_error_t
+recover_journal (const char *fname)
+{
+  gpg_error_t err = 0;
+  char *jname;
+  FILE *fp = NULL;
+  off_t origlen, old_offset, curlen;
+  size_t bloblen;
+  int complete;
+
+  jname = journal_fname (fname);
+  if (!jname)
+    return gpg_error_from_syserror ();
+
+  err = read_journal (jname, &origlen, &bloblen, &old_offset);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    {
+      xfree (jname);
+      return 0;
+    }
+  if (err)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    {
+      if (errno == ENOENT)
+        goto leave;
+      err = gpg_error_from_syserror ();
+      goto leave_keep;
+    }
+
+  if (fseeko (fp, 0, SEEK_END) || (curlen = ftello (fp)) == (off_t)(-1))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave_keep;
+    }
+
+  complete = journal_blob_complete (fp, curlen, origlen, bloblen);
+  if (complete)
+    {
+      if (old_offset != (off_t)(-1))
+        err = mark_blob_deleted (fp, old_offset);
+    }
+  else if (curlen > origlen)
+    {
+      fflush (fp);
+      if (ftruncate (fileno (fp), origlen))
+        err = gpg_error_from_syserror ();
+    }
+  if (!err)
+    err = sync_file (fp);
+  if (err)
+    goto leave_keep;
+
+  log_info ("keybox '%s': %s interrupted update\n",
+            fname, complete? "completed":"rolled back");
+
+ leave:
+  gnupg_remove (jname);
+ leave_keep:
+  if (fp)
+    fclose (fp);
+  xfree (jname);
+  return err;
+}
+
+
+/* Determine which part of the keybox FP, which has just been opened
+   for reading, may be used.  FNAME is the name of the keybox.  Blobs
+   at or after offset R_LIMIT shall be ignored as well as a blob at
+   offset R_SKIP (which is set to -1 if not needed).  This takes
+   care of an append operation which is in progress or has been
+   interrupted: A reader sees either the keybox before the append or
+   after it, but never a partly written blob or both the old and the
+   new version of an updated keyblock.  */
+void
+_keybox_get_read_limits (const char *fname, FILE *fp,
+                         off_t *r_limit, off_t *r_skip)
+{
+  struct stat st;
+  char *jname;
+  off_t origlen, old_offset;
+  size_t bloblen;
+
+  *r_limit = (off_t)(-1);
+  *r_skip = (off_t)(-1);
+
+  /* Take the length before looking at the journal; a journal is
+     always written before the keybox is changed.  */
+  if (fstat (fileno (fp), &st))
+    return;
+  *r_limit = st.st_size;
+
+  jname = journal_fname (fname);
+  if (!jname)
+    return;
+  if (!read_journal (jname, &origlen, &bloblen, &old_offset)
+      && origlen <= st.st_size)
+    {
+      if (journal_blob_complete (fp, st.st_size, origlen, bloblen))
+        {
+          *r_limit = origlen + bloblen;
+          *r_skip = old_offset;
+        }
+      else
+        *r_limit = origlen;
+      fseeko (fp, 0, SEEK_SET);
+    }
+  xfree (jname);
+}
+
+
+/* Set the last maintenance run time stamp in the header blob of the
+   keybox FNAME to the current time.  Errors are ignored.  */
+static void
+update_maint_stamp (const char *fname)
+{
+  unsigned char buf[28];
+  u32 now = time (NULL);
+  FILE *fp;
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    return;
+  if (fread (buf, 28, 1, fp) == 1
+      && buf[4] == KEYBOX_BLOBTYPE_HEADER && buf32_to_size_t (buf) >= 32
+      && !fseeko (fp, 20, SEEK_SET))
+    {
+      buf[0] = now >> 24;
+      buf[1] = now >> 16;
+      buf[2] = now >>  8;
+      buf[3] = now;
+      fwrite (buf, 4, 1, fp);
+    }
+  fclose (fp);
+}
+
+
+/* Compress the keybox of HD if it has too many deleted blobs.
+   Errors are ignored because the keybox is still usable.  */
+static void
+maybe_compress (KEYBOX_HANDLE hd)
+{
+  gpg_error_t err;
+
+  if (hd->secret)
+    return;
+  err = keybox_compress (hd);
+  if (err)
+    log_info ("keybox '%s': compress failed: %s\n",
+              hd->kb->fname, gpg_strerror (err));
+}
+
+
+/* Append BLOB to the existing keybox FNAME and if OLD_OFFSET is not
+   -1 mark the blob at that offset as deleted.  A journal is used so
+   that an interrupted operation can be finished by the next write
+   operation.  FOR_OPENPGP indicates that this is called due to an
+   OpenPGP keyblock change.  Returns GPG_ERR_ENOENT if the keybox does
+   not yet exist.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int for_openpgp,
+             off_t old_offset)
+{
+  gpg_error_t err;
+  char *jname = NULL;
+  FILE *fp;
+  unsigned char header[8];
+  off_t origlen;
+  size_t bloblen;
+
+  err = recover_journal (fname);
+  if (err)
+    return err;
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  /* If this is for OpenPGP, make sure that the openpgp flag is set in
+     the header.  */
+  if (for_openpgp
+      && fread (header, sizeof header, 1, fp) == 1
+      && header[4] == KEYBOX_BLOBTYPE_HEADER
+      && !(header[7] & 0x02))
+    {
+      if (fseeko (fp, 7, SEEK_SET)
+          || putc (header[7] | 0x02, fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  if (fseeko (fp, 0, SEEK_END) || (origlen = ftello (fp)) == (off_t)(-1))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  _keybox_get_blob_image (blob, &bloblen);
+
+  jname = journal_fname (fname);
+  if (!jname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = write_journal (jname, origlen, bloblen, old_offset);
+  if (err)
+    goto leave;
+
+  err = _keybox_write_blob (blob, fp);
+  if (!err)
+    err = sync_file (fp);
+  if (!err && old_offset != (off_t)(-1))
+    {
+      err = mark_blob_deleted (fp, old_offset);
+      if (!err)
+        err = sync_file (fp);
+    }
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  fp = NULL;
+
+  /* On error we keep the journal so that the next write operation
+     cleans up.  */
+  if (!err)
+    gnupg_remove (jname);
+
+ leave:
+  if (fp)
+    fclose (fp);
+  xfree (jname);
+  return err;
+}
+
+
+
 /* Perform insert/delete/update operation.  MODE is one of
    FILECOPY_INSERT, FILECOPY_DELETE, FILECOPY_UPDATE.  FOR_OPENPGP
    indicates that this is called due to an OpenPGP keyblock change.  */
@@ -448,7 +876,9 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      err = blob_append (fname, blob, 1, (off_t)(-1));
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -498,11 +928,15 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
                                      NULL, hd->ephemeral);
   _keybox_destroy_openpgp_info (&info);
 
-  /* Update the keyblock.  */
+  /* Update the keyblock.  The new blob is appended and the old one
+     marked as deleted; keybox_compress will eventually reclaim the
+     space.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      err = blob_append (fname, blob, 1, off);
       _keybox_release_blob (blob);
+      if (!err)
+        maybe_compress (hd);
     }
   return err;
 }
@@ -534,7 +968,9 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      rc = blob_append (fname, blob, 0, (off_t)(-1));
+      if (gpg_err_code (rc) == GPG_ERR_ENOENT)
+        rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -597,6 +1033,9 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  ec = gpg_err_code (recover_journal (fname));
+  if (ec)
+    return gpg_error (ec);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -659,19 +1098,16 @@ keybox_delete (KEYBOX_HANDLE hd)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
-  off += 4;
 
   _keybox_close_file (hd);
+  rc = recover_journal (fname);
+  if (rc)
+    return rc;
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
 
-  if (fseeko (fp, off, SEEK_SET))
-    rc = gpg_error_from_syserror ();
-  else if (putc (0, fp) == EOF)
-    rc = gpg_error_from_syserror ();
-  else
-    rc = 0;
+  rc = mark_blob_deleted (fp, off);
 
   if (fclose (fp))
     {
@@ -679,6 +1115,8 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  if (!rc)
+    maybe_compress (hd);
   return rc;
 }
 
@@ -716,6 +1154,11 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (access (fname, W_OK))
     return gpg_error_from_syserror ();
 
+  /* Finish an interrupted append operation before we copy the file.  */
+  rc = recover_journal (fname);
+  if (rc)
+    return rc;
+
   fp = fopen (fname, "rb");
   if (!fp && errno == ENOENT)
     return 0; /* Ready. File has been deleted right after the access above. */
@@ -726,18 +1169,23 @@ keybox_compress (KEYBOX_HANDLE hd)
     }
 
   /* A quick test to see if we need to compress the file at all.  We
-     schedule a compress run after 3 hours. */
+     schedule a compress run after 3 hours or if deleted blobs take
+     more than half of the file. */
   if ( !_keybox_read_blob (&blob, fp) )
     {
       const unsigned char *buffer;
       size_t length;
+      struct stat st;
 
       buffer = _keybox_get_blob_image (blob, &length);
-      if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+      if (length >= 32 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           u32 last_maint = buf32_to_u32 (buffer+20);
+          u32 deleted = buf32_to_u32 (buffer+24);
 
-          if ( (last_maint + 3*3600) > time (NULL) )
+          if ( (last_maint + 3*3600) > time (NULL)
+               && !(!fstat (fileno (fp), &st)
+                    && (off_t)deleted > st.st_size / 2))
             {
               fclose (fp);
               _keybox_release_blob (blob);
@@ -847,9 +1295,15 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (fclose(newfp) && !rc)
     rc = gpg_error_from_syserror ();
 
-  /* Rename or remove the temporary file. */
+  /* Rename or remove the temporary file.  If nothing changed we
+     only update the maintenance time stamp so that the next quick
+     test does not need to scan the file again.  */
   if (rc || !any_changes)
-    gnupg_remove (tmpfname);
+    {
+      gnupg_remove (tmpfname);
+      if (!rc)
+        update_maint_stamp (fname);
+    }
   else
     rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
 
@@ -63,8 +63,10 @@
 
 #include "iso7816.h"
 #include "apdu.h"
+#include "atr.h"
 #define CCID_DRIVER_INCLUDE_USB_IDS 1
 #include "ccid-driver.h"
+#include "simcard.h"
 
 /* Due to conflicting use of threading libraries we usually can't link
    against libpcsclite if we are using Pth.  Instead we use a wrapper
@@ -76,7 +78,7 @@
 #endif
 
 
-#define MAX_READER 4 /* Number of readers we support concurrently. */
+#define MAX_READER 8 /* Number of readers we support concurrently. */
 
 
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -104,6 +106,8 @@ struct reader_table_s {
   int (*shutdown_reader)(int);
   int (*reset_reader)(int);
   int (*get_status_reader)(int, unsigned int *);
+  int (*wait_status_change)(int, int, int *);
+  void (*cancel_wait)(int);
   int (*send_apdu_reader)(int,unsigned char *,size_t,
                           unsigned char *, size_t *, pininfo_t *);
   int (*check_pinpad)(int, int, pininfo_t *);
@@ -123,6 +127,8 @@ struct reader_table_s {
     pcsc_dword_t modify_ioctl;
     int pinmin;
     int pinmax;
+    long wait_context;        /* Extra context for blocking waits.  */
+    pcsc_dword_t wait_state;  /* Last state seen by the waiter.  */
 #ifdef NEED_PCSC_WRAPPER
     int req_fd;
     int rsp_fd;
@@ -134,6 +140,9 @@ struct reader_table_s {
     rapdu_t handle;
   } rapdu;
 #endif /*USE_G10CODE_RAPDU*/
+  struct {
+    simcard_t handle;
+  } sim;
   char *rdrname;     /* Name of the connected reader or NULL if unknown. */
   int any_status;    /* True if we have seen any status.  */
   int last_status;
@@ -143,11 +152,16 @@ struct reader_table_s {
   int pinpad_varlen_supported;  /* True if we know that the reader
                                    supports variable length pinpad
                                    input.  */
+  int exlen_max;     /* Max. data length of an extended length APDU
+                        the reader can transfer or 0 if not supported.  */
+  unsigned int roundtrips;  /* Number of APDUs exchanged so far.  */
   unsigned char atr[33];
   size_t atrlen;           /* A zero length indicates that the ATR has
                               not yet been read; i.e. the card is not
                               ready for use. */
   unsigned int change_counter;
+  int waiting;             /* True while a thread blocks in
+                              apdu_wait_status_change.  */
 #ifdef USE_NPTH
   int lock_initialized;
   npth_mutex_t lock;
@@ -267,6 +281,7 @@ static char (* DLSTDCALL CT_close) (unsigned short ctn);
 #define PCSCv2_PART10_PROPERTY_bTimeOut2                 3
 #define PCSCv2_PART10_PROPERTY_bMinPINSize               6
 #define PCSCv2_PART10_PROPERTY_bMaxPINSize               7
+#define PCSCv2_PART10_PROPERTY_dwMaxAPDUDataSize        10
 #define PCSCv2_PART10_PROPERTY_wIdVendor                11
 #define PCSCv2_PART10_PROPERTY_wIdProduct               12
 
@@ -317,6 +332,7 @@ long (* DLSTDCALL pcsc_get_status_change) (long context,
                                            pcsc_dword_t timeout,
                                            pcsc_readerstate_t readerstates,
                                            pcsc_dword_t nreaderstates);
+long (* DLSTDCALL pcsc_cancel) (long context);
 long (* DLSTDCALL pcsc_connect) (long context,
                                  const char *reader,
                                  pcsc_dword_t share_mode,
@@ -464,6 +480,8 @@ new_reader_slot (void)
   reader_table[reader].shutdown_reader = NULL;
   reader_table[reader].reset_reader = NULL;
   reader_table[reader].get_status_reader = NULL;
+  reader_table[reader].wait_status_change = NULL;
+  reader_table[reader].cancel_wait = NULL;
   reader_table[reader].send_apdu_reader = NULL;
   reader_table[reader].check_pinpad = check_pcsc_pinpad;
   reader_table[reader].dump_status_reader = NULL;
@@ -477,6 +495,11 @@ new_reader_slot (void)
   reader_table[reader].is_t0 = 1;
   reader_table[reader].is_spr532 = 0;
   reader_table[reader].pinpad_varlen_supported = 0;
+  reader_table[reader].exlen_max = 0;
+  reader_table[reader].roundtrips = 0;
+  reader_table[reader].waiting = 0;
+  reader_table[reader].pcsc.wait_context = 0;
+  reader_table[reader].pcsc.wait_state = PCSC_STATE_UNAWARE;
 #ifdef NEED_PCSC_WRAPPER
   reader_table[reader].pcsc.req_fd = -1;
   reader_table[reader].pcsc.rsp_fd = -1;
@@ -1003,6 +1026,63 @@ pcsc_get_status_direct (int slot, unsigned int *status)
 
   return 0;
 }
+
+
+/* Block up to TIMEOUT milliseconds until PC/SC reports a state change
+   of the reader.  A separate context is used so that the wait does
+   not interfere with commands sent using the main context.  */
+static int
+pcsc_wait_status_change_direct (int slot, int timeout, int *r_changed)
+{
+  long err;
+  struct pcsc_readerstate_s rdrstates[1];
+
+  if (!reader_table[slot].pcsc.wait_context)
+    {
+      err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                    &reader_table[slot].pcsc.wait_context);
+      if (err)
+        {
+          log_error ("pcsc_establish_context failed: %s (0x%lx)\n",
+                     pcsc_error_string (err), err);
+          reader_table[slot].pcsc.wait_context = 0;
+          return pcsc_error_to_sw (err);
+        }
+    }
+
+  memset (rdrstates, 0, sizeof *rdrstates);
+  rdrstates[0].reader = reader_table[slot].rdrname;
+  rdrstates[0].current_state = reader_table[slot].pcsc.wait_state;
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
+  err = pcsc_get_status_change (reader_table[slot].pcsc.wait_context,
+                                timeout, rdrstates, 1);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
+  if (err == PCSC_E_TIMEOUT || err == PCSC_E_CANCELLED)
+    return 0;
+  if (err)
+    {
+      log_error ("pcsc_get_status_change failed: %s (0x%lx)\n",
+                 pcsc_error_string (err), err);
+      return pcsc_error_to_sw (err);
+    }
+
+  reader_table[slot].pcsc.wait_state
+    = (rdrstates[0].event_state & ~PCSC_STATE_CHANGED);
+  *r_changed = 1;
+  return 0;
+}
+
+
+static void
+pcsc_cancel_wait_direct (int slot)
+{
+  if (pcsc_cancel && reader_table[slot].pcsc.wait_context)
+    pcsc_cancel (reader_table[slot].pcsc.wait_context);
+}
 #endif /*!NEED_PCSC_WRAPPER*/
 
 
@@ -1152,9 +1232,17 @@ pcsc_send_apdu_direct (int slot, unsigned char *apdu, size_t apdulen,
       send_pci.protocol = PCSC_PROTOCOL_T0;
   send_pci.pci_len = sizeof send_pci;
   recv_len = *buflen;
+  /* Let the other readers and sessions run while the card is busy;
+     the slot itself is protected by its lock.  */
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
   err = pcsc_transmit (reader_table[slot].pcsc.card,
                        &send_pci, apdu, apdulen,
                        NULL, buffer, &recv_len);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
   *buflen = recv_len;
   if (err)
     log_error ("pcsc_transmit failed: %s (0x%lx)\n",
@@ -1450,6 +1538,9 @@ control_pcsc (int slot, pcsc_dword_t ioctl_code,
 static int
 close_pcsc_reader_direct (int slot)
 {
+  if (reader_table[slot].pcsc.wait_context)
+    pcsc_release_context (reader_table[slot].pcsc.wait_context);
+  reader_table[slot].pcsc.wait_context = 0;
   pcsc_release_context (reader_table[slot].pcsc.context);
   xfree (reader_table[slot].rdrname);
   reader_table[slot].rdrname = NULL;
@@ -1867,6 +1958,8 @@ pcsc_vendor_specific_init (int slot)
         reader_table[slot].pcsc.pinmin = v;
       else if (tag == PCSCv2_PART10_PROPERTY_bMaxPINSize)
         reader_table[slot].pcsc.pinmax = v;
+      else if (tag == PCSCv2_PART10_PROPERTY_dwMaxAPDUDataSize)
+        reader_table[slot].exlen_max = v > 65535? 65535 : v;
       else if (tag == PCSCv2_PART10_PROPERTY_wIdVendor)
         vendor = v;
       else if (tag == PCSCv2_PART10_PROPERTY_wIdProduct)
@@ -2008,6 +2101,8 @@ open_pcsc_reader_direct (const char *portstr)
   reader_table[slot].close_reader = close_pcsc_reader;
   reader_table[slot].reset_reader = reset_pcsc_reader;
   reader_table[slot].get_status_reader = pcsc_get_status;
+  reader_table[slot].wait_status_change = pcsc_wait_status_change_direct;
+  reader_table[slot].cancel_wait = pcsc_cancel_wait_direct;
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
 
@@ -2530,6 +2625,18 @@ get_status_ccid (int slot, unsigned int *status)
 }
 
 
+/* Wait for a message on the interrupt endpoint of the reader.  The
+   CCID driver can't cancel the transfer; thus the caller must use a
+   TIMEOUT short enough to allow a timely close of the reader.  The
+   driver releases the nPth lock while waiting.  */
+static int
+wait_status_change_ccid (int slot, int timeout, int *r_changed)
+{
+  return ccid_wait_slot_change (reader_table[slot].ccid.handle,
+                                timeout, r_changed);
+}
+
+
 /* Actually send the APDU of length APDULEN to SLOT and return a
    maximum of *BUFLEN data in BUFFER, the actual returned size will be
    set to BUFLEN.  Returns: Internal CCID driver error code. */
@@ -2649,6 +2756,7 @@ open_ccid_reader (const char *portstr)
   reader_table[slot].shutdown_reader = shutdown_ccid_reader;
   reader_table[slot].reset_reader = reset_ccid_reader;
   reader_table[slot].get_status_reader = get_status_ccid;
+  reader_table[slot].wait_status_change = wait_status_change_ccid;
   reader_table[slot].send_apdu_reader = send_apdu_ccid;
   reader_table[slot].check_pinpad = check_ccid_pinpad;
   reader_table[slot].dump_status_reader = dump_ccid_reader_status;
@@ -2658,6 +2766,8 @@ open_ccid_reader (const char *portstr)
   /* Our CCID reader code does not support T=0 at all, thus reset the
      flag.  */
   reader_table[slot].is_t0 = 0;
+  reader_table[slot].exlen_max
+    = ccid_get_exlen_max (reader_table[slot].ccid.handle);
 
   dump_reader_status (slot);
   unlock_slot (slot);
@@ -2968,6 +3078,120 @@ open_rapdu_reader (int portno,
 #endif /*USE_G10CODE_RAPDU*/
 
 
+
+/*
+     Simulated card interface.
+
+     The port string "sim:FILE" selects a software OpenPGP card
+     described by FILE; see simcard.c.
+ */
+
+static void
+dump_sim_reader_status (int slot)
+{
+  log_info ("reader slot %d: using card simulator\n", slot);
+}
+
+
+static int
+close_sim_reader (int slot)
+{
+  simcard_close (reader_table[slot].sim.handle);
+  reader_table[slot].sim.handle = NULL;
+  xfree (reader_table[slot].rdrname);
+  reader_table[slot].rdrname = NULL;
+  reader_table[slot].used = 0;
+  return 0;
+}
+
+
+static int
+reset_sim_reader (int slot)
+{
+  reader_table_t slotp = reader_table + slot;
+
+  simcard_reset (slotp->sim.handle);
+  slotp->atrlen = simcard_get_atr (slotp->sim.handle,
+                                   slotp->atr, sizeof slotp->atr);
+  dump_reader_status (slot);
+  return 0;
+}
+
+
+static int
+get_status_sim (int slot, unsigned int *status)
+{
+  (void)slot;
+  *status = (APDU_CARD_USABLE|APDU_CARD_PRESENT|APDU_CARD_ACTIVE);
+  return 0;
+}
+
+
+static int
+send_apdu_sim (int slot, unsigned char *apdu, size_t apdulen,
+               unsigned char *buffer, size_t *buflen,
+               pininfo_t *pininfo)
+{
+  (void)pininfo;
+
+  if (DBG_CARD_IO)
+    log_printhex (" raw apdu:", apdu, apdulen);
+
+  return simcard_transceive (reader_table[slot].sim.handle, apdu, apdulen,
+                             buffer, *buflen, buflen);
+}
+
+
+/* Open the simulated card described by the file FNAME.  */
+static int
+open_sim_reader (const char *fname)
+{
+  gpg_error_t err;
+  int slot;
+  reader_table_t slotp;
+
+  slot = new_reader_slot ();
+  if (slot == -1)
+    return -1;
+  slotp = reader_table + slot;
+
+  err = simcard_open (&slotp->sim.handle, fname);
+  if (!err)
+    {
+      slotp->rdrname = strconcat ("sim:", fname, NULL);
+      if (!slotp->rdrname)
+        {
+          err = gpg_error_from_syserror ();
+          simcard_close (slotp->sim.handle);
+        }
+    }
+  if (err)
+    {
+      slotp->used = 0;
+      unlock_slot (slot);
+      return -1;
+    }
+  slotp->atrlen = simcard_get_atr (slotp->sim.handle,
+                                   slotp->atr, sizeof slotp->atr);
+  slotp->last_status = (APDU_CARD_USABLE|APDU_CARD_PRESENT|APDU_CARD_ACTIVE);
+
+  slotp->close_reader = close_sim_reader;
+  slotp->reset_reader = reset_sim_reader;
+  slotp->get_status_reader = get_status_sim;
+  slotp->send_apdu_reader = send_apdu_sim;
+  slotp->check_pinpad = NULL;
+  slotp->dump_status_reader = dump_sim_reader_status;
+  slotp->pinpad_verify = NULL;
+  slotp->pinpad_modify = NULL;
+  slotp->is_t0 = 0;
+  slotp->exlen_max = simcard_get_exlen_max (slotp->sim.handle);
+
+  dump_reader_status (slot);
+  unlock_slot (slot);
+  return slot;
+}
+
+
 
 /*
        Driver Access
@@ -2986,6 +3210,14 @@ apdu_open_reader (const char *portstr)
   if (DBG_READER)
     log_debug ("enter: apdu_open_reader: portstr=%s\n", portstr);
 
+  if (portstr && !strncmp (portstr, "sim:", 4))
+    {
+      slot = open_sim_reader (portstr + 4);
+      if (DBG_READER)
+        log_debug ("leave: apdu_open_reader => slot=%d [sim]\n", slot);
+      return slot;
+    }
+
 #ifdef HAVE_LIBUSB
   if (!opt.disable_ccid)
     {
@@ -3106,6 +3338,7 @@ apdu_open_reader (const char *portstr)
       pcsc_transmit          = dlsym (handle, "SCardTransmit");
       pcsc_set_timeout       = dlsym (handle, "SCardSetTimeout");
       pcsc_control           = dlsym (handle, "SCardControl");
+      pcsc_cancel            = dlsym (handle, "SCardCancel");
 
       if (!pcsc_establish_context
           || !pcsc_release_context
@@ -3212,6 +3445,14 @@ apdu_close_reader (int slot)
         log_debug ("leave: apdu_close_reader => SW_HOST_NO_DRIVER\n");
       return SW_HOST_NO_DRIVER;
     }
+  /* Wake up and wait for a thread blocked in apdu_wait_status_change;
+     it uses the handles we are about to release.  */
+  if (reader_table[slot].waiting && reader_table[slot].cancel_wait)
+    reader_table[slot].cancel_wait (slot);
+#ifdef USE_NPTH
+  while (reader_table[slot].waiting)
+    npth_usleep (20000);
+#endif
   sw = apdu_disconnect (slot);
   if (sw)
     {
@@ -3592,6 +3833,34 @@ apdu_get_status (int slot, int hang,
 }
 
 
+/* Wait up to TIMEOUT milliseconds for a change of the card status in
+   SLOT.  R_CHANGED is set to true if the reader signalled an event;
+   the caller should then use apdu_get_status to read the new status.
+   A return value of SW_HOST_NOT_SUPPORTED indicates that the reader
+   has no way to notify us and needs to be polled.  The slot is not
+   locked while waiting, so that other threads may use the reader.
+   Only one thread may wait on a slot at a time.  */
+int
+apdu_wait_status_change (int slot, int timeout, int *r_changed)
+{
+  int sw;
+
+  *r_changed = 0;
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
+    return SW_HOST_NO_DRIVER;
+  if (!reader_table[slot].wait_status_change)
+    return SW_HOST_NOT_SUPPORTED;
+
+  reader_table[slot].waiting = 1;
+  sw = reader_table[slot].wait_status_change (slot, timeout, r_changed);
+  reader_table[slot].waiting = 0;
+  if (DBG_READER && (sw || *r_changed))
+    log_debug ("apdu_wait_status_change: slot=%d sw=0x%x changed=%d\n",
+               slot, sw, *r_changed);
+  return sw;
+}
+
+
 /* Check whether the reader supports the ISO command code COMMAND on
    the pinpad.  Return 0 on success.  For a description of the pin
    parameters, see ccid-driver.c */
@@ -3677,6 +3946,7 @@ send_apdu (int slot, unsigned char *apdu, size_t apdulen,
   if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
     return SW_HOST_NO_DRIVER;
 
+  reader_table[slot].roundtrips++;
   if (reader_table[slot].send_apdu_reader)
     return reader_table[slot].send_apdu_reader (slot,
                                                 apdu, apdulen,
@@ -3687,6 +3957,36 @@ send_apdu (int slot, unsigned char *apdu, size_t apdulen,
 }
 
 
+/* Return the card capabilities byte of the card in SLOT as described
+   with atr_get_card_capabilities.  */
+static unsigned int
+card_capabilities (int slot)
+{
+  if (!reader_table[slot].atrlen)
+    return 0;
+  return atr_get_card_capabilities (reader_table[slot].atr,
+                                    reader_table[slot].atrlen);
+}
+
+
+/* Return the maximum data length of an extended length APDU which may
+   be used with the card in SLOT.  This requires that the card
+   announces support for extended Lc and Le in its ATR and that the
+   reader is able to transfer them.  Returns 0 if extended length
+   APDUs may not be used.  */
+int
+apdu_get_exlen_max (int slot)
+{
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
+    return 0;
+  if (reader_table[slot].is_t0 || !reader_table[slot].exlen_max)
+    return 0;
+  if (!(card_capabilities (slot) & 0x40))
+    return 0;
+  return reader_table[slot].exlen_max;
+}
+
+
 /* Core APDU tranceiver function. Parameters are described at
    apdu_send_le with the exception of PININFO which indicates pinpad
    related operations if not NULL.  If EXTENDED_MODE is not 0
@@ -3694,7 +3994,10 @@ send_apdu (int slot, unsigned char *apdu, size_t apdulen,
    values:
        n < 0 := Use command chaining with the data part limited to -n
                 in each chunk.  If -1 is used a default value is used.
-      n == 0 := No extended mode or command chaining.
+      n == 0 := No extended mode or command chaining unless LC or LE
+                don't fit into a short APDU; in that case extended
+                length or command chaining is used if announced by
+                the card and supported by the reader.
       n == 1 := Use extended length for input and output without a
                 length limit.
        n > 1 := Use extended length with up to N bytes.
@@ -3724,10 +4027,23 @@ send_le (int slot, int class, int ins, int p0, int p1,
   int use_chaining = 0;
   int use_extended_length = 0;
   int lc_chunk;
+  int exlen_max;
+  unsigned int roundtrips;
 
   if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
     return SW_HOST_NO_DRIVER;
 
+  exlen_max = apdu_get_exlen_max (slot);
+  if (!extended_mode && ((lc != -1 && lc > 255) || le > 256))
+    {
+      /* Use the largest APDU supported by the card and the reader
+         instead of failing.  */
+      if (exlen_max)
+        extended_mode = exlen_max;
+      else if (lc > 255 && (card_capabilities (slot) & 0x80))
+        extended_mode = -1;
+    }
+
   if (DBG_CARD_IO)
     log_debug ("send apdu: c=%02X i=%02X p1=%02X p2=%02X lc=%d le=%d em=%d\n",
                class, ins, p0, p1, lc, le, extended_mode);
@@ -3817,6 +4133,7 @@ send_le (int slot, int class, int ins, int p0, int p1,
       xfree (result_buffer);
       return sw;
     }
+  roundtrips = reader_table[slot].roundtrips;
 
   do
     {
@@ -3966,6 +4283,22 @@ send_le (int slot, int class, int ins, int p0, int p1,
           if (DBG_CARD_IO)
             log_debug ("apdu_send_simple(%d): %d more bytes available\n",
                        slot, len);
+          if (!len && exlen_max
+              && result_buffer_size < exlen_max + 2)
+            {
+              /* At least 256 more bytes are available; get them in
+                 one go using an extended length GET RESPONSE.  */
+              unsigned char *newbuf = xtrymalloc (exlen_max + 2 + 10);
+
+              if (!newbuf)
+                exlen_max = 0;
+              else
+                {
+                  xfree (result_buffer);
+                  result = result_buffer = newbuf;
+                  result_buffer_size = exlen_max + 2;
+                }
+            }
           apdu_buffer_size = sizeof short_apdu_buffer;
           apdu = short_apdu_buffer;
           apdulen = 0;
@@ -3973,7 +4306,14 @@ send_le (int slot, int class, int ins, int p0, int p1,
           apdu[apdulen++] = 0xC0;
           apdu[apdulen++] = 0;
           apdu[apdulen++] = 0;
-          apdu[apdulen++] = len;
+          if (!len && exlen_max)
+            {
+              apdu[apdulen++] = 0;  /* Z byte: Extended length marker.  */
+              apdu[apdulen++] = ((exlen_max >> 8) & 0xff);
+              apdu[apdulen++] = (exlen_max & 0xff);
+            }
+          else
+            apdu[apdulen++] = len;
           assert (apdulen <= apdu_buffer_size);
           memset (apdu+apdulen, 0, apdu_buffer_size - apdulen);
           resultlen = result_buffer_size;
@@ -4035,11 +4375,15 @@ send_le (int slot, int class, int ins, int p0, int p1,
         }
     }
 
+  roundtrips = reader_table[slot].roundtrips - roundtrips;
   unlock_slot (slot);
   xfree (result_buffer);
 
   if (DBG_CARD_IO && retbuf && sw == SW_SUCCESS)
     log_printhex ("      dump: ", *retbuf, *retbuflen);
+  if (DBG_CARD_IO)
+    log_debug ("apdu_send_simple(%d): %u round trip%s\n",
+               slot, roundtrips, roundtrips == 1? "":"s");
 
   return sw;
 }
@@ -138,10 +138,16 @@ gpg_error_t app_openpgp_storekey (app_t app, int keyno,
                           gpg_error_t (*pincb)(void*, const char *, char **),
                           void *pincb_arg);
 #else
+/* The directory below the home directory with the cache files of the
+   card applications.  */
+#define APP_CACHE_DIR "scd-cache.d"
+
 /*-- app-help.c --*/
 unsigned int app_help_count_bits (const unsigned char *a, size_t len);
 gpg_error_t app_help_get_keygrip_string (ksba_cert_t cert, char *hexkeygrip);
 size_t app_help_read_length_of_cert (int slot, int fid, size_t *r_certoff);
+gpg_error_t app_help_write_cache_file (const char *fname,
+                                       const void *buffer, size_t length);
 
 
 /*-- app.c --*/
@@ -155,6 +161,7 @@ char *get_supported_applications (void);
 void release_application (app_t app);
 gpg_error_t app_munge_serialno (app_t app);
 gpg_error_t app_get_serial_and_stamp (app_t app, char **serial, time_t *stamp);
+gpg_error_t app_get_slot_serialno (int slot, char **r_serialno, int *r_busy);
 gpg_error_t app_write_learn_status (app_t app, ctrl_t ctrl,
                                     unsigned int flags);
 gpg_error_t app_readcert (app_t app, const char *certid,
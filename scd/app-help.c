@@ -178,3 +178,51 @@ app_help_read_length_of_cert (int slot, int fid, size_t *r_certoff)
 
   return resultlen;
 }
+
+
+/* Write the LENGTH bytes at BUFFER to the cache file FNAME.  The data
+   is first written to a temporary file which is then renamed, so that
+   a reader never sees a partly written file.  The cache directory
+   APP_CACHE_DIR is created if needed.  */
+gpg_error_t
+app_help_write_cache_file (const char *fname,
+                           const void *buffer, size_t length)
+{
+  gpg_error_t err = 0;
+  char *tmpfname;
+  estream_t fp;
+
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    return gpg_error_from_syserror ();
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp && errno == ENOENT)
+    {
+      /* Create the cache directory and try again.  */
+      char *dname = make_filename_try (opt.homedir, APP_CACHE_DIR, NULL);
+
+      if (dname && !gnupg_mkdir (dname, "-rwx"))
+        fp = es_fopen (tmpfname, "wb");
+      xfree (dname);
+    }
+  if (!fp || es_write (fp, buffer, length, NULL) || es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      if (fp)
+        gnupg_remove (tmpfname);
+      goto leave;
+    }
+#ifdef HAVE_DOSISH_SYSTEM
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  return err;
+}
@@ -71,6 +71,10 @@
 #include "openpgpdefs.h"
 
 
+/* The maximum size of a cache file.  */
+#define PUBKEY_CACHE_MAXLEN 8192
+
+
 /* A table describing the DOs of the card.  */
 static struct {
   int tag;
@@ -1220,6 +1224,205 @@ retrieve_key_material (FILE *fp, const char *hexkeyid,
 #endif /*GNUPG_MAJOR_VERSION > 1*/
 
 
+/* Reading the public keys from the card is by far the slowest part of
+   the LEARN command.  Thus we keep a copy of each public key in the
+   file APP_CACHE_DIR/<serialno>.<keyno> below the home directory.
+   The file holds a canonical S-expression
+
+     (openpgp-card-pubkey (fpr <fingerprint>) (public-key ...))
+
+   The copy is only used if the fingerprint matches the one currently
+   stored on the card.  Whoever puts a new key onto the card also
+   needs to update the fingerprint; thus a changed key is detected by
+   this cheap check without reading the key.  The fingerprints are
+   taken from the Application Related Data DO which we read anyway
+   when selecting the application.  */
+#if GNUPG_MAJOR_VERSION > 1
+/* Return the malloced name of the cache file for KEYNO or NULL if
+   this card can't be cached.  */
+static char *
+pubkey_cache_fname (app_t app, int keyno)
+{
+  char *hexsn, *fname;
+  char name[80];
+
+  if (!app->serialno || !app->serialnolen || app->serialnolen > 32)
+    return NULL;
+  hexsn = bin2hex (app->serialno, app->serialnolen, NULL);
+  if (!hexsn)
+    return NULL;
+  snprintf (name, sizeof name, "%s.%d", hexsn, keyno+1);
+  xfree (hexsn);
+  fname = make_filename_try (opt.homedir, APP_CACHE_DIR, name, NULL);
+  return fname;
+}
+
+
+/* Store the current fingerprint of key KEYNO at FPR which must have
+   space for 20 bytes.  Returns false if no fingerprint is available
+   or if it is all zero, i.e. no key is set.  */
+static int
+pubkey_cache_fpr (app_t app, int keyno, unsigned char *fpr)
+{
+  void *relptr;
+  unsigned char *value;
+  size_t valuelen;
+  int i, any = 0;
+
+  relptr = get_one_do (app, 0x00C5, &value, &valuelen, NULL);
+  if (relptr && valuelen >= 60)
+    {
+      memcpy (fpr, value + keyno*20, 20);
+      for (i=0; i < 20; i++)
+        if (fpr[i])
+          any = 1;
+    }
+  xfree (relptr);
+  return any;
+}
+
+
+/* Try to set the public key KEYNO from the cache.  Returns 0 on
+   success.  */
+static gpg_error_t
+load_cached_public_key (app_t app, int keyno)
+{
+  gpg_error_t err;
+  unsigned char fpr[20];
+  char *fname;
+  estream_t fp = NULL;
+  char *buffer = NULL;
+  size_t buflen, len;
+  gcry_sexp_t s_cache = NULL;
+  gcry_sexp_t l;
+  const char *s;
+  char *keybuf;
+
+  if (!pubkey_cache_fpr (app, keyno, fpr))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  fname = pubkey_cache_fname (app, keyno);
+  if (!fname)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  buffer = xtrymalloc (PUBKEY_CACHE_MAXLEN);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_read (fp, buffer, PUBKEY_CACHE_MAXLEN, &buflen)
+      || buflen == PUBKEY_CACHE_MAXLEN)
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+
+  err = gcry_sexp_sscan (&s_cache, NULL, buffer, buflen);
+  if (err)
+    goto leave;
+
+  l = gcry_sexp_find_token (s_cache, "fpr", 0);
+  s = l? gcry_sexp_nth_data (l, 1, &len) : NULL;
+  if (!s || len != 20 || memcmp (s, fpr, 20))
+    {
+      /* The key has been replaced.  */
+      gcry_sexp_release (l);
+      err = gpg_error (GPG_ERR_BAD_PUBKEY);
+      goto leave;
+    }
+  gcry_sexp_release (l);
+
+  l = gcry_sexp_find_token (s_cache, "public-key", 0);
+  if (!l)
+    {
+      err = gpg_error (GPG_ERR_INV_SEXP);
+      goto leave;
+    }
+  len = gcry_sexp_sprint (l, GCRYSEXP_FMT_CANON, NULL, 0);
+  keybuf = xtrymalloc (len);
+  if (!keybuf)
+    {
+      err = gpg_error_from_syserror ();
+      gcry_sexp_release (l);
+      goto leave;
+    }
+  gcry_sexp_sprint (l, GCRYSEXP_FMT_CANON, keybuf, len);
+  gcry_sexp_release (l);
+
+  app->app_local->pk[keyno].key = (unsigned char*)keybuf;
+  app->app_local->pk[keyno].keylen = len - 1; /* Decrement for trailing '\0' */
+  if (opt.verbose)
+    log_info ("using cached public key %d from '%s'\n", keyno+1, fname);
+
+ leave:
+  if (err && gpg_err_code (err) != GPG_ERR_ENOENT && opt.verbose)
+    log_info ("ignoring public key cache '%s': %s\n",
+              fname, gpg_strerror (err));
+  gcry_sexp_release (s_cache);
+  xfree (buffer);
+  es_fclose (fp);
+  xfree (fname);
+  return err;
+}
+
+
+/* Store the public key KEYNO in the cache.  Errors are only logged
+   because the cache is an optimization.  */
+static void
+store_cached_public_key (app_t app, int keyno)
+{
+  gpg_error_t err;
+  unsigned char fpr[20];
+  char *fname = NULL;
+  gcry_sexp_t s_pkey = NULL;
+  gcry_sexp_t s_cache = NULL;
+  char *buffer = NULL;
+  size_t len;
+
+  if (!app->app_local->pk[keyno].key
+      || !pubkey_cache_fpr (app, keyno, fpr))
+    return;
+  fname = pubkey_cache_fname (app, keyno);
+  if (!fname)
+    return;
+
+  err = gcry_sexp_sscan (&s_pkey, NULL,
+                         (const char*)app->app_local->pk[keyno].key,
+                         app->app_local->pk[keyno].keylen);
+  if (!err)
+    err = gcry_sexp_build (&s_cache, NULL,
+                           "(openpgp-card-pubkey(fpr%b)%S)",
+                           20, fpr, s_pkey);
+  if (err)
+    goto leave;
+  len = gcry_sexp_sprint (s_cache, GCRYSEXP_FMT_CANON, NULL, 0);
+  buffer = xtrymalloc (len);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  len = gcry_sexp_sprint (s_cache, GCRYSEXP_FMT_CANON, buffer, len);
+  err = app_help_write_cache_file (fname, buffer, len);
+
+ leave:
+  if (err)
+    log_info ("error writing public key cache '%s': %s\n",
+              fname, gpg_strerror (err));
+  gcry_sexp_release (s_pkey);
+  gcry_sexp_release (s_cache);
+  xfree (buffer);
+  xfree (fname);
+}
+#endif /*GNUPG_MAJOR_VERSION > 1*/
+
+
 /* Get the public key for KEYNO and store it as an S-expresion with
    the APP handle.  On error that field gets cleared.  If we already
    know about the public key we will just return.  Note that this does
@@ -1257,6 +1460,12 @@ get_public_key (app_t app, int keyno)
   app->app_local->pk[keyno].key = NULL;
   app->app_local->pk[keyno].keylen = 0;
 
+  if (!load_cached_public_key (app, keyno))
+    {
+      app->app_local->pk[keyno].read_done = 1;
+      return 0;
+    }
+
   m = e = NULL; /* (avoid cc warning) */
 
   if (app->card_version > 0x0100)
@@ -1460,6 +1669,7 @@ get_public_key (app_t app, int keyno)
 
   app->app_local->pk[keyno].key = (unsigned char*)keybuf;
   app->app_local->pk[keyno].keylen = len - 1; /* Decrement for trailing '\0' */
+  store_cached_public_key (app, keyno);
 
  leave:
   /* Set a flag to indicate that we tried to read the key.  */
@@ -40,9 +40,14 @@
 #include "iso7816.h"
 #include "app-common.h"
 #include "tlv.h"
+#include "membuf.h"
 #include "apdu.h" /* fixme: we should move the card detection to a
                      separate file */
 
+/* The maximum size of a cache file we are willing to write and to
+   load.  */
+#define P15_CACHE_MAXLEN (1024*1024)
+
 /* Types of cards we know and which needs special treatment. */
 typedef enum
   {
@@ -272,6 +277,18 @@ struct aodf_object_s
 typedef struct aodf_object_s *aodf_object_t;
 
 
+/* An item of the persistent cache; i.e. the content of a directory
+   file or a certificate.  */
+struct cache_item_s
+{
+  struct cache_item_s *next;
+  unsigned char *data;
+  size_t datalen;
+  char name[1];   /* The name of the item; e.g. "ef-4401".  */
+};
+typedef struct cache_item_s *cache_item_t;
+
+
 /* Context local to this application. */
 struct app_local_s
 {
@@ -317,12 +334,31 @@ struct app_local_s
   /* Information on all authentication objects. */
   aodf_object_t auth_object_info;
 
+  /* Flags telling which of the above lists have already been read.
+     The directory files are only read when needed.  */
+  unsigned int cdf_loaded:1;
+  unsigned int prkdf_loaded:1;
+  unsigned int aodf_loaded:1;
+
+  /* The persistent cache.  CACHE_KEY is a hash over EF(TokenInfo) and
+     EF(ODF); the cached items are only used if the key matches.  The
+     cache is only used if the TokenInfo has a lastUpdate field.  */
+  unsigned int have_last_update:1;
+  gcry_md_hd_t cache_md;       /* Used to compute CACHE_KEY.  */
+  unsigned char cache_key[20];
+  unsigned int cache_valid:1;  /* CACHE_KEY has been computed.  */
+  unsigned int cache_dirty:1;  /* CACHE_ITEMS needs to be written.  */
+  cache_item_t cache_items;
 };
 
 
 /*** Local prototypes.  ***/
 static gpg_error_t readcert_by_cdf (app_t app, cdf_object_t cdf,
                                     unsigned char **r_cert, size_t *r_certlen);
+static void save_cache (app_t app);
+static gpg_error_t load_cdf_info (app_t app);
+static gpg_error_t load_prkdf_info (app_t app);
+static gpg_error_t load_aodf_info (app_t app);
 
 
 
@@ -386,6 +422,16 @@ do_deinit (app_t app)
 {
   if (app && app->app_local)
     {
+      cache_item_t item;
+
+      save_cache (app);
+      while ((item = app->app_local->cache_items))
+        {
+          app->app_local->cache_items = item->next;
+          xfree (item->data);
+          xfree (item);
+        }
+      gcry_md_close (app->app_local->cache_md);
       release_cdflist (app->app_local->certificate_info);
       release_cdflist (app->app_local->trusted_certificate_info);
       release_cdflist (app->app_local->useful_certificate_info);
@@ -427,6 +473,309 @@ select_and_read_binary (int slot, unsigned short efid, const char *efid_desc,
 }
 
 
+
+/* Return the name of the cache file for the card or NULL.  */
+static char *
+cache_fname (app_t app)
+{
+  char *hexsn, *fname;
+
+  if (!app->serialno || !app->serialnolen || app->serialnolen > 32)
+    return NULL;
+  hexsn = bin2hex (app->serialno, app->serialnolen, NULL);
+  if (!hexsn)
+    return NULL;
+  fname = strconcat ("p15-", hexsn, NULL);
+  xfree (hexsn);
+  if (fname)
+    {
+      char *tmp = make_filename_try (opt.homedir, APP_CACHE_DIR, fname, NULL);
+      xfree (fname);
+      fname = tmp;
+    }
+  return fname;
+}
+
+
+/* Add the item NAME with DATA of length DATALEN to the in-memory
+   cache.  */
+static gpg_error_t
+add_cache_item (app_t app, const char *name,
+                const void *data, size_t datalen)
+{
+  cache_item_t item;
+
+  item = xtrymalloc (sizeof *item + strlen (name));
+  if (!item)
+    return gpg_error_from_syserror ();
+  item->data = xtrymalloc (datalen? datalen : 1);
+  if (!item->data)
+    {
+      xfree (item);
+      return gpg_error_from_syserror ();
+    }
+  memcpy (item->data, data, datalen);
+  item->datalen = datalen;
+  strcpy (item->name, name);
+  item->next = app->app_local->cache_items;
+  app->app_local->cache_items = item;
+  return 0;
+}
+
+
+/* Hash the content of a file which is read at every select into the
+   cache key.  */
+static void
+hash_for_cache (app_t app, const void *buffer, size_t buflen)
+{
+  if (app->app_local->cache_md)
+    gcry_md_write (app->app_local->cache_md, buffer, buflen);
+}
+
+
+/* Finish the cache key and load the cache file of the card.  Cached
+   items are only used if the key stored with them matches, so that
+   a change of the token info (e.g. its lastUpdate field) or of the
+   ODF invalidates the cache.  Cards without a lastUpdate field are
+   not cached at all because the key does not cover the directory
+   files.  */
+static void
+load_cache (app_t app)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp = NULL;
+  membuf_t mb;
+  char buffer[4096];
+  size_t nread;
+  char *image = NULL;
+  size_t imagelen;
+  gcry_sexp_t s_cache = NULL;
+  gcry_sexp_t l = NULL;
+  const char *s, *name;
+  size_t n, namelen;
+  char *namebuf;
+  int idx;
+
+  if (!app->app_local->cache_md)
+    return;
+  memcpy (app->app_local->cache_key,
+          gcry_md_read (app->app_local->cache_md, GCRY_MD_SHA1), 20);
+  gcry_md_close (app->app_local->cache_md);
+  app->app_local->cache_md = NULL;
+  if (!app->app_local->have_last_update)
+    {
+      /* Without lastUpdate a change of a directory file does not
+         change the cache key.  */
+      if (opt.verbose)
+        log_info ("not using a PKCS#15 cache: no lastUpdate in TokenInfo\n");
+      return;
+    }
+  app->app_local->cache_valid = 1;
+
+  fname = cache_fname (app);
+  if (!fname)
+    return;
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  init_membuf (&mb, 8192);
+  do
+    {
+      if (es_read (fp, buffer, sizeof buffer, &nread))
+        break;
+      put_membuf (&mb, buffer, nread);
+    }
+  while (nread && get_membuf_len (&mb) <= P15_CACHE_MAXLEN);
+  image = get_membuf (&mb, &imagelen);
+  if (!image)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (imagelen > P15_CACHE_MAXLEN || !es_feof (fp))
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+
+  err = gcry_sexp_sscan (&s_cache, NULL, image, imagelen);
+  if (err)
+    goto leave;
+
+  l = gcry_sexp_find_token (s_cache, "key", 0);
+  s = l? gcry_sexp_nth_data (l, 1, &n) : NULL;
+  if (!s || n != 20 || memcmp (s, app->app_local->cache_key, 20))
+    {
+      /* The card has been changed; we will write a new cache.  */
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto leave;
+    }
+
+  for (idx=1; !err; idx++)
+    {
+      gcry_sexp_release (l);
+      l = gcry_sexp_nth (s_cache, idx);
+      if (!l)
+        break;
+      name = gcry_sexp_nth_data (l, 0, &n);
+      if (!name || n != 4 || memcmp (name, "item", 4))
+        continue;
+      name = gcry_sexp_nth_data (l, 1, &namelen);
+      s = gcry_sexp_nth_data (l, 2, &n);
+      if (!name || !s)
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          break;
+        }
+      namebuf = xtrymalloc (namelen + 1);
+      if (!namebuf)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      memcpy (namebuf, name, namelen);
+      namebuf[namelen] = 0;
+      err = add_cache_item (app, namebuf, s, n);
+      xfree (namebuf);
+    }
+
+  if (!err && opt.verbose)
+    log_info ("using PKCS#15 cache '%s'\n", fname);
+
+ leave:
+  if (err)
+    {
+      cache_item_t item;
+
+      if (gpg_err_code (err) != GPG_ERR_ENOENT && opt.verbose)
+        log_info ("ignoring PKCS#15 cache '%s': %s\n",
+                  fname, gpg_strerror (err));
+      while ((item = app->app_local->cache_items))
+        {
+          app->app_local->cache_items = item->next;
+          xfree (item->data);
+          xfree (item);
+        }
+    }
+  gcry_sexp_release (l);
+  gcry_sexp_release (s_cache);
+  xfree (image);
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Write the cache if it has been changed.  Errors are only logged
+   because the cache is an optimization.  */
+static void
+save_cache (app_t app)
+{
+  gpg_error_t err = 0;
+  char *fname = NULL;
+  cache_item_t item;
+  membuf_t mb;
+  char *image = NULL;
+  size_t imagelen;
+
+  if (!app->app_local->cache_valid || !app->app_local->cache_dirty)
+    return;
+  app->app_local->cache_dirty = 0;
+  fname = cache_fname (app);
+  if (!fname)
+    return;
+
+  init_membuf (&mb, 8192);
+  put_membuf_str (&mb, "(9:p15-cache(3:key20:");
+  put_membuf (&mb, app->app_local->cache_key, 20);
+  put_membuf_str (&mb, ")");
+  for (item = app->app_local->cache_items; item; item = item->next)
+    {
+      put_membuf_printf (&mb, "(4:item%u:%s%u:",
+                         (unsigned int)strlen (item->name), item->name,
+                         (unsigned int)item->datalen);
+      put_membuf (&mb, item->data, item->datalen);
+      put_membuf_str (&mb, ")");
+    }
+  put_membuf_str (&mb, ")");
+  image = get_membuf (&mb, &imagelen);
+  if (!image)
+    err = gpg_error_from_syserror ();
+  else if (imagelen > P15_CACHE_MAXLEN)
+    {
+      /* load_cache would not accept that file anyway.  */
+      if (opt.verbose)
+        log_info ("not writing PKCS#15 cache '%s': %s\n",
+                  fname, gpg_strerror (GPG_ERR_TOO_LARGE));
+    }
+  else
+    err = app_help_write_cache_file (fname, image, imagelen);
+
+  if (err)
+    log_error ("error writing PKCS#15 cache '%s': %s\n",
+               fname, gpg_strerror (err));
+  xfree (image);
+  xfree (fname);
+}
+
+
+/* Return a copy of the cached item NAME at R_BUFFER and R_BUFLEN.
+   The caller must free the buffer on success.  */
+static gpg_error_t
+get_cached (app_t app, const char *name,
+            unsigned char **r_buffer, size_t *r_buflen)
+{
+  cache_item_t item;
+
+  for (item = app->app_local->cache_items; item; item = item->next)
+    if (!strcmp (item->name, name))
+      break;
+  if (!item)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  *r_buffer = xtrymalloc (item->datalen? item->datalen : 1);
+  if (!*r_buffer)
+    return gpg_error_from_syserror ();
+  memcpy (*r_buffer, item->data, item->datalen);
+  *r_buflen = item->datalen;
+  return 0;
+}
+
+
+/* Store a copy of BUFFER of length BUFLEN as item NAME in the cache.
+   Errors are ignored.  */
+static void
+put_cached (app_t app, const char *name,
+            const unsigned char *buffer, size_t buflen)
+{
+  if (!app->app_local->cache_valid || !app->serialno)
+    return;
+  if (!add_cache_item (app, name, buffer, buflen))
+    app->app_local->cache_dirty = 1;
+}
+
+
+/* Like select_and_read_binary but use the cache for the directory
+   file EFID.  */
+static gpg_error_t
+read_directory_file (app_t app, unsigned short efid, const char *efid_desc,
+                     unsigned char **buffer, size_t *buflen)
+{
+  gpg_error_t err;
+  char name[20];
+
+  snprintf (name, sizeof name, "ef-%04hX", efid);
+  if (!get_cached (app, name, buffer, buflen))
+    return 0;
+  err = select_and_read_binary (app->slot, efid, efid_desc, buffer, buflen);
+  if (!err)
+    put_cached (app, name, *buffer, *buflen);
+  return err;
+}
+
+
 /* This function calls select file to read a file using a complete
    path which may or may not start at the master file (MF). */
 static gpg_error_t
@@ -538,6 +887,9 @@ cdf_object_from_certid (app_t app, const char *certid, cdf_object_t *r_cdf)
   unsigned char *objid;
   cdf_object_t cdf;
 
+  err = load_cdf_info (app);
+  if (err)
+    return err;
   err = parse_certid (app, certid, &objid, &objidlen);
   if (err)
     return err;
@@ -572,6 +924,9 @@ prkdf_object_from_keyidstr (app_t app, const char *keyidstr,
   unsigned char *objid;
   prkdf_object_t prkdf;
 
+  err = load_prkdf_info (app);
+  if (err)
+    return err;
   err = parse_certid (app, keyidstr, &objid, &objidlen);
   if (err)
     return err;
@@ -616,6 +971,7 @@ read_ef_odf (app_t app, unsigned short odf_fid)
   err = select_and_read_binary (app->slot, odf_fid, "ODF", &buffer, &buflen);
   if (err)
     return err;
+  hash_for_cache (app, buffer, buflen);
 
   if (buflen < 8)
     {
@@ -828,7 +1184,7 @@ read_ef_prkdf (app_t app, unsigned short fid, prkdf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No private keys. */
 
-  err = select_and_read_binary (app->slot, fid, "PrKDF", &buffer, &buflen);
+  err = read_directory_file (app, fid, "PrKDF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -1284,7 +1640,7 @@ read_ef_cdf (app_t app, unsigned short fid, cdf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No certificates. */
 
-  err = select_and_read_binary (app->slot, fid, "CDF", &buffer, &buflen);
+  err = read_directory_file (app, fid, "CDF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -1557,7 +1913,7 @@ read_ef_aodf (app_t app, unsigned short fid, aodf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No authentication objects. */
 
-  err = select_and_read_binary (app->slot, fid, "AODF", &buffer, &buflen);
+  err = read_directory_file (app, fid, "AODF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -2223,6 +2579,10 @@ read_ef_tokeninfo (app_t app)
                                 &buffer, &buflen);
   if (err)
     return err;
+  /* The TokenInfo includes the lastUpdate field if the card
+     maintains one; thus it is part of the cache key.  */
+  hash_for_cache (app, buffer, buflen);
+  app->app_local->have_last_update = 0;
 
   p = buffer;
   n = buflen;
@@ -2278,6 +2638,24 @@ read_ef_tokeninfo (app_t app)
   memcpy (app->app_local->serialno, p, objlen);
   app->app_local->serialnolen = objlen;
   log_printhex ("Serialnumber from EF(TokenInfo) is:", p, objlen);
+  p += objlen;
+  n -= objlen;
+
+  /* Look for the lastUpdate field; the other fields are not used.  */
+  while (n)
+    {
+      if (parse_ber_header (&p, &n, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || objlen > n)
+        break;
+      if (class == CLASS_CONTEXT && tag == 5)
+        {
+          app->app_local->have_last_update = 1;
+          break;
+        }
+      p += objlen;
+      n -= objlen;
+    }
 
  leave:
   xfree (buffer);
@@ -2287,12 +2665,16 @@ read_ef_tokeninfo (app_t app)
 
 /* Get all the basic information from the pkcs#15 card, check the
    structure and initialize our local context.  This is used once at
-   application initialization. */
+   application initialization.  The directory files are only read
+   when needed; see load_cdf_info and friends.  */
 static gpg_error_t
 read_p15_info (app_t app)
 {
   gpg_error_t err;
 
+  if (gcry_md_open (&app->app_local->cache_md, GCRY_MD_SHA1, 0))
+    app->app_local->cache_md = NULL;
+
   if (!read_ef_tokeninfo (app))
     {
       /* If we don't have a serial number yet but the TokenInfo provides
@@ -2316,7 +2698,20 @@ read_p15_info (app_t app)
   if (err)
     return err;
 
-  /* Read certificate information. */
+  load_cache (app);
+  return 0;
+}
+
+
+/* Read the certificate directory files if not yet done.  */
+static gpg_error_t
+load_cdf_info (app_t app)
+{
+  gpg_error_t err;
+
+  if (app->app_local->cdf_loaded)
+    return 0;
+
   assert (!app->app_local->certificate_info);
   assert (!app->app_local->trusted_certificate_info);
   assert (!app->app_local->useful_certificate_info);
@@ -2331,9 +2726,29 @@ read_p15_info (app_t app)
   if (gpg_err_code (err) == GPG_ERR_NO_DATA)
     err = 0;
   if (err)
-    return err;
+    {
+      release_cdflist (app->app_local->certificate_info);
+      release_cdflist (app->app_local->trusted_certificate_info);
+      release_cdflist (app->app_local->useful_certificate_info);
+      app->app_local->certificate_info = NULL;
+      app->app_local->trusted_certificate_info = NULL;
+      app->app_local->useful_certificate_info = NULL;
+      return err;
+    }
+  app->app_local->cdf_loaded = 1;
+  return 0;
+}
+
+
+/* Read the private key directory file if not yet done.  */
+static gpg_error_t
+load_prkdf_info (app_t app)
+{
+  gpg_error_t err;
+
+  if (app->app_local->prkdf_loaded)
+    return 0;
 
-  /* Read information about private keys. */
   assert (!app->app_local->private_key_info);
   err = read_ef_prkdf (app, app->app_local->odf.private_keys,
                        &app->app_local->private_key_info);
@@ -2341,16 +2756,29 @@ read_p15_info (app_t app)
     err = 0;
   if (err)
     return err;
+  app->app_local->prkdf_loaded = 1;
+  return 0;
+}
+
+
+/* Read the authentication object directory file if not yet done.  */
+static gpg_error_t
+load_aodf_info (app_t app)
+{
+  gpg_error_t err;
+
+  if (app->app_local->aodf_loaded)
+    return 0;
 
-  /* Read information about authentication objects. */
   assert (!app->app_local->auth_object_info);
   err = read_ef_aodf (app, app->app_local->odf.auth_objects,
                       &app->app_local->auth_object_info);
   if (gpg_err_code (err) == GPG_ERR_NO_DATA)
     err = 0;
-
-
-  return err;
+  if (err)
+    return err;
+  app->app_local->aodf_loaded = 1;
+  return 0;
 }
 
 
@@ -2406,6 +2834,10 @@ keygripstr_from_prkdf (app_t app, prkdf_object_t prkdf, char *r_gripstr)
      have one, so we can only use the fallback solution bu looking for
      a matching certificate and extract the key from there. */
 
+  err = load_cdf_info (app);
+  if (err)
+    return err;
+
   /* Look for a matching certificate. A certificate matches if the Id
      matches the one of the private key info. */
   for (cdf = app->app_local->certificate_info; cdf; cdf = cdf->next)
@@ -2501,7 +2933,7 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
 
   if ((flags & 1))
     err = 0;
-  else
+  else if (!(err = load_cdf_info (app)))
     {
       err = send_certinfo (app, ctrl, "100", app->app_local->certificate_info);
       if (!err)
@@ -2512,9 +2944,14 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
                              app->app_local->useful_certificate_info);
     }
 
+  if (!err)
+    err = load_prkdf_info (app);
   if (!err)
     err = send_keypairinfo (app, ctrl, app->app_local->private_key_info);
 
+  /* LEARN has read all directory files and the certificates needed
+     for the keygrips; this is a good time to update the cache.  */
+  save_cache (app);
   return err;
 }
 
@@ -2534,6 +2971,7 @@ readcert_by_cdf (app_t app, cdf_object_t cdf,
   size_t totobjlen, objlen, hdrlen;
   int rootca;
   int i;
+  char *cachename, *s;
 
   *r_cert = NULL;
   *r_certlen = 0;
@@ -2549,6 +2987,23 @@ readcert_by_cdf (app_t app, cdf_object_t cdf,
       return 0;
     }
 
+  /* Then check the persistent cache.  The item is named after the
+     location of the certificate on the card.  */
+  cachename = xtrymalloc (5 + 4 * cdf->pathlen + 1 + 20 + 1);
+  if (!cachename)
+    return gpg_error_from_syserror ();
+  s = stpcpy (cachename, "cert-");
+  for (i=0; i < cdf->pathlen; i++)
+    s += sprintf (s, "%04hX", cdf->path[i]);
+  sprintf (s, "-%lu", cdf->off);
+  if (!get_cached (app, cachename, &buffer, &buflen))
+    {
+      cdf->image = buffer;
+      cdf->imagelen = buflen;
+      xfree (cachename);
+      return readcert_by_cdf (app, cdf, r_cert, r_certlen);
+    }
+
   /* Read the entire file.  fixme: This could be optimized by first
      reading the header to figure out how long the certificate
      actually is. */
@@ -2631,9 +3086,10 @@ readcert_by_cdf (app_t app, cdf_object_t cdf,
       memcpy (cdf->image, *r_cert, *r_certlen);
       cdf->imagelen = *r_certlen;
     }
-
+  put_cached (app, cachename, *r_cert, *r_certlen);
 
  leave:
+  xfree (cachename);
   xfree (buffer);
   return err;
 }
@@ -2658,6 +3114,7 @@ do_readcert (app_t app, const char *certid,
   err = cdf_object_from_certid (app, certid, &cdf);
   if (!err)
     err = readcert_by_cdf (app, cdf, r_cert, r_certlen);
+  save_cache (app);
   return err;
 }
 
@@ -2677,6 +3134,9 @@ do_getattr (app_t app, ctrl_t ctrl, const char *name)
 
       /* We return the ID of the first private keycapable of
          signing. */
+      err = load_prkdf_info (app);
+      if (err)
+        return err;
       for (prkdf = app->app_local->private_key_info; prkdf;
            prkdf = prkdf->next)
         if (prkdf->usageflags.sign)
@@ -2895,6 +3355,9 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
     }
 
   /* Find the authentication object to this private key object. */
+  err = load_aodf_info (app);
+  if (err)
+    return err;
   for (aodf = app->app_local->auth_object_info; aodf; aodf = aodf->next)
     if (aodf->objidlen == prkdf->authidlen
         && !memcmp (aodf->objid, prkdf->authid, prkdf->authidlen))
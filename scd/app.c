@@ -584,6 +584,48 @@ app_get_serial_and_stamp (app_t app, char **serial, time_t *stamp)
 }
 
 
+/* Store the serial number of the card in SLOT at R_SERIALNO without
+   waiting for the lock of the reader, which is held for the entire
+   duration of a card operation.  This works if an application has
+   already been selected for SLOT; nPth switches threads only at
+   blocking calls and thus the lock table may be inspected without
+   holding the lock.  If R_BUSY is not NULL it is set to true if
+   another session is using the reader.  Returns GPG_ERR_NOT_FOUND if
+   the card is not yet known; the caller may then use
+   select_application to identify it.  GPG_ERR_EBUSY is returned
+   instead if the reader is in use.  */
+gpg_error_t
+app_get_slot_serialno (int slot, char **r_serialno, int *r_busy)
+{
+  app_t app;
+  int busy = 0;
+
+  *r_serialno = NULL;
+  if (r_busy)
+    *r_busy = 0;
+
+  if (slot < 0 || slot >= DIM (lock_table))
+    return gpg_error (slot<0? GPG_ERR_INV_VALUE : GPG_ERR_RESOURCE_LIMIT);
+  if (!lock_table[slot].initialized)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  if (npth_mutex_trylock (&lock_table[slot].lock))
+    busy = 1;
+  else
+    npth_mutex_unlock (&lock_table[slot].lock);
+  if (r_busy)
+    *r_busy = busy;
+
+  app = lock_table[slot].app;
+  if (!app || app->no_reuse)
+    app = lock_table[slot].last_app;
+  if (app && !app->no_reuse)
+    return app_get_serial_and_stamp (app, r_serialno, NULL);
+
+  return gpg_error (busy? GPG_ERR_EBUSY : GPG_ERR_NOT_FOUND);
+}
+
+
 /* Write out the application specifig status lines for the LEARN
    command. */
 gpg_error_t
@@ -288,3 +288,59 @@ atr_dump (const void *buffer, size_t buflen)
 
   return result;
 }
+
+
+/* Return the third byte of the card capabilities from the historical
+   bytes of the ATR in (BUFFER,BUFLEN) or 0 if they are not available.
+   The bits of interest are 0x80 (command chaining) and 0x40
+   (extended Lc and Le fields); see ISO/IEC 7816-4, 8.1.1.2.7.  */
+unsigned int
+atr_get_card_capabilities (const void *buffer, size_t buflen)
+{
+  const unsigned char *atr = buffer;
+  const unsigned char *hist;
+  size_t n_historical;
+  size_t idx;
+  int y;
+
+  if (buflen < 2)
+    return 0;
+  n_historical = (atr[1] & 0x0f);
+  y = (atr[1] >> 4);
+  idx = 2;
+  /* Skip the interface bytes.  */
+  for (;;)
+    {
+      idx += !!(y & 1) + !!(y & 2) + !!(y & 4);
+      if (!(y & 8))
+        break;
+      if (idx >= buflen)
+        return 0;
+      y = (atr[idx++] >> 4);
+    }
+  if (idx + n_historical > buflen || n_historical < 2)
+    return 0;
+  hist = atr + idx;
+
+  /* Only the category indicators 0x00 and 0x80 are followed by
+     COMPACT-TLV data objects.  With 0x00 the last three bytes are a
+     status indicator.  */
+  if (*hist == 0x00)
+    {
+      if (n_historical < 4)
+        return 0;
+      n_historical -= 3;
+    }
+  else if (*hist != 0x80)
+    return 0;
+
+  for (idx = 1; idx < n_historical; idx += 1 + (hist[idx] & 0x0f))
+    if ((hist[idx] & 0xf0) == 0x70)
+      {
+        if ((hist[idx] & 0x0f) >= 3 && idx + 3 < n_historical)
+          return hist[idx+3];
+        break;
+      }
+
+  return 0;
+}
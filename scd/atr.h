@@ -21,6 +21,7 @@
 #define ATR_H
 
 char *atr_dump (const void *buffer, size_t buflen);
+unsigned int atr_get_card_capabilities (const void *buffer, size_t buflen);
 
 
 
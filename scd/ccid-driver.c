@@ -337,6 +337,54 @@ my_sleep (int seconds)
 #endif
 }
 
+
+/* Transfer types for do_usb_transfer.  */
+#define XFER_BULK_OUT 1
+#define XFER_BULK_IN  2
+#define XFER_INTR_IN  3
+
+/* Run the blocking libusb transfer XFERTYPE on endpoint EP.  The
+   transfer functions wait until the reader has answered, which may
+   take several seconds for key generation or decryption.  To keep
+   the Assuan connections and the other readers going we release the
+   nPth lock while waiting; the reader itself is protected by the
+   slot lock of apdu.c.  Returns the value of the libusb function with
+   ERRNO preserved.  */
+static int
+do_usb_transfer (usb_dev_handle *idev, int xfertype, int ep,
+                 unsigned char *buffer, int length, int timeout)
+{
+  int rc;
+#ifdef USE_NPTH
+  int saved_errno;
+
+  npth_unprotect ();
+#endif
+  switch (xfertype)
+    {
+    case XFER_BULK_OUT:
+      rc = usb_bulk_write (idev, ep, (char*)buffer, length, timeout);
+      break;
+    case XFER_BULK_IN:
+      rc = usb_bulk_read (idev, ep, (char*)buffer, length, timeout);
+      break;
+    case XFER_INTR_IN:
+      rc = usb_interrupt_read (idev, ep, (char*)buffer, length, timeout);
+      break;
+    default:
+      errno = EINVAL;
+      rc = -1;
+      break;
+    }
+#ifdef USE_NPTH
+  saved_errno = errno;
+  npth_protect ();
+  errno = saved_errno;
+#endif
+  return rc;
+}
+
+
 static void
 print_progress (ccid_driver_t handle)
 {
@@ -1916,10 +1964,9 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
 
   if (handle->idev)
     {
-      rc = usb_bulk_write (handle->idev,
-                           handle->ep_bulk_out,
-                           (char*)msg, msglen,
-                           5000 /* ms timeout */);
+      rc = do_usb_transfer (handle->idev, XFER_BULK_OUT,
+                            handle->ep_bulk_out, msg, msglen,
+                            5000 /* ms timeout */);
       if (rc == msglen)
         return 0;
 #ifdef LIBUSB_ERRNO_NO_SUCH_DEVICE
@@ -1981,10 +2028,8 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
  retry:
   if (handle->idev)
     {
-      rc = usb_bulk_read (handle->idev,
-                          handle->ep_bulk_in,
-                          (char*)buffer, length,
-                          timeout);
+      rc = do_usb_transfer (handle->idev, XFER_BULK_IN,
+                            handle->ep_bulk_in, buffer, length, timeout);
       if (rc < 0)
         {
           rc = errno;
@@ -2000,7 +2045,11 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
     }
   else
     {
+#ifdef USE_NPTH
+      rc = npth_read (handle->dev_fd, buffer, length);
+#else
       rc = read (handle->dev_fd, buffer, length);
+#endif
       if (rc < 0)
         {
           rc = errno;
@@ -2147,10 +2196,9 @@ abort_cmd (ccid_driver_t handle, int seqno)
       msglen = 10;
       set_msg_len (msg, 0);
 
-      rc = usb_bulk_write (handle->idev,
-                           handle->ep_bulk_out,
-                           (char*)msg, msglen,
-                           5000 /* ms timeout */);
+      rc = do_usb_transfer (handle->idev, XFER_BULK_OUT,
+                            handle->ep_bulk_out, msg, msglen,
+                            5000 /* ms timeout */);
       if (rc == msglen)
         rc = 0;
       else if (rc == -1)
@@ -2162,10 +2210,9 @@ abort_cmd (ccid_driver_t handle, int seqno)
       if (rc)
         return rc;
 
-      rc = usb_bulk_read (handle->idev,
-                          handle->ep_bulk_in,
-                          (char*)msg, sizeof msg,
-                          5000 /*ms timeout*/);
+      rc = do_usb_transfer (handle->idev, XFER_BULK_IN,
+                            handle->ep_bulk_in, msg, sizeof msg,
+                            5000 /*ms timeout*/);
       if (rc < 0)
         {
           DEBUGOUT_1 ("usb_bulk_read error in abort_cmd: %s\n",
@@ -2332,6 +2379,84 @@ ccid_poll (ccid_driver_t handle)
 }
 
 
+/* Wait up to TIMEOUT milliseconds for a message on the interrupt-IN
+   endpoint of the reader.  On success R_CHANGED is set to true if the
+   reader sent a RDR_to_PC_NotifySlotChange or a RDR_to_PC_HardwareError
+   message; it is set to false on timeout.  The function does not use
+   the bulk endpoints and may thus be called from another thread while
+   a command is in progress.  CCID_DRIVER_ERR_NOT_SUPPORTED is returned
+   if the reader is not connected via USB or does not implement the
+   interrupt endpoint.  */
+int
+ccid_wait_slot_change (ccid_driver_t handle, int timeout, int *r_changed)
+{
+  int rc;
+  unsigned char msg[10];
+
+  *r_changed = 0;
+  if (!handle->idev)
+    return CCID_DRIVER_ERR_NOT_SUPPORTED;
+  if (handle->enodev_seen)
+    return CCID_DRIVER_ERR_NO_READER;
+
+  rc = do_usb_transfer (handle->idev, XFER_INTR_IN, handle->ep_intr,
+                        msg, sizeof msg, timeout);
+#ifdef LIBUSB_ERRNO_NO_SUCH_DEVICE
+  if (rc == -(LIBUSB_ERRNO_NO_SUCH_DEVICE))
+    {
+      errno = LIBUSB_ERRNO_NO_SUCH_DEVICE;
+      rc = -1;
+    }
+#endif /*LIBUSB_ERRNO_NO_SUCH_DEVICE*/
+  if (rc == -ETIMEDOUT || (rc == -1 && errno == ETIMEDOUT))
+    return 0;
+  if (rc < 0)
+    {
+      DEBUGOUT_1 ("usb_intr_read error: %s\n", strerror (errno));
+#ifdef LIBUSB_ERRNO_NO_SUCH_DEVICE
+      if (rc == -1 && errno == LIBUSB_ERRNO_NO_SUCH_DEVICE)
+        {
+          handle->enodev_seen = 1;
+          return CCID_DRIVER_ERR_NO_READER;
+        }
+#endif /*LIBUSB_ERRNO_NO_SUCH_DEVICE*/
+      /* A reader without an interrupt endpoint ends up here as
+         well; the caller falls back to polling.  */
+      return CCID_DRIVER_ERR_NOT_SUPPORTED;
+    }
+
+  if (rc >= 1 && (msg[0] == RDR_to_PC_NotifySlotChange
+                  || msg[0] == RDR_to_PC_HardwareError))
+    {
+      if (debug_level > 1)
+        DEBUGOUT_1 ("intr-in msg of type %02X\n", msg[0]);
+      *r_changed = 1;
+    }
+  else if (rc >= 1)
+    DEBUGOUT_1 ("unknown intr-in msg of type %02X\n", msg[0]);
+
+  return 0;
+}
+
+
+/* Return the maximum length of the data in an extended length APDU
+   the reader is able to transfer or 0 if the reader does not support
+   extended length APDUs.  */
+int
+ccid_get_exlen_max (ccid_driver_t handle)
+{
+  if (!handle->apdu_level)
+    return 65535;  /* TPDU level; T=1 chaining is done by us.  */
+  else if (handle->apdu_level > 1)
+    return CCID_MAX_BUF - 10 - 9; /* CCID header, APDU header, Le.  */
+  else if (handle->id_vendor == VENDOR_OMNIKEY
+           || (!handle->idev && handle->id_product == TRANSPORT_CM4040))
+    return 65535;  /* Sent as TPDUs via the escape command.  */
+  else
+    return 0;      /* Short APDU level.  */
+}
+
+
 /* Note that this function won't return the error codes NO_CARD or
    CARD_INACTIVE */
 int
@@ -95,6 +95,9 @@ struct vreader_s
                  tracking for the slot has been initialized.  */
   unsigned int status;  /* Last status of the reader. */
   unsigned int changed; /* Last change counter of the reader. */
+
+  int watching; /* A reader_watcher thread is running for this
+                   reader; the ticker does not need to poll it.  */
 };
 
 
@@ -159,8 +162,18 @@ static struct server_local_s *locked_session;
 static npth_mutex_t status_file_update_lock;
 
 
+/* The maximum time in milliseconds a reader watcher blocks while
+   waiting for an event of the reader.  Closing a reader may need to
+   wait this long for the watcher if the driver can't cancel the wait.
+   While the status of a busy reader can't be read we retry at the
+   rate of the ticker.  */
+#define READER_WATCH_TIMEOUT   5000
+#define READER_RETRY_TIMEOUT    500
+
+
 /*-- Local prototypes --*/
 static void update_reader_status_file (int set_card_removed_flag);
+static void start_reader_watcher (int vrdr);
 
 
 
@@ -418,18 +431,12 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 }
 
 
-/* Return the index of the current reader or open the reader if no
-   other sessions are using that reader.  If it is not possible to
-   open the reader -1 is returned.  Note, that we currently support
-   only one reader but most of the code (except for this function)
-   should be able to cope with several readers.  */
+/* Make sure that the virtual reader VRDR is open using the port
+   PORTSTR.  Returns true if the reader is usable.  */
 static int
-get_current_reader (void)
+open_vreader (int vrdr, const char *portstr)
 {
-  struct vreader_s *vr;
-
-  /* We only support one reader for now.  */
-  vr = &vreader_table[0];
+  struct vreader_s *vr = vreader_table + vrdr;
 
   /* Initialize the vreader item if not yet done. */
   if (!vr->valid)
@@ -441,7 +448,7 @@ get_current_reader (void)
   /* Try to open the reader. */
   if (vr->slot == -1)
     {
-      vr->slot = apdu_open_reader (opt.reader_port);
+      vr->slot = apdu_open_reader (portstr);
 
       /* If we still don't have a slot, we have no readers.
 	 Invalidate for now until a reader is attached. */
@@ -449,10 +456,170 @@ get_current_reader (void)
 	{
 	  vr->valid = 0;
 	}
+      else
+        start_reader_watcher (vrdr);
+    }
+
+  return vr->valid;
+}
+
+
+/* Open all configured readers if not yet done and return their
+   number.  Each --reader-port option describes one virtual reader;
+   without that option only the default reader is used.  */
+static int
+open_all_vreaders (void)
+{
+  strlist_t port;
+  int nports;
+
+  nports = 0;
+  port = opt.reader_port;
+  do
+    {
+      open_vreader (nports, port? port->d : NULL);
+      nports++;
+      if (port)
+        port = port->next;
+    }
+  while (port && nports < DIM (vreader_table));
+
+  return nports;
+}
+
+
+/* Return the index of the reader to be used by a new session and
+   open the readers if not yet done.  This is the first usable
+   reader; a client may ask for the card in another reader using
+   "SERIALNO --demand".  If it is not possible to open a reader -1 is
+   returned.  */
+static int
+get_current_reader (void)
+{
+  int nports, vrdr;
+
+  nports = open_all_vreaders ();
+  for (vrdr=0; vrdr < nports; vrdr++)
+    if (vreader_table[vrdr].valid)
+      return vrdr;
+  return -1;
+}
+
+
+/* Store the serial number of the card in the virtual reader VRDR at
+   R_SERIALNO and set R_BUSY if another session is using that reader.
+   The caller must free the returned string.  A reader in use is not
+   waited for; the serial number of its card is taken from the
+   application already selected for it.  */
+static gpg_error_t
+get_vreader_serialno (ctrl_t ctrl, int vrdr, char **r_serialno, int *r_busy)
+{
+  gpg_error_t err;
+  int slot = vreader_slot (vrdr);
+  int sw;
+  app_t app;
+  time_t stamp;
+
+  err = app_get_slot_serialno (slot, r_serialno, r_busy);
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    return err;
+
+  sw = apdu_connect (slot);
+  if (sw && sw != SW_HOST_ALREADY_CONNECTED)
+    return gpg_error (GPG_ERR_CARD);
+
+  err = select_application (ctrl, slot, NULL, &app);
+  if (err)
+    return err;
+  err = app_get_serial_and_stamp (app, r_serialno, &stamp);
+  release_application (app);
+  return err;
+}
+
+
+/* Return the index of a reader holding the card with the serial
+   number DEMAND or -1 if there is no such card.  If several readers
+   hold a card with that serial number, an idle reader is preferred
+   over one in use and then the one with the fewest sessions is
+   returned, taking turns among equally used readers.  Thus the
+   requests for a key on a set of cards with the same serial number
+   are spread over these cards.  */
+static int
+find_vreader_by_serialno (ctrl_t ctrl, const char *demand)
+{
+  static int next_vrdr;  /* The reader to try first for a tie.  */
+  struct server_local_s *sl;
+  int nports, vrdr, i, n, busy;
+  int best = -1;
+  int best_count = 0;
+  int best_busy = 0;
+  char *serialno;
+
+  nports = open_all_vreaders ();
+  for (i=0; i < nports; i++)
+    {
+      vrdr = (next_vrdr + i) % nports;
+      if (!vreader_table[vrdr].valid)
+        continue;
+      if (get_vreader_serialno (ctrl, vrdr, &serialno, &busy))
+        continue;
+      n = ascii_strcasecmp (serialno, demand);
+      xfree (serialno);
+      if (n)
+        continue;
+
+      for (n=0, sl=session_list; sl; sl = sl->next_session)
+        if (sl != ctrl->server_local && sl->vreader_idx == vrdr)
+          n++;
+      if (best == -1 || busy < best_busy
+          || (busy == best_busy && n < best_count))
+        {
+          best = vrdr;
+          best_count = n;
+          best_busy = busy;
+        }
     }
 
-  /* Return the vreader index or -1.  */
-  return vr->valid ? 0 : -1;
+  if (best != -1)
+    next_vrdr = (best + 1) % nports;
+  return best;
+}
+
+
+/* Switch the session to a reader holding the card with the serial
+   number DEMAND.  Nothing is changed if the current card already has
+   that serial number, if no such card is available or if the session
+   holds the lock on its reader.  */
+static void
+demand_card (ctrl_t ctrl, const char *demand)
+{
+  char *serialno;
+  time_t stamp;
+  int vrdr;
+
+  if (ctrl->app_ctx && !ctrl->server_local->app_ctx_marked_for_release
+      && !app_get_serial_and_stamp (ctrl->app_ctx, &serialno, &stamp))
+    {
+      vrdr = ascii_strcasecmp (serialno, demand);
+      xfree (serialno);
+      if (!vrdr)
+        return;
+    }
+
+  if (locked_session && ctrl->server_local == locked_session)
+    return;
+
+  vrdr = find_vreader_by_serialno (ctrl, demand);
+  if (vrdr == -1)
+    return;
+
+  if (ctrl->app_ctx)
+    {
+      release_application (ctrl->app_ctx);
+      ctrl->app_ctx = NULL;
+    }
+  ctrl->server_local->app_ctx_marked_for_release = 0;
+  ctrl->server_local->vreader_idx = vrdr;
 }
 
 
@@ -527,11 +694,15 @@ open_card (ctrl_t ctrl, const char *apptype)
 
 
 static const char hlp_serialno[] =
-  "SERIALNO [<apptype>]\n"
+  "SERIALNO [--demand=<serialno>] [<apptype>]\n"
   "\n"
   "Return the serial number of the card using a status response.  This\n"
   "function should be used to check for the presence of a card.\n"
   "\n"
+  "If --demand is given and several readers are in use, the session is\n"
+  "switched to a reader holding the card with that serial number.  If\n"
+  "no such card is available, the current card is used.\n"
+  "\n"
   "If APPTYPE is given, an application of that type is selected and an\n"
   "error is returned if the application is not supported or available.\n"
   "The default is to auto-select the application using a hardwired\n"
@@ -551,9 +722,24 @@ cmd_serialno (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int rc = 0;
   char *serial;
+  char *demand;
   time_t stamp;
   int retries = 0;
 
+  if ((demand = (char *)has_option_name (line, "--demand")))
+    {
+      if (*demand != '=')
+        return set_error (GPG_ERR_ASS_PARAMETER, "missing value for option");
+      demand++;
+    }
+  line = skip_options (line);
+  if (demand)
+    {
+      for (serial = demand; *serial && !spacep (serial); serial++)
+        ;
+      *serial = 0;
+    }
+
   /* Clear the remove flag so that the open_card is able to reread it.  */
  retry:
   if (ctrl->server_local->card_removed)
@@ -563,6 +749,9 @@ cmd_serialno (assuan_context_t ctx, char *line)
       do_reset (ctrl, 1);
     }
 
+  if (demand)
+    demand_card (ctrl, demand);
+
   if ((rc = open_card (ctrl, *line? line:NULL)))
     {
       /* In case of an inactive card, retry once.  */
@@ -2275,153 +2464,255 @@ send_client_notifications (void)
 
 
 
-/* This is the core of scd_update_reader_status_file but the caller
-   needs to take care of the locking.  */
-static void
-update_reader_status_file (int set_card_removed_flag)
+/* Update the status file and notify the clients for the virtual
+   reader IDX.  The caller needs to take care of the locking.  Returns
+   -1 if the status could not be read (e.g. because the reader is
+   busy) and 0 otherwise.  */
+static int
+update_one_reader_status (int idx, int set_card_removed_flag)
 {
-  int idx;
+  struct vreader_s *vr = vreader_table + idx;
+  struct server_local_s *sl;
   unsigned int status, changed;
+  int sw_apdu;
+
+  if (!vr->valid || vr->slot == -1)
+    return 0; /* Not valid or reader not yet open. */
 
   /* Note, that we only try to get the status, because it does not
      make sense to wait here for a operation to complete.  If we are
      busy working with a card, delays in the status file update should
      be acceptable. */
-  for (idx=0; idx < DIM(vreader_table); idx++)
+  sw_apdu = apdu_get_status (vr->slot, 0, &status, &changed);
+  if (sw_apdu == SW_HOST_NO_READER)
     {
-      struct vreader_s *vr = vreader_table + idx;
-      struct server_local_s *sl;
-      int sw_apdu;
-
-      if (!vr->valid || vr->slot == -1)
-        continue; /* Not valid or reader not yet open. */
+      /* Most likely the _reader_ has been unplugged.  */
+      application_notify_card_reset (vr->slot);
+      apdu_close_reader (vr->slot);
+      vr->slot = -1;
+      status = 0;
+      changed = vr->changed;
+    }
+  else if (sw_apdu)
+    {
+      /* Get status failed.  Ignore that.  */
+      return -1;
+    }
 
-      sw_apdu = apdu_get_status (vr->slot, 0, &status, &changed);
-      if (sw_apdu == SW_HOST_NO_READER)
-        {
-          /* Most likely the _reader_ has been unplugged.  */
-          application_notify_card_reset (vr->slot);
-	  apdu_close_reader (vr->slot);
-          vr->slot = -1;
-          status = 0;
-          changed = vr->changed;
-        }
-      else if (sw_apdu)
+  if (!vr->any || vr->status != status || vr->changed != changed )
+    {
+      char *fname;
+      char templ[50];
+      FILE *fp;
+
+      log_info ("updating reader %d (%d) status: 0x%04X->0x%04X (%u->%u)\n",
+                idx, vr->slot, vr->status, status, vr->changed, changed);
+      vr->status = status;
+      vr->changed = changed;
+
+      /* FIXME: Should this be IDX instead of vr->slot?  This
+         depends on how client sessions will associate the reader
+         status with their session.  */
+      snprintf (templ, sizeof templ, "reader_%d.status", vr->slot);
+      fname = make_filename (opt.homedir, templ, NULL );
+      fp = fopen (fname, "w");
+      if (fp)
         {
-          /* Get status failed.  Ignore that.  */
-          continue;
+          fprintf (fp, "%s\n",
+                   (status & 1)? "USABLE":
+                   (status & 4)? "ACTIVE":
+                   (status & 2)? "PRESENT": "NOCARD");
+          fclose (fp);
         }
+      xfree (fname);
 
-      if (!vr->any || vr->status != status || vr->changed != changed )
-        {
-          char *fname;
-          char templ[50];
-          FILE *fp;
-
-          log_info ("updating reader %d (%d) status: 0x%04X->0x%04X (%u->%u)\n",
-                    idx, vr->slot, vr->status, status, vr->changed, changed);
-          vr->status = status;
-          vr->changed = changed;
-
-	  /* FIXME: Should this be IDX instead of vr->slot?  This
-	     depends on how client sessions will associate the reader
-	     status with their session.  */
-          snprintf (templ, sizeof templ, "reader_%d.status", vr->slot);
-          fname = make_filename (opt.homedir, templ, NULL );
-          fp = fopen (fname, "w");
-          if (fp)
-            {
-              fprintf (fp, "%s\n",
-                       (status & 1)? "USABLE":
+      /* If a status script is executable, run it. */
+      {
+        const char *args[9], *envs[2];
+        char numbuf1[30], numbuf2[30], numbuf3[30];
+        char *homestr, *envstr;
+        gpg_error_t err;
+
+        homestr = make_filename (opt.homedir, NULL);
+        if (gpgrt_asprintf (&envstr, "GNUPGHOME=%s", homestr) < 0)
+          log_error ("out of core while building environment\n");
+        else
+          {
+            envs[0] = envstr;
+            envs[1] = NULL;
+
+            sprintf (numbuf1, "%d", vr->slot);
+            sprintf (numbuf2, "0x%04X", vr->status);
+            sprintf (numbuf3, "0x%04X", status);
+            args[0] = "--reader-port";
+            args[1] = numbuf1;
+            args[2] = "--old-code";
+            args[3] = numbuf2;
+            args[4] = "--new-code";
+            args[5] = numbuf3;
+            args[6] = "--status";
+            args[7] = ((status & 1)? "USABLE":
                        (status & 4)? "ACTIVE":
                        (status & 2)? "PRESENT": "NOCARD");
-              fclose (fp);
-            }
-          xfree (fname);
-
-          /* If a status script is executable, run it. */
-          {
-            const char *args[9], *envs[2];
-            char numbuf1[30], numbuf2[30], numbuf3[30];
-            char *homestr, *envstr;
-            gpg_error_t err;
-
-            homestr = make_filename (opt.homedir, NULL);
-            if (gpgrt_asprintf (&envstr, "GNUPGHOME=%s", homestr) < 0)
-              log_error ("out of core while building environment\n");
-            else
-              {
-                envs[0] = envstr;
-                envs[1] = NULL;
-
-                sprintf (numbuf1, "%d", vr->slot);
-                sprintf (numbuf2, "0x%04X", vr->status);
-                sprintf (numbuf3, "0x%04X", status);
-                args[0] = "--reader-port";
-                args[1] = numbuf1;
-                args[2] = "--old-code";
-                args[3] = numbuf2;
-                args[4] = "--new-code";
-                args[5] = numbuf3;
-                args[6] = "--status";
-                args[7] = ((status & 1)? "USABLE":
-                           (status & 4)? "ACTIVE":
-                           (status & 2)? "PRESENT": "NOCARD");
-                args[8] = NULL;
-
-                fname = make_filename (opt.homedir, "scd-event", NULL);
-                err = gnupg_spawn_process_detached (fname, args, envs);
-                if (err && gpg_err_code (err) != GPG_ERR_ENOENT)
-                  log_error ("failed to run event handler '%s': %s\n",
-                             fname, gpg_strerror (err));
-                xfree (fname);
-                xfree (envstr);
-              }
-            xfree (homestr);
+            args[8] = NULL;
+
+            fname = make_filename (opt.homedir, "scd-event", NULL);
+            err = gnupg_spawn_process_detached (fname, args, envs);
+            if (err && gpg_err_code (err) != GPG_ERR_ENOENT)
+              log_error ("failed to run event handler '%s': %s\n",
+                         fname, gpg_strerror (err));
+            xfree (fname);
+            xfree (envstr);
           }
+        xfree (homestr);
+      }
 
-          /* Set the card removed flag for all current sessions.  */
-          if (vr->any && vr->status == 0 && set_card_removed_flag)
-            update_card_removed (idx, 1);
+      /* Set the card removed flag for all current sessions.  */
+      if (vr->any && vr->status == 0 && set_card_removed_flag)
+        update_card_removed (idx, 1);
 
-          vr->any = 1;
+      vr->any = 1;
 
-          /* Send a signal to all clients who applied for it.  */
-          send_client_notifications ();
-        }
+      /* Send a signal to all clients who applied for it.  */
+      send_client_notifications ();
+    }
 
-      /* Check whether a disconnect is pending.  */
-      if (opt.card_timeout)
+  /* Check whether a disconnect is pending.  */
+  if (opt.card_timeout)
+    {
+      for (sl=session_list; sl; sl = sl->next_session)
+        if (!sl->disconnect_allowed)
+          break;
+      if (session_list && !sl)
         {
-          for (sl=session_list; sl; sl = sl->next_session)
-            if (!sl->disconnect_allowed)
-              break;
-          if (session_list && !sl)
-            {
-              /* FIXME: Use a real timeout.  */
-              /* At least one connection and all allow a disconnect.  */
-              log_info ("disconnecting card in reader %d (%d)\n",
-                        idx, vr->slot);
-              apdu_disconnect (vr->slot);
-            }
+          /* FIXME: Use a real timeout.  */
+          /* At least one connection and all allow a disconnect.  */
+          log_info ("disconnecting card in reader %d (%d)\n",
+                    idx, vr->slot);
+          apdu_disconnect (vr->slot);
         }
-
     }
+  return 0;
+}
+
+
+/* This is the core of scd_update_reader_status_file but the caller
+   needs to take care of the locking.  */
+static void
+update_reader_status_file (int set_card_removed_flag)
+{
+  int idx;
+
+  for (idx=0; idx < DIM(vreader_table); idx++)
+    update_one_reader_status (idx, set_card_removed_flag);
 }
 
 /* This function is called by the ticker thread to check for changes
    of the reader stati.  It updates the reader status files and if
-   requested by the caller also send a signal to the caller.  */
+   requested by the caller also send a signal to the caller.  Readers
+   watched by a reader_watcher thread are skipped.  */
 void
 scd_update_reader_status_file (void)
 {
   int err;
+  int idx;
+
   err = npth_mutex_lock (&status_file_update_lock);
   if (err)
     return; /* locked - give up. */
-  update_reader_status_file (1);
+  for (idx=0; idx < DIM(vreader_table); idx++)
+    if (!vreader_table[idx].watching)
+      update_one_reader_status (idx, 1);
   err = npth_mutex_unlock (&status_file_update_lock);
   if (err)
     log_error ("failed to release status_file_update lock: %s\n",
 	       strerror (err));
 }
+
+
+/* Return true if the ticker needs to poll at least one reader.  */
+int
+scd_reader_polling_needed (void)
+{
+  int idx;
+
+  for (idx=0; idx < DIM(vreader_table); idx++)
+    if (vreader_table[idx].valid && vreader_table[idx].slot != -1
+        && !vreader_table[idx].watching)
+      return 1;
+  return 0;
+}
+
+
+/* Thread function to watch the reader ARG for status changes.  The
+   thread blocks until the reader signals an event and then updates
+   the status file like the ticker does.  It terminates as soon as the
+   reader has been closed or if the reader does not support events;
+   the reader is then polled by the ticker.  */
+static void *
+reader_watcher (void *arg)
+{
+  struct vreader_s *vr = arg;
+  int idx = vr - vreader_table;
+  int slot = vr->slot;
+  int pending = 1;  /* Get the initial status.  */
+  int changed;
+  int sw;
+
+  while (vr->valid && vr->slot == slot)
+    {
+      sw = apdu_wait_status_change (slot, (pending? READER_RETRY_TIMEOUT
+                                           /* */ : READER_WATCH_TIMEOUT),
+                                    &changed);
+      if (sw)
+        {
+          if (sw != SW_HOST_NOT_SUPPORTED)
+            log_info ("watching reader %d (%d) failed: %s\n",
+                      idx, slot, apdu_strerror (sw));
+          break;
+        }
+
+      if ((changed || pending) && vr->slot == slot)
+        {
+          if (npth_mutex_lock (&status_file_update_lock))
+            break;
+          pending = update_one_reader_status (idx, 1) == -1;
+          npth_mutex_unlock (&status_file_update_lock);
+        }
+    }
+
+  if (DBG_READER)
+    log_debug ("reader watcher for reader %d (%d) terminated\n", idx, slot);
+  vr->watching = 0;
+  return NULL;
+}
+
+
+/* Start a thread watching the virtual reader VRDR for status changes
+   unless one is already running.  This is not done with
+   --card-timeout because the disconnect logic depends on the
+   ticker.  */
+static void
+start_reader_watcher (int vrdr)
+{
+  struct vreader_s *vr = vreader_table + vrdr;
+  npth_attr_t tattr;
+  npth_t thread;
+  int err;
+
+  if (vr->watching || opt.card_timeout)
+    return;
+
+  err = npth_attr_init (&tattr);
+  if (err)
+    return;
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  vr->watching = 1;
+  err = npth_create (&thread, &tattr, reader_watcher, vr);
+  if (err)
+    {
+      log_error ("error spawning reader watcher: %s\n", strerror (err));
+      vr->watching = 0;
+    }
+  npth_attr_destroy (&tattr);
+}
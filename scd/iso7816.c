@@ -463,6 +463,34 @@ iso7816_manage_security_env (int slot, int p1, int p2,
 }
 
 
+/* Send a command for iso7816_compute_ds and friends.  AUTO_MODE is
+   true if EXTENDED_MODE was not requested by the caller but taken
+   from the card's ATR.  Some cards or readers do not handle the
+   announced extended length and return SW_WRONG_LENGTH; in this case
+   the command is sent again using short APDUs and, if the data does
+   not fit, command chaining.  */
+static int
+send_le_fallback (int slot, int auto_mode, int extended_mode,
+                  int ins, int p0, int p1,
+                  int lc, const char *data, int le,
+                  unsigned char **result, size_t *resultlen)
+{
+  int sw;
+
+  sw = apdu_send_le (slot, extended_mode, 0x00, ins, p0, p1,
+                     lc, data, le, result, resultlen);
+  if (sw == SW_WRONG_LENGTH && auto_mode && extended_mode > 0)
+    {
+      xfree (*result);
+      *result = NULL;
+      *resultlen = 0;
+      sw = apdu_send_le (slot, lc > 255? -1 : 0, 0x00, ins, p0, p1,
+                         lc, data, 256, result, resultlen);
+    }
+  return sw;
+}
+
+
 /* Perform the security operation COMPUTE DIGITAL SIGANTURE.  On
    success 0 is returned and the data is availavle in a newly
    allocated buffer stored at RESULT with its length stored at
@@ -473,22 +501,26 @@ iso7816_compute_ds (int slot, int extended_mode,
                     unsigned char **result, size_t *resultlen)
 {
   int sw;
+  int auto_mode;
 
   if (!data || !datalen || !result || !resultlen)
     return gpg_error (GPG_ERR_INV_VALUE);
   *result = NULL;
   *resultlen = 0;
 
-  if (!extended_mode)
+  auto_mode = !extended_mode;
+  if (!extended_mode && (extended_mode = apdu_get_exlen_max (slot)))
+    le = extended_mode;  /* Get the entire response in one go.  */
+  else if (!extended_mode)
     le = 256;  /* Ignore provided Le and use what apdu_send uses. */
   else if (le >= 0 && le < 256)
     le = 256;
 
-  sw = apdu_send_le (slot, extended_mode,
-                     0x00, CMD_PSO, 0x9E, 0x9A,
-                     datalen, (const char*)data,
-                     le,
-                     result, resultlen);
+  sw = send_le_fallback (slot, auto_mode, extended_mode,
+                         CMD_PSO, 0x9E, 0x9A,
+                         datalen, (const char*)data,
+                         le,
+                         result, resultlen);
   if (sw != SW_SUCCESS)
     {
       /* Make sure that pending buffers are released. */
@@ -514,6 +546,7 @@ iso7816_decipher (int slot, int extended_mode,
                   int padind, unsigned char **result, size_t *resultlen)
 {
   int sw;
+  int auto_mode;
   unsigned char *buf;
 
   if (!data || !datalen || !result || !resultlen)
@@ -521,7 +554,10 @@ iso7816_decipher (int slot, int extended_mode,
   *result = NULL;
   *resultlen = 0;
 
-  if (!extended_mode)
+  auto_mode = !extended_mode;
+  if (!extended_mode && (extended_mode = apdu_get_exlen_max (slot)))
+    le = extended_mode;  /* Get the entire response in one go.  */
+  else if (!extended_mode)
     le = 256;  /* Ignore provided Le and use what apdu_send uses. */
   else if (le >= 0 && le < 256)
     le = 256;
@@ -535,18 +571,18 @@ iso7816_decipher (int slot, int extended_mode,
 
       *buf = padind; /* Padding indicator. */
       memcpy (buf+1, data, datalen);
-      sw = apdu_send_le (slot, extended_mode,
-                         0x00, CMD_PSO, 0x80, 0x86,
-                         datalen+1, (char*)buf, le,
-                         result, resultlen);
+      sw = send_le_fallback (slot, auto_mode, extended_mode,
+                             CMD_PSO, 0x80, 0x86,
+                             datalen+1, (char*)buf, le,
+                             result, resultlen);
       xfree (buf);
     }
   else
     {
-      sw = apdu_send_le (slot, extended_mode,
-                         0x00, CMD_PSO, 0x80, 0x86,
-                         datalen, (const char *)data, le,
-                         result, resultlen);
+      sw = send_le_fallback (slot, auto_mode, extended_mode,
+                             CMD_PSO, 0x80, 0x86,
+                             datalen, (const char *)data, le,
+                             result, resultlen);
     }
   if (sw != SW_SUCCESS)
     {
@@ -569,22 +605,26 @@ iso7816_internal_authenticate (int slot, int extended_mode,
                                unsigned char **result, size_t *resultlen)
 {
   int sw;
+  int auto_mode;
 
   if (!data || !datalen || !result || !resultlen)
     return gpg_error (GPG_ERR_INV_VALUE);
   *result = NULL;
   *resultlen = 0;
 
-  if (!extended_mode)
+  auto_mode = !extended_mode;
+  if (!extended_mode && (extended_mode = apdu_get_exlen_max (slot)))
+    le = extended_mode;  /* Get the entire response in one go.  */
+  else if (!extended_mode)
     le = 256;  /* Ignore provided Le and use what apdu_send uses. */
   else if (le >= 0 && le < 256)
     le = 256;
 
-  sw = apdu_send_le (slot, extended_mode,
-                     0x00, CMD_INTERNAL_AUTHENTICATE, 0, 0,
-                     datalen, (const char*)data,
-                     le,
-                     result, resultlen);
+  sw = send_le_fallback (slot, auto_mode, extended_mode,
+                         CMD_INTERNAL_AUTHENTICATE, 0, 0,
+                         datalen, (const char*)data,
+                         le,
+                         result, resultlen);
   if (sw != SW_SUCCESS)
     {
       /* Make sure that pending buffers are released. */
@@ -704,12 +744,17 @@ iso7816_read_binary (int slot, size_t offset, size_t nmax,
   size_t bufferlen;
   int read_all = !nmax;
   size_t n;
+  int exlen;
 
   if (!result || !resultlen)
     return gpg_error (GPG_ERR_INV_VALUE);
   *result = NULL;
   *resultlen = 0;
 
+  /* With extended length we can read up to EXLEN bytes at once
+     instead of chunks of 256 bytes.  */
+  exlen = apdu_get_exlen_max (slot);
+
   /* We can only encode 15 bits in p0,p1 to indicate an offset. Thus
      we check for this limit. */
   if (offset > 32767)
@@ -720,9 +765,19 @@ iso7816_read_binary (int slot, size_t offset, size_t nmax,
       buffer = NULL;
       bufferlen = 0;
       n = read_all? 0 : nmax;
-      sw = apdu_send_le (slot, 0, 0x00, CMD_READ_BINARY,
+      if (exlen && (read_all || nmax > 256))
+        n = (read_all || nmax > exlen)? exlen : nmax;
+      sw = apdu_send_le (slot, n > 256? exlen : 0, 0x00, CMD_READ_BINARY,
                          ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
                          n, &buffer, &bufferlen);
+      if (sw == SW_WRONG_LENGTH && n > 256)
+        {
+          /* The card does not like our extended Le; fall back to
+             short APDUs.  */
+          xfree (buffer);
+          exlen = 0;
+          continue;
+        }
       if ( SW_EXACT_LENGTH_P(sw) )
         {
           n = (sw & 0x00ff);
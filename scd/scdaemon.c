@@ -189,18 +189,17 @@ static struct debug_flags_s debug_flags [] =
 #define DEFAULT_PCSC_DRIVER "libpcsclite.so"
 #endif
 
-/* The timer tick used for housekeeping stuff.  We poll every 500ms to
-   let the user immediately know a status change.
-
-   This is not too good for power saving but given that there is no
-   easy way to block on card status changes it is the best we can do.
-   For PC/SC we could in theory use an extra thread to wait for status
-   changes but that requires a native thread because there is no way
-   to make the underlying PC/SC card change function block using a Npth
-   mechanism.  Given that a native thread could only be used under W32
-   we don't do that at all.  */
+/* The timer tick used for housekeeping stuff.  Readers which are
+   able to notify us about card status changes (CCID readers with an
+   interrupt endpoint and PC/SC readers) are watched by a thread
+   blocking on the reader (see reader_watcher in command.c).  For all
+   other readers we poll every 500ms to let the user immediately know
+   a status change.  If there is no reader to poll, the tick is only
+   used to check for a pending shutdown and runs at a much slower
+   rate to save power.  */
 #define TIMERTICK_INTERVAL_SEC     (0)
 #define TIMERTICK_INTERVAL_USEC    (500000)
+#define TIMERTICK_IDLE_INTERVAL_SEC (5)
 
 /* Flag to indicate that a shutdown was requested. */
 static int shutdown_pending;
@@ -591,7 +590,9 @@ main (int argc, char **argv )
         case oMultiServer: pipe_server = 1; multi_server = 1; break;
         case oDaemon: is_daemon = 1; break;
 
-        case oReaderPort: opt.reader_port = pargs.r.ret_str; break;
+        case oReaderPort:
+          append_to_strlist (&opt.reader_port, pargs.r.ret_str);
+          break;
         case octapiDriver: opt.ctapi_driver = pargs.r.ret_str; break;
         case opcscDriver: opt.pcsc_driver = pargs.r.ret_str; break;
         case oDisableCCID: opt.disable_ccid = 1; break;
@@ -1034,6 +1035,23 @@ handle_tick (void)
 }
 
 
+/* Set TIMEOUT to the interval until the next tick.  */
+static void
+get_tick_interval (struct timespec *timeout)
+{
+  if (!shutdown_pending && (ticker_disabled || !scd_reader_polling_needed ()))
+    {
+      timeout->tv_sec = TIMERTICK_IDLE_INTERVAL_SEC;
+      timeout->tv_nsec = 0;
+    }
+  else
+    {
+      timeout->tv_sec = TIMERTICK_INTERVAL_SEC;
+      timeout->tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
+    }
+}
+
+
 /* Create a name for the socket.  We check for valid characters as
    well as against a maximum allowed length for a unix domain socket
    is done.  The function terminates the process in case of an error.
@@ -1222,8 +1240,7 @@ handle_connections (int listen_fd)
     }
 
   npth_clock_gettime (&curtime);
-  timeout.tv_sec = TIMERTICK_INTERVAL_SEC;
-  timeout.tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
+  get_tick_interval (&timeout);
   npth_timeradd (&curtime, &timeout, &abstime);
   /* We only require abstime here.  The others will be reused.  */
 
@@ -1247,8 +1264,7 @@ handle_connections (int listen_fd)
 	{
 	  /* Timeout.  */
 	  handle_tick ();
-	  timeout.tv_sec = TIMERTICK_INTERVAL_SEC;
-	  timeout.tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
+	  get_tick_interval (&timeout);
 	  npth_timeradd (&curtime, &timeout, &abstime);
 	}
       npth_timersub (&abstime, &curtime, &timeout);
@@ -54,7 +54,7 @@ struct
   const char *homedir;      /* Configuration directory name. */
   const char *ctapi_driver; /* Library to access the ctAPI. */
   const char *pcsc_driver;  /* Library to access the PC/SC system. */
-  const char *reader_port;  /* NULL or reder port to use. */
+  strlist_t reader_port;    /* NULL or list of reader ports to use. */
   int disable_ccid;    /* Disable the use of the internal CCID driver. */
   int disable_pinpad;  /* Do not use a pinpad. */
   int enable_pinpad_varlen;  /* Use variable length input for pinpad. */
@@ -127,6 +127,7 @@ void send_status_info (ctrl_t ctrl, const char *keyword, ...)
      GPGRT_ATTR_SENTINEL(1);
 void send_status_direct (ctrl_t ctrl, const char *keyword, const char *args);
 void scd_update_reader_status_file (void);
+int  scd_reader_polling_needed (void);
 
 
 #endif /*SCDAEMON_H*/
@@ -0,0 +1,1599 @@
+/* simcard.c - Software simulation of OpenPGP and PKCS#15 cards
+ * Copyright (C) 2015 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This module simulates a reader with an inserted OpenPGP card v2.0
+   or a PKCS#15 card.  It is used with "--reader-port sim:FILE" to
+   test and benchmark scdaemon without a physical token.  FILE is a
+   text file with one keyword and its arguments per line; empty lines
+   and lines starting with a '#' are ignored:
+
+     latency MS        Delay each APDU exchange by MS milliseconds.
+     baudrate N        Add the time to transfer the APDU and the
+                       response at N bit/s.
+     exlen N           Support extended length APDUs with up to N
+                       bytes of data.  By default only short APDUs
+                       are supported and responses are split using
+                       GET RESPONSE.
+     aid HEX           The 16 byte AID including the serial number.
+     pin 1|3 STRING    Set PW1 or PW3 (default 123456 and 12345678).
+     key 1|2|3 FILE    Load the RSA key for slot 1 (sign), 2 (decrypt)
+                       or 3 (auth) from FILE, which holds a private
+                       key S-expression.
+     key 1|2|3 generate NBITS
+                       Create a new RSA key at startup.
+     created 1|2|3 TIME
+                       Creation time of the key; this is used to
+                       compute the fingerprint.
+     do TAG HEX        Set the data object TAG (e.g. 5B for the name).
+     pkcs15 FID        Simulate a PKCS#15 card instead of an OpenPGP
+                       card.  Selecting the PKCS#15 AID selects the DF
+                       FID (e.g. 5015) below the MF.
+     file PATH HEX     Create the EF with the full PATH from the MF
+                       (e.g. 3F0050155032) and the content HEX.
+     file PATH @FNAME  Ditto but read the content from FNAME.
+
+   A PKCS#15 card supports SELECT by AID, FID or path and READ BINARY
+   on the EFs created with "file"; the OpenPGP specific commands are
+   still available but the OpenPGP application can't be selected.
+
+   Changes done by PUT DATA and key generation are not written back to
+   FILE.  */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "scdaemon.h"
+#include "membuf.h"
+#include "iso7816.h"
+#include "apdu.h"
+#include "simcard.h"
+
+
+/* A data object stored on the card.  */
+struct simcard_do_s
+{
+  struct simcard_do_s *next;
+  int tag;
+  size_t len;
+  unsigned char data[1];
+};
+typedef struct simcard_do_s *simcard_do_t;
+
+
+/* The maximum depth of a file.  */
+#define SIM_MAX_PATH 8
+
+/* An elementary file of a simulated PKCS#15 card.  */
+struct simcard_file_s
+{
+  struct simcard_file_s *next;
+  unsigned short path[SIM_MAX_PATH]; /* The full path from the MF.  */
+  int pathlen;
+  size_t len;
+  unsigned char data[1];
+};
+typedef struct simcard_file_s *simcard_file_t;
+
+
+/* An RSA key stored on the card.  */
+struct simcard_key_s
+{
+  gcry_sexp_t skey;      /* The private key or NULL.  */
+  unsigned char *n;      /* The modulus.  */
+  size_t nlen;
+  unsigned char *e;      /* The public exponent.  */
+  size_t elen;
+};
+
+
+/* The state of a simulated card.  */
+struct simcard_s
+{
+  unsigned int latency;  /* Delay per APDU in milliseconds.  */
+  unsigned int baudrate; /* Simulated link speed or 0.  */
+  unsigned int exlen;    /* Max. length for extended APDUs or 0.  */
+
+  unsigned char aid[16];
+  unsigned char hist[10];  /* The historical bytes.  */
+  simcard_do_t dos;        /* Simple data objects.  */
+
+  unsigned short p15_df;   /* FID of the PKCS#15 DF or 0.  */
+  simcard_file_t files;    /* The EFs of a PKCS#15 card.  */
+  unsigned short curdf[SIM_MAX_PATH]; /* The current DF.  */
+  int curdflen;
+  simcard_file_t curef;    /* The current EF or NULL.  */
+
+  char pin[4][65];         /* PW1 at index 1 and PW3 at index 3.  */
+  int tries[4];            /* Retry counters.  */
+  int verified[4];         /* CHV state for P2 0x81, 0x82, 0x83.  */
+  int pw1_multiple;        /* PW1 is valid for several signatures.  */
+
+  struct simcard_key_s key[3];
+  unsigned char fpr[60];
+  unsigned char cafpr[60];
+  unsigned char times[12];
+  unsigned long sig_counter;
+
+  membuf_t chain;          /* Data of a command chain.  */
+  int chaining;            /* True if CHAIN is active.  */
+  unsigned char *pending;  /* Response data for GET RESPONSE.  */
+  size_t pending_len;
+};
+
+
+/* The status words we use.  */
+#define SIM_SW_OK                0x9000
+#define SIM_SW_EOF_REACHED       0x6282
+#define SIM_SW_WRONG_LENGTH      0x6700
+#define SIM_SW_SECURITY_STATUS   0x6982
+#define SIM_SW_AUTH_BLOCKED      0x6983
+#define SIM_SW_NO_CURRENT_EF     0x6986
+#define SIM_SW_WRONG_DATA        0x6A80
+#define SIM_SW_FUNC_NOT_SUPP     0x6A81
+#define SIM_SW_FILE_NOT_FOUND    0x6A82
+#define SIM_SW_REF_NOT_FOUND     0x6A88
+#define SIM_SW_WRONG_P1P2        0x6B00
+#define SIM_SW_INS_NOT_SUPP      0x6D00
+#define SIM_SW_CLA_NOT_SUPP      0x6E00
+
+
+
+/* Store a BER-TLV encoded data object in MB.  */
+static void
+put_tlv (membuf_t *mb, int tag, const void *data, size_t len)
+{
+  unsigned char buf[5];
+  int n = 0;
+
+  if (tag > 0xff)
+    buf[n++] = tag >> 8;
+  buf[n++] = tag;
+  if (len < 128)
+    buf[n++] = len;
+  else if (len < 256)
+    {
+      buf[n++] = 0x81;
+      buf[n++] = len;
+    }
+  else
+    {
+      buf[n++] = 0x82;
+      buf[n++] = len >> 8;
+      buf[n++] = len;
+    }
+  put_membuf (mb, buf, n);
+  put_membuf (mb, data, len);
+}
+
+
+/* Store the constructed data object TAG with the content of INNER in
+   MB and release INNER.  */
+static void
+put_constructed (membuf_t *mb, int tag, membuf_t *inner)
+{
+  void *p;
+  size_t len;
+
+  p = get_membuf (inner, &len);
+  if (p)
+    put_tlv (mb, tag, p, len);
+  xfree (p);
+}
+
+
+/* Append the content of INNER to MB and release INNER.  */
+static void
+put_inner (membuf_t *mb, membuf_t *inner)
+{
+  void *p;
+  size_t len;
+
+  p = get_membuf (inner, &len);
+  if (p)
+    put_membuf (mb, p, len);
+  xfree (p);
+}
+
+
+static simcard_do_t
+find_do (simcard_t card, int tag)
+{
+  simcard_do_t d;
+
+  for (d = card->dos; d; d = d->next)
+    if (d->tag == tag)
+      return d;
+  return NULL;
+}
+
+
+static gpg_error_t
+set_do (simcard_t card, int tag, const void *data, size_t len)
+{
+  simcard_do_t d, *dp;
+
+  for (dp = &card->dos; *dp; dp = &(*dp)->next)
+    if ((*dp)->tag == tag)
+      {
+        d = *dp;
+        *dp = d->next;
+        xfree (d);
+        break;
+      }
+
+  d = xtrymalloc (sizeof *d + len);
+  if (!d)
+    return gpg_error_from_syserror ();
+  d->tag = tag;
+  d->len = len;
+  if (len)
+    memcpy (d->data, data, len);
+  d->next = card->dos;
+  card->dos = d;
+  return 0;
+}
+
+
+/* Put the simple DO TAG to MB if it exists.  */
+static void
+put_do (simcard_t card, membuf_t *mb, int tag)
+{
+  simcard_do_t d = find_do (card, tag);
+
+  if (d)
+    put_tlv (mb, tag, d->data, d->len);
+}
+
+
+/* Store the content of data object TAG in MB.  Returns a status
+   word.  */
+static int
+get_data (simcard_t card, int tag, membuf_t *mb)
+{
+  unsigned char buf[16];
+  membuf_t inner, discr;
+  simcard_do_t d;
+  int i;
+
+  switch (tag)
+    {
+    case 0x004F:
+      put_membuf (mb, card->aid, 16);
+      break;
+
+    case 0x5F52:
+      put_membuf (mb, card->hist, sizeof card->hist);
+      break;
+
+    case 0x0065:
+      init_membuf (&inner, 64);
+      put_do (card, &inner, 0x005B);
+      put_do (card, &inner, 0x5F2D);
+      put_do (card, &inner, 0x5F35);
+      put_inner (mb, &inner);
+      break;
+
+    case 0x006E:
+      init_membuf (&inner, 256);
+      put_tlv (&inner, 0x004F, card->aid, 16);
+      put_tlv (&inner, 0x5F52, card->hist, sizeof card->hist);
+      init_membuf (&discr, 256);
+      for (i = 0xC0; i <= 0xC6; i++)
+        {
+          membuf_t tmp;
+
+          init_membuf (&tmp, 64);
+          get_data (card, i, &tmp);
+          put_constructed (&discr, i, &tmp);
+        }
+      put_tlv (&discr, 0x00CD, card->times, sizeof card->times);
+      put_constructed (&inner, 0x0073, &discr);
+      put_inner (mb, &inner);
+      break;
+
+    case 0x007A:
+      init_membuf (&inner, 16);
+      buf[0] = card->sig_counter >> 16;
+      buf[1] = card->sig_counter >> 8;
+      buf[2] = card->sig_counter;
+      put_tlv (&inner, 0x0093, buf, 3);
+      put_inner (mb, &inner);
+      break;
+
+    case 0x00C0:
+      /* Extended capabilities: get challenge, PW status change,
+         private DOs; no SM.  */
+      buf[0] = 0x58;
+      buf[1] = 0;
+      buf[2] = 0x00; buf[3] = 0xff;  /* Max. GET CHALLENGE.  */
+      buf[4] = 0x08; buf[5] = 0x00;  /* Max. cardholder certificate.  */
+      buf[6] = card->exlen? (card->exlen >> 8) : 0x00;
+      buf[7] = card->exlen? (card->exlen & 0xff) : 0xff;
+      buf[8] = card->exlen? (card->exlen >> 8) : 0x01;
+      buf[9] = card->exlen? (card->exlen & 0xff) : 0x00;
+      put_membuf (mb, buf, 10);
+      break;
+
+    case 0x00C1: case 0x00C2: case 0x00C3:
+      {
+        struct simcard_key_s *key = card->key + (tag - 0x00C1);
+        unsigned int nbits = key->nlen? key->nlen * 8 : 2048;
+
+        buf[0] = 0x01;  /* RSA.  */
+        buf[1] = nbits >> 8;
+        buf[2] = nbits;
+        buf[3] = 0x00;
+        buf[4] = 0x20;  /* 32 bit exponent.  */
+        buf[5] = 0x00;  /* Standard format.  */
+        put_membuf (mb, buf, 6);
+      }
+      break;
+
+    case 0x00C4:
+      buf[0] = card->pw1_multiple;
+      buf[1] = buf[2] = buf[3] = 0x7f;
+      buf[4] = card->tries[1];
+      buf[5] = 0;
+      buf[6] = card->tries[3];
+      put_membuf (mb, buf, 7);
+      break;
+
+    case 0x00C5:
+      put_membuf (mb, card->fpr, sizeof card->fpr);
+      break;
+
+    case 0x00C6:
+      put_membuf (mb, card->cafpr, sizeof card->cafpr);
+      break;
+
+    case 0x00CD:
+      put_membuf (mb, card->times, sizeof card->times);
+      break;
+
+    case 0x0093:
+      buf[0] = card->sig_counter >> 16;
+      buf[1] = card->sig_counter >> 8;
+      buf[2] = card->sig_counter;
+      put_membuf (mb, buf, 3);
+      break;
+
+    case 0x0101: case 0x0102:
+      d = find_do (card, tag);
+      if (d)
+        put_membuf (mb, d->data, d->len);
+      break;
+
+    case 0x0103:
+      if (!card->verified[2])
+        return SIM_SW_SECURITY_STATUS;
+      d = find_do (card, tag);
+      if (d)
+        put_membuf (mb, d->data, d->len);
+      break;
+
+    case 0x0104:
+      if (!card->verified[3])
+        return SIM_SW_SECURITY_STATUS;
+      d = find_do (card, tag);
+      if (d)
+        put_membuf (mb, d->data, d->len);
+      break;
+
+    default:
+      d = find_do (card, tag);
+      if (!d)
+        return SIM_SW_REF_NOT_FOUND;
+      put_membuf (mb, d->data, d->len);
+      break;
+    }
+
+  return SIM_SW_OK;
+}
+
+
+
+/* Return the value of the MPI NAME from the key S-expression SEXP as
+   a malloced buffer without leading zeroes.  */
+static unsigned char *
+get_mpi_value (gcry_sexp_t sexp, const char *name, size_t *r_len)
+{
+  gcry_sexp_t l;
+  const unsigned char *s;
+  unsigned char *buf = NULL;
+  size_t len;
+
+  l = gcry_sexp_find_token (sexp, name, 0);
+  if (!l)
+    return NULL;
+  s = gcry_sexp_nth_data (l, 1, &len);
+  for (; s && len && !*s; s++, len--)
+    ;
+  if (s && len)
+    {
+      buf = xtrymalloc (len);
+      if (buf)
+        {
+          memcpy (buf, s, len);
+          *r_len = len;
+        }
+    }
+  gcry_sexp_release (l);
+  return buf;
+}
+
+
+/* Compute the OpenPGP v4 fingerprint of key KEYNO using the creation
+   time from the CD data object.  */
+static void
+update_fingerprint (simcard_t card, int keyno)
+{
+  struct simcard_key_s *key = card->key + keyno;
+  const unsigned char *t = card->times + 4 * keyno;
+  unsigned char *buf, *p;
+  size_t n;
+  unsigned int nbits;
+
+  memset (card->fpr + 20 * keyno, 0, 20);
+  if (!key->n || !(t[0]|t[1]|t[2]|t[3]))
+    return;
+
+  n = 6 + 2 + key->nlen + 2 + key->elen;
+  buf = xtrymalloc (3 + n);
+  if (!buf)
+    return;
+  p = buf;
+  *p++ = 0x99;
+  *p++ = n >> 8;
+  *p++ = n;
+  *p++ = 4;
+  memcpy (p, t, 4);
+  p += 4;
+  *p++ = 1;  /* RSA.  */
+  nbits = key->nlen * 8;
+  for (n = 0x80; n && !(key->n[0] & n); n >>= 1)
+    nbits--;
+  *p++ = nbits >> 8;
+  *p++ = nbits;
+  memcpy (p, key->n, key->nlen);
+  p += key->nlen;
+  nbits = key->elen * 8;
+  for (n = 0x80; n && !(key->e[0] & n); n >>= 1)
+    nbits--;
+  *p++ = nbits >> 8;
+  *p++ = nbits;
+  memcpy (p, key->e, key->elen);
+  p += key->elen;
+  gcry_md_hash_buffer (GCRY_MD_SHA1, card->fpr + 20 * keyno, buf, p - buf);
+  xfree (buf);
+}
+
+
+/* Take ownership of the private key SKEY and store it in slot
+   KEYNO.  */
+static gpg_error_t
+set_key (simcard_t card, int keyno, gcry_sexp_t skey)
+{
+  struct simcard_key_s *key = card->key + keyno;
+  gcry_sexp_t l;
+  unsigned char *n, *e;
+  size_t nlen, elen;
+
+  l = gcry_sexp_find_token (skey, "private-key", 0);
+  if (!l)
+    {
+      gcry_sexp_release (skey);
+      return gpg_error (GPG_ERR_NO_SECKEY);
+    }
+  gcry_sexp_release (skey);
+  skey = l;
+
+  n = get_mpi_value (skey, "n", &nlen);
+  e = get_mpi_value (skey, "e", &elen);
+  if (!n || !e || elen > 4)
+    {
+      xfree (n);
+      xfree (e);
+      gcry_sexp_release (skey);
+      return gpg_error (GPG_ERR_UNSUPPORTED_ALGORITHM);
+    }
+
+  gcry_sexp_release (key->skey);
+  xfree (key->n);
+  xfree (key->e);
+  key->skey = skey;
+  key->n = n;
+  key->nlen = nlen;
+  key->e = e;
+  key->elen = elen;
+  update_fingerprint (card, keyno);
+  return 0;
+}
+
+
+static gpg_error_t
+generate_key (simcard_t card, int keyno, unsigned int nbits)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_parms, s_key;
+
+  err = gcry_sexp_build (&s_parms, NULL,
+                         "(genkey(rsa(nbits %u)))", nbits);
+  if (err)
+    return err;
+  err = gcry_pk_genkey (&s_key, s_parms);
+  gcry_sexp_release (s_parms);
+  if (err)
+    return err;
+  return set_key (card, keyno, s_key);
+}
+
+
+static gpg_error_t
+load_key (simcard_t card, int keyno, const char *fname)
+{
+  gpg_error_t err;
+  estream_t fp;
+  char buffer[16384];
+  size_t nread;
+  gcry_sexp_t s_key;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
+      return err;
+    }
+  if (es_read (fp, buffer, sizeof buffer, &nread))
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      return err;
+    }
+  es_fclose (fp);
+
+  err = gcry_sexp_sscan (&s_key, NULL, buffer, nread);
+  wipememory (buffer, sizeof buffer);
+  if (err)
+    {
+      log_error ("error parsing key '%s': %s\n", fname, gpg_strerror (err));
+      return err;
+    }
+  return set_key (card, keyno, s_key);
+}
+
+
+
+/* Create a signature over the LEN bytes at DATA with key KEYNO using
+   PKCS#1 v1.5 padding as done by the card.  The result is stored in
+   MB.  */
+static int
+sign_data (simcard_t card, int keyno, const unsigned char *data, size_t len,
+           membuf_t *mb)
+{
+  struct simcard_key_s *key = card->key + keyno;
+  gcry_sexp_t s_data, s_sig;
+  unsigned char *em, *sig;
+  size_t siglen, n;
+  int sw;
+
+  if (!key->skey)
+    return SIM_SW_REF_NOT_FOUND;
+  if (len + 11 > key->nlen)
+    return SIM_SW_WRONG_LENGTH;
+
+  em = xtrymalloc (key->nlen);
+  if (!em)
+    return SIM_SW_WRONG_DATA;
+  em[0] = 0;
+  em[1] = 1;
+  memset (em + 2, 0xff, key->nlen - len - 3);
+  em[key->nlen - len - 1] = 0;
+  memcpy (em + key->nlen - len, data, len);
+
+  sw = SIM_SW_WRONG_DATA;
+  if (!gcry_sexp_build (&s_data, NULL, "(data(flags raw)(value %b))",
+                        (int)key->nlen, em))
+    {
+      if (!gcry_pk_sign (&s_sig, s_data, key->skey))
+        {
+          sig = get_mpi_value (s_sig, "s", &siglen);
+          if (sig && siglen <= key->nlen)
+            {
+              /* Pad to the length of the modulus.  */
+              for (n = siglen; n < key->nlen; n++)
+                put_membuf (mb, "", 1);
+              put_membuf (mb, sig, siglen);
+              sw = SIM_SW_OK;
+            }
+          xfree (sig);
+          gcry_sexp_release (s_sig);
+        }
+      gcry_sexp_release (s_data);
+    }
+  xfree (em);
+  return sw;
+}
+
+
+/* Decrypt the LEN bytes at DATA with key KEYNO and store the
+   plaintext with the PKCS#1 v1.5 padding removed in MB.  */
+static int
+decrypt_data (simcard_t card, int keyno, const unsigned char *data,
+              size_t len, membuf_t *mb)
+{
+  struct simcard_key_s *key = card->key + keyno;
+  gcry_sexp_t s_data, s_plain, l;
+  const char *s;
+  size_t n;
+  int sw;
+
+  if (!key->skey)
+    return SIM_SW_REF_NOT_FOUND;
+
+  sw = SIM_SW_WRONG_DATA;
+  if (!gcry_sexp_build (&s_data, NULL, "(enc-val(flags pkcs1)(rsa(a %b)))",
+                        (int)len, data))
+    {
+      if (!gcry_pk_decrypt (&s_plain, s_data, key->skey))
+        {
+          l = gcry_sexp_find_token (s_plain, "value", 0);
+          s = l? gcry_sexp_nth_data (l, 1, &n) : NULL;
+          if (s)
+            {
+              put_membuf (mb, s, n);
+              sw = SIM_SW_OK;
+            }
+          gcry_sexp_release (l);
+          gcry_sexp_release (s_plain);
+        }
+      gcry_sexp_release (s_data);
+    }
+  return sw;
+}
+
+
+/* Store the public key KEYNO as 7F49 template in MB.  */
+static int
+put_public_key (simcard_t card, int keyno, membuf_t *mb)
+{
+  struct simcard_key_s *key = card->key + keyno;
+  membuf_t inner;
+
+  if (!key->n)
+    return SIM_SW_REF_NOT_FOUND;
+
+  init_membuf (&inner, key->nlen + 16);
+  put_tlv (&inner, 0x0081, key->n, key->nlen);
+  put_tlv (&inner, 0x0082, key->e, key->elen);
+  put_constructed (mb, 0x7F49, &inner);
+  return SIM_SW_OK;
+}
+
+
+
+static int
+cmd_verify (simcard_t card, int p2, const unsigned char *data, size_t lc)
+{
+  int ref, pinidx;
+
+  if (p2 < 0x81 || p2 > 0x83)
+    return SIM_SW_WRONG_P1P2;
+  ref = p2 - 0x80;
+  pinidx = ref == 3? 3 : 1;
+
+  if (!lc)
+    return card->verified[ref]? SIM_SW_OK : (0x63C0 | card->tries[pinidx]);
+  if (!card->tries[pinidx])
+    return SIM_SW_AUTH_BLOCKED;
+
+  if (lc != strlen (card->pin[pinidx])
+      || memcmp (data, card->pin[pinidx], lc))
+    {
+      card->verified[ref] = 0;
+      card->tries[pinidx]--;
+      return SIM_SW_SECURITY_STATUS;
+    }
+  card->tries[pinidx] = 3;
+  card->verified[ref] = 1;
+  return SIM_SW_OK;
+}
+
+
+static int
+cmd_change_reference_data (simcard_t card, int p2,
+                           const unsigned char *data, size_t lc)
+{
+  int pinidx;
+  size_t oldlen;
+
+  if (p2 != 0x81 && p2 != 0x83)
+    return SIM_SW_WRONG_P1P2;
+  pinidx = p2 - 0x80;
+  if (!card->tries[pinidx])
+    return SIM_SW_AUTH_BLOCKED;
+
+  oldlen = strlen (card->pin[pinidx]);
+  if (lc < oldlen || memcmp (data, card->pin[pinidx], oldlen))
+    {
+      card->tries[pinidx]--;
+      return SIM_SW_SECURITY_STATUS;
+    }
+  if (lc - oldlen < (pinidx == 3? 8 : 6) || lc - oldlen > 64)
+    return SIM_SW_WRONG_DATA;
+
+  memcpy (card->pin[pinidx], data + oldlen, lc - oldlen);
+  card->pin[pinidx][lc - oldlen] = 0;
+  card->tries[pinidx] = 3;
+  return SIM_SW_OK;
+}
+
+
+static int
+cmd_reset_retry_counter (simcard_t card, int p1, int p2,
+                         const unsigned char *data, size_t lc)
+{
+  if (p1 != 0x02 || p2 != 0x81)
+    return SIM_SW_FUNC_NOT_SUPP;
+  if (!card->verified[3])
+    return SIM_SW_SECURITY_STATUS;
+  if (lc < 6 || lc > 64)
+    return SIM_SW_WRONG_DATA;
+
+  memcpy (card->pin[1], data, lc);
+  card->pin[1][lc] = 0;
+  card->tries[1] = 3;
+  return SIM_SW_OK;
+}
+
+
+static int
+cmd_put_data (simcard_t card, int tag, const unsigned char *data, size_t lc)
+{
+  int ref = (tag == 0x0101 || tag == 0x0103)? 2 : 3;
+
+  if (!card->verified[ref])
+    return SIM_SW_SECURITY_STATUS;
+
+  switch (tag)
+    {
+    case 0x00C4:
+      if (lc < 1)
+        return SIM_SW_WRONG_LENGTH;
+      card->pw1_multiple = !!data[0];
+      break;
+
+    case 0x00C7: case 0x00C8: case 0x00C9:
+      if (lc != 20)
+        return SIM_SW_WRONG_LENGTH;
+      memcpy (card->fpr + 20 * (tag - 0x00C7), data, 20);
+      break;
+
+    case 0x00CA: case 0x00CB: case 0x00CC:
+      if (lc != 20)
+        return SIM_SW_WRONG_LENGTH;
+      memcpy (card->cafpr + 20 * (tag - 0x00CA), data, 20);
+      break;
+
+    case 0x00CE: case 0x00CF: case 0x00D0:
+      if (lc != 4)
+        return SIM_SW_WRONG_LENGTH;
+      memcpy (card->times + 4 * (tag - 0x00CE), data, 4);
+      break;
+
+    case 0x004F: case 0x5F52: case 0x0065: case 0x006E: case 0x007A:
+    case 0x00C0: case 0x00C1: case 0x00C2: case 0x00C3: case 0x00C5:
+    case 0x00C6: case 0x00CD: case 0x0093:
+      return SIM_SW_REF_NOT_FOUND;
+
+    default:
+      if (set_do (card, tag, data, lc))
+        return SIM_SW_WRONG_DATA;
+      break;
+    }
+  return SIM_SW_OK;
+}
+
+
+static int
+cmd_generate_keypair (simcard_t card, int p1,
+                      const unsigned char *data, size_t lc, membuf_t *mb)
+{
+  int keyno;
+
+  if (lc < 1)
+    return SIM_SW_WRONG_LENGTH;
+  switch (data[0])
+    {
+    case 0xB6: keyno = 0; break;
+    case 0xB8: keyno = 1; break;
+    case 0xA4: keyno = 2; break;
+    default: return SIM_SW_WRONG_DATA;
+    }
+
+  if (p1 == 0x80)
+    {
+      if (!card->verified[3])
+        return SIM_SW_SECURITY_STATUS;
+      if (generate_key (card, keyno,
+                        card->key[keyno].nlen? card->key[keyno].nlen*8 : 2048))
+        return SIM_SW_WRONG_DATA;
+      if (!keyno)
+        card->sig_counter = 0;
+    }
+  else if (p1 != 0x81)
+    return SIM_SW_WRONG_P1P2;
+
+  return put_public_key (card, keyno, mb);
+}
+
+
+/* Return the EF with PATH of length PATHLEN or NULL.  */
+static simcard_file_t
+find_file (simcard_t card, const unsigned short *path, int pathlen)
+{
+  simcard_file_t f;
+
+  for (f = card->files; f; f = f->next)
+    if (f->pathlen == pathlen
+        && !memcmp (f->path, path, pathlen * sizeof *path))
+      return f;
+  return NULL;
+}
+
+
+/* Return true if PATH of length PATHLEN is a DF.  DFs are not
+   created explicitly; any prefix of the path of an EF is a DF.  */
+static int
+is_df (simcard_t card, const unsigned short *path, int pathlen)
+{
+  simcard_file_t f;
+
+  if (pathlen == 1 && path[0] == 0x3F00)
+    return 1;
+  for (f = card->files; f; f = f->next)
+    if (f->pathlen > pathlen
+        && !memcmp (f->path, path, pathlen * sizeof *path))
+      return 1;
+  return 0;
+}
+
+
+/* Make the file with PATH of length PATHLEN the current file.  If
+   WANT_DF is 1 it must be a DF, if it is 0 it must be an EF and if it
+   is -1 it may be either.  */
+static int
+select_path (simcard_t card, const unsigned short *path, int pathlen,
+             int want_df)
+{
+  simcard_file_t f;
+
+  f = want_df == 1? NULL : find_file (card, path, pathlen);
+  if (f)
+    {
+      memcpy (card->curdf, path, (pathlen - 1) * sizeof *path);
+      card->curdflen = pathlen - 1;
+      card->curef = f;
+    }
+  else if (want_df && is_df (card, path, pathlen))
+    {
+      memcpy (card->curdf, path, pathlen * sizeof *path);
+      card->curdflen = pathlen;
+      card->curef = NULL;
+    }
+  else
+    return SIM_SW_FILE_NOT_FOUND;
+  return SIM_SW_OK;
+}
+
+
+/* The SELECT command.  An OpenPGP card only knows the selection of
+   its application; a PKCS#15 card also allows the selection of files
+   by FID (P1 0 to 2) and by path from the MF (P1 8).  */
+static int
+cmd_select (simcard_t card, int p1, const unsigned char *data, size_t lc)
+{
+  static unsigned char const pkcs15_aid[] =
+    { 0xA0, 0, 0, 0, 0x63, 0x50, 0x4B, 0x43, 0x53, 0x2D, 0x31, 0x35 };
+  unsigned short path[SIM_MAX_PATH];
+  int pathlen, i;
+
+  if (!card->p15_df)
+    {
+      if (p1 != 0x04 || lc < 6 || memcmp (data, card->aid, 6))
+        return SIM_SW_FILE_NOT_FOUND;
+      memset (card->verified, 0, sizeof card->verified);
+      return SIM_SW_OK;
+    }
+
+  switch (p1)
+    {
+    case 0x00: /* The MF.  */
+      if (lc && (lc != 2 || data[0] != 0x3F || data[1]))
+        return SIM_SW_FILE_NOT_FOUND;
+      path[0] = 0x3F00;
+      return select_path (card, path, 1, 1);
+
+    case 0x01: /* A DF below the current DF.  */
+    case 0x02: /* An EF below the current DF.  */
+      if (lc != 2)
+        return SIM_SW_WRONG_LENGTH;
+      if (card->curdflen + 1 > SIM_MAX_PATH)
+        return SIM_SW_FILE_NOT_FOUND;
+      memcpy (path, card->curdf, card->curdflen * sizeof *path);
+      pathlen = card->curdflen;
+      path[pathlen++] = (data[0] << 8) | data[1];
+      return select_path (card, path, pathlen, p1 == 0x01);
+
+    case 0x04: /* An application.  */
+      if (lc != sizeof pkcs15_aid || memcmp (data, pkcs15_aid, lc))
+        return SIM_SW_FILE_NOT_FOUND;
+      memset (card->verified, 0, sizeof card->verified);
+      path[0] = 0x3F00;
+      path[1] = card->p15_df;
+      return select_path (card, path, 2, 1);
+
+    case 0x08: /* A path from the MF.  */
+      if (!lc || (lc & 1) || lc/2 + 1 > SIM_MAX_PATH)
+        return SIM_SW_WRONG_LENGTH;
+      path[0] = 0x3F00;
+      for (pathlen = 1, i = 0; i < lc; i += 2)
+        path[pathlen++] = (data[i] << 8) | data[i+1];
+      return select_path (card, path, pathlen, -1);
+
+    default:
+      return SIM_SW_WRONG_P1P2;
+    }
+}
+
+
+/* The READ BINARY command for the current EF.  P1 and P2 give the
+   offset.  Less than LE bytes are only returned at the end of the
+   file; this is indicated by a warning.  */
+static int
+cmd_read_binary (simcard_t card, int p1, int p2, size_t le, membuf_t *mb)
+{
+  simcard_file_t f = card->curef;
+  size_t off, n;
+
+  if (!card->p15_df)
+    return SIM_SW_INS_NOT_SUPP;
+  if ((p1 & 0x80))
+    return SIM_SW_FUNC_NOT_SUPP; /* Short EF identifiers.  */
+  if (!f)
+    return SIM_SW_NO_CURRENT_EF;
+  off = (p1 << 8) | p2;
+  if (off > f->len || (off == f->len && off))
+    return SIM_SW_WRONG_P1P2;
+
+  n = f->len - off;
+  if (n > le)
+    n = le;
+  put_membuf (mb, f->data + off, n);
+  return n < le? SIM_SW_EOF_REACHED : SIM_SW_OK;
+}
+
+
+/* Process one command.  The response data is stored in MB and the
+   status word is returned.  LE is the number of expected bytes.  */
+static int
+process_command (simcard_t card, int ins, int p1, int p2,
+                 const unsigned char *data, size_t lc, size_t le,
+                 membuf_t *mb)
+{
+  unsigned char *buf;
+  int sw;
+
+  switch (ins)
+    {
+    case 0xA4: /* SELECT */
+      return cmd_select (card, p1, data, lc);
+
+    case 0xB0: /* READ BINARY */
+      return cmd_read_binary (card, p1, p2, le, mb);
+
+    case 0xCA: /* GET DATA */
+      return get_data (card, (p1 << 8) | p2, mb);
+
+    case 0xDA: /* PUT DATA */
+      return cmd_put_data (card, (p1 << 8) | p2, data, lc);
+
+    case 0x20: /* VERIFY */
+      return cmd_verify (card, p2, data, lc);
+
+    case 0x24: /* CHANGE REFERENCE DATA */
+      return cmd_change_reference_data (card, p2, data, lc);
+
+    case 0x2C: /* RESET RETRY COUNTER */
+      return cmd_reset_retry_counter (card, p1, p2, data, lc);
+
+    case 0x47: /* GENERATE ASYMMETRIC KEY PAIR */
+      return cmd_generate_keypair (card, p1, data, lc, mb);
+
+    case 0x2A: /* PERFORM SECURITY OPERATION */
+      if (p1 == 0x9E && p2 == 0x9A)
+        {
+          if (!card->verified[1])
+            return SIM_SW_SECURITY_STATUS;
+          sw = sign_data (card, 0, data, lc, mb);
+          if (sw == SIM_SW_OK)
+            {
+              card->sig_counter++;
+              if (!card->pw1_multiple)
+                card->verified[1] = 0;
+            }
+          return sw;
+        }
+      else if (p1 == 0x80 && p2 == 0x86)
+        {
+          if (!card->verified[2])
+            return SIM_SW_SECURITY_STATUS;
+          if (lc < 2 || data[0])
+            return SIM_SW_WRONG_DATA;
+          return decrypt_data (card, 1, data + 1, lc - 1, mb);
+        }
+      return SIM_SW_WRONG_P1P2;
+
+    case 0x88: /* INTERNAL AUTHENTICATE */
+      if (!card->verified[2])
+        return SIM_SW_SECURITY_STATUS;
+      return sign_data (card, 2, data, lc, mb);
+
+    case 0x84: /* GET CHALLENGE */
+      buf = xtrymalloc (le);
+      if (!buf)
+        return SIM_SW_WRONG_LENGTH;
+      gcry_create_nonce (buf, le);
+      put_membuf (mb, buf, le);
+      xfree (buf);
+      return SIM_SW_OK;
+
+    default:
+      return SIM_SW_INS_NOT_SUPP;
+    }
+}
+
+
+
+/* Create the EF with the hex encoded path PATHSTR from the MF and
+   the content VALUE, which is either a hex string or the name of a
+   file prefixed with '@'.  */
+static gpg_error_t
+add_file (simcard_t card, const char *pathstr, const char *value)
+{
+  gpg_error_t err = 0;
+  unsigned short path[SIM_MAX_PATH];
+  int pathlen, i;
+  unsigned char *buf;
+  size_t len;
+  estream_t fp;
+  simcard_file_t f, *fp_prev;
+
+  len = strlen (pathstr);
+  if (!len || (len % 4) || len / 4 > SIM_MAX_PATH)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  for (i = 0; i < len; i++)
+    if (!hexdigitp (pathstr + i))
+      return gpg_error (GPG_ERR_INV_VALUE);
+  for (pathlen = 0; *pathstr; pathstr += 4)
+    path[pathlen++] = xtoi_4 (pathstr);
+  if (path[0] != 0x3F00 || pathlen < 2)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  /* READ BINARY can only address 15 bit offsets.  */
+  buf = xtrymalloc (32768);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  if (*value == '@')
+    {
+      fp = es_fopen (value + 1, "rb");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("can't open '%s': %s\n", value + 1, gpg_strerror (err));
+        }
+      else
+        {
+          if (es_read (fp, buf, 32768, &len))
+            err = gpg_error_from_syserror ();
+          else if (len == 32768)
+            err = gpg_error (GPG_ERR_TOO_LARGE);
+          es_fclose (fp);
+        }
+    }
+  else
+    {
+      len = strlen (value);
+      if ((len & 1) || len/2 >= 32768 || hex2bin (value, buf, len/2) < 0)
+        err = gpg_error (GPG_ERR_INV_VALUE);
+      len /= 2;
+    }
+  if (err)
+    goto leave;
+
+  for (fp_prev = &card->files; *fp_prev; fp_prev = &(*fp_prev)->next)
+    if ((*fp_prev)->pathlen == pathlen
+        && !memcmp ((*fp_prev)->path, path, pathlen * sizeof *path))
+      {
+        f = *fp_prev;
+        *fp_prev = f->next;
+        xfree (f);
+        break;
+      }
+
+  f = xtrymalloc (sizeof *f + len);
+  if (!f)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (f->path, path, pathlen * sizeof *path);
+  f->pathlen = pathlen;
+  f->len = len;
+  if (len)
+    memcpy (f->data, buf, len);
+  f->next = card->files;
+  card->files = f;
+
+ leave:
+  xfree (buf);
+  return err;
+}
+
+
+/* Parse the configuration line LINE of the simulated card.  */
+static gpg_error_t
+parse_config_line (simcard_t card, char *line)
+{
+  char *fields[4] = { NULL, NULL, NULL, NULL };
+  int nfields, n;
+  char *p;
+  unsigned char *buf;
+  gpg_error_t err;
+
+  for (nfields = 0, p = line; *p && nfields < DIM (fields); nfields++)
+    {
+      fields[nfields] = p;
+      p += strcspn (p, " \t");
+      if (*p)
+        {
+          *p++ = 0;
+          p += strspn (p, " \t");
+        }
+    }
+
+  if (nfields == 2 && !strcmp (fields[0], "latency"))
+    card->latency = strtoul (fields[1], NULL, 10);
+  else if (nfields == 2 && !strcmp (fields[0], "baudrate"))
+    card->baudrate = strtoul (fields[1], NULL, 10);
+  else if (nfields == 2 && !strcmp (fields[0], "exlen"))
+    {
+      card->exlen = strtoul (fields[1], NULL, 10);
+      if (card->exlen > 65535)
+        card->exlen = 65535;
+      else if (card->exlen && card->exlen < 256)
+        card->exlen = 256;
+    }
+  else if (nfields == 2 && !strcmp (fields[0], "aid"))
+    {
+      if (hex2bin (fields[1], card->aid, 16) < 0)
+        return gpg_error (GPG_ERR_INV_VALUE);
+    }
+  else if (nfields == 3 && !strcmp (fields[0], "pin")
+           && (*fields[1] == '1' || *fields[1] == '3') && !fields[1][1])
+    {
+      n = atoi (fields[1]);
+      if (strlen (fields[2]) >= sizeof card->pin[n])
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      strcpy (card->pin[n], fields[2]);
+    }
+  else if (nfields >= 3
+           && (!strcmp (fields[0], "key") || !strcmp (fields[0], "created"))
+           && *fields[1] >= '1' && *fields[1] <= '3' && !fields[1][1])
+    {
+      n = atoi (fields[1]) - 1;
+      if (*fields[0] == 'c')
+        {
+          unsigned long t = strtoul (fields[2], NULL, 10);
+
+          card->times[4*n]   = t >> 24;
+          card->times[4*n+1] = t >> 16;
+          card->times[4*n+2] = t >> 8;
+          card->times[4*n+3] = t;
+          update_fingerprint (card, n);
+        }
+      else if (nfields == 4 && !strcmp (fields[2], "generate"))
+        return generate_key (card, n, strtoul (fields[3], NULL, 10));
+      else
+        return load_key (card, n, fields[2]);
+    }
+  else if (nfields == 3 && !strcmp (fields[0], "do"))
+    {
+      n = strlen (fields[2]);
+      if ((n & 1))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      buf = xtrymalloc (n/2 + 1);
+      if (!buf)
+        return gpg_error_from_syserror ();
+      if (hex2bin (fields[2], buf, n/2) < 0)
+        err = gpg_error (GPG_ERR_INV_VALUE);
+      else
+        err = set_do (card, strtoul (fields[1], NULL, 16), buf, n/2);
+      xfree (buf);
+      return err;
+    }
+  else if (nfields == 2 && !strcmp (fields[0], "pkcs15"))
+    {
+      unsigned long fid = strtoul (fields[1], NULL, 16);
+
+      if (!fid || fid == 0x3F00 || fid > 0xFFFF)
+        return gpg_error (GPG_ERR_INV_VALUE);
+      card->p15_df = fid;
+    }
+  else if (nfields == 3 && !strcmp (fields[0], "file"))
+    return add_file (card, fields[1], fields[2]);
+  else
+    return gpg_error (GPG_ERR_SYNTAX);
+
+  return 0;
+}
+
+
+/* Create a simulated card from the configuration file FNAME and store
+   it at R_CARD.  */
+gpg_error_t
+simcard_open (simcard_t *r_card, const char *fname)
+{
+  static const unsigned char default_aid[16] =
+    { 0xD2, 0x76, 0x00, 0x01, 0x24, 0x01, 0x02, 0x00,
+      0xFF, 0xFE, 0x12, 0x34, 0x56, 0x78, 0x00, 0x00 };
+  gpg_error_t err = 0;
+  simcard_t card;
+  FILE *fp;
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t max_length;
+  int lnr = 0;
+  int n;
+
+  *r_card = NULL;
+
+  card = xtrycalloc (1, sizeof *card);
+  if (!card)
+    return gpg_error_from_syserror ();
+  memcpy (card->aid, default_aid, 16);
+  strcpy (card->pin[1], "123456");
+  strcpy (card->pin[3], "12345678");
+  card->tries[1] = card->tries[3] = 3;
+  card->curdf[0] = 0x3F00;
+  card->curdflen = 1;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't open card simulation file '%s': %s\n",
+                 fname, gpg_strerror (err));
+      xfree (card);
+      return err;
+    }
+  for (;;)
+    {
+      max_length = 65536;
+      n = read_line (fp, &line, &line_size, &max_length);
+      if (!n)
+        break;
+      if (n < 0 || !max_length)
+        {
+          err = n < 0? gpg_error_from_syserror () : gpg_error (GPG_ERR_TRUNCATED);
+          break;
+        }
+      lnr++;
+      trim_spaces (line);
+      if (!*line || *line == '#')
+        continue;
+      err = parse_config_line (card, line);
+      if (err)
+        {
+          log_error ("%s:%d: %s\n", fname, lnr, gpg_strerror (err));
+          break;
+        }
+    }
+  xfree (line);
+  fclose (fp);
+  if (err)
+    {
+      simcard_close (card);
+      return err;
+    }
+
+  /* The historical bytes: category indicator, card service data,
+     card capabilities and status indicator.  */
+  card->hist[0] = 0x00;
+  card->hist[1] = 0x31;
+  card->hist[2] = 0xC5;
+  card->hist[3] = 0x73;
+  card->hist[4] = 0xC0;
+  card->hist[5] = 0x01;
+  card->hist[6] = 0x80 | (card->exlen? 0x40 : 0);
+  card->hist[7] = 0x05;
+  card->hist[8] = 0x90;
+  card->hist[9] = 0x00;
+
+  *r_card = card;
+  return 0;
+}
+
+
+void
+simcard_close (simcard_t card)
+{
+  simcard_do_t d;
+  simcard_file_t f;
+  int i;
+
+  if (!card)
+    return;
+  while ((d = card->dos))
+    {
+      card->dos = d->next;
+      xfree (d);
+    }
+  while ((f = card->files))
+    {
+      card->files = f->next;
+      xfree (f);
+    }
+  for (i = 0; i < 3; i++)
+    {
+      gcry_sexp_release (card->key[i].skey);
+      xfree (card->key[i].n);
+      xfree (card->key[i].e);
+    }
+  if (card->chaining)
+    xfree (get_membuf (&card->chain, NULL));
+  xfree (card->pending);
+  wipememory (card->pin, sizeof card->pin);
+  xfree (card);
+}
+
+
+/* Simulate a cold reset of the card.  */
+void
+simcard_reset (simcard_t card)
+{
+  memset (card->verified, 0, sizeof card->verified);
+  card->curdf[0] = 0x3F00;
+  card->curdflen = 1;
+  card->curef = NULL;
+  if (card->chaining)
+    xfree (get_membuf (&card->chain, NULL));
+  card->chaining = 0;
+  xfree (card->pending);
+  card->pending = NULL;
+}
+
+
+/* Store the ATR of CARD at ATR and return its length.  */
+size_t
+simcard_get_atr (simcard_t card, unsigned char *atr, size_t maxlen)
+{
+  static const unsigned char prefix[] =
+    { 0x3B, 0xDA, 0x18, 0xFF, 0x81, 0xB1, 0xFE, 0x75, 0x1F, 0x03 };
+  unsigned char buf[sizeof prefix + sizeof card->hist + 1];
+  size_t n, i;
+
+  memcpy (buf, prefix, sizeof prefix);
+  memcpy (buf + sizeof prefix, card->hist, sizeof card->hist);
+  n = sizeof prefix + sizeof card->hist;
+  buf[n] = 0;
+  for (i = 1; i < n; i++)
+    buf[n] ^= buf[i];
+  n++;
+
+  if (n > maxlen)
+    return 0;
+  memcpy (atr, buf, n);
+  return n;
+}
+
+
+/* Return the maximum data length of extended length APDUs or 0 if
+   the card supports only short APDUs.  */
+int
+simcard_get_exlen_max (simcard_t card)
+{
+  return card->exlen;
+}
+
+
+/* Delay the caller to simulate the transfer of N bytes.  */
+static void
+simulate_link (simcard_t card, size_t n)
+{
+  unsigned long usec;
+
+  usec = card->latency * 1000UL;
+  if (card->baudrate)
+    usec += (unsigned long)((n * 10 * 1000000.0) / card->baudrate);
+  if (usec)
+    npth_usleep (usec);
+}
+
+
+/* Send the APDU of length APDULEN to CARD and store the response
+   including the status word at RESP.  Returns 0 on success or an
+   SW_HOST_* error code.  */
+int
+simcard_transceive (simcard_t card,
+                    const unsigned char *apdu, size_t apdulen,
+                    unsigned char *resp, size_t maxresplen,
+                    size_t *nresp)
+{
+  const unsigned char *body = apdu + 4;
+  size_t n = apdulen - 4;
+  const unsigned char *data = NULL;
+  size_t lc = 0;
+  size_t le = 0;
+  size_t maxle;
+  int exmode = 0;
+  int sw;
+  membuf_t mb;
+  unsigned char *rdata = NULL;
+  size_t rlen = 0;
+
+  if (apdulen < 4 || maxresplen < 2)
+    return SW_HOST_INV_VALUE;
+
+  /* Parse the APDU according to ISO 7816-3 cases 1 to 4.  */
+  if (!n)
+    ;
+  else if (n == 1)
+    le = body[0]? body[0] : 256;
+  else if (body[0])
+    {
+      lc = body[0];
+      data = body + 1;
+      if (n == 2 + lc)
+        le = body[n-1]? body[n-1] : 256;
+      else if (n != 1 + lc)
+        lc = (size_t)(-1);
+    }
+  else if (n >= 3)
+    {
+      exmode = 1;
+      if (n == 3)
+        le = ((body[1] << 8) | body[2]);
+      else
+        {
+          lc = (body[1] << 8) | body[2];
+          data = body + 3;
+          if (n == 5 + lc)
+            le = (body[n-2] << 8) | body[n-1];
+          else if (n != 3 + lc)
+            lc = (size_t)(-1);
+        }
+      if (!le && (n == 3 || n == 5 + lc))
+        le = 65536;
+    }
+  else
+    lc = (size_t)(-1);
+
+  maxle = exmode? card->exlen : 256;
+  if (!maxle)
+    maxle = 256;
+  if (le > maxle)
+    le = maxle;
+
+  if (lc == (size_t)(-1) || (exmode && !card->exlen))
+    sw = SIM_SW_WRONG_LENGTH;
+  else if ((apdu[0] & ~0x10))
+    sw = SIM_SW_CLA_NOT_SUPP;
+  else if (apdu[1] == 0xC0)
+    {
+      /* GET RESPONSE.  */
+      if (!card->pending)
+        sw = SIM_SW_INS_NOT_SUPP;
+      else
+        {
+          rdata = card->pending;
+          rlen = card->pending_len;
+          card->pending = NULL;
+          sw = SIM_SW_OK;
+        }
+    }
+  else
+    {
+      xfree (card->pending);
+      card->pending = NULL;
+
+      if ((apdu[0] & 0x10))
+        {
+          /* Command chaining: collect the data.  */
+          if (!card->chaining)
+            init_membuf (&card->chain, 1024);
+          card->chaining = 1;
+          put_membuf (&card->chain, data, lc);
+          sw = SIM_SW_OK;
+        }
+      else
+        {
+          unsigned char *chaindata = NULL;
+
+          if (card->chaining)
+            {
+              put_membuf (&card->chain, data, lc);
+              chaindata = get_membuf (&card->chain, &lc);
+              data = chaindata;
+              card->chaining = 0;
+            }
+
+          init_membuf (&mb, 256);
+          sw = process_command (card, apdu[1], apdu[2], apdu[3],
+                                data, data? lc : 0, le? le : maxle, &mb);
+          rdata = get_membuf (&mb, &rlen);
+          if (chaindata)
+            {
+              wipememory (chaindata, lc);
+              xfree (chaindata);
+            }
+          if (!rdata)
+            sw = SIM_SW_WRONG_DATA;
+          else if (sw != SIM_SW_OK && sw != SIM_SW_EOF_REACHED)
+            rlen = 0;
+        }
+    }
+
+  /* Return at most LE bytes; the rest is fetched by GET RESPONSE.  */
+  if (!le)
+    le = maxle;
+  if (rlen > le)
+    {
+      card->pending_len = rlen - le;
+      card->pending = xtrymalloc (card->pending_len);
+      if (!card->pending)
+        {
+          xfree (rdata);
+          return SW_HOST_OUT_OF_CORE;
+        }
+      memcpy (card->pending, rdata + le, card->pending_len);
+      rlen = le;
+      sw = 0x6100 | (card->pending_len > 255? 0 : card->pending_len);
+    }
+
+  if (rlen + 2 > maxresplen)
+    {
+      xfree (rdata);
+      return SW_HOST_INV_VALUE;
+    }
+  if (rlen)
+    memcpy (resp, rdata, rlen);
+  resp[rlen] = sw >> 8;
+  resp[rlen+1] = sw;
+  *nresp = rlen + 2;
+  xfree (rdata);
+
+  simulate_link (card, apdulen + *nresp);
+  return 0;
+}
@@ -0,0 +1,37 @@
+/* simcard.h - Software simulation of an OpenPGP card
+ * Copyright (C) 2015 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMCARD_H
+#define SIMCARD_H
+
+struct simcard_s;
+typedef struct simcard_s *simcard_t;
+
+gpg_error_t simcard_open (simcard_t *r_card, const char *fname);
+void simcard_close (simcard_t card);
+void simcard_reset (simcard_t card);
+size_t simcard_get_atr (simcard_t card, unsigned char *atr, size_t maxlen);
+int simcard_get_exlen_max (simcard_t card);
+int simcard_transceive (simcard_t card,
+                        const unsigned char *apdu, size_t apdulen,
+                        unsigned char *resp, size_t maxresplen,
+                        size_t *nresp);
+
+
+#endif /*SIMCARD_H*/
@@ -32,6 +32,7 @@
 #include <ksba.h>
 
 #include "i18n.h"
+#include "radix64.h"
 
 #ifdef HAVE_DOSISH_SYSTEM
   #define LF "\r\n"
@@ -312,6 +313,23 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 
           while (n < count && parm->readpos < parm->linelen )
             {
+              if (!idx && count - n >= 3)
+                {
+                  /* Decode as many complete groups as fit into the
+                     buffer in one go.  */
+                  size_t nread;
+                  size_t max = parm->linelen - parm->readpos;
+
+                  if (max > (count - n) / 3 * 4)
+                    max = (count - n) / 3 * 4;
+                  n += radix64_decode (buffer + n,
+                                       (char*)parm->line + parm->readpos,
+                                       max, &nread);
+                  parm->readpos += nread;
+                  if (nread)
+                    continue;
+                }
+
               c = parm->line[parm->readpos++];
               if (c == '\n' || c == ' ' || c == '\r' || c == '\t')
                 continue;
@@ -409,7 +427,7 @@ base64_writer_cb (void *cb_value, const void *buffer, size_t count)
 {
   struct writer_cb_parm_s *parm = cb_value;
   unsigned char radbuf[4];
-  int i, c, idx, quad_count;
+  int i, idx, quad_count;
   const unsigned char *p;
   estream_t stream = parm->stream;
 
@@ -434,25 +452,39 @@ base64_writer_cb (void *cb_value, const void *buffer, size_t count)
   for (i=0; i < idx; i++)
     radbuf[i] = parm->base64.radbuf[i];
 
-  for (p=buffer; count; p++, count--)
+  for (p=buffer; count; )
     {
-      radbuf[idx++] = *p;
-      if (idx > 2)
+      char line[64];
+      size_t n;
+
+      if (!idx && count >= 3)
         {
+          /* Encode the complete groups up to the end of the line at
+             once.  */
+          n = (64/4) - quad_count;
+          if (n > count / 3)
+            n = count / 3;
+          quad_count += n;
+          n *= 3;
+          es_write (stream, line, radix64_encode (line, p, n), NULL);
+          p += n;
+          count -= n;
+        }
+      else
+        {
+          radbuf[idx++] = *p++;
+          count--;
+          if (idx < 3)
+            continue;
           idx = 0;
-          c = bintoasc[(*radbuf >> 2) & 077];
-          es_putc (c, stream);
-          c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-          es_putc (c, stream);
-          c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-          es_putc (c, stream);
-          c = bintoasc[radbuf[2]&077];
-          es_putc (c, stream);
-          if (++quad_count >= (64/4))
-            {
-              es_fputs (LF, stream);
-              quad_count = 0;
-            }
+          es_write (stream, line, radix64_encode (line, radbuf, 3), NULL);
+          quad_count++;
+        }
+
+      if (quad_count >= (64/4))
+        {
+          es_fputs (LF, stream);
+          quad_count = 0;
         }
     }
   for (i=0; i < idx; i++)
@@ -972,6 +972,12 @@ static gc_option_t gc_options_dirmngr[] =
    { "max-replies", GC_OPT_FLAG_NONE, GC_LEVEL_BASIC,
      "dirmngr", "|N|do not return more than N items in one query",
      GC_ARG_TYPE_UINT32, GC_BACKEND_DIRMNGR },
+   { "max-open-crl-files", GC_OPT_FLAG_NONE, GC_LEVEL_EXPERT,
+     "dirmngr", "|N|keep at most N CRL cache files open",
+     GC_ARG_TYPE_UINT32, GC_BACKEND_DIRMNGR },
+   { "no-crl-prefetch", GC_OPT_FLAG_NONE, GC_LEVEL_ADVANCED,
+     "dirmngr", "do not fetch CRLs in the background",
+     GC_ARG_TYPE_NONE, GC_BACKEND_DIRMNGR },
 
    { "OCSP",
      GC_OPT_FLAG_GROUP, GC_LEVEL_ADVANCED,